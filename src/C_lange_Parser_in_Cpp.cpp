@@ -3,455 +3,36 @@
 #include <string>
 #include <vector>
 #include <stdexcept> // Required for std::runtime_error
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include "scanner.h"
+#include "parse_tree.h"
+#include "parser.h"
+#include "ir.h"
+#include "inliner.h"
+#include "tail_calls.h"
+#include "loop_unroll.h"
+#include "regalloc.h"
+#include "x86_64_codegen.h"
+#include "x86_64_scheduler.h"
+#include "elf_writer.h"
+#include "jit.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "interpreter.h"
+#include "tiered.h"
+#include "profile.h"
+#include "compile_server.h"
+#include "lsp_server.h"
+#include "source_analysis.h"
+#include "watch.h"
+#include "batch.h"
+#include "compile_commands.h"
+#include "process_pool.h"
 
 using namespace std;
 
-// --- DATA STRUCTURES ---
-
-class Token {
-public:
-    string token_value;
-    string token_class;
-    int line_number;
-};
-
-struct ParseNode {
-    string type;
-    string value;
-    int line;
-    vector<ParseNode*> children;
-    ~ParseNode() {
-        for (ParseNode* child : children) {
-            delete child;
-        }
-    }
-};
-
-// --- THE PARSER CLASS ---
-
-class Parser {
-public:
-    Parser(const vector<Token>& tokens) : m_tokens(tokens) {}
-
-    ParseNode* parse() {
-        try {
-            return parse_program();
-        } catch (const runtime_error& e) {
-            return nullptr;
-        }
-    }
-
-private:
-    const vector<Token>& m_tokens;
-    size_t m_current_pos = 0;
-
-    // ===================================================================
-    // ===       UTILITY METHODS (REVISED FOR CORRECTNESS)           ===
-    // ===================================================================
-    // The previous versions of these functions had several logical bugs that
-    // could cause infinite loops or segmentation faults. This new design is
-    // simpler, safer, and correct.
-
-    // **FIXED**: This is the simplest, most fundamental check. It must be
-    // independent and not call any other parser methods.
-    bool is_at_end() {
-        return m_current_pos >= m_tokens.size();
-    }
-
-    // **FIXED**: This function's only job is to move the main cursor forward
-    // until it points to a meaningful (non-comment) token.
-    void skip_comments() {
-        while (!is_at_end() &&
-               (m_tokens[m_current_pos].token_class == "Single-Line Comment" ||
-                m_tokens[m_current_pos].token_class == "Multi-Line Comment")) {
-            m_current_pos++;
-        }
-    }
-
-    // **FIXED**: `peek` is now much simpler. It ensures comments are skipped
-    // and then safely returns the current token. The complex lookahead logic
-    // has been moved into the functions that actually need it.
-    const Token& peek() {
-        skip_comments(); // ALWAYS ensure we are on a meaningful token before peeking.
-        if (is_at_end()) {
-            static Token eof_token = {"", "EOF", -1}; // A safe, static EOF token.
-            return eof_token;
-        }
-        return m_tokens[m_current_pos];
-    }
-    
-    // **NEW**: A dedicated lookahead function for the one case where we need it.
-    // This is much cleaner than complicating the main `peek` function.
-    const Token& lookahead(int offset) {
-        skip_comments(); // Start from the current meaningful token.
-        size_t lookahead_pos = m_current_pos;
-        while (offset > 0 && lookahead_pos < m_tokens.size()) {
-            lookahead_pos++;
-            // Skip comments at the lookahead position.
-            while (lookahead_pos < m_tokens.size() &&
-                   (m_tokens[lookahead_pos].token_class == "Single-Line Comment" ||
-                    m_tokens[lookahead_pos].token_class == "Multi-Line Comment")) {
-                lookahead_pos++;
-            }
-            offset--;
-        }
-
-        if (lookahead_pos >= m_tokens.size()) {
-            static Token eof_token = {"", "EOF", -1};
-            return eof_token;
-        }
-        return m_tokens[lookahead_pos];
-    }
-
-
-    // **FIXED**: `advance` should only ever do one thing: move the cursor.
-    // The next call to `peek()` will handle any comments that follow.
-    void advance() {
-        if (!is_at_end()) {
-            m_current_pos++;
-        }
-    }
-
-    // `match` remains the same, but it's now supported by the corrected helpers.
-    Token match(const string& expected_class, const string& expected_value = "") {
-        const Token& token = peek();
-        if (token.token_class == expected_class && (expected_value.empty() || token.token_value == expected_value)) {
-            Token matched_token = token;
-            advance();
-            return matched_token;
-        }
-        string error_message = "Expected " + expected_class;
-        if (!expected_value.empty()) error_message += " with value '" + expected_value + "'";
-        error_message += ", but got " + token.token_class + " with value '" + token.token_value + "'";
-        report_error(error_message);
-        throw runtime_error("Syntax Error");
-    }
-
-    // --- ERROR REPORTING ---
-    void report_error(const string& message) {
-        if (is_at_end()) {
-            cerr << "[End of File] Syntax Error: " << message << endl;
-        } else {
-            cerr << "[Line " << peek().line_number << "] Syntax Error: " << message << endl;
-        }
-    }
-
-    // --- RECURSIVE DESCENT PARSING FUNCTIONS ---
-
-    // **FIXED**: Removed the stray `advance()` call that was eating the first token.
-    ParseNode* parse_program() {
-        ParseNode* program_node = new ParseNode{"Program", "", (m_tokens.empty() ? 0 : peek().line_number)};
-        while (!is_at_end()) {
-            program_node->children.push_back(parse_top_level_declaration());
-        }
-        cout << "Parsing completed successfully." << endl;
-        return program_node;
-    }
-
-    // **FIXED**: Now uses the new, safer `lookahead()` function.
-    ParseNode* parse_top_level_declaration() {
-        if (peek().token_class == "PREPROCESSOR DIRECTIVE") {
-            Token directive = match("PREPROCESSOR DIRECTIVE");
-            return new ParseNode{"PreprocessorDirective", directive.token_value, directive.line_number};
-        }
-        if (peek().token_class == "KEYWORD" &&
-            (peek().token_value == "int" || peek().token_value == "float" ||
-             peek().token_value == "char" || peek().token_value == "void" || peek().token_value == "const")) {
-            
-            // Look at the token AFTER the identifier to resolve ambiguity.
-            // A type is token 0, an identifier is token 1. We need to see token 2.
-            const Token& future_token = lookahead(2);
-
-            if (future_token.token_value == "(") {
-                return parse_function_or_prototype();
-            } else {
-                return parse_variable_declaration();
-            }
-        }
-        report_error("Unrecognized top-level statement. Expected a global variable or function.");
-        throw runtime_error("Syntax Error");
-    }
-
-    // The rest of the parsing functions are correct and do not need changes.
-    // I am including them here for completeness of the class.
-
-    ParseNode* parse_function_or_prototype() {
-        int start_line = peek().line_number;
-        Token type_token = match("KEYWORD");
-        Token name_token = match("IDENTIFIER");
-        match("SPECIAL CHARACTER", "(");
-        // We can add parameter parsing here later
-        match("SPECIAL CHARACTER", ")");
-        if (peek().token_value == "{") {
-            ParseNode* func_def_node = new ParseNode{"FunctionDefinition", name_token.token_value, start_line};
-            func_def_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
-            func_def_node->children.push_back(parse_block_statement());
-            return func_def_node;
-        } else if (peek().token_value == ";") {
-            match("SPECIAL CHARACTER", ";");
-            ParseNode* func_proto_node = new ParseNode{"FunctionPrototype", name_token.token_value, start_line};
-            func_proto_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
-            return func_proto_node;
-        } else {
-            report_error("Expected '{' for function body or ';' for prototype after function signature.");
-            throw runtime_error("Syntax Error");
-        }
-    }
-
-    ParseNode* parse_variable_declaration() {
-        int start_line = peek().line_number;
-        ParseNode* decl_statement_node = new ParseNode{"VariableDeclarationStatement", "", start_line};
-        if (peek().token_value == "const") {
-            Token t = match("KEYWORD", "const");
-            decl_statement_node->children.push_back(new ParseNode{"Keyword", t.token_value, t.line_number});
-        }
-        Token type_token = match("KEYWORD");
-        decl_statement_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
-        do {
-            if (peek().token_value == ",") {
-                match("SPECIAL CHARACTER", ",");
-            }
-            Token var_token = match("IDENTIFIER");
-            ParseNode* declarator_node = new ParseNode{"Declarator", var_token.token_value, var_token.line_number};
-            if (peek().token_value == "=") {
-                match("OPERATOR", "=");
-                ParseNode* initializer_node = new ParseNode{"Initializer", "=", peek().line_number};
-                initializer_node->children.push_back(parse_expression());
-                declarator_node->children.push_back(initializer_node);
-            }
-            decl_statement_node->children.push_back(declarator_node);
-        } while (peek().token_value == ",");
-        match("SPECIAL CHARACTER", ";");
-        return decl_statement_node;
-    }
-
-    ParseNode* parse_statement() {
-        const string& token_value = peek().token_value;
-        if (token_value == "if") return parse_if_statement();
-        if (token_value == "for") return parse_for_statement();
-        if (token_value == "return") return parse_return_statement();
-        if (token_value == "{") return parse_block_statement();
-        if (token_value == ";") {
-            int line = peek().line_number;
-            match("SPECIAL CHARACTER", ";");
-            return new ParseNode{"EmptyStatement", ";", line};
-        }
-        if (token_value == "const" || token_value == "int" ||
-            token_value == "float" || token_value == "char") {
-            return parse_variable_declaration();
-        }
-        return parse_expression_statement();
-    }
-
-    ParseNode* parse_block_statement() {
-        int start_line = peek().line_number;
-        match("SPECIAL CHARACTER", "{");
-        ParseNode* block_node = new ParseNode{"BlockStatement", "{}", start_line};
-        while (peek().token_value != "}") {
-            block_node->children.push_back(parse_statement());
-        }
-        match("SPECIAL CHARACTER", "}");
-        return block_node;
-    }
-
-    ParseNode* parse_if_statement() {
-        int start_line = peek().line_number;
-        match("KEYWORD", "if");
-        ParseNode* if_node = new ParseNode{"IfStatement", "if", start_line};
-        match("SPECIAL CHARACTER", "(");
-        if_node->children.push_back(parse_expression());
-        match("SPECIAL CHARACTER", ")");
-        if_node->children.push_back(parse_statement());
-        if (peek().token_value == "else") {
-            match("KEYWORD", "else");
-            if_node->children.push_back(parse_statement());
-        }
-        return if_node;
-    }
-
-    ParseNode* parse_return_statement() {
-        int start_line = peek().line_number;
-        match("KEYWORD", "return");
-        ParseNode* return_node = new ParseNode{"ReturnStatement", "return", start_line};
-        if (peek().token_value != ";") {
-            return_node->children.push_back(parse_expression());
-        }
-        match("SPECIAL CHARACTER", ";");
-        return return_node;
-    }
-
-    ParseNode* parse_expression_statement() {
-        int start_line = peek().line_number;
-        ParseNode* expr_stmt_node = new ParseNode{"ExpressionStatement", "", start_line};
-        expr_stmt_node->children.push_back(parse_expression());
-        match("SPECIAL CHARACTER", ";");
-        return expr_stmt_node;
-    }
-/*-------------
-    ParseNode* parse_for_statement() {
-        int start_line = peek().line_number;
-        match("KEYWORD", "for");
-        ParseNode* for_node = new ParseNode{"ForStatement", "for", start_line};
-        match("SPECIAL CHARACTER", "(");
-        if (peek().token_value == ";") {
-            match("SPECIAL CHARACTER", ";");
-            for_node->children.push_back(new ParseNode{"Empty", "initializer", start_line});
-        } else if (peek().token_value == "int" || peek().token_value == "char" || peek().token_value == "float") {
-            for_node->children.push_back(parse_variable_declaration());
-        } else {
-            for_node->children.push_back(parse_expression_statement());
-        }
-        if (peek().token_value == ";") {
-            match("SPECIAL CHARACTER", ";");
-            for_node->children.push_back(new ParseNode{"Empty", "condition", start_line});
-        } else {
-            for_node->children.push_back(parse_expression());
-            match("SPECIAL CHARACTER", ";");
-        }
-        if (peek().token_value == ")") {
-            for_node->children.push_back(new ParseNode{"Empty", "increment", start_line});
-        } else {
-            for_node->children.push_back(parse_expression());
-        }
-        match("SPECIAL CHARACTER", ")");
-        for_node->children.push_back(parse_statement());
-        return for_node;
-    }
-----------------*/
-// REPLACE your old parse_for_statement() with this new, cleaner version.
-
-// Rule: for_statement -> 'for' '(' initializer condition increment ')' statement
-ParseNode* parse_for_statement() {
-    int start_line = peek().line_number;
-    match("KEYWORD", "for");
-    ParseNode* for_node = new ParseNode{"ForStatement", "for", start_line};
-    
-    match("SPECIAL CHARACTER", "(");
-
-    // --- 1. Parse Initializer ---
-    // This part can remain the same. It correctly handles the three cases.
-    if (peek().token_value == ";") {
-        match("SPECIAL CHARACTER", ";");
-        for_node->children.push_back(new ParseNode{"Empty", "initializer", start_line});
-    } else if (peek().token_value == "int" || peek().token_value == "char" || peek().token_value == "float") {
-        for_node->children.push_back(parse_variable_declaration());
-    } else {
-        for_node->children.push_back(parse_expression_statement());
-    }
-
-    // --- 2. Parse Condition (REVISED) ---
-    // If the condition is not empty, parse the expression and add it DIRECTLY.
-    if (peek().token_value == ";") {
-        match("SPECIAL CHARACTER", ";");
-        for_node->children.push_back(new ParseNode{"Empty", "condition", start_line});
-    } else {
-        // THE FIX: No extra "Condition" wrapper node is created.
-        for_node->children.push_back(parse_expression());
-        match("SPECIAL CHARACTER", ";");
-    }
-
-    // --- 3. Parse Increment (REVISED) ---
-    // If the increment is not empty, parse the expression and add it DIRECTLY.
-    if (peek().token_value == ")") {
-        // Empty increment
-        for_node->children.push_back(new ParseNode{"Empty", "increment", start_line});
-    } else {
-        // THE FIX: No extra "UPDATE" or "Increment" wrapper node is created.
-        for_node->children.push_back(parse_expression());
-    }
-
-    match("SPECIAL CHARACTER", ")");
-    
-    // --- 4. Parse the Body Statement ---
-    // This part remains the same.
-    for_node->children.push_back(parse_statement());
-
-    return for_node;
-}
-    ParseNode* parse_expression() { return parse_assignment(); }
-    ParseNode* parse_assignment() {
-        int start_line = peek().line_number;
-        ParseNode* left_node = parse_equality();
-        if (peek().token_value == "=") {
-            Token op = match("OPERATOR", "=");
-            ParseNode* right_node = parse_assignment();
-            ParseNode* assignment_node = new ParseNode{"AssignmentExpression", op.token_value, start_line};
-            assignment_node->children.push_back(left_node);
-            assignment_node->children.push_back(right_node);
-            return assignment_node;
-        }
-        return left_node;
-    }
-    ParseNode* parse_equality() {
-        ParseNode* left_node = parse_relational();
-        while (peek().token_value == "==" || peek().token_value == "!=") {
-            Token op = match("OPERATOR");
-            ParseNode* right_node = parse_relational();
-            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
-            new_left->children.push_back(left_node);
-            new_left->children.push_back(right_node);
-            left_node = new_left;
-        }
-        return left_node;
-    }
-    ParseNode* parse_relational() {
-        ParseNode* left_node = parse_additive();
-        while (peek().token_value == "<" || peek().token_value == ">" ||
-               peek().token_value == "<=" || peek().token_value == ">=") {
-            Token op = match("OPERATOR");
-            ParseNode* right_node = parse_additive();
-            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
-            new_left->children.push_back(left_node);
-            new_left->children.push_back(right_node);
-            left_node = new_left;
-        }
-        return left_node;
-    }
-    ParseNode* parse_additive() {
-        ParseNode* left_node = parse_multiplicative();
-        while (peek().token_value == "+" || peek().token_value == "-") {
-            Token op = match("OPERATOR");
-            ParseNode* right_node = parse_multiplicative();
-            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
-            new_left->children.push_back(left_node);
-            new_left->children.push_back(right_node);
-            left_node = new_left;
-        }
-        return left_node;
-    }
-    ParseNode* parse_multiplicative() {
-        ParseNode* left_node = parse_primary();
-        while (peek().token_value == "*" || peek().token_value == "/") {
-            Token op = match("OPERATOR");
-            ParseNode* right_node = parse_primary();
-            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
-            new_left->children.push_back(left_node);
-            new_left->children.push_back(right_node);
-            left_node = new_left;
-        }
-        return left_node;
-    }
-    ParseNode* parse_primary() {
-        int line = peek().line_number;
-        if (peek().token_class == "NUMERIC CONSTANT") {
-            Token value = match("NUMERIC CONSTANT");
-            return new ParseNode{"Constant", value.token_value, line};
-        }
-        if (peek().token_class == "IDENTIFIER") {
-            Token value = match("IDENTIFIER");
-            return new ParseNode{"Identifier", value.token_value, line};
-        }
-        if (peek().token_value == "(") {
-            match("SPECIAL CHARACTER", "(");
-            ParseNode* expr_node = parse_expression();
-            match("SPECIAL CHARACTER", ")");
-            return expr_node;
-        }
-        report_error("Expected a value, variable, or expression in parentheses.");
-        throw runtime_error("Syntax Error");
-    }
-};
-
 // --- FILE READING LOGIC ---
 
 vector<Token> load_tokens_from_file(const string& filename) {
@@ -558,16 +139,411 @@ void visualize_parse_tree(const ParseNode* root) {
 
     cout << "--------------------------" << endl;
 }
-// --- MAIN FUNCTION ---
+// --- COMMAND LINE OPTIONS ---
+// Without arguments the parser keeps its interactive behaviour: read
+// tokens.txt, print the AST and wait for enter. The options below drive the
+// compiler stages that follow parsing.
+
+// How --run executes the program.
+enum class Engine { Jit, VM, Interp, Tiered };
+
+struct CompilerOptions {
+    string token_file = "tokens.txt";
+    bool emit_ir = false;
+    bool emit_bytecode = false;
+    bool emit_regalloc = false;
+    bool emit_asm = false;
+    bool emit_object = false;
+    string run_file;           // --run: C source to compile and execute in memory
+    Engine engine = Engine::Jit;
+    bool tier_stats = false;   // --tier-stats: with --engine=tiered, report what went native
+    string output_file;        // default: a.s for -S, a.o for -c
+    AsmSyntax asm_syntax = AsmSyntax::ATT;
+    int opt_level = 1;
+    string profile_generate;   // --profile-generate: instrument and write the profile here
+    string profile_use;        // --profile-use: optimise with this profile
+    string emit_ast;           // --emit-ast: write the binary parse tree here
+    string serve_socket;       // --serve: run as a compile server on this socket
+    string connect_socket;     // --connect: let the server on this socket compile
+    bool shutdown_server = false;
+    bool lsp = false;          // --lsp: language server on stdin/stdout
+    string watch_directory;    // --watch: check the sources below it on every change
+    string batch_path;         // --batch: a directory or a compile_commands.json to check
+    unsigned jobs = 0;         // -j: threads for --batch (0: one per core)
+    unsigned processes = 0;    // --processes: worker processes for --batch instead of threads
+    ReadMethod read_method = ReadMethod::IoUring;   // --reader: how --batch reads its files
+    size_t max_memory = 0;     // --max-memory: memory budget of --batch in bytes (0: none)
+    bool interactive = true;
+};
 
-int main() {
-    const string token_file = "tokens.txt";
-    vector<Token> tokens = load_tokens_from_file(token_file);
+void print_usage() {
+    cerr << "Usage: parser [options] [token-file|FILE.c]" << endl
+         << "       parser [-O0|-O1] [--engine=ENGINE] --run FILE.c" << endl
+         << "       parser --serve=SOCKET" << endl
+         << "       parser --connect=SOCKET [options] [token-file|FILE.c]" << endl
+         << "       parser --lsp" << endl
+         << "       parser --watch DIR" << endl
+         << "       parser [-j N|--processes=N] [--max-memory=SIZE] --batch DIR|compile_commands.json" << endl
+         << "  An input ending in .c is scanned in memory instead of read as tokens." << endl
+         << "  --emit-ir   lower the program to IR, optimise it and print the IR" << endl
+         << "  --emit-bytecode  print the bytecode the virtual machine executes" << endl
+         << "  --emit-regalloc  print the live intervals and register assignment" << endl
+         << "              of every function (System V x86-64 registers)" << endl
+         << "  -S          generate x86-64 assembly (System V, GNU as)" << endl
+         << "  -c          generate an ELF64 object file directly (no assembler needed)" << endl
+         << "  -o FILE     output file (default a.s for -S, a.o for -c, '-' for stdout)" << endl
+         << "  --asm-syntax=att|intel  assembly dialect (default att)" << endl
+         << "  --run FILE.c  scan, compile and execute FILE.c in memory; the exit" << endl
+         << "              status is the value returned by main" << endl
+         << "  --engine=jit|vm|interp|tiered  run native code (default), the" << endl
+         << "              bytecode VM, the tree-walking interpreter, or the VM" << endl
+         << "              with hot functions compiled in the background" << endl
+         << "  --tier-stats  with --engine=tiered: print to stderr how many" << endl
+         << "              functions were compiled to native code" << endl
+         << "  -O0         disable IR optimisations" << endl
+         << "  -O1         enable tail-call elimination, inlining, loop unrolling," << endl
+         << "              peephole optimisation and scheduling (default)" << endl
+         << "  --profile-generate=FILE  with --run: count how often every block" << endl
+         << "              and branch runs and write the counts to FILE" << endl
+         << "  --profile-use=FILE  guide inlining and block layout with a profile" << endl
+         << "  --emit-ast=FILE  write the parse tree to FILE in binary form" << endl
+         << "  --serve=SOCKET  stay resident and compile the requests of clients on" << endl
+         << "              the UNIX domain socket SOCKET, keeping parsed inputs cached" << endl
+         << "  --connect=SOCKET  have the server on SOCKET compile, as if it ran in" << endl
+         << "              this directory; compiles locally when no server listens" << endl
+         << "  --shutdown  with --connect: stop the server" << endl
+         << "  --lsp       run as a language server (LSP over stdin and stdout)" << endl
+         << "  --watch DIR  check the .c and .h files below DIR, then check again" << endl
+         << "              what every change affects, including files that include it" << endl
+         << "  --batch DIR  check every .c and .h file below DIR in parallel and" << endl
+         << "              report the errors in file name order" << endl
+         << "  --batch compile_commands.json  check the files of a compilation" << endl
+         << "              database with the include paths of their commands" << endl
+         << "  -j N        threads for --batch (default: one per core)" << endl
+         << "  --processes=N  run --batch in N forked worker processes, so that a" << endl
+         << "              file that crashes the checker is reported, not fatal" << endl
+         << "  --reader=io_uring|pread  how --batch reads its files ahead of the" << endl
+         << "              threads (default io_uring, pread where it is missing)" << endl
+         << "  --max-memory=SIZE  keep --batch within SIZE bytes (suffix K, M or G):" << endl
+         << "              fewer files at a time, streamed scanning, and parse trees" << endl
+         << "              dropped after use or spilled to a temporary file" << endl;
+}
 
-    if (tokens.empty()) {
-        cout << "No tokens to parse. Halting." << endl;
+// A size in bytes, with an optional K, M or G (powers of 1024); false if
+// `text` is not one or is zero.
+bool parse_memory_size(const string& text, size_t& bytes) {
+    char* end;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || !isdigit((unsigned char)text[0])) return false;
+    string suffix = end;
+    if (suffix == "K" || suffix == "k") value <<= 10;
+    else if (suffix == "M" || suffix == "m") value <<= 20;
+    else if (suffix == "G" || suffix == "g") value <<= 30;
+    else if (!suffix.empty()) return false;
+    bytes = (size_t)value;
+    return bytes > 0;
+}
+
+bool parse_options(int argc, char* argv[], CompilerOptions& options) {
+    options.interactive = argc <= 1;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--emit-ir") options.emit_ir = true;
+        else if (arg == "--emit-bytecode") options.emit_bytecode = true;
+        else if (arg == "--emit-regalloc") options.emit_regalloc = true;
+        else if (arg == "-S") options.emit_asm = true;
+        else if (arg == "-c") options.emit_object = true;
+        else if (arg == "--run" && i + 1 < argc) options.run_file = argv[++i];
+        else if (arg == "-o" && i + 1 < argc) options.output_file = argv[++i];
+        else if (arg == "--engine=jit") options.engine = Engine::Jit;
+        else if (arg == "--engine=vm") options.engine = Engine::VM;
+        else if (arg == "--engine=interp") options.engine = Engine::Interp;
+        else if (arg == "--engine=tiered") options.engine = Engine::Tiered;
+        else if (arg == "--tier-stats") options.tier_stats = true;
+        else if (arg == "--asm-syntax=att") options.asm_syntax = AsmSyntax::ATT;
+        else if (arg == "--asm-syntax=intel") options.asm_syntax = AsmSyntax::Intel;
+        else if (arg == "-O0") options.opt_level = 0;
+        else if (arg == "-O1") options.opt_level = 1;
+        else if (arg.compare(0, 19, "--profile-generate=") == 0) options.profile_generate = arg.substr(19);
+        else if (arg.compare(0, 14, "--profile-use=") == 0) options.profile_use = arg.substr(14);
+        else if (arg.compare(0, 11, "--emit-ast=") == 0) options.emit_ast = arg.substr(11);
+        else if (arg.compare(0, 8, "--serve=") == 0) options.serve_socket = arg.substr(8);
+        else if (arg.compare(0, 10, "--connect=") == 0) options.connect_socket = arg.substr(10);
+        else if (arg == "--shutdown") options.shutdown_server = true;
+        else if (arg == "--lsp") options.lsp = true;
+        else if (arg == "--watch" && i + 1 < argc) options.watch_directory = argv[++i];
+        else if (arg == "--batch" && i + 1 < argc) options.batch_path = argv[++i];
+        else if (arg == "-j" && i + 1 < argc && atoi(argv[i + 1]) > 0) options.jobs = atoi(argv[++i]);
+        else if (arg == "--reader=io_uring") options.read_method = ReadMethod::IoUring;
+        else if (arg == "--reader=pread") options.read_method = ReadMethod::Pread;
+        else if (arg.compare(0, 12, "--processes=") == 0 && atoi(arg.c_str() + 12) > 0) {
+            options.processes = atoi(arg.c_str() + 12);
+        }
+        else if (arg.compare(0, 13, "--max-memory=") == 0) {
+            if (!parse_memory_size(arg.substr(13), options.max_memory)) {
+                cerr << "Option --max-memory needs a size such as 512M or 2G" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--help") { print_usage(); return false; }
+        else if (!arg.empty() && arg[0] == '-') {
+            cerr << "Unknown option '" << arg << "'" << endl;
+            print_usage();
+            return false;
+        } else options.token_file = arg;
+    }
+    if (options.emit_asm && options.emit_object) {
+        cerr << "Options -S and -c cannot be combined" << endl;
+        return false;
+    }
+    if (!options.profile_generate.empty() && (options.run_file.empty() || options.engine == Engine::Interp)) {
+        cerr << "Option --profile-generate needs --run and an engine that runs the IR" << endl;
+        return false;
+    }
+    if (options.shutdown_server && options.connect_socket.empty()) {
+        cerr << "Option --shutdown needs --connect" << endl;
+        return false;
+    }
+    if (options.output_file.empty()) options.output_file = options.emit_object ? "a.o" : "a.s";
+    return true;
+}
+
+// Lowers the parse tree to IR and runs the optimisation pipeline.
+bool compile_to_ir(const ParseNode* parse_tree, const CompilerOptions& options, IrModule& module) {
+    IrLowering lowering(parse_tree);
+    if (!lowering.lower(module)) return false;
+    if (!options.profile_generate.empty()) ProfileInstrumenter(module).run();
+    if (!options.profile_use.empty()) {
+        Profile profile;
+        string error;
+        if (!read_profile(options.profile_use, profile, error)) {
+            cerr << "Error: " << error << endl;
+            return false;
+        }
+        apply_profile(module, profile);
+    }
+    if (options.opt_level >= 1) {
+        TailCallElimination tail_calls(module);
+        tail_calls.eliminate_self_recursion();
+        Inliner inliner(module);
+        inliner.run();
+        LoopUnroller(module).run();
+        tail_calls.mark_sibling_calls();
+        if (!options.profile_use.empty()) ProfileGuidedLayout(module).run();
+    }
+    return true;
+}
+
+// Generates assembly or an object file for the whole module into
+// options.output_file; "-" writes to `standard_output`.
+bool write_machine_code(const IrModule& module, const CompilerOptions& options, FILE* standard_output = stdout) {
+    bool to_stdout = options.output_file == "-";
+    FILE* file = to_stdout ? standard_output : fopen(options.output_file.c_str(), options.emit_object ? "wb" : "w");
+    if (!file) {
+        cerr << "Error: Could not open output file '" << options.output_file << "'" << endl;
+        return false;
+    }
+    X86CodeGenerator generator(module);
+    MModule machine_code = generator.generate();
+    if (options.opt_level >= 1) optimise_machine_code(machine_code);
+    bool ok;
+    if (options.emit_object) {
+        EncodedModule encoded = X86Encoder().encode(machine_code);
+        ok = ElfObjectWriter(encoded).write(file) && fflush(file) == 0;
+    } else {
+        OutputBuffer out(file);
+        AsmPrinter(out, options.asm_syntax).print(machine_code);
+        out.flush();
+        ok = out.ok();
+    }
+    if (!to_stdout && fclose(file) != 0) ok = false;
+    if (!ok) cerr << "Error: Could not write output file '" << options.output_file << "'" << endl;
+    return ok;
+}
+
+// Whether the program has a `main` that --run can call.
+bool check_main(bool defined, IrType return_type, const vector<IrType>& param_types) {
+    if (!defined) {
+        cerr << "Error: The program does not define 'main'." << endl;
+        return false;
+    }
+    if (!param_types.empty() || return_type != IrType::Int) {
+        cerr << "Error: 'main' must be declared as 'int main()' to be run." << endl;
+        return false;
+    }
+    return true;
+}
+
+// Reports the outcome of an interpreted run; the exit status is main's value.
+int finish_interpreted_run(bool ok, const RuntimeValue& result, const string& error) {
+    fflush(stdout);
+    if (!ok) {
+        cerr << "Runtime Error: " << error << endl;
+        return 1;
+    }
+    return result.i;
+}
+
+// --profile-generate: writes the counters of an instrumented run.
+// `global_address(name)` locates a global in the engine that ran the program.
+template <typename GlobalAddress>
+bool save_profile(const IrModule& module, const CompilerOptions& options, GlobalAddress global_address) {
+    if (options.profile_generate.empty()) return true;
+    if (!write_profile(collect_profile(module, global_address), options.profile_generate)) {
+        cerr << "Error: Could not write profile '" << options.profile_generate << "'" << endl;
+        return false;
+    }
+    return true;
+}
+
+// --engine=interp: walks the parse tree, without IR or optimisations.
+int run_tree_interpreter(const ParseNode* parse_tree) {
+    TreeInterpreter interpreter(parse_tree);
+    if (!interpreter.analyse()) return 1;
+    const TreeInterpreter::Function* main_function = interpreter.find_function("main");
+    if (!check_main(main_function && main_function->defined, main_function ? main_function->return_type : IrType::Void,
+                    main_function ? main_function->param_types : vector<IrType>())) {
+        return 1;
+    }
+    string error;
+    if (!interpreter.load(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    RuntimeValue result;
+    cout.flush();
+    bool ok = interpreter.run("main", result, error);
+    return finish_interpreted_run(ok, result, error);
+}
+
+// --engine=vm: compiles the IR to bytecode and interprets it.
+int run_bytecode(const IrModule& module, const CompilerOptions& options) {
+    BcProgram program = BytecodeCompiler(module).compile();
+    BytecodeVM vm(program);
+    string error;
+    if (!vm.load(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    RuntimeValue result;
+    cout.flush();
+    bool ok = vm.run("main", result, error);
+    int status = finish_interpreted_run(ok, result, error);
+    if (ok && !save_profile(module, options, [&vm](const string& name) { return vm.global_address(name); })) return 1;
+    return status;
+}
+
+// --engine=tiered: starts in the VM, hot functions move to native code.
+int run_tiered(const IrModule& module, const CompilerOptions& options) {
+    TieredEngine engine(module, options.opt_level);
+    string error;
+    if (!engine.load(error)) {
+        cerr << "Error: " << error << endl;
         return 1;
     }
+    RuntimeValue result;
+    cout.flush();
+    bool ok = engine.run("main", result, error);
+    int status = finish_interpreted_run(ok, result, error);
+    if (options.tier_stats) {
+        engine.wait_for_compilations();
+        cerr << "Tiered: " << engine.native_functions() << " functions compiled to native code." << endl;
+    }
+    if (ok && !save_profile(module, options, [&engine](const string& name) { return engine.global_address(name); })) {
+        return 1;
+    }
+    return status;
+}
+
+// Scans C source in memory. A lexical error is reported like a syntax error.
+bool scan_source_file(const string& path, vector<Token>& tokens) {
+    ifstream input(path);
+    if (!input.is_open()) {
+        cerr << "Error: Could not open file '" << path << "'" << endl;
+        return false;
+    }
+    string source((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    return scan_source(source, tokens);
+}
+
+// --run: everything happens in this process, from the source text to a call
+// of the generated `main`. Only the program's own output reaches stdout.
+int run_program(const CompilerOptions& options) {
+    vector<Token> tokens;
+    if (!scan_source_file(options.run_file, tokens)) return 1;
+
+    Parser parser(tokens, false);
+    ParseNode* parse_tree = parser.parse();
+    if (!parse_tree) return 1;
+    if (options.engine == Engine::Interp) {
+        int status = run_tree_interpreter(parse_tree);
+        delete parse_tree;
+        return status;
+    }
+    IrModule module;
+    bool lowered = compile_to_ir(parse_tree, options, module);
+    delete parse_tree;
+    if (!lowered) return 1;
+    const IrFunction* main_function = module.find_function("main");
+    if (!check_main(main_function && main_function->defined, main_function ? main_function->return_type : IrType::Void,
+                    main_function ? main_function->param_types : vector<IrType>())) {
+        return 1;
+    }
+
+    if (options.engine == Engine::VM) return run_bytecode(module, options);
+    if (options.engine == Engine::Tiered) return run_tiered(module, options);
+
+    MModule machine_code = X86CodeGenerator(module).generate();
+    if (options.opt_level >= 1) optimise_machine_code(machine_code);
+    EncodedModule encoded = X86Encoder().encode(machine_code);
+    JitModule jit;
+    string error;
+    if (!jit.load(encoded, error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    typedef int (*MainFunction)();
+    MainFunction program_main = (MainFunction)jit.function("main");
+    cout.flush();
+    int result = program_main();
+    fflush(stdout);
+    if (!save_profile(module, options, [&jit](const string& name) { return jit.global(name); })) return 1;
+    return result;
+}
+
+void print_register_allocation(const IrModule& module, ostream& out) {
+    for (const IrFunction& function : module.functions) {
+        if (!function.defined) continue;
+        AllocInput input = X86Selector(function).allocation_input();   // as the code generator sees it
+        LinearScanAllocator allocator(input, sysv_x86_64_register_file());
+        allocator.run();
+        out << "registers for " << function.name << ":" << endl;
+        allocator.print(out);
+    }
+}
+
+// --- COMPILING A TOKEN FILE OR A SOURCE FILE ---
+
+// The tokens of the input: a .c file is scanned in memory, anything else is a
+// token file written by the scanner.
+vector<Token> load_input_tokens(const string& path) {
+    if (path.size() > 2 && path.compare(path.size() - 2, 2, ".c") == 0) {
+        vector<Token> tokens;
+        if (scan_source_file(path, tokens)) cout << "Source file scanned. " << tokens.size() << " tokens read." << endl;
+        return tokens;
+    }
+    return load_tokens_from_file(path);
+}
+
+// Loads and parses the input, printing what the parser reports. Null after a
+// syntax error; `has_tokens` tells whether there was anything to parse.
+ParseNode* parse_input(const CompilerOptions& options, bool& has_tokens) {
+    vector<Token> tokens = load_input_tokens(options.token_file);
+    has_tokens = !tokens.empty();
+    if (!has_tokens) {
+        cout << "No tokens to parse. Halting." << endl;
+        return nullptr;
+    }
 
     cout << "---------------------------------" << endl;
     cout << "Starting Parser..." << endl;
@@ -577,13 +553,208 @@ int main() {
     cout << "---------------------------------" << endl;
     if (parse_tree != nullptr) {
         cout << "Program is syntactically valid." << endl;
-        visualize_parse_tree(parse_tree);
-        delete parse_tree;
     } else {
         cout << "Program has one or more syntax errors." << endl;
     }
-    
-    cout << "Press enter to end the program.";
-    cin.get();
+    return parse_tree;
+}
+
+// Everything after parsing: the requested output, or the tree printed when
+// nothing was requested. `ast` receives the binary tree for --emit-ast.
+int compile_parse_tree(const ParseNode* parse_tree, const CompilerOptions& options, FILE* standard_output,
+                       string& ast) {
+    if (!options.emit_ast.empty()) ast = ParseTreeWriter().write(parse_tree);
+    if (!options.emit_ir && !options.emit_bytecode && !options.emit_regalloc && !options.emit_asm &&
+        !options.emit_object) {
+        if (options.emit_ast.empty()) visualize_parse_tree(parse_tree);
+        return 0;
+    }
+    IrModule module;
+    if (!compile_to_ir(parse_tree, options, module)) return 1;
+    if (options.emit_ir) print_ir(module, cout);
+    if (options.emit_bytecode) print_bytecode(BytecodeCompiler(module).compile(), cout);
+    if (options.emit_regalloc) print_register_allocation(module, cout);
+    if ((options.emit_asm || options.emit_object) && !write_machine_code(module, options, standard_output)) return 1;
     return 0;
-}
\ No newline at end of file
+}
+
+bool write_binary_file(const string& path, const string& data) {
+    ofstream file(path, ios::binary);
+    if (!file.write(data.data(), data.size()) || !file.flush()) {
+        cerr << "Error: Could not write output file '" << path << "'" << endl;
+        return false;
+    }
+    return true;
+}
+
+// --- COMPILE SERVER ---
+
+// The parse of options.token_file, reused from the cache while the file is
+// unchanged. Inputs that cannot be stamped (missing files) are not cached.
+CachedParse parse_cached(const CompilerOptions& options, ParseCache& cache) {
+    char resolved[PATH_MAX];
+    FileStamp stamp;
+    bool cacheable = realpath(options.token_file.c_str(), resolved) && stamp_file(resolved, stamp);
+    if (cacheable) {
+        if (const CachedParse* hit = cache.find(resolved, stamp)) return *hit;
+    }
+    CachedParse entry;
+    {
+        StreamCapture capture;
+        entry.tree.reset(parse_input(options, entry.has_tokens));
+        entry.output = capture.output();
+        entry.diagnostics = capture.diagnostics();
+    }
+    entry.stamp = stamp;
+    if (cacheable) cache.insert(resolved, entry);
+    return entry;
+}
+
+// One client request, compiled in the client's directory. Prints into the
+// capture of the caller; machine code for "-o -" is appended to it.
+int serve_compile_request(const CompileRequest& request, ParseCache& cache, CompileResponse& response) {
+    if (chdir(request.cwd.c_str()) != 0) {
+        cerr << "Error: Could not enter directory '" << request.cwd << "'" << endl;
+        return 1;
+    }
+    vector<string> args(1, "parser");
+    args.insert(args.end(), request.args.begin(), request.args.end());
+    vector<char*> argv;
+    for (string& arg : args) argv.push_back(&arg[0]);
+    CompilerOptions options;
+    if (!parse_options((int)argv.size(), argv.data(), options)) return 1;
+    options.interactive = false;
+    if (!options.run_file.empty() || !options.serve_socket.empty() || !options.connect_socket.empty()) {
+        cerr << "Error: --run, --serve and --connect are not available through the compile server" << endl;
+        return 1;
+    }
+
+    CachedParse parsed = parse_cached(options, cache);
+    cout << parsed.output;
+    cerr << parsed.diagnostics;
+    if (!parsed.tree) return 1;
+    char* buffer = nullptr;
+    size_t size = 0;
+    FILE* standard_output = open_memstream(&buffer, &size);
+    if (!standard_output) {
+        cerr << "Error: Out of memory" << endl;
+        return 1;
+    }
+    int status = compile_parse_tree(parsed.tree.get(), options, standard_output, response.ast);
+    fclose(standard_output);
+    cout.write(buffer, size);
+    free(buffer);
+    return status;
+}
+
+// --serve: answers requests until a client sends --shutdown.
+int run_compile_server(const string& socket_path) {
+    char home[PATH_MAX];
+    if (!getcwd(home, sizeof(home))) {
+        cerr << "Error: Could not determine the working directory" << endl;
+        return 1;
+    }
+    CompileServer server(socket_path);
+    string error;
+    if (!server.listen(error)) {
+        cerr << "Error: " << error << endl;
+        return 1;
+    }
+    cout << "Compile server listening on '" << socket_path << "'." << endl;
+    ParseCache cache;
+    server.serve([&cache, &home](const CompileRequest& request, CompileResponse& response) {
+        {
+            StreamCapture capture;
+            try {
+                response.status = serve_compile_request(request, cache, response);
+            } catch (const exception& e) {
+                cerr << "Error: " << e.what() << endl;
+                response.status = 1;
+            }
+            response.output = capture.output();
+            response.diagnostics = capture.diagnostics();
+        }
+        if (chdir(home) != 0) cerr << "Warning: Could not return to '" << home << "'" << endl;
+    });
+    return 0;
+}
+
+// --connect: has the server compile the command line and prints its answer
+// as if the compile had run here. False when no server answered.
+bool compile_on_server(int argc, char* argv[], const CompilerOptions& options, int& status) {
+    CompileRequest request;
+    request.kind = options.shutdown_server ? RequestKind::Shutdown : RequestKind::Compile;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return false;
+    request.cwd = cwd;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.compare(0, 10, "--connect=") != 0 && arg != "--shutdown") request.args.push_back(arg);
+    }
+    CompileResponse response;
+    string error;
+    if (!call_compile_server(options.connect_socket, request, response, error)) {
+        if (options.shutdown_server) cerr << "Error: " << error << endl;
+        return false;
+    }
+    cout << response.output << flush;
+    cerr << response.diagnostics;
+    status = response.status;
+    if (!response.ast.empty() && !write_binary_file(options.emit_ast, response.ast)) status = 1;
+    return true;
+}
+
+// --- MAIN FUNCTION ---
+
+// --batch: checks a whole tree of sources, or the files of a compilation
+// database, on a pool of threads.
+int run_batch(const CompilerOptions& options) {
+    vector<BatchInput> inputs;
+    struct stat info;
+    bool is_database = stat(options.batch_path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+    if (is_database ? !collect_database_inputs(options.batch_path, inputs)
+                    : !collect_directory_inputs(options.batch_path, inputs)) {
+        return 1;
+    }
+    if (options.processes > 0) {
+        return BatchProcessChecker(options.processes, options.max_memory).run(inputs) == 0 ? 0 : 1;
+    }
+    unsigned jobs = options.jobs > 0 ? options.jobs : thread::hardware_concurrency();
+    return BatchChecker(jobs, options.read_method, options.max_memory).run(inputs) == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    CompilerOptions options;
+    if (!parse_options(argc, argv, options)) return 1;
+    if (options.lsp) return LanguageServer().run();
+    if (!options.watch_directory.empty()) return SourceWatcher(options.watch_directory).run();
+    if (!options.batch_path.empty()) return run_batch(options);
+    if (!options.serve_socket.empty()) return run_compile_server(options.serve_socket);
+    if (!options.connect_socket.empty() && options.run_file.empty()) {
+        // Without a server the client compiles by itself; --run always does,
+        // the program has to run in this process.
+        int status;
+        if (compile_on_server(argc, argv, options, status)) return status;
+        if (options.shutdown_server) return 1;
+    }
+    if (!options.run_file.empty()) return run_program(options);
+
+    bool has_tokens;
+    ParseNode* parse_tree = parse_input(options, has_tokens);
+    if (!has_tokens) return 1;
+
+    int status = 1;
+    if (parse_tree != nullptr) {
+        string ast;
+        status = compile_parse_tree(parse_tree, options, stdout, ast);
+        if (!options.emit_ast.empty() && !write_binary_file(options.emit_ast, ast)) status = 1;
+        delete parse_tree;
+    }
+    
+    if (options.interactive) {
+        cout << "Press enter to end the program.";
+        cin.get();
+        return 0;
+    }
+    return status;
+}
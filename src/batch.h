@@ -0,0 +1,515 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file_reader.h"
+#include "source_analysis.h"
+#include "task_pool.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         BATCH CHECKING                                      ===
+// ===================================================================
+// `parser --batch DIR` checks every .c and .h file below DIR on a pool of
+// threads (-j). Each file is a chain of three tasks — scan, parse, analyse —
+// and the chains start largest file first, so the longest ones are not left
+// for the end; a reader thread reads the files ahead of the scans
+// (file_reader.h). The scan and parse of a file happen once, in a cache
+// shared by all threads: analysing a file looks up the headers it includes
+// there, and parses a header on the spot if no thread has got to it yet.
+//
+// Every report depends only on the files, never on which thread produced it
+// or when, and the reports are printed in the order of the file names, so
+// the output is the same for any number of threads.
+
+// How a file is compiled: where its #include "..." may look besides its own
+// directory, and the macros the command line defines. Files with the same
+// configuration share one.
+struct BatchConfiguration {
+    vector<string> include_directories;   // absolute and normalised
+    vector<string> defines;               // NAME or NAME=VALUE, -U as -NAME
+};
+
+struct BatchInput {
+    string path;   // absolute and normalised
+    string name;   // as reported
+    shared_ptr<const BatchConfiguration> configuration;
+    off_t size = 0;
+};
+
+// Roughly the heap memory of the tree under `node`.
+inline size_t tree_footprint(const ParseNode* node) {
+    size_t bytes = sizeof(ParseNode) + 16 + node->children.capacity() * sizeof(ParseNode*);
+    for (const string* text : {&node->type, &node->value}) {
+        if (text->capacity() > 15) bytes += text->capacity() + 17;   // beyond the small-string buffer
+    }
+    for (const ParseNode* child : node->children) bytes += tree_footprint(child);
+    return bytes;
+}
+
+// The scans and parses of every file a batch has touched, by absolute path.
+//
+// With a memory budget (--max-memory) a file is scanned and parsed in one
+// streamed pass, never holding all of its tokens, and the trees the cache
+// keeps are counted against the budget. Past it, the least recently used are
+// written to a spill file (unlinked, in $TMPDIR) and dropped; a later use
+// reads them back, or parses the file again if the spill file could not be
+// written. The trees are handed out as shared pointers, so dropping one
+// never pulls it from under an analysis still using it.
+class SourceCache {
+public:
+    struct Entry {
+        mutex lock;
+        bool scanned = false;
+        bool parsed = false;
+        bool exists = true;
+        vector<Token> tokens;   // between the scan and the parse
+        ParsedSource parse;
+        // Under a budget:
+        bool evicted = false;      // parse.tree dropped until the next use
+        size_t footprint = 0;      // what parse.tree is counted as
+        off_t spill_offset = -1;   // where the tree is in the spill file
+        size_t spill_size = 0;
+        uint64_t last_use = 0;
+    };
+
+    // `budget` bounds the memory of the trees kept; 0 keeps everything.
+    explicit SourceCache(size_t budget = 0) : m_budget(budget) {}
+
+    ~SourceCache() {
+        if (m_spill_fd >= 0) close(m_spill_fd);
+    }
+
+    Entry& entry(const string& path) {
+        lock_guard<mutex> lock(m_lock);
+        unique_ptr<Entry>& slot = m_entries[path];
+        if (!slot) slot.reset(new Entry);
+        return *slot;
+    }
+
+    // Reads and scans the file, unless that happened already.
+    void scan(const string& path, Entry& entry) {
+        {
+            lock_guard<mutex> lock(entry.lock);
+            scan_locked(path, entry);
+        }
+        trim();
+    }
+
+    // The same with the text read elsewhere; null if it could not be read.
+    void scan(Entry& entry, const string* text) {
+        {
+            lock_guard<mutex> lock(entry.lock);
+            if (entry.scanned) return;
+            entry.scanned = true;
+            entry.exists = text != nullptr;
+            if (text) scan_text(*text, entry);
+            else entry.parsed = true;
+        }
+        trim();
+    }
+
+    // Parses the scanned tokens, unless that happened already.
+    void parse(const string& path, Entry& entry) {
+        {
+            lock_guard<mutex> lock(entry.lock);
+            parse_locked(path, entry);
+        }
+        trim();
+    }
+
+    // The parse of `path`, scanning and parsing it first if needed, and with
+    // `tree` its tree (read back if it was dropped); null if there is no such
+    // file. Use `tree` rather than the parse's own, which may be dropped.
+    const ParsedSource* get(const string& path, shared_ptr<const ParseNode>* tree = nullptr) {
+        return use(path, entry(path), tree);
+    }
+
+    // The same for the entry of `path`.
+    const ParsedSource* use(const string& path, Entry& found, shared_ptr<const ParseNode>* tree) {
+        {
+            lock_guard<mutex> lock(found.lock);
+            parse_locked(path, found);
+            if (!found.exists) return nullptr;
+            if (tree) {
+                if (found.evicted) restore(path, found);
+                found.last_use = ++m_clock;
+                *tree = found.parse.tree;
+            }
+        }
+        trim();
+        return &found.parse;
+    }
+
+    // Under a budget, drops the tree of a file that is done with (its next
+    // use parses it again).
+    void discard(Entry& entry) {
+        if (m_budget == 0) return;
+        lock_guard<mutex> lock(entry.lock);
+        if (!entry.evicted && entry.parse.tree) evict(entry, false);
+    }
+
+private:
+    mutex m_lock;
+    map<string, unique_ptr<Entry>> m_entries;
+    size_t m_budget;
+    atomic<size_t> m_used{0};
+    atomic<uint64_t> m_clock{0};
+    mutex m_trim_lock;
+    mutex m_spill_lock;
+    int m_spill_fd = -1;
+    bool m_spill_failed = false;
+    off_t m_spill_end = 0;
+
+    static bool read_text(const string& path, string& text) {
+        ifstream input(path);
+        if (!input.is_open()) return false;
+        text.assign((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+        return true;
+    }
+
+    void scan_text(const string& text, Entry& entry) {
+        if (m_budget == 0) {
+            if (!scan_parsed_source(text, entry.tokens, entry.parse)) entry.parsed = true;
+            return;
+        }
+        entry.parse = stream_parsed_source(text);
+        entry.parsed = true;
+        account(entry);
+    }
+
+    void scan_locked(const string& path, Entry& entry) {
+        if (entry.scanned) return;
+        entry.scanned = true;
+        string text;
+        if (!read_text(path, text)) {
+            entry.exists = false;
+            return;
+        }
+        scan_text(text, entry);
+    }
+
+    void parse_locked(const string& path, Entry& entry) {
+        scan_locked(path, entry);
+        if (entry.parsed) return;
+        entry.parsed = true;
+        if (!entry.exists) return;
+        parse_scanned_source(entry.tokens, entry.parse);
+        vector<Token>().swap(entry.tokens);
+    }
+
+    // --- THE BUDGET ---
+
+    void account(Entry& entry) {
+        entry.footprint = entry.parse.tree ? tree_footprint(entry.parse.tree.get()) : 0;
+        m_used += entry.footprint;
+    }
+
+    // Drops the tree, writing it to the spill file first if `spill`.
+    void evict(Entry& entry, bool spill) {
+        if (spill && entry.spill_offset < 0) spill_tree(entry);
+        entry.parse.tree.reset();
+        entry.evicted = true;
+        m_used -= entry.footprint;
+        entry.footprint = 0;
+    }
+
+    void restore(const string& path, Entry& entry) {
+        shared_ptr<const ParseNode> tree;
+        if (entry.spill_offset >= 0) {
+            string data(entry.spill_size, '\0');
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t got = pread(m_spill_fd, &data[done], data.size() - done, entry.spill_offset + done);
+                if (got <= 0) break;
+                done += got;
+            }
+            if (done == data.size()) tree.reset(ParseTreeReader().read(data));
+        }
+        string text;
+        if (!tree && read_text(path, text)) tree = stream_parsed_source(text).tree;
+        entry.parse.tree = tree;
+        entry.evicted = false;
+        account(entry);
+    }
+
+    void spill_tree(Entry& entry) {
+        string data = ParseTreeWriter().write(entry.parse.tree.get());
+        off_t offset;
+        {
+            lock_guard<mutex> lock(m_spill_lock);
+            if (m_spill_fd < 0 && !m_spill_failed) {
+                const char* directory = getenv("TMPDIR");
+                string name = string(directory && *directory ? directory : "/tmp") + "/parser-spill-XXXXXX";
+                m_spill_fd = mkstemp(&name[0]);
+                if (m_spill_fd >= 0) unlink(name.c_str());
+                else m_spill_failed = true;
+            }
+            if (m_spill_fd < 0) return;
+            offset = m_spill_end;
+            m_spill_end += data.size();
+        }
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t wrote = pwrite(m_spill_fd, data.data() + done, data.size() - done, offset + done);
+            if (wrote <= 0) return;   // read back by parsing again
+            done += wrote;
+        }
+        entry.spill_offset = offset;
+        entry.spill_size = data.size();
+    }
+
+    // Drops the least recently used trees until a quarter of the budget is
+    // free again. Entries in use by another thread are left alone.
+    void trim() {
+        if (m_budget == 0 || m_used <= m_budget) return;
+        lock_guard<mutex> trimming(m_trim_lock);
+        vector<pair<uint64_t, Entry*>> loaded;
+        {
+            lock_guard<mutex> lock(m_lock);
+            for (auto& slot : m_entries) {
+                Entry& candidate = *slot.second;
+                if (!candidate.lock.try_lock()) continue;
+                if (!candidate.evicted && candidate.parse.tree) loaded.push_back(make_pair(candidate.last_use, &candidate));
+                candidate.lock.unlock();
+            }
+        }
+        sort(loaded.begin(), loaded.end());
+        for (const auto& oldest : loaded) {
+            if (m_used <= m_budget / 4 * 3) break;
+            Entry& candidate = *oldest.second;
+            if (!candidate.lock.try_lock()) continue;
+            if (!candidate.evicted && candidate.parse.tree) evict(candidate, true);
+            candidate.lock.unlock();
+        }
+    }
+};
+
+// The .c and .h files below `directory`, leaving out hidden directories.
+inline void list_source_files(const string& directory, vector<string>& files) {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return;
+    vector<string> subdirectories;
+    while (dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.empty() || name[0] == '.') continue;
+        string child = directory + "/" + name;
+        struct stat info;
+        if (lstat(child.c_str(), &info) != 0) continue;
+        if (S_ISDIR(info.st_mode)) subdirectories.push_back(child);
+        else if (S_ISREG(info.st_mode) && is_source_name(name)) files.push_back(child);
+    }
+    closedir(dir);
+    for (const string& subdirectory : subdirectories) list_source_files(subdirectory, files);
+}
+
+// The inputs for `parser --batch DIR`: headers resolve against DIR as well.
+inline bool collect_directory_inputs(const string& directory, vector<BatchInput>& inputs) {
+    char resolved[PATH_MAX];
+    struct stat info;
+    if (!realpath(directory.c_str(), resolved) || stat(resolved, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        cerr << "Error: '" << directory << "' is not a directory" << endl;
+        return false;
+    }
+    string root = resolved;
+    shared_ptr<BatchConfiguration> configuration(new BatchConfiguration);
+    configuration->include_directories.push_back(root);
+    vector<string> files;
+    list_source_files(root, files);
+    for (const string& file : files) {
+        BatchInput input;
+        input.path = file;
+        input.name = file.substr(root.size() + 1);
+        input.configuration = configuration;
+        struct stat file_info;
+        if (stat(file.c_str(), &file_info) == 0) input.size = file_info.st_size;
+        inputs.push_back(input);
+    }
+    return true;
+}
+
+// Sorts `inputs` by name, the order of the reports, and returns their
+// indices largest file first, the order to start them in.
+inline vector<size_t> prepare_batch(vector<BatchInput>& inputs) {
+    sort(inputs.begin(), inputs.end(), [](const BatchInput& a, const BatchInput& b) { return a.name < b.name; });
+    vector<size_t> order(inputs.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&inputs](size_t a, size_t b) { return inputs[a].size > inputs[b].size; });
+    return order;
+}
+
+// Prints the reports of the files with errors and a summary; returns how
+// many files had errors.
+inline size_t print_batch_reports(const vector<BatchInput>& inputs, const vector<string>& reports, ostream& out) {
+    size_t failed = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!reports[i].empty()) failed++;
+        print_file_report(inputs[i].name, reports[i], true, out);
+    }
+    out << "Checked " << inputs.size() << " files, " << failed << " with errors." << endl;
+    return failed;
+}
+
+// With --max-memory the batch keeps to a budget: a quarter of it bounds the
+// texts read ahead, a quarter the files being checked, each counted as
+// kFileWorkingSetFactor times its size (its tree, mostly), and half the
+// trees the cache keeps. The rest is left for everything else. A file is then
+// one task from scan to report, so that a thread holds one file at a time,
+// and the tree of a .c file is dropped as soon as it is analysed.
+const size_t kFileWorkingSetFactor = 48;   // a tree takes about 40 times the text
+
+class BatchChecker {
+public:
+    // `max_memory` is the budget, 0 for none.
+    explicit BatchChecker(unsigned jobs, ReadMethod read_method = ReadMethod::IoUring, size_t max_memory = 0)
+        : m_pool(jobs),
+          m_read_method(read_method),
+          m_max_memory(max_memory),
+          m_read_budget(max_memory > 0 ? min(kReadAheadBytes, max_memory / 4) : kReadAheadBytes),
+          m_flight_budget(max_memory / 4),
+          m_cache(max_memory / 2) {}
+
+    // Checks `inputs` and prints their reports, files with errors only;
+    // returns how many had errors.
+    size_t run(vector<BatchInput> inputs, ostream& out = cout) {
+        vector<size_t> order = prepare_batch(inputs);
+        vector<string> reports(inputs.size());
+        // The files are read ahead in the order the tasks start in.
+        vector<ReadRequest> requests;
+        for (size_t index : order) {
+            ReadRequest request;
+            request.path = inputs[index].path;
+            request.expected_size = inputs[index].size;
+            requests.push_back(request);
+        }
+        BatchReader reader(move(requests), m_read_method, m_read_budget);
+        vector<TaskPool::Task> tasks;
+        for (size_t position = 0; position < order.size(); ++position) {
+            size_t index = order[position];
+            tasks.push_back([this, &inputs, &reports, &reader, index, position]() {
+                const BatchInput& input = inputs[index];
+                SourceCache::Entry& entry = m_cache.entry(input.path);
+                string text;
+                bool read = reader.take(position, text);
+                if (m_max_memory > 0) {
+                    // Waiting here holds no other file's work up: every file
+                    // in flight has its text and needs nothing from this one.
+                    size_t weight = text.size() * kFileWorkingSetFactor;
+                    enter_flight(weight);
+                    m_cache.scan(entry, read ? &text : nullptr);
+                    reader.give_back(text);
+                    reports[index] = finish(input, entry);
+                    leave_flight(weight);
+                    return;
+                }
+                m_cache.scan(entry, read ? &text : nullptr);
+                reader.give_back(text);
+                m_pool.spawn([this, &input, &reports, &entry, index]() {
+                    m_cache.parse(input.path, entry);
+                    m_pool.spawn([this, &input, &reports, &entry, index]() {
+                        reports[index] = report(input, entry);
+                    });
+                });
+            });
+        }
+        m_pool.run(move(tasks));
+        return print_batch_reports(inputs, reports, out);
+    }
+
+    // The report of one file, all three stages on the calling thread.
+    string check(const BatchInput& input) {
+        SourceCache::Entry& entry = m_cache.entry(input.path);
+        m_cache.parse(input.path, entry);
+        return finish(input, entry);
+    }
+
+private:
+    TaskPool m_pool;
+    ReadMethod m_read_method;
+    size_t m_max_memory;
+    size_t m_read_budget;
+    size_t m_flight_budget;
+    SourceCache m_cache;
+    mutex m_flight_lock;
+    condition_variable m_flight_room;
+    size_t m_in_flight = 0;
+
+    // Waits until `weight` more bytes of files in flight fit the budget; a
+    // file alone in flight always does.
+    void enter_flight(size_t weight) {
+        unique_lock<mutex> lock(m_flight_lock);
+        m_flight_room.wait(lock, [&]() { return m_in_flight == 0 || m_in_flight + weight <= m_flight_budget; });
+        m_in_flight += weight;
+    }
+
+    void leave_flight(size_t weight) {
+        {
+            lock_guard<mutex> lock(m_flight_lock);
+            m_in_flight -= weight;
+        }
+        m_flight_room.notify_all();
+    }
+
+    // The header `#include "name"` in `from` refers to; empty if none.
+    string resolve_include(const BatchInput& input, const string& from, const string& name) {
+        for (const string& candidate : include_candidates(from, name, input.configuration->include_directories)) {
+            if (m_cache.get(candidate)) return candidate;
+        }
+        return "";
+    }
+
+    // The declarations of the headers `path` includes, then its own from
+    // `tree`; `trees` keeps every tree they belong to.
+    void collect_declarations(const BatchInput& input, const string& path, const ParsedSource& parse,
+                              const ParseNode* tree, set<string>& seen, vector<shared_ptr<const ParseNode>>& trees,
+                              vector<const ParseNode*>& declarations) {
+        for (const string& name : parse.includes) {
+            string header = resolve_include(input, path, name);
+            if (header.empty() || !seen.insert(header).second) continue;
+            shared_ptr<const ParseNode> header_tree;
+            const ParsedSource* header_parse = m_cache.get(header, &header_tree);
+            if (!header_tree) continue;
+            trees.push_back(header_tree);
+            collect_declarations(input, header, *header_parse, header_tree.get(), seen, trees, declarations);
+        }
+        for (const ParseNode* node : tree->children) declarations.push_back(node);
+    }
+
+    // The report, then under a budget the tree of a .c file dropped.
+    string finish(const BatchInput& input, SourceCache::Entry& entry) {
+        string result = report(input, entry);
+        if (!is_header_name(input.path)) m_cache.discard(entry);
+        return result;
+    }
+
+    string report(const BatchInput& input, SourceCache::Entry& entry) {
+        vector<shared_ptr<const ParseNode>> trees(1);
+        const ParsedSource* parse = m_cache.use(input.path, entry, &trees[0]);
+        if (!parse) return "Error: Could not open file.\n";
+        string report = parse->diagnostics;
+        if (!trees[0]) return report;
+        set<string> seen = {input.path};
+        vector<const ParseNode*> declarations;
+        collect_declarations(input, input.path, *parse, trees[0].get(), seen, trees, declarations);
+        return report + check_declarations(declarations);
+    }
+};
+
+#endif
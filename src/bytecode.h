@@ -0,0 +1,518 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "ir.h"
+#include "native_call.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         REGISTER BYTECODE                                   ===
+// ===================================================================
+// A compact, portable form of the optimised IR for the virtual machine in
+// vm.h. Code is a stream of 32-bit words: an opcode followed by its operands.
+// Operands name registers of the current frame (the IR's vregs), entries of
+// the constant pool, byte offsets into global memory, functions, or code
+// offsets for jumps.
+//
+// Opcodes are typed (I: int, F: float, D: double) so that the VM never looks
+// at types at run time. Besides the plain three-address instructions there are
+// superinstructions for the most frequent pairs in the IR:
+//   - a comparison whose only use is the branch after it becomes one
+//     compare-and-branch (JltI a, b, target);
+//   - an operand that is an integer constant is folded into the instruction
+//     (AddIK dst, a, imm; JltIK a, imm, target), and the constant load goes
+//     away when nothing else needs it.
+//
+// For tiered execution the compiler can also put a LoopHeader instruction at
+// the start of every block that a backward jump reaches, so that the VM can
+// count loop iterations per function.
+
+#define BYTECODE_OPS(X)                                                     \
+    X(LoadK) X(Move)                                                        \
+    X(AddI) X(SubI) X(MulI) X(DivI) X(AddIK) X(SubIK)                      \
+    X(AddF) X(SubF) X(MulF) X(DivF)                                         \
+    X(AddD) X(SubD) X(MulD) X(DivD)                                         \
+    X(EqI) X(NeI) X(LtI) X(GtI) X(LeI) X(GeI)                               \
+    X(EqF) X(NeF) X(LtF) X(GtF) X(LeF) X(GeF)                               \
+    X(EqD) X(NeD) X(LtD) X(GtD) X(LeD) X(GeD)                               \
+    X(I2F) X(I2D) X(F2I) X(D2I) X(F2D) X(D2F) X(TruncChar) X(TestBit)       \
+    X(LoadGI) X(LoadGC) X(LoadGF) X(LoadGD)                                 \
+    X(StoreGI) X(StoreGC) X(StoreGF) X(StoreGD)                             \
+    X(Jmp) X(Jnz) X(Jz) X(JumpTable)                                        \
+    X(JeqI) X(JneI) X(JltI) X(JgtI) X(JleI) X(JgeI)                         \
+    X(JeqIK) X(JneIK) X(JltIK) X(JgtIK) X(JleIK) X(JgeIK)                   \
+    X(Call) X(TailCall) X(CallNative) X(Ret) X(RetVoid)                     \
+    X(LoopHeader)
+
+enum class BcOp : uint32_t {
+#define BYTECODE_ENUM(name) name,
+    BYTECODE_OPS(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+    Count
+};
+
+inline const char* bc_op_name(BcOp op) {
+    static const char* const names[] = {
+#define BYTECODE_NAME(name) #name,
+        BYTECODE_OPS(BYTECODE_NAME)
+#undef BYTECODE_NAME
+    };
+    return names[(int)op];
+}
+
+const uint32_t kNoRegister = 0xFFFFFFFFu;
+const long long kBcNotConstant = 1LL << 40;   // marks vregs that do not hold a known constant
+
+struct BcFunction {
+    string name;
+    IrType return_type = IrType::Void;
+    vector<IrType> param_types;
+    vector<uint32_t> params;      // register receiving each argument
+    uint32_t num_registers = 0;
+    vector<uint32_t> code;
+};
+
+// A function that is declared but not defined; called in the host process.
+struct BcNative {
+    string name;
+    IrType return_type;
+    vector<IrType> param_types;
+};
+
+struct BcProgram {
+    vector<RuntimeValue> constants;
+    vector<BcFunction> functions;
+    vector<BcNative> natives;
+    vector<uint8_t> globals;          // initial contents of global memory
+    map<string, uint32_t> global_offsets;
+
+    int find_function(const string& name) const {
+        for (size_t i = 0; i < functions.size(); ++i) {
+            if (functions[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+};
+
+// Number of words taken by the instruction at code[pc].
+inline size_t bc_instruction_size(const uint32_t* code) {
+    switch ((BcOp)code[0]) {
+        case BcOp::RetVoid: case BcOp::LoopHeader:
+            return 1;
+        case BcOp::Jmp: case BcOp::Ret:
+            return 2;
+        case BcOp::LoadK: case BcOp::Move: case BcOp::Jnz: case BcOp::Jz:
+        case BcOp::I2F: case BcOp::I2D: case BcOp::F2I: case BcOp::D2I: case BcOp::F2D: case BcOp::D2F:
+        case BcOp::TruncChar:
+        case BcOp::LoadGI: case BcOp::LoadGC: case BcOp::LoadGF: case BcOp::LoadGD:
+        case BcOp::StoreGI: case BcOp::StoreGC: case BcOp::StoreGF: case BcOp::StoreGD:
+            return 3;
+        case BcOp::Call: case BcOp::TailCall: case BcOp::CallNative:
+            return 4 + code[3];
+        case BcOp::JumpTable:   // JumpTable x, low, count, default, target...
+            return 5 + code[3];
+        default:
+            return 4;
+    }
+}
+
+// ===================================================================
+// ===         COMPILER: IR -> BYTECODE                            ===
+// ===================================================================
+
+class BytecodeCompiler {
+public:
+    BytecodeCompiler(const IrModule& module, bool mark_loop_headers = false)
+        : m_module(module), m_mark_loop_headers(mark_loop_headers) {}
+
+    BcProgram compile() {
+        BcProgram program;
+        m_program = &program;
+        for (const IrGlobal& global : m_module.globals) layout_global(global);
+        for (const IrFunction& function : m_module.functions) {
+            if (function.defined) {
+                m_function_index[function.name] = (uint32_t)program.functions.size();
+                BcFunction entry;
+                entry.name = function.name;
+                program.functions.push_back(entry);
+            } else {
+                m_native_index[function.name] = (uint32_t)program.natives.size();
+                program.natives.push_back(BcNative{function.name, function.return_type, function.param_types});
+            }
+        }
+        for (const IrFunction& function : m_module.functions) {
+            if (function.defined) compile_function(function, program.functions[m_function_index[function.name]]);
+        }
+        m_program = nullptr;
+        return program;
+    }
+
+private:
+    const IrModule& m_module;
+    bool m_mark_loop_headers;
+    BcProgram* m_program = nullptr;
+    map<string, uint32_t> m_function_index;
+    map<string, uint32_t> m_native_index;
+    map<uint64_t, uint32_t> m_constant_index;
+
+    // Per-function state.
+    const IrFunction* m_function = nullptr;
+    vector<uint32_t>* m_code = nullptr;
+    vector<int> m_definitions;        // per vreg: number of definitions
+    vector<long long> m_constant;     // per vreg: value when defined once by Const
+    vector<int> m_remaining_uses;     // uses left after folding
+    struct JumpFixup {
+        size_t word;
+        int block;
+    };
+    vector<JumpFixup> m_fixups;
+
+    void layout_global(const IrGlobal& global) {
+        vector<uint8_t>& memory = m_program->globals;
+        size_t size = global.type == IrType::Char ? 1 : global.type == IrType::Double ? 8 : 4;
+        while (memory.size() % size != 0) memory.push_back(0);
+        m_program->global_offsets[global.name] = (uint32_t)memory.size();
+        uint8_t bytes[8];
+        if (global.type == IrType::Float) {
+            float value = (float)global.finit;
+            memcpy(bytes, &value, 4);
+        } else if (global.type == IrType::Double) {
+            memcpy(bytes, &global.finit, 8);
+        } else if (global.type == IrType::Char) {
+            bytes[0] = (uint8_t)(int8_t)global.init;
+        } else {
+            int32_t value = (int32_t)global.init;
+            memcpy(bytes, &value, 4);
+        }
+        memory.insert(memory.end(), bytes, bytes + size);
+    }
+
+    uint32_t constant(RuntimeValue value) {
+        auto it = m_constant_index.find(value.bits);
+        if (it != m_constant_index.end()) return it->second;
+        uint32_t index = (uint32_t)m_program->constants.size();
+        m_program->constants.push_back(value);
+        m_constant_index[value.bits] = index;
+        return index;
+    }
+
+    bool is_int_constant(int vreg) const {
+        return vreg >= 0 && m_definitions[vreg] == 1 && m_constant[vreg] != kBcNotConstant;
+    }
+
+    // --- SUPERINSTRUCTION SELECTION ---
+    // Decided once per instruction and used by both passes: counting the
+    // uses that remain (so unneeded constant loads can be dropped) and emission.
+    struct Selection {
+        bool fuse_branch = false;   // comparison + following branch
+        int folded = -1;            // 0: operand a is an immediate, 1: operand b
+    };
+
+    Selection select(const IrBlock& block, size_t i) const {
+        const IrInst& inst = block.insts[i];
+        Selection selection;
+        bool is_int = value_type(inst.operand_type) == IrType::Int;
+        if ((inst.op == IrOp::Add || inst.op == IrOp::Sub) && inst.type == IrType::Int) {
+            if (is_int_constant(inst.b)) selection.folded = 1;
+            else if (inst.op == IrOp::Add && is_int_constant(inst.a)) selection.folded = 0;
+        } else if (is_comparison(inst.op) && is_int && i + 1 < block.insts.size()) {
+            const IrInst& next = block.insts[i + 1];
+            if (next.op == IrOp::Branch && next.a == inst.dest && use_count(inst.dest) == 1 && inst.a != inst.dest &&
+                inst.b != inst.dest) {
+                selection.fuse_branch = true;
+                if (is_int_constant(inst.b)) selection.folded = 1;
+                else if (is_int_constant(inst.a)) selection.folded = 0;
+            }
+        }
+        return selection;
+    }
+
+    vector<int> m_use_count;
+    int use_count(int vreg) const { return m_use_count[vreg]; }
+
+    void analyse(const IrFunction& function) {
+        size_t vregs = function.vreg_types.size();
+        m_definitions.assign(vregs, 0);
+        m_constant.assign(vregs, kBcNotConstant);
+        m_use_count.assign(vregs, 0);
+        for (int param : function.params) m_definitions[param]++;
+        for (const IrBlock& block : function.blocks) {
+            for (const IrInst& inst : block.insts) {
+                if (inst.dest >= 0) {
+                    m_definitions[inst.dest]++;
+                    if (inst.op == IrOp::Const) m_constant[inst.dest] = inst.imm;
+                }
+                if (inst.a >= 0) m_use_count[inst.a]++;
+                if (inst.b >= 0) m_use_count[inst.b]++;
+                for (int arg : inst.args) m_use_count[arg]++;
+            }
+        }
+        m_remaining_uses = m_use_count;
+        for (const IrBlock& block : function.blocks) {
+            for (size_t i = 0; i < block.insts.size(); ++i) {
+                Selection selection = select(block, i);
+                if (selection.folded == 0) m_remaining_uses[block.insts[i].a]--;
+                if (selection.folded == 1) m_remaining_uses[block.insts[i].b]--;
+                if (selection.fuse_branch) i++;
+            }
+        }
+    }
+
+    // --- EMISSION ---
+    void word(uint32_t value) { m_code->push_back(value); }
+    void op(BcOp opcode) { word((uint32_t)opcode); }
+    void target(int block) {
+        m_fixups.push_back(JumpFixup{m_code->size(), block});
+        word(0);
+    }
+
+    void compile_function(const IrFunction& function, BcFunction& result) {
+        result.return_type = function.return_type;
+        result.param_types = function.param_types;
+        for (int param : function.params) result.params.push_back((uint32_t)param);
+        result.num_registers = (uint32_t)function.vreg_types.size();
+        m_function = &function;
+        m_code = &result.code;
+        analyse(function);
+
+        // Blocks are laid out in order, so a jump to a block that is not
+        // after its own is a back edge.
+        vector<bool> loop_header(function.blocks.size(), false);
+        if (m_mark_loop_headers) {
+            for (size_t b = 0; b < function.blocks.size(); ++b) {
+                for (int successor : successors(function.blocks[b])) {
+                    if (successor <= (int)b) loop_header[successor] = true;
+                }
+            }
+        }
+
+        vector<size_t> block_start(function.blocks.size());
+        for (size_t b = 0; b < function.blocks.size(); ++b) {
+            block_start[b] = m_code->size();
+            if (loop_header[b]) op(BcOp::LoopHeader);
+            const IrBlock& block = function.blocks[b];
+            for (size_t i = 0; i < block.insts.size(); ++i) {
+                Selection selection = select(block, i);
+                if (selection.fuse_branch) {
+                    compile_compare_and_branch(block.insts[i], block.insts[i + 1], selection, (int)b);
+                    i++;
+                    continue;
+                }
+                const IrInst& inst = block.insts[i];
+                if (inst.op == IrOp::Call && inst.tail_call && i + 1 < block.insts.size() &&
+                    m_function_index.count(inst.symbol)) {
+                    compile_call(inst, BcOp::TailCall, m_function_index[inst.symbol]);
+                    i++; // the Ret is part of the tail call
+                    continue;
+                }
+                compile_inst(inst, selection, (int)b);
+            }
+        }
+        for (const JumpFixup& fixup : m_fixups) (*m_code)[fixup.word] = (uint32_t)block_start[fixup.block];
+        m_fixups.clear();
+        m_code = nullptr;
+        m_function = nullptr;
+    }
+
+    static BcOp typed(IrType type, BcOp int_op, BcOp float_op, BcOp double_op) {
+        if (type == IrType::Float) return float_op;
+        if (type == IrType::Double) return double_op;
+        return int_op;
+    }
+
+    void three(BcOp opcode, int dest, int a, int b) {
+        op(opcode);
+        word((uint32_t)dest);
+        word((uint32_t)a);
+        word((uint32_t)b);
+    }
+    void two(BcOp opcode, uint32_t first, uint32_t second) {
+        op(opcode);
+        word(first);
+        word(second);
+    }
+
+    void compile_inst(const IrInst& inst, const Selection& selection, int b) {
+        switch (inst.op) {
+            case IrOp::Const:
+                if (m_remaining_uses[inst.dest] == 0 && m_definitions[inst.dest] == 1) break;
+                two(BcOp::LoadK, (uint32_t)inst.dest, constant(make_int_value((int32_t)inst.imm)));
+                break;
+            case IrOp::FConst: {
+                RuntimeValue value;
+                value.bits = 0;
+                if (inst.type == IrType::Float) value.f = (float)inst.fimm;
+                else value.d = inst.fimm;
+                two(BcOp::LoadK, (uint32_t)inst.dest, constant(value));
+                break;
+            }
+            case IrOp::Copy:
+                if (inst.dest != inst.a) two(BcOp::Move, (uint32_t)inst.dest, (uint32_t)inst.a);
+                break;
+            case IrOp::Add: case IrOp::Sub:
+                if (selection.folded >= 0) {
+                    int other = selection.folded == 1 ? inst.a : inst.b;
+                    long long imm = m_constant[selection.folded == 1 ? inst.b : inst.a];
+                    three(inst.op == IrOp::Add ? BcOp::AddIK : BcOp::SubIK, inst.dest, other, (int)(int32_t)imm);
+                    break;
+                }
+                if (inst.op == IrOp::Add) three(typed(inst.type, BcOp::AddI, BcOp::AddF, BcOp::AddD), inst.dest, inst.a, inst.b);
+                else three(typed(inst.type, BcOp::SubI, BcOp::SubF, BcOp::SubD), inst.dest, inst.a, inst.b);
+                break;
+            case IrOp::Mul: three(typed(inst.type, BcOp::MulI, BcOp::MulF, BcOp::MulD), inst.dest, inst.a, inst.b); break;
+            case IrOp::Div: three(typed(inst.type, BcOp::DivI, BcOp::DivF, BcOp::DivD), inst.dest, inst.a, inst.b); break;
+            case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Gt: case IrOp::Le: case IrOp::Ge: {
+                int k = (int)inst.op - (int)IrOp::Eq;
+                BcOp base = typed(inst.operand_type, BcOp::EqI, BcOp::EqF, BcOp::EqD);
+                three((BcOp)((int)base + k), inst.dest, inst.a, inst.b);
+                break;
+            }
+            case IrOp::Convert: {
+                BcOp opcode;
+                if (inst.operand_type == IrType::Int) opcode = inst.type == IrType::Float ? BcOp::I2F : BcOp::I2D;
+                else if (inst.operand_type == IrType::Float) opcode = inst.type == IrType::Int ? BcOp::F2I : BcOp::F2D;
+                else opcode = inst.type == IrType::Int ? BcOp::D2I : BcOp::D2F;
+                two(opcode, (uint32_t)inst.dest, (uint32_t)inst.a);
+                break;
+            }
+            case IrOp::TruncChar: two(BcOp::TruncChar, (uint32_t)inst.dest, (uint32_t)inst.a); break;
+            case IrOp::TestBit: {
+                RuntimeValue mask;
+                mask.bits = (uint64_t)inst.imm;
+                three(BcOp::TestBit, inst.dest, inst.a, (int)constant(mask));
+                break;
+            }
+            case IrOp::LoadGlobal: {
+                BcOp opcode = inst.operand_type == IrType::Char ? BcOp::LoadGC
+                            : typed(inst.operand_type, BcOp::LoadGI, BcOp::LoadGF, BcOp::LoadGD);
+                two(opcode, (uint32_t)inst.dest, m_program->global_offsets[inst.symbol]);
+                break;
+            }
+            case IrOp::StoreGlobal: {
+                BcOp opcode = inst.operand_type == IrType::Char ? BcOp::StoreGC
+                            : typed(inst.operand_type, BcOp::StoreGI, BcOp::StoreGF, BcOp::StoreGD);
+                two(opcode, m_program->global_offsets[inst.symbol], (uint32_t)inst.a);
+                break;
+            }
+            case IrOp::Call:
+                if (m_function_index.count(inst.symbol)) compile_call(inst, BcOp::Call, m_function_index[inst.symbol]);
+                else compile_call(inst, BcOp::CallNative, m_native_index[inst.symbol]);
+                break;
+            case IrOp::Jump:
+                if (inst.target != b + 1) {
+                    op(BcOp::Jmp);
+                    target(inst.target);
+                }
+                break;
+            case IrOp::Branch:
+                if (inst.target == b + 1) {
+                    op(BcOp::Jz);
+                    word((uint32_t)inst.a);
+                    target(inst.target_false);
+                    break;
+                }
+                op(BcOp::Jnz);
+                word((uint32_t)inst.a);
+                target(inst.target);
+                if (inst.target_false != b + 1) {
+                    op(BcOp::Jmp);
+                    target(inst.target_false);
+                }
+                break;
+            case IrOp::Switch:
+                op(BcOp::JumpTable);
+                word((uint32_t)inst.a);
+                word((uint32_t)(int32_t)inst.imm);
+                word((uint32_t)inst.table.size());
+                target(inst.target);
+                for (int entry : inst.table) target(entry);
+                break;
+            case IrOp::Ret:
+                if (inst.a >= 0) {
+                    op(BcOp::Ret);
+                    word((uint32_t)inst.a);
+                } else {
+                    op(BcOp::RetVoid);
+                }
+                break;
+        }
+    }
+
+    void compile_call(const IrInst& inst, BcOp opcode, uint32_t callee) {
+        op(opcode);
+        word(inst.dest >= 0 ? (uint32_t)inst.dest : kNoRegister);
+        word(callee);
+        word((uint32_t)inst.args.size());
+        for (int arg : inst.args) word((uint32_t)arg);
+    }
+
+    // Jumps to the true target with the condition, or to the false target with
+    // its negation, whichever lets the other one fall through.
+    void compile_compare_and_branch(const IrInst& compare, const IrInst& branch, const Selection& selection, int b) {
+        static const IrOp negated[] = {IrOp::Ne, IrOp::Eq, IrOp::Ge, IrOp::Le, IrOp::Gt, IrOp::Lt};
+        static const IrOp mirrored[] = {IrOp::Eq, IrOp::Ne, IrOp::Gt, IrOp::Lt, IrOp::Ge, IrOp::Le};
+        IrOp condition = compare.op;
+        int a = compare.a, rhs = compare.b;
+        if (selection.folded == 0) {
+            condition = mirrored[(int)condition - (int)IrOp::Eq];
+            swap(a, rhs);
+        }
+        int taken = branch.target, other = branch.target_false;
+        if (taken == b + 1) {
+            condition = negated[(int)condition - (int)IrOp::Eq];
+            swap(taken, other);
+        }
+        int k = (int)condition - (int)IrOp::Eq;
+        if (selection.folded >= 0) {
+            op((BcOp)((int)BcOp::JeqIK + k));
+            word((uint32_t)a);
+            word((uint32_t)(int32_t)m_constant[rhs]);
+        } else {
+            op((BcOp)((int)BcOp::JeqI + k));
+            word((uint32_t)a);
+            word((uint32_t)rhs);
+        }
+        target(taken);
+        if (other != b + 1) {
+            op(BcOp::Jmp);
+            target(other);
+        }
+    }
+};
+
+// ===================================================================
+// ===         BYTECODE PRINTING                                   ===
+// ===================================================================
+
+inline void print_bytecode(const BcProgram& program, ostream& out) {
+    for (size_t k = 0; k < program.constants.size(); ++k) {
+        out << "const k" << k << " = 0x" << hex << program.constants[k].bits << dec << endl;
+    }
+    for (const BcFunction& function : program.functions) {
+        out << "function " << function.name << " (" << function.num_registers << " registers)" << endl;
+        const uint32_t* code = function.code.data();
+        size_t pc = 0;
+        while (pc < function.code.size()) {
+            BcOp opcode = (BcOp)code[pc];
+            size_t size = bc_instruction_size(code + pc);
+            out << "  " << pc << ": " << bc_op_name(opcode);
+            for (size_t i = 1; i < size; ++i) {
+                uint32_t operand = code[pc + i];
+                out << (i == 1 ? " " : ", ");
+                if (operand == kNoRegister) out << "-";
+                else out << (int32_t)operand;
+            }
+            out << endl;
+            pc += size;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef COMPILE_COMMANDS_H
+#define COMPILE_COMMANDS_H
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "batch.h"
+#include "json.h"
+#include "source_analysis.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         COMPILATION DATABASE                                ===
+// ===================================================================
+// `parser --batch compile_commands.json` checks the files of a compilation
+// database (as CMake, Bear and others write it) instead of a directory. The
+// -I, -iquote, -D and -U options of each command become the configuration of
+// its file; entries with the same configuration share one, and an entry that
+// repeats a file with an equal configuration (a file built for two targets
+// with the same flags) is checked once.
+//
+// Without a preprocessor the macros do not change what a file means, so
+// they are kept for the identity of a configuration but two entries that
+// differ only in them are the same check. Headers do not depend on the
+// configuration either: the batch keeps one parse per header for all files.
+
+// Splits a "command" string the way a POSIX shell splits words: blanks
+// separate, quotes group, a backslash escapes the next character.
+inline vector<string> split_command_line(const string& command) {
+    vector<string> words;
+    string word;
+    bool in_word = false;
+    char quote = 0;
+    for (size_t i = 0; i < command.size(); ++i) {
+        char c = command[i];
+        if (quote == '\'') {
+            if (c == '\'') quote = 0;
+            else word += c;
+        } else if (c == '\\' && i + 1 < command.size() && quote != '\'') {
+            word += command[++i];
+            in_word = true;
+        } else if (quote == '"') {
+            if (c == '"') quote = 0;
+            else word += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_word = true;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (in_word) words.push_back(word);
+            word.clear();
+            in_word = false;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if (in_word) words.push_back(word);
+    return words;
+}
+
+// The configuration the compiler arguments `args` describe; relative include
+// directories are relative to `directory`.
+inline BatchConfiguration configuration_from_arguments(const vector<string>& args, const string& directory) {
+    BatchConfiguration configuration;
+    auto add_include = [&](const string& path) {
+        configuration.include_directories.push_back(
+            normalize_path(!path.empty() && path[0] == '/' ? path : directory + "/" + path));
+    };
+    for (size_t i = 1; i < args.size(); ++i) {
+        const string& arg = args[i];
+        // Both "-I dir" and "-Idir".
+        for (const char* option : {"-iquote", "-I", "-D", "-U"}) {
+            size_t length = strlen(option);
+            if (arg.compare(0, length, option) != 0) continue;
+            string value;
+            if (arg.size() > length) value = arg.substr(length);
+            else if (i + 1 < args.size()) value = args[++i];
+            else break;
+            if (arg[1] == 'i' || arg[1] == 'I') add_include(value);
+            else if (arg[1] == 'D') configuration.defines.push_back(value);
+            else configuration.defines.push_back("-" + value);
+            break;
+        }
+    }
+    return configuration;
+}
+
+// Reads `database_path` into batch inputs; false (with a message) if it is
+// not a compilation database.
+inline bool collect_database_inputs(const string& database_path, vector<BatchInput>& inputs) {
+    ifstream input(database_path);
+    if (!input.is_open()) {
+        cerr << "Error: Could not open file '" << database_path << "'" << endl;
+        return false;
+    }
+    string text((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    JsonValue database;
+    if (!parse_json(text, database) || database.kind() != JsonValue::Kind::Array) {
+        cerr << "Error: '" << database_path << "' is not a compilation database (a JSON array of commands)" << endl;
+        return false;
+    }
+    char resolved[PATH_MAX];
+    string base = realpath(database_path.c_str(), resolved) ? directory_of(resolved) : ".";
+
+    // Configurations by their flags, and the checks by file and include
+    // directories, the part of a configuration that can change a result.
+    map<pair<vector<string>, vector<string>>, shared_ptr<const BatchConfiguration>> configurations;
+    map<pair<string, vector<string>>, bool> seen;
+    map<string, int> configurations_of_file;
+    size_t entry_number = 0;
+    for (const JsonValue& entry : database.items()) {
+        entry_number++;
+        string directory = entry["directory"].as_string();
+        string file = entry["file"].as_string();
+        vector<string> args;
+        if (entry["arguments"].kind() == JsonValue::Kind::Array) {
+            for (const JsonValue& arg : entry["arguments"].items()) args.push_back(arg.as_string());
+        } else {
+            args = split_command_line(entry["command"].as_string());
+        }
+        if (file.empty() || args.empty()) {
+            cerr << "Error: Entry " << entry_number << " of '" << database_path
+                 << "' needs a file and a command or arguments" << endl;
+            return false;
+        }
+        if (directory.empty() || directory[0] != '/') directory = normalize_path(base + "/" + directory);
+        string path = normalize_path(file[0] == '/' ? file : directory + "/" + file);
+
+        BatchConfiguration parsed = configuration_from_arguments(args, directory);
+        shared_ptr<const BatchConfiguration>& configuration =
+            configurations[make_pair(parsed.include_directories, parsed.defines)];
+        if (!configuration) configuration.reset(new BatchConfiguration(parsed));
+        bool& checked = seen[make_pair(path, parsed.include_directories)];
+        if (checked) continue;
+        checked = true;
+
+        BatchInput batch_input;
+        batch_input.path = path;
+        batch_input.name = path.compare(0, base.size() + 1, base + "/") == 0 ? path.substr(base.size() + 1) : path;
+        // A file built with several configurations is checked with each.
+        int count = ++configurations_of_file[path];
+        if (count > 1) batch_input.name += " (configuration " + to_string(count) + ")";
+        batch_input.configuration = configuration;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0) batch_input.size = info.st_size;
+        inputs.push_back(batch_input);
+    }
+    return true;
+}
+
+#endif
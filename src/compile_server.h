@@ -0,0 +1,369 @@
+#ifndef COMPILE_SERVER_H
+#define COMPILE_SERVER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "parse_tree.h"
+#include "stream_capture.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         COMPILE SERVER                                      ===
+// ===================================================================
+// `parser --serve=SOCKET` stays resident and answers requests on a UNIX
+// domain socket; `parser --connect=SOCKET ...` is the thin client that build
+// scripts call instead of a fresh compiler. A request carries the client's
+// working directory and command line, the answer the exit status, what the
+// compiler printed on stdout and stderr, and the binary parse tree when
+// --emit-ast asked for one. The server parses each input file once: as long
+// as its size and modification time stay the same, later requests reuse the
+// tree and replay the messages of the first parse.
+//
+// Every message is framed as a u32 length followed by that many bytes;
+// integers are little-endian (put_u32 in parse_tree.h).
+//
+// The server answers one client at a time, so a client has a deadline for
+// sending its request and a timeout for each write of the answer; one that
+// connects and sends nothing, or stops halfway, is dropped instead of
+// holding up the others and --shutdown.
+
+const uint32_t kMaxServerMessage = 1u << 30;
+const int kClientTimeoutMs = 10000;
+const size_t kMaxCachedParses = 256;
+
+enum class RequestKind : uint32_t { Compile = 1, Shutdown = 2 };
+
+struct CompileRequest {
+    RequestKind kind = RequestKind::Compile;
+    string cwd;
+    vector<string> args;
+};
+
+struct CompileResponse {
+    int status = 0;
+    string output;        // stdout of the compiler
+    string diagnostics;   // stderr of the compiler
+    string ast;           // --emit-ast: the binary parse tree
+};
+
+// --- WIRE FORMAT ---
+
+inline void put_string(string& out, const string& text) {
+    put_u32(out, (uint32_t)text.size());
+    out += text;
+}
+
+class WireReader {
+public:
+    explicit WireReader(const string& data) : m_data(data) {}
+
+    bool get_u32(uint32_t& value) {
+        if (m_data.size() - m_pos < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) value |= (uint32_t)(unsigned char)m_data[m_pos + i] << (8 * i);
+        m_pos += 4;
+        return true;
+    }
+
+    bool get_string(string& text) {
+        uint32_t size;
+        if (!get_u32(size) || m_data.size() - m_pos < size) return false;
+        text.assign(m_data, m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    bool at_end() const { return m_pos == m_data.size(); }
+
+private:
+    const string& m_data;
+    size_t m_pos = 0;
+};
+
+inline string encode_request(const CompileRequest& request) {
+    string out;
+    put_u32(out, (uint32_t)request.kind);
+    put_string(out, request.cwd);
+    put_u32(out, (uint32_t)request.args.size());
+    for (const string& arg : request.args) put_string(out, arg);
+    return out;
+}
+
+inline bool decode_request(const string& data, CompileRequest& request) {
+    WireReader reader(data);
+    uint32_t kind, count;
+    if (!reader.get_u32(kind) || !reader.get_string(request.cwd) || !reader.get_u32(count)) return false;
+    if (kind != (uint32_t)RequestKind::Compile && kind != (uint32_t)RequestKind::Shutdown) return false;
+    request.kind = (RequestKind)kind;
+    request.args.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        string arg;
+        if (!reader.get_string(arg)) return false;
+        request.args.push_back(arg);
+    }
+    return reader.at_end();
+}
+
+inline string encode_response(const CompileResponse& response) {
+    string out;
+    put_u32(out, (uint32_t)response.status);
+    put_string(out, response.output);
+    put_string(out, response.diagnostics);
+    put_string(out, response.ast);
+    return out;
+}
+
+inline bool decode_response(const string& data, CompileResponse& response) {
+    WireReader reader(data);
+    uint32_t status;
+    if (!reader.get_u32(status) || !reader.get_string(response.output) || !reader.get_string(response.diagnostics) ||
+        !reader.get_string(response.ast)) {
+        return false;
+    }
+    response.status = (int)status;
+    return reader.at_end();
+}
+
+inline bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Without a `deadline` waits as long as it takes.
+inline bool read_all(int fd, char* data, size_t size, const chrono::steady_clock::time_point* deadline = nullptr) {
+    while (size > 0) {
+        if (deadline) {
+            long long left = chrono::duration_cast<chrono::milliseconds>(*deadline - chrono::steady_clock::now()).count();
+            pollfd readable = {fd, POLLIN, 0};
+            int ready = left > 0 ? poll(&readable, 1, (int)min<long long>(left, INT_MAX)) : 0;
+            if (ready < 0 && errno == EINTR) continue;
+            if (ready <= 0) return false;
+        }
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+inline bool write_frame(int fd, const string& payload) {
+    string header;
+    put_u32(header, (uint32_t)payload.size());
+    return write_all(fd, header.data(), header.size()) && write_all(fd, payload.data(), payload.size());
+}
+
+inline bool read_frame(int fd, string& payload, const chrono::steady_clock::time_point* deadline = nullptr) {
+    string header(4, '\0');
+    uint32_t size;
+    if (!read_all(fd, &header[0], 4, deadline) || !WireReader(header).get_u32(size) || size > kMaxServerMessage) {
+        return false;
+    }
+    payload.assign(size, '\0');
+    return size == 0 || read_all(fd, &payload[0], size, deadline);
+}
+
+inline bool make_socket_address(const string& path, sockaddr_un& address, string& error) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        error = "Socket path '" + path + "' is empty or too long";
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// --- CLIENT ---
+
+// Sends one request and waits for the answer. Fails without side effects when
+// no server listens on `socket_path`, so the caller can compile locally.
+inline bool call_compile_server(const string& socket_path, const CompileRequest& request, CompileResponse& response,
+                                string& error) {
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address, error)) return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = string("Could not create socket: ") + strerror(errno);
+        return false;
+    }
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        error = "No compile server at '" + socket_path + "': " + strerror(errno);
+        close(fd);
+        return false;
+    }
+    string answer;
+    bool ok = write_frame(fd, encode_request(request)) && read_frame(fd, answer);
+    close(fd);
+    if (ok && request.kind == RequestKind::Compile) ok = decode_response(answer, response);
+    if (!ok) error = "The compile server at '" + socket_path + "' did not answer";
+    return ok;
+}
+
+// --- PARSE CACHE ---
+
+// Identifies one version of a file: a rewrite changes its size or its
+// modification time.
+struct FileStamp {
+    dev_t device = 0;
+    ino_t inode = 0;
+    off_t size = 0;
+    time_t mtime = 0;
+    long mtime_nsec = 0;
+
+    bool operator==(const FileStamp& other) const {
+        return device == other.device && inode == other.inode && size == other.size && mtime == other.mtime &&
+               mtime_nsec == other.mtime_nsec;
+    }
+};
+
+inline bool stamp_file(const string& path, FileStamp& stamp) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+    stamp.device = info.st_dev;
+    stamp.inode = info.st_ino;
+    stamp.size = info.st_size;
+    stamp.mtime = info.st_mtim.tv_sec;
+    stamp.mtime_nsec = info.st_mtim.tv_nsec;
+    return true;
+}
+
+// The result of parsing one input file and everything the parse printed.
+struct CachedParse {
+    FileStamp stamp;
+    shared_ptr<const ParseNode> tree;   // null after errors or without tokens
+    bool has_tokens = false;
+    string output;
+    string diagnostics;
+    unsigned long long last_use = 0;
+};
+
+// Parsed inputs by absolute path, the least recently used dropped beyond
+// kMaxCachedParses.
+class ParseCache {
+public:
+    // The entry for `path` if the file has not changed since it was parsed.
+    const CachedParse* find(const string& path, const FileStamp& stamp) {
+        auto it = m_entries.find(path);
+        if (it == m_entries.end() || !(it->second.stamp == stamp)) return nullptr;
+        it->second.last_use = ++m_clock;
+        return &it->second;
+    }
+
+    const CachedParse* insert(const string& path, const CachedParse& entry) {
+        if (m_entries.size() >= kMaxCachedParses && !m_entries.count(path)) evict();
+        CachedParse& slot = m_entries[path];
+        slot = entry;
+        slot.last_use = ++m_clock;
+        return &slot;
+    }
+
+private:
+    map<string, CachedParse> m_entries;
+    unsigned long long m_clock = 0;
+
+    void evict() {
+        auto oldest = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->second.last_use < oldest->second.last_use) oldest = it;
+        }
+        m_entries.erase(oldest);
+    }
+};
+
+// --- SERVER ---
+
+// Answers requests one at a time; `handler(request, response)` compiles one.
+// Requests are serialised because the compiler reports through the global
+// cout and cerr.
+class CompileServer {
+public:
+    explicit CompileServer(const string& socket_path) : m_socket_path(socket_path) {}
+
+    ~CompileServer() {
+        if (m_fd >= 0) {
+            close(m_fd);
+            unlink(m_socket_path.c_str());
+        }
+    }
+
+    // Binds the socket, replacing one left behind by a server that died.
+    bool listen(string& error) {
+        sockaddr_un address;
+        if (!make_socket_address(m_socket_path, address, error)) return false;
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, (sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) close(probe);
+        if (live) {
+            error = "A compile server is already listening on '" + m_socket_path + "'";
+            return false;
+        }
+        unlink(m_socket_path.c_str());
+        m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_fd < 0 || bind(m_fd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(m_fd, 64) != 0) {
+            error = "Could not listen on '" + m_socket_path + "': " + strerror(errno);
+            return false;
+        }
+        signal(SIGPIPE, SIG_IGN);
+        return true;
+    }
+
+    template <typename Handler>
+    void serve(Handler handler) {
+        for (;;) {
+            int client = accept(m_fd, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            timeval timeout = {kClientTimeoutMs / 1000, (kClientTimeoutMs % 1000) * 1000};
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            chrono::steady_clock::time_point deadline =
+                chrono::steady_clock::now() + chrono::milliseconds(kClientTimeoutMs);
+            string data;
+            CompileRequest request;
+            bool ok = read_frame(client, data, &deadline) && decode_request(data, request);
+            if (ok && request.kind == RequestKind::Shutdown) {
+                write_frame(client, "");
+                close(client);
+                return;
+            }
+            if (ok) {
+                CompileResponse response;
+                handler(request, response);
+                write_frame(client, encode_response(response));
+            }
+            close(client);
+        }
+    }
+
+private:
+    string m_socket_path;
+    int m_fd = -1;
+};
+
+#endif
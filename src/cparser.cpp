@@ -0,0 +1,243 @@
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cparser.h"
+#include "ir.h"
+#include "parse_tree.h"
+#include "parser.h"
+#include "scanner.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         EMBEDDING API (IMPLEMENTATION)                      ===
+// ===================================================================
+// The C functions of cparser.h over the scanner, the parser and the IR
+// lowering. The stages run on demand, each once per text: asking for the
+// tree scans first if needed, asking for the diagnostics of every stage
+// parses and lowers first. No exception leaves the library; running out of
+// memory makes the call fail the way its declaration describes.
+
+struct cparser_context {
+    string text;
+    int stage = 0;   // 0: nothing yet, 1: scanned, 2: parsed, 3: checked
+    bool scanned_ok = false;
+    vector<Token> tokens;
+    vector<cparser_token> token_views;
+    unique_ptr<ParseNode> tree;
+    bool has_binary = false;
+    string binary;
+    deque<string> messages;   // a deque keeps the views' pointers valid
+    vector<cparser_diagnostic> diagnostics;
+};
+
+namespace {
+
+const ParseNode* as_parse_node(const cparser_node* node) {
+    return reinterpret_cast<const ParseNode*>(node);
+}
+
+const cparser_node* as_c_node(const ParseNode* node) {
+    return reinterpret_cast<const cparser_node*>(node);
+}
+
+void add_diagnostic(cparser_context* context, cparser_diagnostic_kind kind, int line, const string& message) {
+    context->messages.push_back(message);
+    cparser_diagnostic diagnostic;
+    diagnostic.kind = kind;
+    diagnostic.line = line;
+    diagnostic.message = context->messages.back().c_str();
+    context->diagnostics.push_back(diagnostic);
+}
+
+// Splits what the parser or the lowering reported, lines of the form
+// "[Line N] Syntax Error: message" or "[End of File] Syntax Error: message".
+void add_report(cparser_context* context, cparser_diagnostic_kind kind, const string& report) {
+    size_t start = 0;
+    while (start < report.size()) {
+        size_t end = report.find('\n', start);
+        if (end == string::npos) end = report.size();
+        string text = report.substr(start, end - start);
+        start = end + 1;
+        if (text.empty()) continue;
+        int line = 0;
+        if (text.compare(0, 6, "[Line ") == 0) line = atoi(text.c_str() + 6);
+        size_t close = text.find("] ");
+        if (close != string::npos) text = text.substr(close + 2);
+        size_t error = text.find("Error: ");
+        if (error != string::npos) text = text.substr(error + 7);
+        add_diagnostic(context, kind, line, text);
+    }
+}
+
+void scan(cparser_context* context) {
+    if (context->stage >= 1) return;
+    Scanner scanner;
+    scanner.scan(context->text);
+    context->stage = 1;
+    if (scanner.unterminated_comment_error) {
+        add_diagnostic(context, CPARSER_LEXICAL_ERROR, scanner.current_line, "Unterminated multi-line comment.");
+        return;
+    }
+    if (scanner.unexpected_char_error) {
+        add_diagnostic(context, CPARSER_LEXICAL_ERROR, scanner.current_line,
+                       string("Unexpected character '") + scanner.unexpected_char + "'.");
+        return;
+    }
+    context->scanned_ok = true;
+    context->tokens.swap(scanner.tokens);
+    context->token_views.reserve(context->tokens.size());
+    for (const Token& token : context->tokens) {
+        cparser_token view;
+        view.value = token.token_value.c_str();
+        view.kind = token.token_class.c_str();
+        view.line = token.line_number;
+        context->token_views.push_back(view);
+    }
+}
+
+void parse(cparser_context* context) {
+    scan(context);
+    if (context->stage >= 2) return;
+    context->stage = 2;
+    if (!context->scanned_ok) return;
+    ostringstream diagnostics;
+    Parser parser(context->tokens, false, diagnostics);
+    context->tree.reset(parser.parse());
+    add_report(context, CPARSER_SYNTAX_ERROR, diagnostics.str());
+}
+
+void check(cparser_context* context) {
+    parse(context);
+    if (context->stage >= 3) return;
+    context->stage = 3;
+    if (!context->tree) return;
+    ostringstream diagnostics;
+    IrModule module;
+    IrLowering(context->tree.get(), diagnostics).lower(module);
+    add_report(context, CPARSER_SEMANTIC_ERROR, diagnostics.str());
+}
+
+void forget_results(cparser_context* context) {
+    context->stage = 0;
+    context->scanned_ok = false;
+    context->tokens.clear();
+    context->token_views.clear();
+    context->tree.reset();
+    context->has_binary = false;
+    context->binary.clear();
+    context->messages.clear();
+    context->diagnostics.clear();
+}
+
+}  // namespace
+
+extern "C" {
+
+unsigned cparser_api_version(void) {
+    return CPARSER_API_VERSION;
+}
+
+cparser_context* cparser_create(void) {
+    return new (nothrow) cparser_context();
+}
+
+void cparser_free(cparser_context* context) {
+    delete context;
+}
+
+int cparser_feed(cparser_context* context, const char* data, size_t size) {
+    try {
+        forget_results(context);
+        context->text.append(data, size);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+void cparser_reset(cparser_context* context) {
+    forget_results(context);
+    string().swap(context->text);
+}
+
+const cparser_token* cparser_tokens(cparser_context* context, size_t* count) {
+    try {
+        scan(context);
+    } catch (...) {
+        forget_results(context);
+    }
+    *count = context->scanned_ok ? context->token_views.size() : 0;
+    return context->scanned_ok ? context->token_views.data() : nullptr;
+}
+
+const cparser_node* cparser_ast(cparser_context* context) {
+    try {
+        parse(context);
+        return as_c_node(context->tree.get());
+    } catch (...) {
+        forget_results(context);
+        return nullptr;
+    }
+}
+
+const char* cparser_ast_binary(cparser_context* context, size_t* size) {
+    *size = 0;
+    try {
+        parse(context);
+        if (!context->tree) return nullptr;
+        if (!context->has_binary) {
+            context->binary = ParseTreeWriter().write(context->tree.get());
+            context->has_binary = true;
+        }
+        *size = context->binary.size();
+        return context->binary.data();
+    } catch (...) {
+        forget_results(context);
+        return nullptr;
+    }
+}
+
+const char* cparser_node_type(const cparser_node* node) {
+    return as_parse_node(node)->type.c_str();
+}
+
+const char* cparser_node_value(const cparser_node* node) {
+    return as_parse_node(node)->value.c_str();
+}
+
+int cparser_node_line(const cparser_node* node) {
+    return as_parse_node(node)->line;
+}
+
+size_t cparser_node_child_count(const cparser_node* node) {
+    return as_parse_node(node)->children.size();
+}
+
+const cparser_node* cparser_node_child(const cparser_node* node, size_t index) {
+    const vector<ParseNode*>& children = as_parse_node(node)->children;
+    return index < children.size() ? as_c_node(children[index]) : nullptr;
+}
+
+size_t cparser_check(cparser_context* context) {
+    try {
+        check(context);
+    } catch (...) {
+        // Out of memory: report what was found before.
+    }
+    return context->diagnostics.size();
+}
+
+size_t cparser_diagnostic_count(cparser_context* context) {
+    return context->diagnostics.size();
+}
+
+const cparser_diagnostic* cparser_diagnostic_at(cparser_context* context, size_t index) {
+    return index < context->diagnostics.size() ? &context->diagnostics[index] : nullptr;
+}
+
+}  // extern "C"
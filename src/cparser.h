@@ -0,0 +1,102 @@
+#ifndef CPARSER_H
+#define CPARSER_H
+
+/*
+ * ===================================================================
+ * ===         EMBEDDING API (C ABI)                               ===
+ * ===================================================================
+ * The scanner, the parser and the semantic checks as a library, for C and
+ * C++ programs that want to parse source text without running the parser
+ * executable. Everything happens in memory: the caller feeds the text of
+ * one translation unit in as many pieces as it likes, then asks for the
+ * tokens, the parse tree or the diagnostics, each computed on first request
+ * and kept until the next feed or reset.
+ *
+ * A context is not thread-safe, but separate contexts can be used from
+ * separate threads at the same time. Every pointer a context returns stays
+ * valid until the next cparser_feed, cparser_reset or cparser_free on it.
+ * Strings are NUL-terminated UTF-8 (the bytes of the source).
+ *
+ * Build (see README): libcparser.a from cparser.cpp, or libcparser.so with
+ * -fPIC -shared and the version script cparser.map, which exports the
+ * functions below and nothing else.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define CPARSER_API __attribute__((visibility("default")))
+#else
+#define CPARSER_API
+#endif
+
+/* Incremented whenever a declaration below changes incompatibly. */
+#define CPARSER_API_VERSION 1
+
+typedef struct cparser_context cparser_context;
+typedef struct cparser_node cparser_node;
+
+typedef struct {
+    const char* value;   /* the lexeme */
+    const char* kind;    /* "KEYWORD", "IDENTIFIER", "NUMERIC CONSTANT", ... */
+    int line;            /* 1-based */
+} cparser_token;
+
+typedef enum {
+    CPARSER_LEXICAL_ERROR = 1,
+    CPARSER_SYNTAX_ERROR = 2,
+    CPARSER_SEMANTIC_ERROR = 3
+} cparser_diagnostic_kind;
+
+typedef struct {
+    cparser_diagnostic_kind kind;
+    int line;              /* 1-based; 0 for the end of the input */
+    const char* message;   /* without the "[Line N] ... Error:" prefix */
+} cparser_diagnostic;
+
+/* CPARSER_API_VERSION of the library actually loaded. */
+CPARSER_API unsigned cparser_api_version(void);
+
+/* A new, empty context; NULL if out of memory. */
+CPARSER_API cparser_context* cparser_create(void);
+CPARSER_API void cparser_free(cparser_context* context);
+
+/* Appends `size` bytes of source text; 0 on success, -1 if out of memory. */
+CPARSER_API int cparser_feed(cparser_context* context, const char* data, size_t size);
+/* Forgets the text and everything computed from it. */
+CPARSER_API void cparser_reset(cparser_context* context);
+
+/* The tokens of the text fed so far, `*count` of them; NULL (and 0) after a
+ * lexical error. */
+CPARSER_API const cparser_token* cparser_tokens(cparser_context* context, size_t* count);
+
+/* The root ("Program") of the parse tree; NULL after a lexical or syntax
+ * error. */
+CPARSER_API const cparser_node* cparser_ast(cparser_context* context);
+/* The tree in the binary form of --emit-ast, `*size` bytes; NULL without a
+ * tree. */
+CPARSER_API const char* cparser_ast_binary(cparser_context* context, size_t* size);
+
+CPARSER_API const char* cparser_node_type(const cparser_node* node);
+CPARSER_API const char* cparser_node_value(const cparser_node* node);
+CPARSER_API int cparser_node_line(const cparser_node* node);
+CPARSER_API size_t cparser_node_child_count(const cparser_node* node);
+/* NULL if `index` is out of range. */
+CPARSER_API const cparser_node* cparser_node_child(const cparser_node* node, size_t index);
+
+/* Runs every check (scanning, parsing, semantic analysis) and returns the
+ * number of diagnostics; 0 means the text is a valid program. */
+CPARSER_API size_t cparser_check(cparser_context* context);
+/* The diagnostics of the stages run so far, in order; NULL past the end. */
+CPARSER_API size_t cparser_diagnostic_count(cparser_context* context);
+CPARSER_API const cparser_diagnostic* cparser_diagnostic_at(cparser_context* context, size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef ELF_WRITER_H
+#define ELF_WRITER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "x86_64_encoder.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         ELF64 RELOCATABLE OBJECT WRITER                     ===
+// ===================================================================
+// Writes an encoded module as an ELF64 x86-64 relocatable object (`.o`) that
+// the system linker accepts like the output of `as`. The structures are
+// serialised by hand, field by field in little-endian order, so no system
+// header is needed.
+//
+// Layout: ELF header, section contents, section header table.
+//   1 .text   2 .data   3 .rodata   4 .symtab   5 .strtab   6 .rela.text
+//   7 .shstrtab   8 .note.GNU-stack (empty: the stack need not be executable)
+//
+// Symbols: the three section symbols (constants are addressed through the
+// .rodata one), then the global functions and variables, then the external
+// functions the code calls.
+
+class ElfObjectWriter {
+public:
+    ElfObjectWriter(const EncodedModule& module) : m_module(module) {}
+
+    vector<uint8_t> build() {
+        build_symbols();
+        vector<uint8_t> rela = build_relocations();
+
+        vector<uint8_t> out(kElfHeaderSize, 0);
+        vector<Section> sections(kSectionCount);
+        sections[kText] = place(out, ".text", kProgBits, kAlloc | kExecInstr, m_module.text, 16);
+        sections[kData] = place(out, ".data", kProgBits, kAlloc | kWrite, m_module.data, 8);
+        sections[kRodata] = place(out, ".rodata", kProgBits, kAlloc, m_module.rodata, 8);
+        sections[kSymtab] = place(out, ".symtab", kSymTab, 0, m_symtab, 8);
+        sections[kSymtab].link = kStrtab;
+        sections[kSymtab].info = m_first_global;
+        sections[kSymtab].entsize = kSymbolSize;
+        sections[kStrtab] = place(out, ".strtab", kStrTab, 0, m_strtab, 1);
+        sections[kRelaText] = place(out, ".rela.text", kRela, kInfoLink, rela, 8);
+        sections[kRelaText].link = kSymtab;
+        sections[kRelaText].info = kText;
+        sections[kRelaText].entsize = kRelaSize;
+        sections[kNoteStack] = place(out, ".note.GNU-stack", kProgBits, 0, vector<uint8_t>(), 1);
+        // .shstrtab last: it has to contain its own name.
+        uint32_t shstrtab_name = add_string(m_shstrtab, ".shstrtab");
+        sections[kShstrtab] = place(out, "", kStrTab, 0, m_shstrtab, 1);
+        sections[kShstrtab].name = shstrtab_name;
+
+        while (out.size() % 8 != 0) out.push_back(0);
+        uint64_t section_headers = out.size();
+        for (const Section& section : sections) write_section_header(out, section);
+        write_elf_header(out, section_headers);
+        return out;
+    }
+
+    bool write(FILE* file) {
+        vector<uint8_t> bytes = build();
+        return fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+
+private:
+    enum {
+        kNull, kText, kData, kRodata, kSymtab, kStrtab, kRelaText, kShstrtab, kNoteStack, kSectionCount
+    };
+    static const int kElfHeaderSize = 64;
+    static const int kSectionHeaderSize = 64;
+    static const int kSymbolSize = 24;
+    static const int kRelaSize = 24;
+    // Section types and flags.
+    static const uint32_t kProgBits = 1, kSymTab = 2, kStrTab = 3, kRela = 4;
+    static const uint64_t kWrite = 1, kAlloc = 2, kExecInstr = 4, kInfoLink = 0x40;
+    // Symbol binding and types.
+    static const int kLocal = 0, kGlobal = 1;
+    static const int kNoType = 0, kObject = 1, kFunc = 2, kSectionSym = 3;
+    // x86-64 relocation types.
+    static const uint32_t kPc32 = 2, kPlt32 = 4;
+
+    struct Section {
+        uint32_t name = 0;
+        uint32_t type = 0;
+        uint64_t flags = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t link = 0;
+        uint32_t info = 0;
+        uint64_t align = 0;
+        uint64_t entsize = 0;
+    };
+
+    const EncodedModule& m_module;
+    vector<uint8_t> m_symtab;
+    vector<uint8_t> m_strtab;
+    vector<uint8_t> m_shstrtab;
+    map<string, uint32_t> m_symbol_index;
+    uint32_t m_symbol_count = 0;
+    uint32_t m_first_global = 0;
+
+    static void put(vector<uint8_t>& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) out.push_back((uint8_t)(value >> (8 * i)));
+    }
+    static void put_at(vector<uint8_t>& out, size_t offset, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; ++i) out[offset + i] = (uint8_t)(value >> (8 * i));
+    }
+
+    static uint32_t add_string(vector<uint8_t>& table, const string& text) {
+        uint32_t offset = (uint32_t)table.size();
+        table.insert(table.end(), text.begin(), text.end());
+        table.push_back(0);
+        return offset;
+    }
+
+    Section place(vector<uint8_t>& out, const string& name, uint32_t type, uint64_t flags,
+                  const vector<uint8_t>& contents, uint64_t align) {
+        if (m_shstrtab.empty()) m_shstrtab.push_back(0);
+        Section section;
+        section.name = name.empty() ? 0 : add_string(m_shstrtab, name);
+        section.type = type;
+        section.flags = flags;
+        section.align = align;
+        while (out.size() % align != 0) out.push_back(0);
+        section.offset = out.size();
+        section.size = contents.size();
+        out.insert(out.end(), contents.begin(), contents.end());
+        return section;
+    }
+
+    void add_symbol(const string& name, int bind, int type, uint16_t section, uint64_t value, uint64_t size) {
+        uint32_t name_offset = name.empty() ? 0 : add_string(m_strtab, name);
+        put(m_symtab, name_offset, 4);
+        put(m_symtab, (uint64_t)((bind << 4) | type), 1);
+        put(m_symtab, 0, 1);
+        put(m_symtab, section, 2);
+        put(m_symtab, value, 8);
+        put(m_symtab, size, 8);
+        if (!name.empty()) m_symbol_index[name] = m_symbol_count;
+        m_symbol_count++;
+    }
+
+    void build_symbols() {
+        m_strtab.assign(1, 0);
+        add_symbol("", kLocal, kNoType, 0, 0, 0);
+        add_symbol("", kLocal, kSectionSym, kText, 0, 0);
+        add_symbol("", kLocal, kSectionSym, kData, 0, 0);
+        add_symbol("", kLocal, kSectionSym, kRodata, 0, 0);
+        m_first_global = m_symbol_count;
+        for (const EncodedSymbol& function : m_module.functions) {
+            add_symbol(function.name, kGlobal, kFunc, kText, function.offset, function.size);
+        }
+        for (const EncodedSymbol& global : m_module.globals) {
+            add_symbol(global.name, kGlobal, kObject, kData, global.offset, global.size);
+        }
+        for (const CodeRelocation& relocation : m_module.relocations) {
+            if (relocation.is_call && !m_symbol_index.count(relocation.symbol)) {
+                add_symbol(relocation.symbol, kGlobal, kNoType, 0, 0, 0);
+            }
+        }
+    }
+
+    vector<uint8_t> build_relocations() {
+        const uint32_t rodata_symbol = 3;
+        vector<uint8_t> rela;
+        for (const CodeRelocation& relocation : m_module.relocations) {
+            uint32_t symbol;
+            int64_t addend = relocation.addend;
+            if (const EncodedSymbol* constant = m_module.find(m_module.constants, relocation.symbol)) {
+                symbol = rodata_symbol;
+                addend += (int64_t)constant->offset;
+            } else {
+                symbol = m_symbol_index[relocation.symbol];
+            }
+            put(rela, relocation.offset, 8);
+            put(rela, ((uint64_t)symbol << 32) | (relocation.is_call ? kPlt32 : kPc32), 8);
+            put(rela, (uint64_t)addend, 8);
+        }
+        return rela;
+    }
+
+    static void write_section_header(vector<uint8_t>& out, const Section& section) {
+        put(out, section.name, 4);
+        put(out, section.type, 4);
+        put(out, section.flags, 8);
+        put(out, 0, 8);                 // sh_addr
+        put(out, section.offset, 8);
+        put(out, section.size, 8);
+        put(out, section.link, 4);
+        put(out, section.info, 4);
+        put(out, section.align, 8);
+        put(out, section.entsize, 8);
+    }
+
+    static void write_elf_header(vector<uint8_t>& out, uint64_t section_headers) {
+        static const uint8_t ident[16] = {0x7f, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* little endian */,
+                                          1 /* version */, 0 /* System V ABI */};
+        for (int i = 0; i < 16; ++i) out[i] = ident[i];
+        put_at(out, 16, 1, 2);                     // e_type: ET_REL
+        put_at(out, 18, 62, 2);                    // e_machine: EM_X86_64
+        put_at(out, 20, 1, 4);                     // e_version
+        put_at(out, 24, 0, 8);                     // e_entry
+        put_at(out, 32, 0, 8);                     // e_phoff
+        put_at(out, 40, section_headers, 8);       // e_shoff
+        put_at(out, 48, 0, 4);                     // e_flags
+        put_at(out, 52, kElfHeaderSize, 2);        // e_ehsize
+        put_at(out, 54, 0, 2);                     // e_phentsize
+        put_at(out, 56, 0, 2);                     // e_phnum
+        put_at(out, 58, kSectionHeaderSize, 2);    // e_shentsize
+        put_at(out, 60, kSectionCount, 2);         // e_shnum
+        put_at(out, 62, kShstrtab, 2);             // e_shstrndx
+    }
+};
+
+#endif
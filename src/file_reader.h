@@ -0,0 +1,494 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+// ===================================================================
+// ===         BATCH FILE READING                                  ===
+// ===================================================================
+// Reads the files of a batch on a background thread, in the order the
+// workers will scan them, so that a scan task finds its text in memory. With
+// tens of thousands of small files the open/read/close system calls cost
+// more than scanning; io_uring submits them in batches instead, keeping up
+// to kReadsInFlight files in flight: an open, then a read into a registered
+// buffer from a pool (or straight into the text for files larger than a
+// buffer), then a close whose completion nobody waits for. Where io_uring is
+// missing or refused (older kernels, seccomp filters in containers) the
+// thread reads with pread, and keeps the next kPrefetchFiles files open with
+// posix_fadvise(WILLNEED) so the kernel reads them from disk while it copies
+// the current one and the workers scan the ones before.
+//
+// Either way the texts read ahead stay within a memory budget and at most
+// kReadAheadFiles ahead of the files the workers have taken. Workers give
+// the texts back when they have scanned them, and the reader reuses their
+// memory for the next files instead of allocating it again.
+
+const unsigned kReadsInFlight = 64;
+const unsigned kReadRingEntries = 256;      // > kReadsInFlight opens/reads plus their closes
+const unsigned kReadAheadFiles = 256;
+const size_t kReadBufferBytes = 64 * 1024;
+const unsigned kPrefetchFiles = 16;
+const size_t kReadAheadBytes = 64u << 20;   // default budget of texts read but not taken
+const size_t kMaxReadBytes = 1u << 30;      // per read operation; the rest is read on
+const unsigned kPooledTexts = 64;
+
+enum class ReadMethod { IoUring, Pread };
+
+// Reads the whole file, growing past `expected_size` if it has grown.
+inline bool pread_file(int fd, string& text, size_t expected_size, size_t already_read = 0) {
+    text.resize(max(expected_size + 1, already_read + 1));
+    size_t size = already_read;
+    for (;;) {
+        if (size == text.size()) text.resize(text.size() * 2);
+        ssize_t got = pread(fd, &text[size], text.size() - size, size);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return false;
+        if (got == 0) break;
+        size += got;
+    }
+    text.resize(size);
+    return true;
+}
+
+inline bool read_file_with_pread(const string& path, string& text, size_t expected_size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = pread_file(fd, text, expected_size);
+    close(fd);
+    return ok;
+}
+
+// --- IO_URING ---
+
+// The submission and completion rings, through the raw system calls.
+class IoUring {
+public:
+    ~IoUring() {
+        if (m_sqes) munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring && m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring) munmap(m_sq_ring, m_sq_ring_size);
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (m_fd < 0) return false;
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) m_sq_ring_size = m_cq_ring_size = max(m_sq_ring_size, m_cq_ring_size);
+        m_sq_ring = map_ring(m_sq_ring_size, IORING_OFF_SQ_RING);
+        if (!m_sq_ring) return false;
+        m_cq_ring = single_mmap ? m_sq_ring : map_ring(m_cq_ring_size, IORING_OFF_CQ_RING);
+        if (!m_cq_ring) return false;
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe*)map_ring(m_sqes_size, IORING_OFF_SQES);
+        if (!m_sqes) return false;
+
+        char* sq = (char*)m_sq_ring;
+        m_sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        m_sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        m_sq_array = (unsigned*)(sq + params.sq_off.array);
+        char* cq = (char*)m_cq_ring;
+        m_cq_head = (unsigned*)(cq + params.cq_off.head);
+        m_cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        m_cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool register_buffers(const vector<iovec>& buffers) {
+        return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers.data(),
+                       (unsigned)buffers.size()) == 0;
+    }
+
+    // A cleared submission entry; it is submitted by the next enter().
+    io_uring_sqe* next_sqe() {
+        unsigned tail = *m_sq_tail + m_queued;
+        unsigned index = tail & m_sq_mask;
+        m_sq_array[index] = index;
+        m_queued++;
+        io_uring_sqe* sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Submits the queued entries and waits for `wait_for` completions.
+    bool enter(unsigned wait_for) {
+        __atomic_store_n(m_sq_tail, *m_sq_tail + m_queued, __ATOMIC_RELEASE);
+        unsigned submit = m_queued;
+        m_queued = 0;
+        for (;;) {
+            long result = syscall(__NR_io_uring_enter, m_fd, submit, wait_for,
+                                  wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) return true;
+            if (errno != EINTR) return false;
+            submit = 0;   // an interrupted call has consumed the entries already
+        }
+    }
+
+    bool pop(io_uring_cqe& cqe) {
+        unsigned head = *m_cq_head;
+        if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) return false;
+        cqe = m_cqes[head & m_cq_mask];
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    int m_fd = -1;
+    void* m_sq_ring = nullptr;
+    void* m_cq_ring = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sq_ring_size = 0, m_cq_ring_size = 0, m_sqes_size = 0;
+    unsigned* m_sq_tail = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned* m_sq_array = nullptr;
+    unsigned* m_cq_head = nullptr;
+    unsigned* m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+    unsigned m_queued = 0;
+
+    void* map_ring(size_t size, off_t offset) {
+        void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+};
+
+// --- THE READER ---
+
+struct ReadRequest {
+    string path;
+    size_t expected_size = 0;   // from stat; the file may have changed since
+};
+
+class BatchReader {
+public:
+    // Starts reading `requests` in order; take() hands out their texts. A
+    // file larger than `budget` is still read, once nothing else is waiting.
+    BatchReader(vector<ReadRequest> requests, ReadMethod method, size_t budget = kReadAheadBytes)
+        : m_requests(move(requests)), m_files(m_requests.size()), m_method(method), m_budget(budget) {
+        m_thread = thread(&BatchReader::read_all, this);
+    }
+
+    ~BatchReader() {
+        {
+            lock_guard<mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_changed.notify_all();
+        m_thread.join();
+    }
+
+    // How the files are read: io_uring may turn out to be unavailable.
+    ReadMethod method() {
+        unique_lock<mutex> lock(m_lock);
+        m_changed.wait(lock, [this]() { return m_method_known; });
+        return m_method;
+    }
+
+    // Waits for request `index` and moves its text to `text`; false if the
+    // file could not be read. Each request is taken once.
+    bool take(size_t index, string& text) {
+        unique_lock<mutex> lock(m_lock);
+        m_changed.wait(lock, [this, index]() { return m_files[index].done; });
+        text.swap(m_files[index].text);
+        m_taken++;
+        m_buffered -= m_files[index].reserved;
+        m_files[index].reserved = 0;
+        lock.unlock();
+        m_changed.notify_all();
+        return m_files[index].ok;
+    }
+
+    // Hands back a text that take() returned, once it is no longer needed.
+    void give_back(string& text) {
+        lock_guard<mutex> lock(m_lock);
+        if (m_pool.size() < kPooledTexts && text.capacity() <= m_budget / kPooledTexts) {
+            m_pool.push_back(string());
+            m_pool.back().swap(text);
+        }
+    }
+
+private:
+    struct FileState {
+        bool done = false;
+        bool ok = false;
+        size_t reserved = 0;   // bytes of the budget held until it is taken
+        string text;
+    };
+
+    // What the io_uring loop knows of a file in flight.
+    struct Flight {
+        int fd = -1;
+        int buffer = -1;          // registered buffer, or -1 for a read into `text`
+        size_t requested = 0;
+        string text;
+    };
+    enum Stage : uint64_t { Opening = 0, Reading = 1, Closing = 2 };
+
+    vector<ReadRequest> m_requests;
+    vector<FileState> m_files;
+    ReadMethod m_method;
+    bool m_method_known = false;
+    mutex m_lock;
+    condition_variable m_changed;
+    size_t m_budget;
+    size_t m_buffered = 0;   // bytes reserved by files read ahead
+    size_t m_taken = 0;
+    vector<string> m_pool;   // texts given back, their memory to be reused
+    bool m_stopping = false;
+    thread m_thread;
+
+    void finish(size_t index, bool ok, string& text) {
+        {
+            lock_guard<mutex> lock(m_lock);
+            m_files[index].ok = ok;
+            m_files[index].text.swap(text);
+            m_files[index].done = true;
+        }
+        m_changed.notify_all();
+    }
+
+    // Waits until reading request `next` stays within kReadAheadFiles of the
+    // files taken and within the budget, and reserves its size; false when
+    // there is no room and `may_block` is not set, or when the reader is
+    // being destroyed.
+    bool wait_for_room(size_t next, bool may_block) {
+        unique_lock<mutex> lock(m_lock);
+        FileState& file = m_files[next];
+        size_t size = m_requests[next].expected_size + 1;
+        auto room = [this, next, size, &file]() {
+            return file.reserved > 0 ||
+                   (next - m_taken < kReadAheadFiles && (m_buffered == 0 || m_buffered + size <= m_budget));
+        };
+        if (may_block) m_changed.wait(lock, [this, &room]() { return m_stopping || room(); });
+        if (m_stopping || !room()) return false;
+        if (file.reserved == 0) {
+            file.reserved = size;
+            m_buffered += size;
+        }
+        return true;
+    }
+
+    // An empty string, with memory of a text given back if there is one.
+    string pooled_text(size_t size) {
+        lock_guard<mutex> lock(m_lock);
+        string text;
+        for (size_t i = 0; i < m_pool.size(); ++i) {
+            if (m_pool[i].capacity() < size) continue;
+            text.swap(m_pool[i]);
+            m_pool[i].swap(m_pool.back());
+            m_pool.pop_back();
+            break;
+        }
+        text.clear();
+        return text;
+    }
+
+    void set_method(ReadMethod method) {
+        {
+            lock_guard<mutex> lock(m_lock);
+            if (m_method_known) return;
+            m_method = method;
+            m_method_known = true;
+        }
+        m_changed.notify_all();
+    }
+
+    void read_all() {
+        if (m_method == ReadMethod::IoUring && read_with_io_uring()) return;
+        set_method(ReadMethod::Pread);
+        read_with_pread();
+    }
+
+    // Reads the files not done yet with pread. The next kPrefetchFiles files
+    // are open already, advised as needed soon.
+    void read_with_pread() {
+        deque<pair<size_t, int>> prefetched;   // request, descriptor
+        size_t next_prefetch = 0;
+        for (size_t next = 0; next < m_requests.size(); ++next) {
+            if (m_files[next].done) continue;   // io_uring read this one
+            if (!wait_for_room(next, true)) break;
+            next_prefetch = max(next_prefetch, next + 1);
+            while (next_prefetch < m_requests.size() && next_prefetch <= next + kPrefetchFiles) {
+                if (!m_files[next_prefetch].done) {
+                    int fd = open(m_requests[next_prefetch].path.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                    prefetched.push_back(make_pair(next_prefetch, fd));
+                }
+                next_prefetch++;
+            }
+            int fd = -1;
+            if (!prefetched.empty() && prefetched.front().first == next) {
+                fd = prefetched.front().second;
+                prefetched.pop_front();
+            } else {
+                fd = open(m_requests[next].path.c_str(), O_RDONLY | O_CLOEXEC);
+            }
+            size_t expected_size = m_requests[next].expected_size;
+            string text = pooled_text(expected_size + 1);
+            bool ok = fd >= 0 && pread_file(fd, text, expected_size);
+            if (fd >= 0) close(fd);
+            finish(next, ok, text);
+        }
+        for (const pair<size_t, int>& file : prefetched) {
+            if (file.second >= 0) close(file.second);
+        }
+    }
+
+    // Reads everything through io_uring; false if the kernel does not offer
+    // it or the ring fails, with the files not read yet left to pread.
+    bool read_with_io_uring() {
+        IoUring ring;
+        if (!ring.setup(kReadRingEntries)) return false;
+        vector<iovec> buffers(kReadsInFlight);
+        char* pool = nullptr;
+        if (posix_memalign((void**)&pool, 4096, kReadsInFlight * kReadBufferBytes) != 0) return false;
+        for (unsigned i = 0; i < kReadsInFlight; ++i) buffers[i] = {pool + i * kReadBufferBytes, kReadBufferBytes};
+        bool registered = ring.register_buffers(buffers);
+        vector<int> free_buffers;
+        if (registered) {
+            for (unsigned i = 0; i < kReadsInFlight; ++i) free_buffers.push_back(i);
+        }
+        set_method(ReadMethod::IoUring);
+
+        // On the heap, so that it can be left to the kernel along with the
+        // pool if the ring fails with reads in flight.
+        unique_ptr<vector<Flight>> flight_table(new vector<Flight>(m_requests.size()));
+        vector<Flight>& flights = *flight_table;
+        size_t next = 0;
+        unsigned files_in_flight = 0, operations = 0;
+        auto user_data = [](size_t index, Stage stage) { return (uint64_t)index << 2 | stage; };
+        auto fail_over = [&](size_t index) {
+            // Any operation io_uring refuses is retried the plain way.
+            Flight& flight = flights[index];
+            if (flight.buffer >= 0) free_buffers.push_back(flight.buffer);
+            flight.buffer = -1;
+            string text;
+            bool ok = flight.fd >= 0 ? pread_file(flight.fd, text, m_requests[index].expected_size)
+                                     : read_file_with_pread(m_requests[index].path, text,
+                                                            m_requests[index].expected_size);
+            if (flight.fd >= 0) close(flight.fd);
+            flight = Flight();
+            files_in_flight--;
+            finish(index, ok, text);
+        };
+
+        for (;;) {
+            while (next < m_requests.size() && files_in_flight < kReadsInFlight && operations < kReadRingEntries &&
+                   wait_for_room(next, files_in_flight == 0 && operations == 0)) {
+                io_uring_sqe* sqe = ring.next_sqe();
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t)(uintptr_t)m_requests[next].path.c_str();
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                sqe->user_data = user_data(next, Opening);
+                next++;
+                files_in_flight++;
+                operations++;
+            }
+            if (operations == 0) break;   // all read, or the reader is stopping
+            if (!ring.enter(1)) {
+                // The kernel may still write into the pool and the texts in
+                // flight: leave them be and let the plain reader do the
+                // files that are not done.
+                flight_table.release();
+                return false;
+            }
+            io_uring_cqe cqe;
+            while (ring.pop(cqe)) {
+                operations--;
+                size_t index = cqe.user_data >> 2;
+                Stage stage = (Stage)(cqe.user_data & 3);
+                Flight& flight = flights[index];
+                if (stage == Closing) continue;
+                if (cqe.res < 0) {
+                    if (stage == Opening && (cqe.res == -ENOENT || cqe.res == -EACCES || cqe.res == -EISDIR)) {
+                        string none;
+                        files_in_flight--;
+                        finish(index, false, none);
+                    } else {
+                        fail_over(index);
+                    }
+                    continue;
+                }
+                if (stage == Opening) {
+                    flight.fd = cqe.res;
+                    // One byte more than expected shows whether the file grew.
+                    flight.requested = min(m_requests[index].expected_size + 1, kMaxReadBytes);
+                    io_uring_sqe* sqe = ring.next_sqe();
+                    sqe->fd = flight.fd;
+                    sqe->len = (unsigned)flight.requested;
+                    sqe->user_data = user_data(index, Reading);
+                    if (flight.requested <= kReadBufferBytes && !free_buffers.empty()) {
+                        flight.buffer = free_buffers.back();
+                        free_buffers.pop_back();
+                        sqe->opcode = IORING_OP_READ_FIXED;
+                        sqe->addr = (uint64_t)(uintptr_t)buffers[flight.buffer].iov_base;
+                        sqe->buf_index = (uint16_t)flight.buffer;
+                    } else {
+                        flight.text = pooled_text(flight.requested);
+                        flight.text.resize(flight.requested);
+                        sqe->opcode = IORING_OP_READ;
+                        sqe->addr = (uint64_t)(uintptr_t)&flight.text[0];
+                    }
+                    operations++;
+                    continue;
+                }
+                // Reading.
+                size_t got = cqe.res;
+                if (flight.buffer >= 0) {
+                    flight.text = pooled_text(got);
+                    flight.text.assign((const char*)buffers[flight.buffer].iov_base, got);
+                    free_buffers.push_back(flight.buffer);
+                    flight.buffer = -1;
+                } else {
+                    flight.text.resize(got);
+                }
+                // A read can come back short without being at the end (the
+                // file grew, the length was clamped, the kernel split it):
+                // only a read of nothing is. The rest is read with pread.
+                size_t expected_size = max(m_requests[index].expected_size, got);
+                bool ok = got == 0 || pread_file(flight.fd, flight.text, expected_size, got);
+                io_uring_sqe* sqe = ring.next_sqe();
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = flight.fd;
+                sqe->user_data = user_data(index, Closing);
+                operations++;
+                files_in_flight--;
+                string text;
+                text.swap(flight.text);
+                flight = Flight();
+                finish(index, ok, text);
+            }
+        }
+        free(pool);
+        return true;
+    }
+};
+
+#endif
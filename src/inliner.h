@@ -0,0 +1,261 @@
+#ifndef INLINER_H
+#define INLINER_H
+
+#include <algorithm>
+#include <vector>
+#include "ir.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         FUNCTION INLINING                                   ===
+// ===================================================================
+// Bottom-up inliner over the call graph. The strongly connected components of
+// the call graph are visited callees-first (the order Tarjan's algorithm
+// produces them in), so a callee has already received its own inlining by the
+// time its size is measured for a caller. Calls between functions of the same
+// component (direct or mutual recursion) are never inlined, and neither is a
+// recursive callee, which keeps the pass terminating.
+//
+// Cost model: a call site is inlined when
+//     callee_size - benefit <= threshold
+// where the benefit rewards what disappears or becomes cheaper once the body
+// is pasted in: the call itself plus argument and result moves, constant
+// arguments, and call sites inside loops (scaled by nesting depth). Callers are
+// not allowed to grow past a fixed multiple of their original size.
+
+class Inliner {
+public:
+    static const int kThreshold = 12;          // net size a call site may add
+    static const int kCallOverhead = 4;        // call/ret, frame setup, result move
+    static const int kArgumentBonus = 1;       // each argument move that disappears
+    static const int kConstantArgumentBonus = 2;
+    static const int kLoopDepthBonus = 8;      // per level of loop nesting, capped below
+    static const int kMaxLoopDepthBonus = 3;
+    static const int kMaxCallerGrowth = 4;     // caller may grow to 4x its size (+ threshold)
+
+    Inliner(IrModule& module) : m_module(module) {}
+
+    // Returns the number of call sites that were inlined.
+    int run() {
+        build_call_graph();
+        compute_components();
+        int inlined = 0;
+        for (const vector<int>& component : m_components) {
+            for (int fn : component) {
+                inlined += inline_calls_in(fn);
+            }
+        }
+        return inlined;
+    }
+
+private:
+    IrModule& m_module;
+    vector<vector<int>> m_callees;     // call graph edges between defined functions
+    vector<int> m_component_of;
+    vector<vector<int>> m_components;  // in callees-first order
+    vector<bool> m_recursive;          // per component: contains a call cycle
+
+    int index_of(const string& name) {
+        for (size_t i = 0; i < m_module.functions.size(); ++i) {
+            if (m_module.functions[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+
+    void build_call_graph() {
+        m_callees.assign(m_module.functions.size(), vector<int>());
+        for (size_t i = 0; i < m_module.functions.size(); ++i) {
+            for (const IrBlock& block : m_module.functions[i].blocks) {
+                for (const IrInst& inst : block.insts) {
+                    if (inst.op != IrOp::Call) continue;
+                    int callee = index_of(inst.symbol);
+                    if (callee >= 0 && m_module.functions[callee].defined) m_callees[i].push_back(callee);
+                }
+            }
+        }
+    }
+
+    // --- TARJAN'S STRONGLY CONNECTED COMPONENTS ---
+    struct TarjanState {
+        vector<int> index, lowlink, stack;
+        vector<bool> on_stack;
+        int next_index = 0;
+    };
+
+    void compute_components() {
+        size_t n = m_module.functions.size();
+        TarjanState state;
+        state.index.assign(n, -1);
+        state.lowlink.assign(n, 0);
+        state.on_stack.assign(n, false);
+        m_component_of.assign(n, -1);
+        m_components.clear();
+        m_recursive.clear();
+        for (size_t i = 0; i < n; ++i) {
+            if (state.index[i] < 0) strong_connect((int)i, state);
+        }
+    }
+
+    void strong_connect(int v, TarjanState& state) {
+        state.index[v] = state.lowlink[v] = state.next_index++;
+        state.stack.push_back(v);
+        state.on_stack[v] = true;
+        for (int w : m_callees[v]) {
+            if (state.index[w] < 0) {
+                strong_connect(w, state);
+                state.lowlink[v] = min(state.lowlink[v], state.lowlink[w]);
+            } else if (state.on_stack[w]) {
+                state.lowlink[v] = min(state.lowlink[v], state.index[w]);
+            }
+        }
+        if (state.lowlink[v] == state.index[v]) {
+            vector<int> component;
+            int w;
+            do {
+                w = state.stack.back();
+                state.stack.pop_back();
+                state.on_stack[w] = false;
+                m_component_of[w] = (int)m_components.size();
+                component.push_back(w);
+            } while (w != v);
+            bool self_call = find(m_callees[v].begin(), m_callees[v].end(), v) != m_callees[v].end();
+            m_recursive.push_back(component.size() > 1 || self_call);
+            m_components.push_back(component);
+        }
+    }
+
+    // --- COST MODEL ---
+    bool should_inline(const IrFunction& caller, const IrInst& call, int loop_depth,
+                       const IrFunction& callee, int caller_budget) {
+        int callee_size = instruction_count(callee);
+        int benefit = kCallOverhead + kArgumentBonus * (int)call.args.size();
+        for (int arg : call.args) {
+            if (is_constant_vreg(caller, arg)) benefit += kConstantArgumentBonus;
+        }
+        benefit += kLoopDepthBonus * min(loop_depth, (int)kMaxLoopDepthBonus);
+        if (callee_size - benefit > kThreshold) return false;
+        return instruction_count(caller) + callee_size <= caller_budget;
+    }
+
+    // Loop depth of the call site, or with a profile the equivalent measured
+    // one: how often the block runs per call of the caller, counted in powers
+    // of ten (a loop level is weighted as ten iterations elsewhere, too).
+    static int call_site_depth(const IrFunction& caller, const IrBlock& block) {
+        long long entries = caller.blocks[0].exec_count;
+        if (block.exec_count < 0 || entries <= 0) return block.loop_depth;
+        int depth = 0;
+        for (long long runs = block.exec_count / entries; runs >= 10 && depth < kMaxLoopDepthBonus; runs /= 10) depth++;
+        return depth;
+    }
+
+    // True when the vreg has a single definition and that is a constant.
+    static bool is_constant_vreg(const IrFunction& function, int vreg) {
+        int definitions = 0;
+        bool constant = false;
+        for (const IrBlock& block : function.blocks) {
+            for (const IrInst& inst : block.insts) {
+                if (inst.dest != vreg) continue;
+                definitions++;
+                constant = inst.op == IrOp::Const || inst.op == IrOp::FConst;
+            }
+        }
+        return definitions == 1 && constant;
+    }
+
+    // --- THE TRANSFORMATION ---
+    int inline_calls_in(int caller_index) {
+        if (!m_module.functions[caller_index].defined) return 0;
+        int budget = kMaxCallerGrowth * instruction_count(m_module.functions[caller_index]) + kThreshold;
+        int inlined = 0;
+        // Blocks appended by inlining are scanned as well, so calls the callee
+        // kept may still be inlined here (e.g. thanks to this call site's loop
+        // depth). Only non-recursive callees qualify and the budget bounds the
+        // growth, so this terminates.
+        for (size_t b = 0; b < m_module.functions[caller_index].blocks.size(); ++b) {
+            for (size_t i = 0; i < m_module.functions[caller_index].blocks[b].insts.size(); ++i) {
+                IrFunction& caller = m_module.functions[caller_index];
+                const IrInst& inst = caller.blocks[b].insts[i];
+                if (inst.op != IrOp::Call) continue;
+                int callee_index = index_of(inst.symbol);
+                if (callee_index < 0 || !m_module.functions[callee_index].defined) continue;
+                // Never inline within a cycle, nor a recursive callee: pasting its
+                // body would only expose the same call again.
+                if (m_component_of[callee_index] == m_component_of[caller_index]) continue;
+                if (m_recursive[m_component_of[callee_index]]) continue;
+                // A call site the profile run never reached is not worth the growth.
+                if (caller.blocks[b].exec_count == 0) continue;
+                const IrFunction& callee = m_module.functions[callee_index];
+                if (!should_inline(caller, inst, call_site_depth(caller, caller.blocks[b]), callee, budget)) continue;
+                inline_call(caller, (int)b, (int)i, callee);
+                inlined++;
+                break; // the rest of this block moved to the continuation block
+            }
+        }
+        if (inlined) simplify_cfg(m_module.functions[caller_index]);
+        return inlined;
+    }
+
+    static long long scale_count(long long count, long long site_count, long long callee_entries) {
+        if (count < 0 || site_count < 0 || callee_entries <= 0) return -1;
+        return (long long)((double)count * site_count / callee_entries);
+    }
+
+    // Splits the caller's block at the call, pastes a renamed copy of the
+    // callee's blocks in between and wires parameters and returns up with copies.
+    static void inline_call(IrFunction& caller, int block_index, int inst_index, const IrFunction& callee) {
+        IrInst call = caller.blocks[block_index].insts[inst_index];
+        int depth = caller.blocks[block_index].loop_depth;
+
+        int continuation = caller.new_block(depth);
+        IrBlock& split = caller.blocks[block_index];
+        caller.blocks[continuation].exec_count = split.exec_count;
+        caller.blocks[continuation].insts.assign(split.insts.begin() + inst_index + 1, split.insts.end());
+        split.insts.erase(split.insts.begin() + inst_index, split.insts.end());
+
+        vector<int> vreg_map(callee.vreg_types.size());
+        for (size_t v = 0; v < callee.vreg_types.size(); ++v) {
+            vreg_map[v] = caller.new_vreg(callee.vreg_types[v]);
+        }
+        int block_offset = (int)caller.blocks.size();
+        for (size_t p = 0; p < callee.params.size(); ++p) {
+            IrInst copy(IrOp::Copy, callee.vreg_types[callee.params[p]]);
+            copy.dest = vreg_map[callee.params[p]];
+            copy.a = call.args[p];
+            caller.blocks[block_index].insts.push_back(copy);
+        }
+        IrInst enter(IrOp::Jump);
+        enter.target = block_offset;
+        caller.blocks[block_index].insts.push_back(enter);
+
+        // Profile counts of the copy: the callee's, scaled to this call site.
+        long long site_count = caller.blocks[block_index].exec_count;
+        long long callee_entries = callee.blocks[0].exec_count;
+        for (const IrBlock& source : callee.blocks) {
+            int id = caller.new_block(depth + source.loop_depth);
+            IrBlock& copy = caller.blocks[id];
+            copy.exec_count = scale_count(source.exec_count, site_count, callee_entries);
+            for (IrInst inst : source.insts) {
+                inst.taken_count = scale_count(inst.taken_count, site_count, callee_entries);
+                if (inst.dest >= 0) inst.dest = vreg_map[inst.dest];
+                if (inst.a >= 0) inst.a = vreg_map[inst.a];
+                if (inst.b >= 0) inst.b = vreg_map[inst.b];
+                for (int& arg : inst.args) arg = vreg_map[arg];
+                for_each_target(inst, [&](int& target) { target += block_offset; });
+                if (inst.op == IrOp::Ret) {
+                    if (call.dest >= 0 && inst.a >= 0) {
+                        IrInst result(IrOp::Copy, caller.vreg_types[call.dest]);
+                        result.dest = call.dest;
+                        result.a = inst.a;
+                        copy.insts.push_back(result);
+                    }
+                    inst = IrInst(IrOp::Jump);
+                    inst.target = continuation;
+                }
+                copy.insts.push_back(inst);
+            }
+        }
+    }
+};
+
+#endif
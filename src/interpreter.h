@@ -0,0 +1,885 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ir.h"
+#include "native_call.h"
+#include "parse_tree.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         TREE-WALKING INTERPRETER                            ===
+// ===================================================================
+// Runs the program straight from the parse tree, without the IR or any
+// optimisation, as a baseline for benchmarks and a reference for the other
+// engines. It follows the same language rules as IrLowering: int, char,
+// float and double with the usual arithmetic conversions, char values kept
+// sign-extended, uninitialised locals reading as zero, and non-void functions
+// returning 0 when they fall off the end.
+//
+// An analysis pass first checks the tree and turns it into ExecNodes in which
+// every name is already resolved: locals to a slot of the function's frame,
+// globals to an index, calls to a function, and every implicit conversion is
+// a node of its own. Execution then never looks at a string.
+
+class TreeInterpreter {
+    struct ExecNode;
+
+public:
+    struct Function {
+        string name;
+        IrType return_type = IrType::Void;
+        vector<IrType> param_types;
+        bool defined = false;
+        int num_slots = 0;
+        const ExecNode* body = nullptr;
+        void* native = nullptr;       // address of an external function, after load()
+    };
+
+    TreeInterpreter(const ParseNode* program) : m_program(program) {}
+
+    // Checks the program and resolves its names. The first error is reported
+    // on cerr (as by IrLowering) and makes it return false.
+    bool analyse() {
+        try {
+            analyse_program();
+            return true;
+        } catch (const runtime_error& e) {
+            return false;
+        }
+    }
+
+    // Resolves the functions that are declared but not defined.
+    bool load(string& error) {
+        for (Function& function : m_functions) {
+            if (function.defined) continue;
+            function.native = find_native_function(function.name);
+            if (!function.native) {
+                error = "undefined reference to '" + function.name + "'";
+                return false;
+            }
+            if (!native_signature_supported(function.param_types)) {
+                error = "cannot call external function '" + function.name + "' from the interpreter";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const Function* find_function(const string& name) const {
+        auto it = m_function_index.find(name);
+        return it == m_function_index.end() ? nullptr : &m_functions[it->second];
+    }
+
+    // Runs the function `name`, which takes no arguments. Returns false with a
+    // message in `error` when the program fails at run time.
+    bool run(const string& name, RuntimeValue& result, string& error) {
+        const Function* function = find_function(name);
+        if (!function || !function->defined) {
+            error = "no function '" + name + "'";
+            return false;
+        }
+        m_stack.assign(kStackSlots, RuntimeValue());
+        m_top = function->num_slots;
+        char marker;
+        m_native_stack_base = (uintptr_t)&marker;
+        try {
+            result = invoke(*function, 0);
+            return true;
+        } catch (const runtime_error& e) {
+            error = e.what();
+            return false;
+        }
+    }
+
+private:
+    enum class Kind {
+        // Expressions
+        Constant, Local, Global, AssignLocal, AssignGlobal, Convert, Binary, Call,
+        // Statements
+        Block, Expression, Declare, If, For, While, DoWhile, Switch, Break, Continue, Label, Goto, Return, Empty
+    };
+
+    struct ExecNode {
+        Kind kind;
+        IrType type = IrType::Void;      // type of the value (Int, Float, Double or Void)
+        IrType to = IrType::Void;        // Convert: declared target type (Char truncates)
+        IrOp op = IrOp::Add;             // Binary
+        int index = -1;                  // slot, global, function or label; Switch: the default's child
+        RuntimeValue constant;
+        vector<const ExecNode*> children;
+        map<int, int> cases;             // Switch: case value -> child the case starts at
+        int first_label = 0;             // statements: the labels defined in them are
+        int end_label = 0;               // [first_label, end_label), in the order defined
+
+        ExecNode(Kind kind_) : kind(kind_) { constant.bits = 0; }
+    };
+
+    struct Local {
+        int slot;
+        IrType type;
+        bool is_const;
+    };
+    struct Global {
+        string name;
+        IrType type;
+        bool is_const;
+    };
+
+    // Goto leaves statements until one contains the label (m_goto), which
+    // then runs again from the label on.
+    enum class Flow { Normal, Break, Continue, Goto, Return };
+
+    static const size_t kStackSlots = 1 << 20;
+    // Interpreted calls nest on the C++ stack, so the part of it they may use
+    // is bounded well below the usual size of the main thread's stack (8 MiB
+    // on Linux and macOS, 1 MiB on Windows).
+#if defined(_WIN32)
+    static const size_t kNativeStackBudget = 512 << 10;
+#else
+    static const size_t kNativeStackBudget = 4 << 20;
+#endif
+
+    const ParseNode* m_program;
+    deque<ExecNode> m_nodes;                 // owns every ExecNode (addresses are stable)
+    vector<Function> m_functions;
+    map<string, int> m_function_index;
+    vector<Global> m_globals;
+    vector<RuntimeValue> m_global_values;
+    map<string, int> m_global_index;
+
+    // Analysis state.
+    vector<map<string, Local>> m_scopes;
+    Function* m_function = nullptr;
+    int m_breakable = 0;                     // loops and switches around the statement being analysed
+    int m_loops = 0;                         // loops around it
+    map<string, int> m_labels;               // label -> its place in the order labels are defined
+    map<string, int> m_label_uses;           // label -> line of its first goto
+    vector<pair<ExecNode*, string>> m_gotos; // resolved at the end of the function
+
+    // Execution state.
+    int m_goto = -1;                         // the label a Goto flow is looking for
+    int m_seek = -1;                         // the label execution resumes at, while entering statements
+    vector<RuntimeValue> m_stack;
+    size_t m_top = 0;                        // first free stack slot
+    uintptr_t m_native_stack_base = 0;       // C++ stack address when run() started
+
+    // ---------------------------------------------------------------
+    // ANALYSIS
+    // ---------------------------------------------------------------
+
+    void report_error(int line, const string& message) {
+        cerr << "[Line " << line << "] Semantic Error: " << message << endl;
+        throw runtime_error("Semantic Error");
+    }
+
+    ExecNode* make(Kind kind, IrType type = IrType::Void) {
+        m_nodes.push_back(ExecNode(kind));
+        m_nodes.back().type = type;
+        return &m_nodes.back();
+    }
+
+    IrType parse_type(const ParseNode* type_node) {
+        const string& name = type_node->value;
+        if (name == "int") return IrType::Int;
+        if (name == "char") return IrType::Char;
+        if (name == "float") return IrType::Float;
+        if (name == "void") return IrType::Void;
+        report_error(type_node->line, "Unsupported type '" + name + "'.");
+        return IrType::Void;
+    }
+
+    static const ParseNode* find_child(const ParseNode* node, const string& type) {
+        for (const ParseNode* child : node->children) {
+            if (child->type == type) return child;
+        }
+        return nullptr;
+    }
+
+    Local* find_local(const string& name) {
+        for (auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) return &it->second;
+        }
+        return nullptr;
+    }
+
+    void declare_local(const string& name, const Local& local, int line) {
+        if (m_scopes.back().count(name)) report_error(line, "Redeclaration of '" + name + "'.");
+        m_scopes.back()[name] = local;
+    }
+
+    // Wraps `value` in a conversion to declared type `to` when one is needed.
+    const ExecNode* convert(const ExecNode* value, IrType to, int line) {
+        if (value->type == IrType::Void) report_error(line, "A void value cannot be used in an expression.");
+        if (value->type == value_type(to) && to != IrType::Char) return value;
+        ExecNode* node = make(Kind::Convert, value_type(to));
+        node->to = to;
+        node->children.push_back(value);
+        return node;
+    }
+
+    void analyse_program() {
+        for (const ParseNode* node : m_program->children) {
+            if (node->type == "VariableDeclarationStatement") analyse_global_declaration(node);
+            else if (node->type == "FunctionDefinition" || node->type == "FunctionPrototype") analyse_function(node);
+        }
+    }
+
+    void analyse_global_declaration(const ParseNode* node) {
+        bool is_const = find_child(node, "Keyword") != nullptr;
+        IrType type = parse_type(find_child(node, "TypeSpecifier"));
+        if (type == IrType::Void) report_error(node->line, "Variables cannot have type void.");
+        for (const ParseNode* declarator : node->children) {
+            if (declarator->type != "Declarator") continue;
+            if (m_global_index.count(declarator->value) || m_function_index.count(declarator->value)) {
+                report_error(declarator->line, "Redefinition of '" + declarator->value + "'.");
+            }
+            RuntimeValue value;
+            value.bits = 0;
+            if (!declarator->children.empty()) {
+                bool is_float = false;
+                double initial = evaluate_constant(declarator->children[0]->children[0], is_float);
+                if (type == IrType::Float) value.f = (float)initial;
+                else if (type == IrType::Char) value.i = (signed char)(long long)initial;
+                else value.i = (int)(long long)initial;
+            }
+            m_global_index[declarator->value] = (int)m_globals.size();
+            m_globals.push_back(Global{declarator->value, type, is_const});
+            m_global_values.push_back(value);
+        }
+    }
+
+    // Folds a global initializer or a case label exactly as IrLowering does.
+    double evaluate_constant(const ParseNode* node, bool& is_float, const string& what = "Global initializer") {
+        if (node->type == "Constant") {
+            if (node->value.find('.') != string::npos) {
+                is_float = true;
+                return stod(node->value);
+            }
+            return (double)(int)stoll(node->value);
+        }
+        if (node->type == "BinaryExpression") {
+            bool left_float = false, right_float = false;
+            double left = evaluate_constant(node->children[0], left_float, what);
+            double right = evaluate_constant(node->children[1], right_float, what);
+            is_float = left_float || right_float;
+            const string& op = node->value;
+            if (op == "+") return is_float ? left + right : (double)(int)((long long)left + (long long)right);
+            if (op == "-") return is_float ? left - right : (double)(int)((long long)left - (long long)right);
+            if (op == "*") return is_float ? left * right : (double)(int)((long long)left * (long long)right);
+            if (op == "/") {
+                if (right == 0) report_error(node->line, "Division by zero in constant expression.");
+                return is_float ? left / right : (double)((long long)left / (long long)right);
+            }
+            is_float = false;
+            if (op == "==") return left == right;
+            if (op == "!=") return left != right;
+            if (op == "<") return left < right;
+            if (op == ">") return left > right;
+            if (op == "<=") return left <= right;
+            if (op == ">=") return left >= right;
+        }
+        report_error(node->line, what + " must be a constant expression.");
+        return 0;
+    }
+
+    void analyse_function(const ParseNode* node) {
+        IrType return_type = parse_type(find_child(node, "TypeSpecifier"));
+        vector<IrType> param_types;
+        vector<const ParseNode*> params;
+        if (const ParseNode* param_list = find_child(node, "ParameterList")) {
+            for (const ParseNode* param : param_list->children) {
+                IrType type = parse_type(param->children[0]);
+                if (type == IrType::Void) report_error(param->line, "Parameters cannot have type void.");
+                param_types.push_back(type);
+                params.push_back(param);
+            }
+        }
+        bool is_definition = node->type == "FunctionDefinition";
+        const string& name = node->value;
+        if (m_global_index.count(name)) report_error(node->line, "Redefinition of '" + name + "'.");
+
+        auto existing = m_function_index.find(name);
+        if (existing == m_function_index.end()) {
+            Function function;
+            function.name = name;
+            function.return_type = return_type;
+            function.param_types = param_types;
+            existing = m_function_index.insert(make_pair(name, (int)m_functions.size())).first;
+            m_functions.push_back(function);
+        } else {
+            const Function& function = m_functions[existing->second];
+            if (function.return_type != return_type || function.param_types != param_types) {
+                report_error(node->line, "Conflicting types for '" + name + "'.");
+            }
+            if (is_definition && function.defined) report_error(node->line, "Redefinition of function '" + name + "'.");
+        }
+        if (!is_definition) return;
+
+        m_function = &m_functions[existing->second];
+        m_function->defined = true;
+        m_function->num_slots = 0;
+        m_scopes.assign(1, map<string, Local>());
+        m_labels.clear();
+        m_label_uses.clear();
+        m_gotos.clear();
+        for (size_t i = 0; i < params.size(); ++i) {
+            if (params[i]->value.empty()) report_error(params[i]->line, "Parameter name omitted in function definition.");
+            declare_local(params[i]->value, Local{m_function->num_slots++, param_types[i], false}, params[i]->line);
+        }
+        ExecNode* body = analyse_block(find_child(node, "BlockStatement"), false);
+        body->end_label = (int)m_labels.size();
+        for (const pair<const string, int>& use : m_label_uses) {
+            if (!m_labels.count(use.first)) report_error(use.second, "Label '" + use.first + "' used but not defined.");
+        }
+        for (const pair<ExecNode*, string>& jump : m_gotos) jump.first->index = m_labels[jump.second];
+        // m_functions may not grow while a body is analysed, so m_function stays valid.
+        m_function->body = body;
+        m_function = nullptr;
+        m_scopes.clear();
+    }
+
+    // --- STATEMENTS ---
+    const ExecNode* analyse_statement(const ParseNode* node) {
+        int first_label = (int)m_labels.size();
+        ExecNode* statement = analyse_statement_kind(node);
+        statement->first_label = first_label;
+        statement->end_label = (int)m_labels.size();
+        return statement;
+    }
+
+    ExecNode* analyse_statement_kind(const ParseNode* node) {
+        const string& type = node->type;
+        if (type == "BlockStatement") return analyse_block(node, true);
+        if (type == "VariableDeclarationStatement") return analyse_local_declaration(node);
+        if (type == "ExpressionStatement") {
+            ExecNode* statement = make(Kind::Expression);
+            statement->children.push_back(analyse_expression(node->children[0]));
+            return statement;
+        }
+        if (type == "IfStatement") {
+            ExecNode* statement = make(Kind::If);
+            statement->children.push_back(analyse_condition(node->children[0], node->line));
+            statement->children.push_back(analyse_statement(node->children[1]));
+            if (node->children.size() > 2) statement->children.push_back(analyse_statement(node->children[2]));
+            return statement;
+        }
+        if (type == "ForStatement") return analyse_for(node);
+        if (type == "WhileStatement" || type == "DoWhileStatement") return analyse_while(node);
+        if (type == "SwitchStatement") return analyse_switch(node);
+        if (type == "CaseStatement" || type == "DefaultStatement") {
+            report_error(node->line, "Case label is not directly inside a switch body.");
+        }
+        if (type == "BreakStatement") {
+            if (m_breakable == 0) report_error(node->line, "Break statement not within a loop or switch.");
+            return make(Kind::Break);
+        }
+        if (type == "ContinueStatement") {
+            if (m_loops == 0) report_error(node->line, "Continue statement not within a loop.");
+            return make(Kind::Continue);
+        }
+        if (type == "LabeledStatement") {
+            if (m_labels.count(node->value)) report_error(node->line, "Duplicate label '" + node->value + "'.");
+            ExecNode* statement = make(Kind::Label);
+            statement->index = (int)m_labels.size();
+            m_labels[node->value] = statement->index;
+            statement->children.push_back(analyse_statement(node->children[0]));
+            return statement;
+        }
+        if (type == "GotoStatement") {
+            if (!m_label_uses.count(node->value)) m_label_uses[node->value] = node->line;
+            ExecNode* statement = make(Kind::Goto);
+            m_gotos.push_back(make_pair(statement, node->value));
+            return statement;
+        }
+        if (type == "ReturnStatement") return analyse_return(node);
+        if (type == "EmptyStatement") return make(Kind::Empty);
+        report_error(node->line, "Unsupported statement '" + type + "'.");
+        return nullptr;
+    }
+
+    ExecNode* analyse_block(const ParseNode* node, bool new_scope) {
+        if (new_scope) m_scopes.push_back(map<string, Local>());
+        ExecNode* block = make(Kind::Block);
+        for (const ParseNode* statement : node->children) block->children.push_back(analyse_statement(statement));
+        if (new_scope) m_scopes.pop_back();
+        return block;
+    }
+
+    // One Declare node per declarator, grouped in a Block (which opens no scope
+    // at run time: scopes only exist during the analysis).
+    ExecNode* analyse_local_declaration(const ParseNode* node) {
+        bool is_const = find_child(node, "Keyword") != nullptr;
+        IrType type = parse_type(find_child(node, "TypeSpecifier"));
+        if (type == IrType::Void) report_error(node->line, "Variables cannot have type void.");
+        ExecNode* group = make(Kind::Block);
+        for (const ParseNode* declarator : node->children) {
+            if (declarator->type != "Declarator") continue;
+            ExecNode* declare = make(Kind::Declare);
+            declare->index = m_function->num_slots++;
+            if (!declarator->children.empty()) {
+                declare->children.push_back(
+                    convert(analyse_expression(declarator->children[0]->children[0]), type, declarator->line));
+            }
+            group->children.push_back(declare);
+            declare_local(declarator->value, Local{declare->index, type, is_const}, declarator->line);
+        }
+        return group;
+    }
+
+    // children: init, condition (nullptr when empty), increment (nullptr when empty), body
+    ExecNode* analyse_for(const ParseNode* node) {
+        m_scopes.push_back(map<string, Local>());
+        ExecNode* statement = make(Kind::For);
+        const ParseNode* init = node->children[0];
+        if (init->type == "VariableDeclarationStatement") {
+            statement->children.push_back(analyse_local_declaration(init));
+        } else if (init->type == "ExpressionStatement") {
+            ExecNode* expression = make(Kind::Expression);
+            expression->children.push_back(analyse_expression(init->children[0]));
+            statement->children.push_back(expression);
+        } else {
+            statement->children.push_back(make(Kind::Empty));
+        }
+        const ParseNode* cond = node->children[1];
+        statement->children.push_back(cond->type == "Empty" ? nullptr : analyse_condition(cond, cond->line));
+        const ParseNode* increment = node->children[2];
+        statement->children.push_back(increment->type == "Empty" ? nullptr : analyse_expression(increment));
+        m_breakable++;
+        m_loops++;
+        statement->children.push_back(analyse_statement(node->children[3]));
+        m_loops--;
+        m_breakable--;
+        m_scopes.pop_back();
+        return statement;
+    }
+
+    // children: condition, body (for both forms)
+    ExecNode* analyse_while(const ParseNode* node) {
+        bool is_do = node->type == "DoWhileStatement";
+        ExecNode* statement = make(is_do ? Kind::DoWhile : Kind::While);
+        const ParseNode* cond = node->children[is_do ? 1 : 0];
+        const ExecNode* condition = nullptr;
+        if (!is_do) condition = analyse_condition(cond, cond->line);
+        m_breakable++;
+        m_loops++;
+        const ExecNode* body = analyse_statement(node->children[is_do ? 0 : 1]);
+        m_loops--;
+        m_breakable--;
+        if (is_do) condition = analyse_condition(cond, cond->line);
+        statement->children.push_back(condition);
+        statement->children.push_back(body);
+        return statement;
+    }
+
+    // children: selector, then the statements of the body with their labels
+    // stripped. Labels must be on statements directly in the body, as in
+    // IrLowering; a case starts running at its statement and falls through.
+    ExecNode* analyse_switch(const ParseNode* node) {
+        ExecNode* statement = make(Kind::Switch);
+        const ExecNode* selector = analyse_expression(node->children[0]);
+        if (selector->type != IrType::Int) report_error(node->line, "Switch quantity is not an integer.");
+        statement->children.push_back(selector);
+
+        const ParseNode* body = node->children[1];
+        vector<const ParseNode*> statements;
+        if (body->type == "BlockStatement") statements.assign(body->children.begin(), body->children.end());
+        else statements.push_back(body);
+        for (size_t i = 0; i < statements.size(); ++i) {
+            int child = (int)i + 1;
+            while (statements[i]->type == "CaseStatement" || statements[i]->type == "DefaultStatement") {
+                const ParseNode* label = statements[i];
+                if (label->type == "DefaultStatement") {
+                    if (statement->index >= 0) report_error(label->line, "Multiple default labels in one switch.");
+                    statement->index = child;
+                } else {
+                    bool is_float = false;
+                    int value = (int)(long long)evaluate_constant(label->children[0], is_float, "Case label");
+                    if (is_float) report_error(label->line, "Case label is not an integer constant.");
+                    if (!statement->cases.insert(make_pair(value, child)).second) {
+                        report_error(label->line, "Duplicate case value " + to_string(value) + ".");
+                    }
+                }
+                statements[i] = label->children.back();
+            }
+        }
+        if (statement->index < 0) statement->index = (int)statements.size() + 1;
+
+        m_scopes.push_back(map<string, Local>());
+        m_breakable++;
+        for (const ParseNode* child : statements) statement->children.push_back(analyse_statement(child));
+        m_breakable--;
+        m_scopes.pop_back();
+        return statement;
+    }
+
+    ExecNode* analyse_return(const ParseNode* node) {
+        ExecNode* statement = make(Kind::Return);
+        IrType return_type = m_function->return_type;
+        if (!node->children.empty()) {
+            if (return_type == IrType::Void) report_error(node->line, "Void function should not return a value.");
+            statement->children.push_back(convert(analyse_expression(node->children[0]), return_type, node->line));
+        } else if (return_type != IrType::Void) {
+            report_error(node->line, "Non-void function should return a value.");
+        }
+        return statement;
+    }
+
+    // Conditions are Int; a floating condition is compared with zero.
+    const ExecNode* analyse_condition(const ParseNode* node, int line) {
+        const ExecNode* value = analyse_expression(node);
+        if (value->type == IrType::Void) report_error(line, "A void value cannot be used as a condition.");
+        if (value->type == IrType::Int) return value;
+        ExecNode* zero = make(Kind::Constant, value->type);
+        ExecNode* compare = make(Kind::Binary, IrType::Int);
+        compare->op = IrOp::Ne;
+        compare->to = value->type;
+        compare->children.push_back(value);
+        compare->children.push_back(zero);
+        return compare;
+    }
+
+    // --- EXPRESSIONS ---
+    const ExecNode* analyse_expression(const ParseNode* node) {
+        const string& type = node->type;
+        if (type == "Constant") {
+            if (node->value.find('.') != string::npos) {
+                ExecNode* constant = make(Kind::Constant, IrType::Double);
+                constant->constant.d = stod(node->value);
+                return constant;
+            }
+            ExecNode* constant = make(Kind::Constant, IrType::Int);
+            constant->constant.i = (int)stoll(node->value);
+            return constant;
+        }
+        if (type == "Identifier") {
+            if (Local* local = find_local(node->value)) {
+                ExecNode* load = make(Kind::Local, value_type(local->type));
+                load->index = local->slot;
+                return load;
+            }
+            auto global = m_global_index.find(node->value);
+            if (global != m_global_index.end()) {
+                ExecNode* load = make(Kind::Global, value_type(m_globals[global->second].type));
+                load->index = global->second;
+                return load;
+            }
+            report_error(node->line, "Use of undeclared identifier '" + node->value + "'.");
+        }
+        if (type == "AssignmentExpression") return analyse_assignment(node);
+        if (type == "BinaryExpression") return analyse_binary(node);
+        if (type == "CallExpression") return analyse_call(node);
+        report_error(node->line, "Unsupported expression '" + type + "'.");
+        return nullptr;
+    }
+
+    const ExecNode* analyse_assignment(const ParseNode* node) {
+        const ParseNode* target = node->children[0];
+        if (target->type != "Identifier") report_error(node->line, "Left side of assignment is not assignable.");
+        const ExecNode* value = analyse_expression(node->children[1]);
+        if (Local* local = find_local(target->value)) {
+            if (local->is_const) report_error(node->line, "Assignment to const variable '" + target->value + "'.");
+            ExecNode* assign = make(Kind::AssignLocal, value_type(local->type));
+            assign->index = local->slot;
+            assign->children.push_back(convert(value, local->type, node->line));
+            return assign;
+        }
+        auto global = m_global_index.find(target->value);
+        if (global != m_global_index.end()) {
+            const Global& variable = m_globals[global->second];
+            if (variable.is_const) report_error(node->line, "Assignment to const variable '" + target->value + "'.");
+            ExecNode* assign = make(Kind::AssignGlobal, value_type(variable.type));
+            assign->index = global->second;
+            assign->children.push_back(convert(value, variable.type, node->line));
+            return assign;
+        }
+        report_error(target->line, "Use of undeclared identifier '" + target->value + "'.");
+        return nullptr;
+    }
+
+    // Binary nodes keep the operand type in `to`.
+    const ExecNode* analyse_binary(const ParseNode* node) {
+        const ExecNode* left = analyse_expression(node->children[0]);
+        const ExecNode* right = analyse_expression(node->children[1]);
+        if (left->type == IrType::Void || right->type == IrType::Void) {
+            report_error(node->line, "A void value cannot be used in an expression.");
+        }
+        IrType common = IrType::Int;
+        if (left->type == IrType::Double || right->type == IrType::Double) common = IrType::Double;
+        else if (left->type == IrType::Float || right->type == IrType::Float) common = IrType::Float;
+
+        static const map<string, IrOp> operators = {
+            {"+", IrOp::Add}, {"-", IrOp::Sub}, {"*", IrOp::Mul}, {"/", IrOp::Div},
+            {"==", IrOp::Eq}, {"!=", IrOp::Ne}, {"<", IrOp::Lt}, {">", IrOp::Gt},
+            {"<=", IrOp::Le}, {">=", IrOp::Ge}};
+        auto op = operators.find(node->value);
+        if (op == operators.end()) report_error(node->line, "Unsupported operator '" + node->value + "'.");
+
+        ExecNode* binary = make(Kind::Binary, is_comparison(op->second) ? IrType::Int : common);
+        binary->op = op->second;
+        binary->to = common;
+        binary->children.push_back(convert(left, common, node->line));
+        binary->children.push_back(convert(right, common, node->line));
+        return binary;
+    }
+
+    const ExecNode* analyse_call(const ParseNode* node) {
+        auto index = m_function_index.find(node->value);
+        if (index == m_function_index.end()) {
+            report_error(node->line, "Call to undeclared function '" + node->value + "'.");
+        }
+        const vector<IrType>& param_types = m_functions[index->second].param_types;
+        IrType return_type = m_functions[index->second].return_type;
+        if (param_types.size() != node->children.size()) {
+            report_error(node->line, "Function '" + node->value + "' expects " + to_string(param_types.size()) +
+                                     " argument(s), but " + to_string(node->children.size()) + " were given.");
+        }
+        ExecNode* call = make(Kind::Call, value_type(return_type));
+        call->index = index->second;
+        for (size_t i = 0; i < node->children.size(); ++i) {
+            call->children.push_back(convert(analyse_expression(node->children[i]), param_types[i], node->line));
+        }
+        return call;
+    }
+
+    // ---------------------------------------------------------------
+    // EXECUTION
+    // ---------------------------------------------------------------
+
+    static int32_t to_int(double value) {
+        if (!(value > -2147483649.0 && value < 2147483648.0)) return INT_MIN;
+        return (int32_t)value;
+    }
+
+    static RuntimeValue convert_value(RuntimeValue value, IrType from, IrType to) {
+        RuntimeValue result;
+        result.bits = 0;
+        switch (to) {
+            case IrType::Int: case IrType::Char: {
+                int32_t i = from == IrType::Float ? to_int(value.f) : from == IrType::Double ? to_int(value.d) : value.i;
+                result.i = to == IrType::Char ? (int32_t)(int8_t)i : i;
+                break;
+            }
+            case IrType::Float:
+                result.f = from == IrType::Double ? (float)value.d : from == IrType::Float ? value.f : (float)value.i;
+                break;
+            case IrType::Double:
+                result.d = from == IrType::Float ? (double)value.f : from == IrType::Double ? value.d : (double)value.i;
+                break;
+            case IrType::Void:
+                break;
+        }
+        return result;
+    }
+
+    template <typename T>
+    static RuntimeValue arithmetic(IrOp op, T a, T b, T RuntimeValue::*field) {
+        RuntimeValue result;
+        result.bits = 0;
+        switch (op) {
+            case IrOp::Add: result.*field = a + b; break;
+            case IrOp::Sub: result.*field = a - b; break;
+            case IrOp::Mul: result.*field = a * b; break;
+            case IrOp::Div: result.*field = a / b; break;
+            case IrOp::Eq: result.i = a == b; break;
+            case IrOp::Ne: result.i = a != b; break;
+            case IrOp::Lt: result.i = a < b; break;
+            case IrOp::Gt: result.i = a > b; break;
+            case IrOp::Le: result.i = a <= b; break;
+            case IrOp::Ge: result.i = a >= b; break;
+            default: break;
+        }
+        return result;
+    }
+
+    static RuntimeValue int_arithmetic(IrOp op, int32_t a, int32_t b) {
+        switch (op) {
+            // int arithmetic wraps around, as in the native code.
+            case IrOp::Add: return make_int_value((int32_t)((uint32_t)a + (uint32_t)b));
+            case IrOp::Sub: return make_int_value((int32_t)((uint32_t)a - (uint32_t)b));
+            case IrOp::Mul: return make_int_value((int32_t)((uint32_t)a * (uint32_t)b));
+            case IrOp::Div:
+                if (b == 0) throw runtime_error("division by zero");
+                return make_int_value(b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b);
+            default:
+                return arithmetic<int32_t>(op, a, b, &RuntimeValue::i);
+        }
+    }
+
+    RuntimeValue evaluate(const ExecNode* node, RuntimeValue* frame) {
+        switch (node->kind) {
+            case Kind::Constant:
+                return node->constant;
+            case Kind::Local:
+                return frame[node->index];
+            case Kind::Global:
+                return m_global_values[node->index];
+            case Kind::AssignLocal:
+                return frame[node->index] = evaluate(node->children[0], frame);
+            case Kind::AssignGlobal:
+                return m_global_values[node->index] = evaluate(node->children[0], frame);
+            case Kind::Convert: {
+                const ExecNode* value = node->children[0];
+                return convert_value(evaluate(value, frame), value->type, node->to);
+            }
+            case Kind::Binary: {
+                RuntimeValue left = evaluate(node->children[0], frame);
+                RuntimeValue right = evaluate(node->children[1], frame);
+                if (node->to == IrType::Int) return int_arithmetic(node->op, left.i, right.i);
+                if (node->to == IrType::Float) return arithmetic<float>(node->op, left.f, right.f, &RuntimeValue::f);
+                return arithmetic<double>(node->op, left.d, right.d, &RuntimeValue::d);
+            }
+            case Kind::Call:
+                return call(m_functions[node->index], node, frame);
+            default:
+                break;
+        }
+        RuntimeValue none;
+        none.bits = 0;
+        return none;
+    }
+
+    static bool contains_label(const ExecNode* node, int label) {
+        return label >= node->first_label && label < node->end_label;
+    }
+
+    // The first of `children` (from `start` on) to run: the one that holds
+    // the label execution resumes at, if it is looking for one.
+    size_t resume_at(const ExecNode* node, size_t start) const {
+        if (m_seek < 0) return start;
+        while (!contains_label(node->children[start], m_seek)) start++;
+        return start;
+    }
+
+    Flow execute(const ExecNode* node, RuntimeValue* frame, RuntimeValue& result) {
+        Flow flow = execute_statement(node, frame, result);
+        while (flow == Flow::Goto && contains_label(node, m_goto)) {
+            m_seek = m_goto;
+            flow = execute_statement(node, frame, result);
+        }
+        return flow;
+    }
+
+    // While m_seek is set, only statements that contain that label are
+    // entered, and they skip what comes before it (conditions included).
+    Flow execute_statement(const ExecNode* node, RuntimeValue* frame, RuntimeValue& result) {
+        switch (node->kind) {
+            case Kind::Block:
+                for (size_t i = resume_at(node, 0); i < node->children.size(); ++i) {
+                    Flow flow = execute(node->children[i], frame, result);
+                    if (flow != Flow::Normal) return flow;
+                }
+                return Flow::Normal;
+            case Kind::Expression:
+                evaluate(node->children[0], frame);
+                return Flow::Normal;
+            case Kind::Declare:
+                if (node->children.empty()) frame[node->index].bits = 0;
+                else frame[node->index] = evaluate(node->children[0], frame);
+                return Flow::Normal;
+            case Kind::If:
+                if (m_seek >= 0) return execute(node->children[resume_at(node, 1)], frame, result);
+                if (evaluate(node->children[0], frame).i != 0) return execute(node->children[1], frame, result);
+                if (node->children.size() > 2) return execute(node->children[2], frame, result);
+                return Flow::Normal;
+            case Kind::For: {
+                const ExecNode* condition = node->children[1];
+                const ExecNode* increment = node->children[2];
+                const ExecNode* body = node->children[3];
+                bool resume = m_seek >= 0;
+                if (!resume) execute(node->children[0], frame, result);
+                while (resume || !condition || evaluate(condition, frame).i != 0) {
+                    resume = false;
+                    Flow flow = execute(body, frame, result);
+                    if (flow == Flow::Return || flow == Flow::Goto) return flow;
+                    if (flow == Flow::Break) break;
+                    if (increment) evaluate(increment, frame);
+                }
+                return Flow::Normal;
+            }
+            case Kind::While: case Kind::DoWhile: {
+                const ExecNode* condition = node->children[0];
+                bool resume = m_seek >= 0 || node->kind == Kind::DoWhile;
+                while (resume || evaluate(condition, frame).i != 0) {
+                    resume = false;
+                    Flow flow = execute(node->children[1], frame, result);
+                    if (flow == Flow::Return || flow == Flow::Goto) return flow;
+                    if (flow == Flow::Break) break;
+                }
+                return Flow::Normal;
+            }
+            case Kind::Switch: {
+                size_t start;
+                if (m_seek >= 0) {
+                    start = resume_at(node, 1);
+                } else {
+                    map<int, int>::const_iterator found = node->cases.find(evaluate(node->children[0], frame).i);
+                    start = found != node->cases.end() ? (size_t)found->second : (size_t)node->index;
+                }
+                for (size_t i = start; i < node->children.size(); ++i) {
+                    Flow flow = execute(node->children[i], frame, result);
+                    if (flow == Flow::Break) break;
+                    if (flow != Flow::Normal) return flow;
+                }
+                return Flow::Normal;
+            }
+            case Kind::Label:
+                if (m_seek == node->index) m_seek = -1;
+                return execute(node->children[0], frame, result);
+            case Kind::Break:
+                return Flow::Break;
+            case Kind::Continue:
+                return Flow::Continue;
+            case Kind::Goto:
+                m_goto = node->index;
+                return Flow::Goto;
+            case Kind::Return:
+                if (node->children.empty()) result.bits = 0;
+                else result = evaluate(node->children[0], frame);
+                return Flow::Return;
+            default:
+                return Flow::Normal;
+        }
+    }
+
+    // The callee's frame starts at the top of the stack and is reserved before
+    // the arguments are evaluated (straight into its parameter slots), so that
+    // calls made while evaluating them go above it.
+    RuntimeValue call(const Function& callee, const ExecNode* node, RuntimeValue* frame) {
+        size_t base = m_top;
+        size_t size = max((size_t)callee.num_slots, node->children.size());
+        char marker;
+        uintptr_t here = (uintptr_t)&marker;
+        size_t native_used = here < m_native_stack_base ? m_native_stack_base - here : here - m_native_stack_base;
+        if (base + size > kStackSlots || native_used > kNativeStackBudget) throw runtime_error("stack overflow");
+        m_top = base + size;
+        for (size_t i = 0; i < node->children.size(); ++i) m_stack[base + i] = evaluate(node->children[i], frame);
+        RuntimeValue result = invoke(callee, base);
+        m_top = base;
+        return result;
+    }
+
+    // Runs `function` with its frame (arguments in place) at stack[base].
+    RuntimeValue invoke(const Function& function, size_t base) {
+        RuntimeValue result;
+        result.bits = 0;
+        if (!function.defined) {
+            return call_native(function.native, function.return_type, function.param_types, &m_stack[base]);
+        }
+        // Falling off the end returns 0 (all bits clear is 0 for every type).
+        if (execute(function.body, &m_stack[base], result) == Flow::Normal) result.bits = 0;
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,1139 @@
+#ifndef IR_H
+#define IR_H
+
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include "parse_tree.h"
+#include "switch_lowering.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         INTERMEDIATE REPRESENTATION (IR)                    ===
+// ===================================================================
+// The IR is a classic three-address code over an unlimited supply of virtual
+// registers ("vregs"), grouped into basic blocks. Every block ends with exactly
+// one terminator (Jump, Branch, Switch or Ret). Local variables live directly in
+// vregs; only globals are memory.
+//
+// Value types: `char` values are kept sign-extended in Int vregs, so a vreg is
+// always Int, Float or Double. IrType::Char only appears as the declared type
+// of globals, parameters and return values.
+
+enum class IrType { Void, Int, Char, Float, Double };
+
+enum class IrOp {
+    Const,       // dest = imm
+    FConst,      // dest = fimm (Float or Double)
+    Copy,        // dest = a
+    Add, Sub, Mul, Div,
+    Eq, Ne, Lt, Gt, Le, Ge, // dest (Int) = a <op> b, compared as operand_type
+    Convert,     // dest (type) = a (operand_type)
+    TruncChar,   // dest = (int)(char)a
+    TestBit,     // dest (Int) = bit (a mod 64) of the 64-bit mask imm
+    LoadGlobal,  // dest = symbol        (operand_type = declared type of the global)
+    StoreGlobal, // symbol = a           (operand_type = declared type of the global)
+    Call,        // dest = symbol(args)  (dest is -1 for void calls)
+    Jump,        // goto target
+    Branch,      // if (a) goto target else goto target_false
+    Switch,      // goto table[a - imm] if a - imm indexes table, else goto target
+    Ret          // return a             (a is -1 for `return;`)
+};
+
+struct IrInst {
+    IrOp op;
+    IrType type;                       // type of dest (or of the value for stores / returns)
+    IrType operand_type = IrType::Void;
+    int dest = -1;
+    int a = -1;
+    int b = -1;
+    long long imm = 0;
+    double fimm = 0.0;
+    string symbol;
+    vector<int> args;
+    int target = -1;
+    int target_false = -1;
+    vector<int> table;                 // Switch: target for each value from imm on
+    bool tail_call = false;            // Call whose result is returned at once (see tail_calls.h)
+    long long taken_count = -1;        // Branch: times `target` was taken in a profile run (-1: unknown)
+
+    IrInst(IrOp op_, IrType type_ = IrType::Void) : op(op_), type(type_) {}
+};
+
+struct IrBlock {
+    int id;
+    vector<IrInst> insts;
+    int loop_depth = 0;
+    long long exec_count = -1;    // executions in a profile run (-1: unknown, see profile.h)
+};
+
+struct IrFunction {
+    string name;
+    IrType return_type = IrType::Void;
+    vector<IrType> param_types;
+    vector<int> params;           // vreg holding each incoming parameter
+    vector<IrType> vreg_types;    // indexed by vreg number
+    vector<IrBlock> blocks;       // blocks[i].id == i, blocks[0] is the entry
+    bool defined = false;         // false for prototypes (external functions)
+
+    int new_vreg(IrType type) {
+        vreg_types.push_back(type);
+        return (int)vreg_types.size() - 1;
+    }
+    int new_block(int loop_depth) {
+        IrBlock block;
+        block.id = (int)blocks.size();
+        block.loop_depth = loop_depth;
+        blocks.push_back(block);
+        return block.id;
+    }
+};
+
+struct IrGlobal {
+    string name;
+    IrType type;
+    bool is_const = false;
+    long long init = 0;
+    double finit = 0.0;
+};
+
+struct IrModule {
+    vector<IrGlobal> globals;
+    vector<IrFunction> functions;
+
+    IrFunction* find_function(const string& name) {
+        for (IrFunction& function : functions) {
+            if (function.name == name) return &function;
+        }
+        return nullptr;
+    }
+    const IrGlobal* find_global(const string& name) const {
+        for (const IrGlobal& global : globals) {
+            if (global.name == name) return &global;
+        }
+        return nullptr;
+    }
+};
+
+// --- SMALL HELPERS SHARED BY THE PASSES ---
+
+inline bool is_terminator(IrOp op) {
+    return op == IrOp::Jump || op == IrOp::Branch || op == IrOp::Switch || op == IrOp::Ret;
+}
+
+inline bool is_comparison(IrOp op) {
+    return op == IrOp::Eq || op == IrOp::Ne || op == IrOp::Lt ||
+           op == IrOp::Gt || op == IrOp::Le || op == IrOp::Ge;
+}
+
+// The type a value of declared type `type` has once it is in a vreg.
+inline IrType value_type(IrType type) {
+    return type == IrType::Char ? IrType::Int : type;
+}
+
+inline vector<int> successors(const IrBlock& block) {
+    vector<int> result;
+    if (block.insts.empty()) return result;
+    const IrInst& last = block.insts.back();
+    if (last.op == IrOp::Jump) result.push_back(last.target);
+    if (last.op == IrOp::Branch) {
+        result.push_back(last.target);
+        if (last.target_false != last.target) result.push_back(last.target_false);
+    }
+    if (last.op == IrOp::Switch) {
+        result.push_back(last.target);
+        for (int target : last.table) {
+            if (find(result.begin(), result.end(), target) == result.end()) result.push_back(target);
+        }
+    }
+    return result;
+}
+
+// Calls `f` on every block number a terminator refers to, so that passes
+// which move or copy blocks can rewrite them in place.
+template <typename F>
+inline void for_each_target(IrInst& inst, F f) {
+    if (inst.target >= 0) f(inst.target);
+    if (inst.target_false >= 0) f(inst.target_false);
+    for (int& target : inst.table) f(target);
+}
+
+// Number of non-terminator instructions; the size measure used by the optimisers.
+inline int instruction_count(const IrFunction& function) {
+    int count = 0;
+    for (const IrBlock& block : function.blocks) {
+        for (const IrInst& inst : block.insts) {
+            if (!is_terminator(inst.op)) count++;
+        }
+    }
+    return count;
+}
+
+// Drops blocks that cannot be reached from the entry and renumbers the rest so
+// that blocks[i].id == i still holds. Layout order is preserved.
+inline void remove_unreachable_blocks(IrFunction& function) {
+    if (function.blocks.empty()) return;
+    vector<bool> reachable(function.blocks.size(), false);
+    vector<int> worklist = {0};
+    reachable[0] = true;
+    while (!worklist.empty()) {
+        int id = worklist.back();
+        worklist.pop_back();
+        for (int succ : successors(function.blocks[id])) {
+            if (!reachable[succ]) {
+                reachable[succ] = true;
+                worklist.push_back(succ);
+            }
+        }
+    }
+    vector<int> new_id(function.blocks.size(), -1);
+    vector<IrBlock> kept;
+    for (size_t i = 0; i < function.blocks.size(); ++i) {
+        if (!reachable[i]) continue;
+        new_id[i] = (int)kept.size();
+        kept.push_back(function.blocks[i]);
+    }
+    for (IrBlock& block : kept) {
+        block.id = new_id[block.id];
+        for_each_target(block.insts.back(), [&](int& target) { target = new_id[target]; });
+    }
+    function.blocks.swap(kept);
+}
+
+// Rearranges the blocks into `order` (a permutation of the current ids, entry
+// first) and renumbers them so that blocks[i].id == i still holds.
+inline void reorder_blocks(IrFunction& function, const vector<int>& order) {
+    vector<int> new_id(function.blocks.size(), -1);
+    for (size_t i = 0; i < order.size(); ++i) new_id[order[i]] = (int)i;
+    vector<IrBlock> reordered;
+    for (int id : order) reordered.push_back(function.blocks[id]);
+    for (IrBlock& block : reordered) {
+        block.id = new_id[block.id];
+        for_each_target(block.insts.back(), [&](int& target) { target = new_id[target]; });
+    }
+    function.blocks.swap(reordered);
+}
+
+// Merges every block that ends in a jump into its target when it is the only
+// way into that target, then drops what became unreachable. Passes that split
+// blocks (inlining, tail calls) call this to undo the resulting jump chains.
+inline void simplify_cfg(IrFunction& function) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        vector<int> predecessor_count(function.blocks.size(), 0);
+        for (const IrBlock& block : function.blocks) {
+            for (int succ : successors(block)) predecessor_count[succ]++;
+        }
+        for (IrBlock& block : function.blocks) {
+            if (block.insts.empty() || block.insts.back().op != IrOp::Jump) continue;
+            int target = block.insts.back().target;
+            if (target == 0 || target == block.id || predecessor_count[target] != 1) continue;
+            IrBlock& next = function.blocks[target];
+            block.insts.pop_back();
+            block.insts.insert(block.insts.end(), next.insts.begin(), next.insts.end());
+            // The emptied block keeps a self-loop so that it stays well formed
+            // until it is removed as unreachable.
+            next.insts.assign(1, IrInst(IrOp::Jump));
+            next.insts[0].target = next.id;
+            predecessor_count[target] = 0;
+            changed = true;
+        }
+        remove_unreachable_blocks(function);
+    }
+}
+
+inline string type_name(IrType type) {
+    switch (type) {
+        case IrType::Void: return "void";
+        case IrType::Int: return "int";
+        case IrType::Char: return "char";
+        case IrType::Float: return "float";
+        case IrType::Double: return "double";
+    }
+    return "?";
+}
+
+// ===================================================================
+// ===         LOWERING: PARSE TREE -> IR                          ===
+// ===================================================================
+// Walks the tree produced by the Parser, resolves names and types (the usual
+// arithmetic conversions of C, restricted to int/char/float/double) and emits
+// IR. Like the parser, the first error is reported with its line number and
+// aborts the lowering.
+
+class IrLowering {
+public:
+    IrLowering(const ParseNode* program, ostream& diagnostics = cerr) : m_program(program), m_diagnostics(diagnostics) {}
+
+    bool lower(IrModule& module) {
+        m_module = &module;
+        try {
+            lower_program();
+            return true;
+        } catch (const runtime_error& e) {
+            return false;
+        }
+    }
+
+private:
+    struct Value {
+        int vreg;
+        IrType type; // Int, Float or Double (Void for calls to void functions)
+    };
+    struct LocalVariable {
+        int vreg;
+        IrType type;
+        bool is_const;
+    };
+    struct FunctionSignature {
+        IrType return_type;
+        vector<IrType> param_types;
+        bool defined;
+    };
+
+    const ParseNode* m_program;
+    ostream& m_diagnostics;   // where semantic errors are reported
+    IrModule* m_module = nullptr;
+    map<string, FunctionSignature> m_signatures;
+    vector<map<string, LocalVariable>> m_scopes;
+    int m_function_index = -1;
+    int m_current_block = -1;
+    int m_loop_depth = 0;
+    vector<int> m_break_targets;      // innermost loop or switch last
+    vector<int> m_continue_targets;   // innermost loop last
+    map<string, int> m_labels;        // label -> block, in the current function
+    set<string> m_defined_labels;
+    map<string, int> m_label_uses;    // label -> line of its first goto
+
+    // --- ERROR REPORTING ---
+    void report_error(int line, const string& message) {
+        m_diagnostics << "[Line " << line << "] Semantic Error: " << message << endl;
+        throw runtime_error("Semantic Error");
+    }
+
+    // --- EMISSION HELPERS ---
+    IrFunction& function() { return m_module->functions[m_function_index]; }
+
+    void emit(const IrInst& inst) {
+        IrBlock* block = &function().blocks[m_current_block];
+        if (!block->insts.empty() && is_terminator(block->insts.back().op)) {
+            // Code after a `return` is unreachable; give it a block of its own
+            // so that the CFG stays well formed. It is removed afterwards.
+            m_current_block = function().new_block(m_loop_depth);
+            block = &function().blocks[m_current_block];
+        }
+        block->insts.push_back(inst);
+    }
+
+    void emit_jump(int target) {
+        IrInst jump(IrOp::Jump);
+        jump.target = target;
+        emit(jump);
+    }
+
+    void emit_branch(int cond, int if_true, int if_false) {
+        IrInst branch(IrOp::Branch);
+        branch.a = cond;
+        branch.target = if_true;
+        branch.target_false = if_false;
+        emit(branch);
+    }
+
+    int emit_const(long long value) {
+        IrInst inst(IrOp::Const, IrType::Int);
+        inst.dest = function().new_vreg(IrType::Int);
+        inst.imm = (int)value;
+        emit(inst);
+        return inst.dest;
+    }
+
+    // dest (Int) = a <op> b on Int operands.
+    int emit_int_binary(IrOp op, int a, int b) {
+        IrInst inst(op, IrType::Int);
+        inst.operand_type = IrType::Int;
+        inst.dest = function().new_vreg(IrType::Int);
+        inst.a = a;
+        inst.b = b;
+        emit(inst);
+        return inst.dest;
+    }
+
+    // Converts `value` to a value of declared type `to` (char is truncated).
+    Value convert(Value value, IrType to, int line) {
+        if (value.type == IrType::Void) report_error(line, "A void value cannot be used in an expression.");
+        IrType target = value_type(to);
+        if (value.type != target) {
+            IrInst inst(IrOp::Convert, target);
+            inst.operand_type = value.type;
+            inst.dest = function().new_vreg(target);
+            inst.a = value.vreg;
+            emit(inst);
+            value = Value{inst.dest, target};
+        }
+        if (to == IrType::Char) {
+            IrInst inst(IrOp::TruncChar, IrType::Int);
+            inst.dest = function().new_vreg(IrType::Int);
+            inst.a = value.vreg;
+            emit(inst);
+            value.vreg = inst.dest;
+        }
+        return value;
+    }
+
+    // --- TYPES AND NAMES ---
+    IrType parse_type(const ParseNode* type_node) {
+        const string& name = type_node->value;
+        if (name == "int") return IrType::Int;
+        if (name == "char") return IrType::Char;
+        if (name == "float") return IrType::Float;
+        if (name == "void") return IrType::Void;
+        report_error(type_node->line, "Unsupported type '" + name + "'.");
+        return IrType::Void;
+    }
+
+    static const ParseNode* find_child(const ParseNode* node, const string& type) {
+        for (const ParseNode* child : node->children) {
+            if (child->type == type) return child;
+        }
+        return nullptr;
+    }
+
+    LocalVariable* find_local(const string& name) {
+        for (auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) return &it->second;
+        }
+        return nullptr;
+    }
+
+    // --- TOP LEVEL ---
+    void lower_program() {
+        for (const ParseNode* node : m_program->children) {
+            if (node->type == "VariableDeclarationStatement") {
+                lower_global_declaration(node);
+            } else if (node->type == "FunctionDefinition" || node->type == "FunctionPrototype") {
+                lower_function(node);
+            }
+            // Preprocessor directives carry no semantics at this stage.
+        }
+        for (IrFunction& fn : m_module->functions) {
+            if (fn.defined) remove_unreachable_blocks(fn);
+        }
+    }
+
+    void lower_global_declaration(const ParseNode* node) {
+        bool is_const = find_child(node, "Keyword") != nullptr;
+        IrType type = parse_type(find_child(node, "TypeSpecifier"));
+        if (type == IrType::Void) report_error(node->line, "Variables cannot have type void.");
+        for (const ParseNode* declarator : node->children) {
+            if (declarator->type != "Declarator") continue;
+            if (m_module->find_global(declarator->value) || m_signatures.count(declarator->value)) {
+                report_error(declarator->line, "Redefinition of '" + declarator->value + "'.");
+            }
+            IrGlobal global;
+            global.name = declarator->value;
+            global.type = type;
+            global.is_const = is_const;
+            if (!declarator->children.empty()) {
+                const ParseNode* initializer = declarator->children[0]->children[0];
+                bool is_float = false;
+                double value = evaluate_constant(initializer, is_float);
+                if (type == IrType::Float || type == IrType::Double) {
+                    global.finit = type == IrType::Float ? (double)(float)value : value;
+                } else {
+                    global.init = type == IrType::Char ? (long long)(signed char)(long long)value
+                                                       : (long long)(int)(long long)value;
+                }
+            }
+            m_module->globals.push_back(global);
+        }
+    }
+
+    // Folds a global initializer or a case label (`what`, for errors). C only
+    // allows constant expressions there.
+    double evaluate_constant(const ParseNode* node, bool& is_float, const string& what = "Global initializer") {
+        if (node->type == "Constant") {
+            if (node->value.find('.') != string::npos) {
+                is_float = true;
+                return stod(node->value);
+            }
+            return (double)(int)stoll(node->value);
+        }
+        if (node->type == "BinaryExpression") {
+            bool left_float = false, right_float = false;
+            double left = evaluate_constant(node->children[0], left_float, what);
+            double right = evaluate_constant(node->children[1], right_float, what);
+            is_float = left_float || right_float;
+            const string& op = node->value;
+            if (op == "+") return is_float ? left + right : (double)(int)((long long)left + (long long)right);
+            if (op == "-") return is_float ? left - right : (double)(int)((long long)left - (long long)right);
+            if (op == "*") return is_float ? left * right : (double)(int)((long long)left * (long long)right);
+            if (op == "/") {
+                if (right == 0) report_error(node->line, "Division by zero in constant expression.");
+                return is_float ? left / right : (double)((long long)left / (long long)right);
+            }
+            is_float = false;
+            if (op == "==") return left == right;
+            if (op == "!=") return left != right;
+            if (op == "<") return left < right;
+            if (op == ">") return left > right;
+            if (op == "<=") return left <= right;
+            if (op == ">=") return left >= right;
+        }
+        report_error(node->line, what + " must be a constant expression.");
+        return 0;
+    }
+
+    void lower_function(const ParseNode* node) {
+        IrType return_type = parse_type(find_child(node, "TypeSpecifier"));
+        vector<IrType> param_types;
+        vector<const ParseNode*> params;
+        if (const ParseNode* param_list = find_child(node, "ParameterList")) {
+            for (const ParseNode* param : param_list->children) {
+                IrType type = parse_type(param->children[0]);
+                if (type == IrType::Void) report_error(param->line, "Parameters cannot have type void.");
+                param_types.push_back(type);
+                params.push_back(param);
+            }
+        }
+        bool is_definition = node->type == "FunctionDefinition";
+        const string& name = node->value;
+        if (m_module->find_global(name)) report_error(node->line, "Redefinition of '" + name + "'.");
+
+        auto existing = m_signatures.find(name);
+        if (existing != m_signatures.end()) {
+            if (existing->second.return_type != return_type || existing->second.param_types != param_types) {
+                report_error(node->line, "Conflicting types for '" + name + "'.");
+            }
+            if (is_definition && existing->second.defined) {
+                report_error(node->line, "Redefinition of function '" + name + "'.");
+            }
+        }
+        FunctionSignature& signature = m_signatures[name];
+        signature.return_type = return_type;
+        signature.param_types = param_types;
+        signature.defined = signature.defined || is_definition;
+
+        IrFunction* fn = m_module->find_function(name);
+        if (!fn) {
+            m_module->functions.push_back(IrFunction());
+            fn = &m_module->functions.back();
+            fn->name = name;
+            fn->return_type = return_type;
+            fn->param_types = param_types;
+        }
+        if (!is_definition) return;
+
+        fn->defined = true;
+        m_function_index = (int)(fn - &m_module->functions[0]);
+        m_loop_depth = 0;
+        m_current_block = function().new_block(0);
+        m_scopes.assign(1, map<string, LocalVariable>());
+        m_labels.clear();
+        m_defined_labels.clear();
+        m_label_uses.clear();
+        for (size_t i = 0; i < params.size(); ++i) {
+            if (params[i]->value.empty()) report_error(params[i]->line, "Parameter name omitted in function definition.");
+            int vreg = function().new_vreg(value_type(param_types[i]));
+            function().params.push_back(vreg);
+            // Callers are not trusted to have extended a char argument.
+            Value param = param_types[i] == IrType::Char ? convert(Value{vreg, IrType::Int}, IrType::Char, params[i]->line)
+                                                         : Value{vreg, value_type(param_types[i])};
+            declare_local(params[i]->value, LocalVariable{param.vreg, param_types[i], false}, params[i]->line);
+        }
+        lower_block(find_child(node, "BlockStatement"), false);
+        for (const pair<const string, int>& use : m_label_uses) {
+            if (!m_defined_labels.count(use.first)) report_error(use.second, "Label '" + use.first + "' used but not defined.");
+        }
+
+        // Falling off the end of a function: `main` returns 0 (C99), other
+        // non-void functions return 0 rather than an undefined value.
+        IrBlock& last = function().blocks[m_current_block];
+        if (last.insts.empty() || !is_terminator(last.insts.back().op)) {
+            IrInst ret(IrOp::Ret, return_type);
+            if (return_type != IrType::Void) {
+                ret.a = convert(Value{emit_const(0), IrType::Int}, return_type, node->line).vreg;
+            }
+            emit(ret);
+        }
+        m_scopes.clear();
+    }
+
+    void declare_local(const string& name, const LocalVariable& variable, int line) {
+        if (m_scopes.back().count(name)) report_error(line, "Redeclaration of '" + name + "'.");
+        m_scopes.back()[name] = variable;
+    }
+
+    // --- STATEMENTS ---
+    void lower_statement(const ParseNode* node) {
+        const string& type = node->type;
+        if (type == "BlockStatement") lower_block(node, true);
+        else if (type == "VariableDeclarationStatement") lower_local_declaration(node);
+        else if (type == "ExpressionStatement") lower_expression(node->children[0]);
+        else if (type == "IfStatement") lower_if(node);
+        else if (type == "ForStatement") lower_for(node);
+        else if (type == "WhileStatement") lower_loop(node->children[0], node->children[1], nullptr, true);
+        else if (type == "DoWhileStatement") lower_loop(node->children[1], node->children[0], nullptr, false);
+        else if (type == "SwitchStatement") lower_switch(node);
+        else if (type == "BreakStatement") lower_break(node);
+        else if (type == "ContinueStatement") lower_continue(node);
+        else if (type == "LabeledStatement") lower_label(node);
+        else if (type == "GotoStatement") lower_goto(node);
+        else if (type == "ReturnStatement") lower_return(node);
+        else if (type == "EmptyStatement") return;
+        else if (type == "CaseStatement" || type == "DefaultStatement") {
+            report_error(node->line, "Case label is not directly inside a switch body.");
+        }
+        else report_error(node->line, "Unsupported statement '" + type + "'.");
+    }
+
+    void lower_block(const ParseNode* node, bool new_scope) {
+        if (new_scope) m_scopes.push_back(map<string, LocalVariable>());
+        for (const ParseNode* statement : node->children) {
+            lower_statement(statement);
+        }
+        if (new_scope) m_scopes.pop_back();
+    }
+
+    void lower_local_declaration(const ParseNode* node) {
+        bool is_const = find_child(node, "Keyword") != nullptr;
+        IrType type = parse_type(find_child(node, "TypeSpecifier"));
+        if (type == IrType::Void) report_error(node->line, "Variables cannot have type void.");
+        for (const ParseNode* declarator : node->children) {
+            if (declarator->type != "Declarator") continue;
+            int vreg = function().new_vreg(value_type(type));
+            IrInst init(IrOp::Copy, value_type(type));
+            init.dest = vreg;
+            if (!declarator->children.empty()) {
+                init.a = convert(lower_expression(declarator->children[0]->children[0]), type, declarator->line).vreg;
+            } else {
+                // Uninitialised locals read as zero so that every execution
+                // engine produces the same result for them.
+                init.a = convert(Value{emit_const(0), IrType::Int}, type, declarator->line).vreg;
+            }
+            emit(init);
+            declare_local(declarator->value, LocalVariable{vreg, type, is_const}, declarator->line);
+        }
+    }
+
+    void lower_if(const ParseNode* node) {
+        int cond = condition_vreg(lower_expression(node->children[0]), node->line);
+        int then_block = function().new_block(m_loop_depth);
+        int join_block = function().new_block(m_loop_depth);
+        int else_block = node->children.size() > 2 ? function().new_block(m_loop_depth) : join_block;
+        emit_branch(cond, then_block, else_block);
+
+        m_current_block = then_block;
+        lower_statement(node->children[1]);
+        emit_jump(join_block);
+        if (node->children.size() > 2) {
+            m_current_block = else_block;
+            lower_statement(node->children[2]);
+            emit_jump(join_block);
+        }
+        m_current_block = join_block;
+    }
+
+    // Loops are rotated: the condition is tested once on the way in and then
+    // at the bottom of the body, so that every iteration ends in a single
+    // conditional branch back to the top instead of a jump and a branch.
+    //
+    // for (init; cond; incr) body
+    //     init; if (cond) goto body else goto exit
+    //   body:  body; goto latch
+    //   latch: incr; if (cond) goto body else goto exit
+    //   exit:
+    //
+    // `while` is the same without init and incr; `do` enters the body without
+    // the first test. `continue` jumps to the latch.
+    void lower_for(const ParseNode* node) {
+        m_scopes.push_back(map<string, LocalVariable>());
+        const ParseNode* init = node->children[0];
+        if (init->type == "VariableDeclarationStatement") lower_local_declaration(init);
+        else if (init->type == "ExpressionStatement") lower_expression(init->children[0]);
+        const ParseNode* cond = node->children[1];
+        const ParseNode* increment = node->children[2];
+        lower_loop(cond->type == "Empty" ? nullptr : cond, node->children[3],
+                   increment->type == "Empty" ? nullptr : increment, true);
+        m_scopes.pop_back();
+    }
+
+    // `cond` is null for a loop without a condition.
+    void lower_loop(const ParseNode* cond, const ParseNode* body, const ParseNode* increment, bool test_first) {
+        int body_block = function().new_block(m_loop_depth + 1);
+        int latch_block = function().new_block(m_loop_depth + 1);
+        int exit_block = function().new_block(m_loop_depth);
+        if (test_first) emit_loop_test(cond, body_block, exit_block);
+        else emit_jump(body_block);
+
+        m_loop_depth++;
+        m_current_block = body_block;
+        m_break_targets.push_back(exit_block);
+        m_continue_targets.push_back(latch_block);
+        lower_statement(body);
+        m_continue_targets.pop_back();
+        m_break_targets.pop_back();
+        emit_jump(latch_block);
+
+        m_current_block = latch_block;
+        if (increment) lower_expression(increment);
+        emit_loop_test(cond, body_block, exit_block);
+        m_loop_depth--;
+        m_current_block = exit_block;
+    }
+
+    void emit_loop_test(const ParseNode* cond, int body_block, int exit_block) {
+        if (!cond) emit_jump(body_block);
+        else emit_branch(condition_vreg(lower_expression(cond), cond->line), body_block, exit_block);
+    }
+
+    void lower_break(const ParseNode* node) {
+        if (m_break_targets.empty()) report_error(node->line, "Break statement not within a loop or switch.");
+        emit_jump(m_break_targets.back());
+    }
+
+    void lower_continue(const ParseNode* node) {
+        if (m_continue_targets.empty()) report_error(node->line, "Continue statement not within a loop.");
+        emit_jump(m_continue_targets.back());
+    }
+
+    // Labels are per function and may be used before they are defined; the
+    // block of a label is made by whichever comes first.
+    int label_block(const string& name) {
+        map<string, int>::iterator label = m_labels.find(name);
+        if (label != m_labels.end()) return label->second;
+        int block = function().new_block(m_loop_depth);
+        m_labels[name] = block;
+        return block;
+    }
+
+    void lower_label(const ParseNode* node) {
+        if (!m_defined_labels.insert(node->value).second) report_error(node->line, "Duplicate label '" + node->value + "'.");
+        int block = label_block(node->value);
+        function().blocks[block].loop_depth = m_loop_depth;
+        emit_jump(block);
+        m_current_block = block;
+        lower_statement(node->children[0]);
+    }
+
+    void lower_goto(const ParseNode* node) {
+        if (!m_label_uses.count(node->value)) m_label_uses[node->value] = node->line;
+        emit_jump(label_block(node->value));
+    }
+
+    // switch (x) body: the labels must be on the statements of the body
+    // itself (`case 1: case 2: stmt` labels one statement twice). Every
+    // labelled statement starts a block; the dispatch jumps straight to them
+    // (see switch_lowering.h) and control falls through from one to the next.
+    void lower_switch(const ParseNode* node) {
+        Value selector = lower_expression(node->children[0]);
+        if (selector.type != IrType::Int) report_error(node->line, "Switch quantity is not an integer.");
+        int exit_block = function().new_block(m_loop_depth);
+
+        const ParseNode* body = node->children[1];
+        vector<const ParseNode*> statements;
+        if (body->type == "BlockStatement") statements.assign(body->children.begin(), body->children.end());
+        else statements.push_back(body);
+        vector<SwitchCase> cases;
+        int default_block = -1;
+        vector<int> statement_block(statements.size(), -1);
+        for (size_t i = 0; i < statements.size(); ++i) {
+            while (statements[i]->type == "CaseStatement" || statements[i]->type == "DefaultStatement") {
+                const ParseNode* label = statements[i];
+                if (statement_block[i] < 0) statement_block[i] = function().new_block(m_loop_depth);
+                if (label->type == "DefaultStatement") {
+                    if (default_block >= 0) report_error(label->line, "Multiple default labels in one switch.");
+                    default_block = statement_block[i];
+                } else {
+                    bool is_float = false;
+                    long long value = (int)(long long)evaluate_constant(label->children[0], is_float, "Case label");
+                    if (is_float) report_error(label->line, "Case label is not an integer constant.");
+                    for (const SwitchCase& c : cases) {
+                        if (c.value == value) report_error(label->line, "Duplicate case value " + to_string(value) + ".");
+                    }
+                    cases.push_back(SwitchCase{value, statement_block[i]});
+                }
+                statements[i] = label->children.back();
+            }
+        }
+        sort(cases.begin(), cases.end(), [](const SwitchCase& x, const SwitchCase& y) { return x.value < y.value; });
+        vector<SwitchCluster> clusters = cluster_switch_cases(cases);
+        emit_switch_search(selector.vreg, clusters, 0, clusters.size(), INT_MIN, INT_MAX,
+                           default_block >= 0 ? default_block : exit_block);
+
+        // Statements before the first label are unreachable; they get a block
+        // without predecessors, removed with the other unreachable ones.
+        m_current_block = function().new_block(m_loop_depth);
+        m_scopes.push_back(map<string, LocalVariable>());
+        m_break_targets.push_back(exit_block);
+        for (size_t i = 0; i < statements.size(); ++i) {
+            if (statement_block[i] >= 0) {
+                emit_jump(statement_block[i]);
+                m_current_block = statement_block[i];
+            }
+            lower_statement(statements[i]);
+        }
+        m_break_targets.pop_back();
+        m_scopes.pop_back();
+        emit_jump(exit_block);
+        m_current_block = exit_block;
+    }
+
+    // --- SWITCH DISPATCH ---
+    // A binary search over clusters[first..last) on their lowest values; only
+    // values in [low, high] reach this point, so tests those bounds already
+    // decide are left out. A few clusters are simply tested in turn.
+    void emit_switch_search(int x, const vector<SwitchCluster>& clusters, size_t first, size_t last, long long low,
+                            long long high, int default_block) {
+        static const size_t kLinearClusters = 3;
+        if (first == last) {
+            emit_jump(default_block);
+            return;
+        }
+        if (last - first <= kLinearClusters) {
+            for (size_t i = first; i < last; ++i) {
+                int miss = i + 1 < last ? function().new_block(m_loop_depth) : default_block;
+                emit_switch_cluster(x, clusters[i], low, high, miss, default_block);
+                if (i + 1 < last) m_current_block = miss;
+            }
+            return;
+        }
+        size_t middle = first + (last - first) / 2;
+        long long pivot = clusters[middle].low;
+        int left = function().new_block(m_loop_depth);
+        int right = function().new_block(m_loop_depth);
+        emit_branch(emit_int_binary(IrOp::Lt, x, emit_const(pivot)), left, right);
+        m_current_block = left;
+        emit_switch_search(x, clusters, first, middle, low, pivot - 1, default_block);
+        m_current_block = right;
+        emit_switch_search(x, clusters, middle, last, pivot, high, default_block);
+    }
+
+    // Goes to `hit` when cluster_low <= x <= cluster_high and to `miss`
+    // otherwise, leaving out the tests that the known bounds [low, high] decide.
+    void emit_range_check(int x, long long cluster_low, long long cluster_high, long long low, long long high,
+                          int hit, int miss) {
+        bool check_low = cluster_low > low, check_high = cluster_high < high;
+        if (!check_low && !check_high) {
+            emit_jump(hit);
+            return;
+        }
+        if (cluster_low == cluster_high) {
+            emit_branch(emit_int_binary(IrOp::Eq, x, emit_const(cluster_low)), hit, miss);
+            return;
+        }
+        if (check_low && check_high) {
+            int next = function().new_block(m_loop_depth);
+            emit_branch(emit_int_binary(IrOp::Ge, x, emit_const(cluster_low)), next, miss);
+            m_current_block = next;
+            check_low = false;
+        }
+        if (check_low) emit_branch(emit_int_binary(IrOp::Ge, x, emit_const(cluster_low)), hit, miss);
+        else emit_branch(emit_int_binary(IrOp::Le, x, emit_const(cluster_high)), hit, miss);
+    }
+
+    // Values the cluster covers go to their case; the values between its
+    // cases go to the default, everything else to `miss`.
+    void emit_switch_cluster(int x, const SwitchCluster& cluster, long long low, long long high, int miss,
+                             int default_block) {
+        if (cluster.kind == SwitchClusterKind::Range) {
+            emit_range_check(x, cluster.low, cluster.high, low, high, cluster.block, miss);
+            return;
+        }
+        if (cluster.kind == SwitchClusterKind::JumpTable) {
+            IrInst dispatch(IrOp::Switch);
+            dispatch.a = x;
+            dispatch.imm = cluster.low;
+            dispatch.target = miss;
+            dispatch.table.assign(cluster.high - cluster.low + 1, default_block);
+            for (const SwitchCase& c : cluster.cases) dispatch.table[c.value - cluster.low] = c.block;
+            emit(dispatch);
+            return;
+        }
+        // Bit test: one mask of x - low per target, most frequent target first.
+        int tests = function().new_block(m_loop_depth);
+        emit_range_check(x, cluster.low, cluster.high, low, high, tests, miss);
+        m_current_block = tests;
+        int bit = cluster.low == 0 ? x : emit_int_binary(IrOp::Sub, x, emit_const(cluster.low));
+        struct Mask {
+            int block;
+            unsigned long long bits;
+            int cases;
+        };
+        vector<Mask> masks;
+        for (const SwitchCase& c : cluster.cases) {
+            size_t t = 0;
+            while (t < masks.size() && masks[t].block != c.block) t++;
+            if (t == masks.size()) masks.push_back(Mask{c.block, 0, 0});
+            masks[t].bits |= 1ULL << (c.value - cluster.low);
+            masks[t].cases++;
+        }
+        stable_sort(masks.begin(), masks.end(), [](const Mask& p, const Mask& q) { return p.cases > q.cases; });
+        for (size_t t = 0; t < masks.size(); ++t) {
+            IrInst test(IrOp::TestBit, IrType::Int);
+            test.dest = function().new_vreg(IrType::Int);
+            test.a = bit;
+            test.imm = (long long)masks[t].bits;
+            emit(test);
+            int next = t + 1 < masks.size() ? function().new_block(m_loop_depth) : default_block;
+            emit_branch(test.dest, masks[t].block, next);
+            if (t + 1 < masks.size()) m_current_block = next;
+        }
+    }
+
+    void lower_return(const ParseNode* node) {
+        IrType return_type = function().return_type;
+        IrInst ret(IrOp::Ret, return_type);
+        if (!node->children.empty()) {
+            if (return_type == IrType::Void) report_error(node->line, "Void function should not return a value.");
+            ret.a = convert(lower_expression(node->children[0]), return_type, node->line).vreg;
+        } else if (return_type != IrType::Void) {
+            report_error(node->line, "Non-void function should return a value.");
+        }
+        emit(ret);
+    }
+
+    // Branches test an Int vreg against zero; floating conditions are compared first.
+    int condition_vreg(Value value, int line) {
+        if (value.type == IrType::Void) report_error(line, "A void value cannot be used as a condition.");
+        if (value.type == IrType::Int) return value.vreg;
+        IrInst zero(IrOp::FConst, value.type);
+        zero.dest = function().new_vreg(value.type);
+        emit(zero);
+        IrInst compare(IrOp::Ne, IrType::Int);
+        compare.operand_type = value.type;
+        compare.dest = function().new_vreg(IrType::Int);
+        compare.a = value.vreg;
+        compare.b = zero.dest;
+        emit(compare);
+        return compare.dest;
+    }
+
+    // --- EXPRESSIONS ---
+    Value lower_expression(const ParseNode* node) {
+        const string& type = node->type;
+        if (type == "Constant") return lower_constant(node);
+        if (type == "Identifier") return lower_identifier(node);
+        if (type == "AssignmentExpression") return lower_assignment(node);
+        if (type == "BinaryExpression") return lower_binary(node);
+        if (type == "CallExpression") return lower_call(node);
+        report_error(node->line, "Unsupported expression '" + type + "'.");
+        return Value{-1, IrType::Void};
+    }
+
+    Value lower_constant(const ParseNode* node) {
+        if (node->value.find('.') != string::npos) {
+            IrInst inst(IrOp::FConst, IrType::Double);
+            inst.dest = function().new_vreg(IrType::Double);
+            inst.fimm = stod(node->value);
+            emit(inst);
+            return Value{inst.dest, IrType::Double};
+        }
+        return Value{emit_const(stoll(node->value)), IrType::Int};
+    }
+
+    Value lower_identifier(const ParseNode* node) {
+        if (LocalVariable* local = find_local(node->value)) {
+            return Value{local->vreg, value_type(local->type)};
+        }
+        if (const IrGlobal* global = m_module->find_global(node->value)) {
+            IrInst load(IrOp::LoadGlobal, value_type(global->type));
+            load.operand_type = global->type;
+            load.dest = function().new_vreg(load.type);
+            load.symbol = global->name;
+            emit(load);
+            return Value{load.dest, load.type};
+        }
+        report_error(node->line, "Use of undeclared identifier '" + node->value + "'.");
+        return Value{-1, IrType::Void};
+    }
+
+    Value lower_assignment(const ParseNode* node) {
+        const ParseNode* target = node->children[0];
+        if (target->type != "Identifier") report_error(node->line, "Left side of assignment is not assignable.");
+        Value value = lower_expression(node->children[1]);
+        if (LocalVariable* local = find_local(target->value)) {
+            if (local->is_const) report_error(node->line, "Assignment to const variable '" + target->value + "'.");
+            value = convert(value, local->type, node->line);
+            IrInst copy(IrOp::Copy, value.type);
+            copy.dest = local->vreg;
+            copy.a = value.vreg;
+            emit(copy);
+            return Value{local->vreg, value.type};
+        }
+        if (const IrGlobal* global = m_module->find_global(target->value)) {
+            if (global->is_const) report_error(node->line, "Assignment to const variable '" + target->value + "'.");
+            value = convert(value, global->type, node->line);
+            IrInst store(IrOp::StoreGlobal, value.type);
+            store.operand_type = global->type;
+            store.a = value.vreg;
+            store.symbol = global->name;
+            emit(store);
+            return value;
+        }
+        report_error(target->line, "Use of undeclared identifier '" + target->value + "'.");
+        return Value{-1, IrType::Void};
+    }
+
+    Value lower_binary(const ParseNode* node) {
+        Value left = lower_expression(node->children[0]);
+        Value right = lower_expression(node->children[1]);
+        if (left.type == IrType::Void || right.type == IrType::Void) {
+            report_error(node->line, "A void value cannot be used in an expression.");
+        }
+        // Usual arithmetic conversions.
+        IrType common = IrType::Int;
+        if (left.type == IrType::Double || right.type == IrType::Double) common = IrType::Double;
+        else if (left.type == IrType::Float || right.type == IrType::Float) common = IrType::Float;
+        left = convert(left, common, node->line);
+        right = convert(right, common, node->line);
+
+        static const map<string, IrOp> operators = {
+            {"+", IrOp::Add}, {"-", IrOp::Sub}, {"*", IrOp::Mul}, {"/", IrOp::Div},
+            {"==", IrOp::Eq}, {"!=", IrOp::Ne}, {"<", IrOp::Lt}, {">", IrOp::Gt},
+            {"<=", IrOp::Le}, {">=", IrOp::Ge}};
+        auto op = operators.find(node->value);
+        if (op == operators.end()) report_error(node->line, "Unsupported operator '" + node->value + "'.");
+
+        IrType result_type = is_comparison(op->second) ? IrType::Int : common;
+        IrInst inst(op->second, result_type);
+        inst.operand_type = common;
+        inst.dest = function().new_vreg(result_type);
+        inst.a = left.vreg;
+        inst.b = right.vreg;
+        emit(inst);
+        return Value{inst.dest, result_type};
+    }
+
+    Value lower_call(const ParseNode* node) {
+        auto signature = m_signatures.find(node->value);
+        if (signature == m_signatures.end()) {
+            report_error(node->line, "Call to undeclared function '" + node->value + "'.");
+        }
+        const vector<IrType>& param_types = signature->second.param_types;
+        if (param_types.size() != node->children.size()) {
+            report_error(node->line, "Function '" + node->value + "' expects " + to_string(param_types.size()) +
+                                     " argument(s), but " + to_string(node->children.size()) + " were given.");
+        }
+        IrType return_type = signature->second.return_type;
+        IrInst call(IrOp::Call, value_type(return_type));
+        call.symbol = node->value;
+        for (size_t i = 0; i < node->children.size(); ++i) {
+            call.args.push_back(convert(lower_expression(node->children[i]), param_types[i], node->line).vreg);
+        }
+        if (return_type != IrType::Void) call.dest = function().new_vreg(call.type);
+        emit(call);
+        if (return_type == IrType::Char) {
+            // Only the low byte of a char return value is meaningful.
+            return convert(Value{call.dest, IrType::Int}, IrType::Char, node->line);
+        }
+        return Value{call.dest, call.type};
+    }
+};
+
+// ===================================================================
+// ===         IR PRINTING                                         ===
+// ===================================================================
+
+inline string ir_op_name(IrOp op) {
+    switch (op) {
+        case IrOp::Const: return "const";
+        case IrOp::FConst: return "fconst";
+        case IrOp::Copy: return "copy";
+        case IrOp::Add: return "add";
+        case IrOp::Sub: return "sub";
+        case IrOp::Mul: return "mul";
+        case IrOp::Div: return "div";
+        case IrOp::Eq: return "eq";
+        case IrOp::Ne: return "ne";
+        case IrOp::Lt: return "lt";
+        case IrOp::Gt: return "gt";
+        case IrOp::Le: return "le";
+        case IrOp::Ge: return "ge";
+        case IrOp::Convert: return "convert";
+        case IrOp::TruncChar: return "truncchar";
+        case IrOp::TestBit: return "testbit";
+        case IrOp::LoadGlobal: return "load";
+        case IrOp::StoreGlobal: return "store";
+        case IrOp::Call: return "call";
+        case IrOp::Jump: return "jmp";
+        case IrOp::Branch: return "br";
+        case IrOp::Switch: return "switch";
+        case IrOp::Ret: return "ret";
+    }
+    return "?";
+}
+
+inline void print_ir_inst(const IrInst& inst, ostream& out) {
+    out << "  ";
+    if (inst.dest >= 0) out << "v" << inst.dest << " = ";
+    out << ir_op_name(inst.op);
+    switch (inst.op) {
+        case IrOp::Const: out << " " << inst.imm; break;
+        case IrOp::FConst: out << "." << type_name(inst.type) << " " << inst.fimm; break;
+        case IrOp::Copy: case IrOp::TruncChar: out << " v" << inst.a; break;
+        case IrOp::Convert: out << "." << type_name(inst.type) << "." << type_name(inst.operand_type) << " v" << inst.a; break;
+        case IrOp::LoadGlobal: out << "." << type_name(inst.operand_type) << " @" << inst.symbol; break;
+        case IrOp::StoreGlobal: out << "." << type_name(inst.operand_type) << " @" << inst.symbol << ", v" << inst.a; break;
+        case IrOp::Call:
+            out << " " << inst.symbol << "(";
+            for (size_t i = 0; i < inst.args.size(); ++i) out << (i ? ", v" : "v") << inst.args[i];
+            out << ")";
+            if (inst.tail_call) out << " tail";
+            break;
+        case IrOp::Jump: out << " bb" << inst.target; break;
+        case IrOp::Branch: out << " v" << inst.a << ", bb" << inst.target << ", bb" << inst.target_false; break;
+        case IrOp::TestBit: out << " v" << inst.a << ", 0x" << hex << (unsigned long long)inst.imm << dec; break;
+        case IrOp::Switch:
+            out << " v" << inst.a << " - " << inst.imm << ", [";
+            for (size_t i = 0; i < inst.table.size(); ++i) out << (i ? ", bb" : "bb") << inst.table[i];
+            out << "], bb" << inst.target;
+            break;
+        case IrOp::Ret: if (inst.a >= 0) out << " v" << inst.a; break;
+        default: out << "." << type_name(inst.operand_type) << " v" << inst.a << ", v" << inst.b; break;
+    }
+    out << endl;
+}
+
+inline void print_ir_function(const IrFunction& function, ostream& out) {
+    out << (function.defined ? "function " : "declare ") << type_name(function.return_type) << " " << function.name << "(";
+    for (size_t i = 0; i < function.param_types.size(); ++i) {
+        if (i) out << ", ";
+        out << type_name(function.param_types[i]);
+        if (function.defined) out << " v" << function.params[i];
+    }
+    out << ")";
+    if (!function.defined) {
+        out << endl;
+        return;
+    }
+    out << " {" << endl;
+    for (const IrBlock& block : function.blocks) {
+        out << "bb" << block.id << ":";
+        if (block.loop_depth > 0) out << "    ; loop depth " << block.loop_depth;
+        out << endl;
+        for (const IrInst& inst : block.insts) print_ir_inst(inst, out);
+    }
+    out << "}" << endl;
+}
+
+inline void print_ir(const IrModule& module, ostream& out) {
+    for (const IrGlobal& global : module.globals) {
+        out << "global " << (global.is_const ? "const " : "") << type_name(global.type) << " @" << global.name << " = ";
+        if (global.type == IrType::Float || global.type == IrType::Double) out << global.finit;
+        else out << global.init;
+        out << endl;
+    }
+    for (const IrFunction& function : module.functions) {
+        print_ir_function(function, out);
+    }
+}
+
+#endif
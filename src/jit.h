@@ -0,0 +1,184 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "native_call.h"
+#include "x86_64_encoder.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+using namespace std;
+
+// ===================================================================
+// ===         IN-MEMORY EXECUTION (JIT)                           ===
+// ===================================================================
+// Loads an encoded module into executable memory of this process and hands
+// out pointers to its functions. The memory is mapped writable, filled and
+// relocated, and only then made executable (never writable and executable at
+// the same time):
+//
+//     code pages      r-x   functions, then one jump stub per external function
+//     constant pages  r--   .rodata
+//     data pages      rw-   globals
+//
+// External functions (`putchar`, ...) are looked up in the running process
+// with find_native_function. They may be anywhere in the address space, so
+// calls reach them through a stub `jmp *addr(%rip)` next to the code, which a
+// rel32 call can always reach.
+
+// How a module is linked with memory outside of it (used by tiered.h).
+struct JitLinkOptions {
+    map<string, uint8_t*> globals;   // globals living elsewhere; the module's own copies go unused
+    uint8_t* near = nullptr;         // map the code close to this address if possible
+};
+
+class JitModule {
+public:
+    JitModule() {}
+    ~JitModule() { release(); }
+    JitModule(const JitModule&) = delete;
+    JitModule& operator=(const JitModule&) = delete;
+
+    // Returns false with a message in `error` when the module cannot be loaded.
+    // References must be within rel32 reach of the code, which is always the
+    // case for the module's own data but has to be checked for `options.globals`.
+    bool load(const EncodedModule& module, string& error, const JitLinkOptions* options = nullptr) {
+#if JIT_SUPPORTED
+        release();
+        vector<string> externals;
+        for (const CodeRelocation& relocation : module.relocations) {
+            if (relocation.is_call && find(externals.begin(), externals.end(), relocation.symbol) == externals.end()) {
+                externals.push_back(relocation.symbol);
+            }
+        }
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t stubs_offset = (module.text.size() + 15) & ~(size_t)15;
+        size_t code_size = round_up(stubs_offset + kStubSize * externals.size(), page);
+        size_t rodata_size = round_up(module.rodata.size(), page);
+        size_t data_size = round_up(module.data.size(), page);
+        m_size = code_size + rodata_size + data_size;
+        // A hint only: the kernel may place the mapping elsewhere.
+        void* hint = nullptr;
+        if (options && options->near && (uintptr_t)options->near > m_size + kNearDistance) {
+            hint = (void*)(((uintptr_t)options->near - m_size - kNearDistance) & ~(uintptr_t)(page - 1));
+        }
+        void* memory = mmap(hint, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            m_size = 0;
+            error = "could not allocate memory for the program";
+            return false;
+        }
+        m_memory = (uint8_t*)memory;
+        uint8_t* code = m_memory;
+        uint8_t* rodata = code + code_size;
+        uint8_t* data = rodata + rodata_size;
+        if (!module.text.empty()) memcpy(code, module.text.data(), module.text.size());
+        if (!module.rodata.empty()) memcpy(rodata, module.rodata.data(), module.rodata.size());
+        if (!module.data.empty()) memcpy(data, module.data.data(), module.data.size());
+
+        // Stubs: jmp *0(%rip) followed by the 8-byte target address.
+        map<string, uint8_t*> stubs;
+        for (size_t i = 0; i < externals.size(); ++i) {
+            void* target = find_native_function(externals[i]);
+            if (!target) {
+                error = "undefined reference to '" + externals[i] + "'";
+                release();
+                return false;
+            }
+            uint8_t* stub = code + stubs_offset + kStubSize * i;
+            static const uint8_t jump[6] = {0xFF, 0x25, 0, 0, 0, 0};
+            memcpy(stub, jump, sizeof(jump));
+            uint64_t address = (uint64_t)(uintptr_t)target;
+            memcpy(stub + sizeof(jump), &address, 8);
+            stubs[externals[i]] = stub;
+        }
+
+        for (const CodeRelocation& relocation : module.relocations) {
+            uint8_t* target;
+            if (relocation.is_call) {
+                target = stubs[relocation.symbol];
+            } else if (options && options->globals.count(relocation.symbol)) {
+                target = options->globals.find(relocation.symbol)->second;
+            } else if (const EncodedSymbol* constant = module.find(module.constants, relocation.symbol)) {
+                target = rodata + constant->offset;
+            } else if (const EncodedSymbol* global = module.find(module.globals, relocation.symbol)) {
+                target = data + global->offset;
+            } else {
+                error = "undefined reference to '" + relocation.symbol + "'";
+                release();
+                return false;
+            }
+            uint8_t* field = code + relocation.offset;
+            int64_t value = (int64_t)((intptr_t)target - (intptr_t)field) + relocation.addend;
+            if (value != (int32_t)value) {
+                error = "'" + relocation.symbol + "' is out of reach of the code";
+                release();
+                return false;
+            }
+            int32_t value32 = (int32_t)value;
+            memcpy(field, &value32, 4);
+        }
+
+        if (mprotect(code, code_size, PROT_READ | PROT_EXEC) != 0 ||
+            (rodata_size && mprotect(rodata, rodata_size, PROT_READ) != 0)) {
+            error = "could not make the program executable";
+            release();
+            return false;
+        }
+        for (const EncodedSymbol& function : module.functions) m_functions[function.name] = code + function.offset;
+        for (const EncodedSymbol& global : module.globals) m_globals[global.name] = data + global.offset;
+        return true;
+#else
+        (void)module;
+        (void)options;
+        error = "in-memory execution is only supported on x86-64 Unix systems";
+        return false;
+#endif
+    }
+
+    // Address of a function of the loaded module, or nullptr.
+    void* function(const string& name) const {
+        auto it = m_functions.find(name);
+        return it == m_functions.end() ? nullptr : it->second;
+    }
+
+    // Address of a global of the loaded module, or nullptr.
+    void* global(const string& name) const {
+        auto it = m_globals.find(name);
+        return it == m_globals.end() ? nullptr : it->second;
+    }
+
+private:
+    static const size_t kStubSize = 16; // 6-byte jmp, 8-byte address, padding
+    static const size_t kNearDistance = 64 << 20;
+
+    uint8_t* m_memory = nullptr;
+    size_t m_size = 0;
+    map<string, void*> m_functions;
+    map<string, void*> m_globals;
+
+    static size_t round_up(size_t size, size_t page) { return (size + page - 1) / page * page; }
+
+    void release() {
+#if JIT_SUPPORTED
+        if (m_memory) munmap(m_memory, m_size);
+#endif
+        m_memory = nullptr;
+        m_size = 0;
+        m_functions.clear();
+        m_globals.clear();
+    }
+};
+
+#endif
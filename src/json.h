@@ -0,0 +1,349 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// ===================================================================
+// ===         JSON VALUES                                         ===
+// ===================================================================
+// Just enough JSON for the language server protocol: a value tree, a strict
+// parser and a compact writer. Objects keep their members in insertion order
+// and look keys up linearly; protocol messages have a handful of members.
+
+class JsonValue {
+public:
+    enum class Kind { Null, Bool, Number, String, Array, Object };
+
+    JsonValue() {}
+    JsonValue(bool value) : m_kind(Kind::Bool), m_bool(value) {}
+    JsonValue(int value) : m_kind(Kind::Number), m_number(value) {}
+    JsonValue(long long value) : m_kind(Kind::Number), m_number((double)value) {}
+    JsonValue(double value) : m_kind(Kind::Number), m_number(value) {}
+    JsonValue(const string& value) : m_kind(Kind::String), m_text(value) {}
+    JsonValue(const char* value) : m_kind(Kind::String), m_text(value) {}
+
+    static JsonValue array() {
+        JsonValue value;
+        value.m_kind = Kind::Array;
+        return value;
+    }
+    static JsonValue object() {
+        JsonValue value;
+        value.m_kind = Kind::Object;
+        return value;
+    }
+
+    Kind kind() const { return m_kind; }
+    bool is_null() const { return m_kind == Kind::Null; }
+    bool as_bool() const { return m_kind == Kind::Bool && m_bool; }
+    long long as_int() const { return m_kind == Kind::Number ? (long long)m_number : 0; }
+    const string& as_string() const { return m_text; }
+    const vector<JsonValue>& items() const { return m_items; }
+
+    // The member `key`, or null when there is none.
+    const JsonValue& operator[](const string& key) const {
+        static const JsonValue null_value;
+        for (const pair<string, JsonValue>& member : m_members) {
+            if (member.first == key) return member.second;
+        }
+        return null_value;
+    }
+
+    JsonValue& set(const string& key, JsonValue value) {
+        m_kind = Kind::Object;
+        m_members.emplace_back(key, move(value));
+        return *this;
+    }
+
+    JsonValue& push(JsonValue value) {
+        m_kind = Kind::Array;
+        m_items.push_back(move(value));
+        return *this;
+    }
+
+    string dump() const {
+        string out;
+        write(out);
+        return out;
+    }
+
+    void write(string& out) const {
+        switch (m_kind) {
+        case Kind::Null: out += "null"; break;
+        case Kind::Bool: out += m_bool ? "true" : "false"; break;
+        case Kind::Number: {
+            char buffer[32];
+            if (m_number == floor(m_number) && fabs(m_number) < 1e15) {
+                // Integers (lines, columns, ids) are most of what is written.
+                long long value = (long long)m_number;
+                unsigned long long magnitude = value < 0 ? -(unsigned long long)value : value;
+                char* end = buffer + sizeof(buffer);
+                char* digits = end;
+                do {
+                    *--digits = (char)('0' + magnitude % 10);
+                    magnitude /= 10;
+                } while (magnitude > 0);
+                if (value < 0) *--digits = '-';
+                out.append(digits, end - digits);
+            } else {
+                snprintf(buffer, sizeof(buffer), "%.17g", m_number);
+                out += buffer;
+            }
+            break;
+        }
+        case Kind::String: write_string(m_text, out); break;
+        case Kind::Array:
+            out += '[';
+            for (size_t i = 0; i < m_items.size(); ++i) {
+                if (i > 0) out += ',';
+                m_items[i].write(out);
+            }
+            out += ']';
+            break;
+        case Kind::Object:
+            out += '{';
+            for (size_t i = 0; i < m_members.size(); ++i) {
+                if (i > 0) out += ',';
+                write_string(m_members[i].first, out);
+                out += ':';
+                m_members[i].second.write(out);
+            }
+            out += '}';
+            break;
+        }
+    }
+
+private:
+    Kind m_kind = Kind::Null;
+    bool m_bool = false;
+    double m_number = 0;
+    string m_text;
+    vector<JsonValue> m_items;
+    vector<pair<string, JsonValue>> m_members;
+
+    static void write_string(const string& text, string& out) {
+        out += '"';
+        size_t run = 0;   // start of the characters that need no escape
+        for (size_t i = 0; i < text.size(); ++i) {
+            unsigned char c = text[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(text, run, i - run);
+            run = i + 1;
+            switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out += buffer;
+            }
+            }
+        }
+        out.append(text, run, string::npos);
+        out += '"';
+    }
+};
+
+// --- PARSER ---
+
+class JsonParser {
+public:
+    explicit JsonParser(const string& text) : m_text(text) {}
+
+    // The whole text as one value; false on malformed input.
+    bool parse(JsonValue& value) {
+        skip_space();
+        if (!parse_value(value, 0)) return false;
+        skip_space();
+        return m_pos == m_text.size();
+    }
+
+private:
+    static const int kMaxDepth = 256;
+
+    const string& m_text;
+    size_t m_pos = 0;
+
+    void skip_space() {
+        while (m_pos < m_text.size() &&
+               (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\n' || m_text[m_pos] == '\r')) {
+            m_pos++;
+        }
+    }
+
+    bool consume(const char* word) {
+        size_t length = strlen(word);
+        if (m_text.compare(m_pos, length, word) != 0) return false;
+        m_pos += length;
+        return true;
+    }
+
+    bool parse_value(JsonValue& value, int depth) {
+        if (m_pos >= m_text.size() || depth > kMaxDepth) return false;
+        char c = m_text[m_pos];
+        if (c == '{') return parse_object(value, depth);
+        if (c == '[') return parse_array(value, depth);
+        if (c == '"') {
+            string text;
+            if (!parse_string(text)) return false;
+            value = JsonValue(text);
+            return true;
+        }
+        if (consume("true")) { value = JsonValue(true); return true; }
+        if (consume("false")) { value = JsonValue(false); return true; }
+        if (consume("null")) { value = JsonValue(); return true; }
+        return parse_number(value);
+    }
+
+    bool parse_object(JsonValue& value, int depth) {
+        value = JsonValue::object();
+        m_pos++;
+        skip_space();
+        if (m_pos < m_text.size() && m_text[m_pos] == '}') {
+            m_pos++;
+            return true;
+        }
+        for (;;) {
+            string key;
+            JsonValue member;
+            skip_space();
+            if (m_pos >= m_text.size() || m_text[m_pos] != '"' || !parse_string(key)) return false;
+            skip_space();
+            if (m_pos >= m_text.size() || m_text[m_pos++] != ':') return false;
+            skip_space();
+            if (!parse_value(member, depth + 1)) return false;
+            value.set(key, move(member));
+            skip_space();
+            if (m_pos >= m_text.size()) return false;
+            char c = m_text[m_pos++];
+            if (c == '}') return true;
+            if (c != ',') return false;
+        }
+    }
+
+    bool parse_array(JsonValue& value, int depth) {
+        value = JsonValue::array();
+        m_pos++;
+        skip_space();
+        if (m_pos < m_text.size() && m_text[m_pos] == ']') {
+            m_pos++;
+            return true;
+        }
+        for (;;) {
+            JsonValue item;
+            skip_space();
+            if (!parse_value(item, depth + 1)) return false;
+            value.push(move(item));
+            skip_space();
+            if (m_pos >= m_text.size()) return false;
+            char c = m_text[m_pos++];
+            if (c == ']') return true;
+            if (c != ',') return false;
+        }
+    }
+
+    bool parse_number(JsonValue& value) {
+        size_t start = m_pos;
+        if (m_pos < m_text.size() && m_text[m_pos] == '-') m_pos++;
+        while (m_pos < m_text.size() && (isdigit((unsigned char)m_text[m_pos]) || m_text[m_pos] == '.' ||
+                                         m_text[m_pos] == 'e' || m_text[m_pos] == 'E' || m_text[m_pos] == '+' ||
+                                         m_text[m_pos] == '-')) {
+            m_pos++;
+        }
+        if (m_pos == start) return false;
+        string number = m_text.substr(start, m_pos - start);
+        char* end;
+        double parsed = strtod(number.c_str(), &end);
+        if (*end != '\0') return false;
+        value = JsonValue(parsed);
+        return true;
+    }
+
+    bool parse_hex4(unsigned& code) {
+        if (m_text.size() - m_pos < 4) return false;
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = m_text[m_pos++];
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return false;
+        }
+        return true;
+    }
+
+    static void append_utf8(unsigned code, string& out) {
+        if (code < 0x80) {
+            out += (char)code;
+        } else if (code < 0x800) {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        } else {
+            out += (char)(0xF0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3F));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+    }
+
+    bool parse_string(string& text) {
+        m_pos++;   // the opening quote
+        for (;;) {
+            if (m_pos >= m_text.size()) return false;
+            char c = m_text[m_pos++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                text += c;
+                continue;
+            }
+            if (m_pos >= m_text.size()) return false;
+            char escape = m_text[m_pos++];
+            switch (escape) {
+            case '"': text += '"'; break;
+            case '\\': text += '\\'; break;
+            case '/': text += '/'; break;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            case 'u': {
+                unsigned code;
+                if (!parse_hex4(code)) return false;
+                if (code >= 0xD800 && code < 0xDC00 && m_text.compare(m_pos, 2, "\\u") == 0) {
+                    m_pos += 2;
+                    unsigned low;
+                    if (!parse_hex4(low) || low < 0xDC00 || low >= 0xE000) return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(code, text);
+                break;
+            }
+            default: return false;
+            }
+        }
+    }
+};
+
+inline bool parse_json(const string& text, JsonValue& value) {
+    return JsonParser(text).parse(value);
+}
+
+#endif
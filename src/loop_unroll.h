@@ -0,0 +1,392 @@
+#ifndef LOOP_UNROLL_H
+#define LOOP_UNROLL_H
+
+#include <climits>
+#include <vector>
+#include "ir.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         COUNTED LOOP UNROLLING                              ===
+// ===================================================================
+// Innermost counted loops, which IrLowering emits rotated (the exit test at
+// the bottom, see IrLowering::lower_loop)
+//
+//     header:  ...body...
+//     latch:   t = add i, 1
+//              i = copy t
+//              c = lt i, limit       (or le)
+//              br c, header, exit
+//
+// are given a second, unrolled copy of themselves that runs kFactor
+// iterations per trip around the loop and tests the exit condition once per
+// trip instead of once per iteration:
+//
+//     entry:   if at least kFactor iterations remain: goto body.0 else header
+//     body.0 -> body.1 -> ... -> body.(kFactor-1) -> guard
+//     guard:   if at least kFactor iterations remain: goto body.0
+//              else if i < limit: goto header else goto exit
+//
+// The original loop stays behind the guards as the epilogue that runs the
+// remaining (fewer than kFactor) iterations; the copies leave out its exit
+// test. The body copies reuse the same vregs: the IR is not in SSA form and
+// the copies run one after another. The header and latch may be one block.
+//
+// A loop qualifies when `i` changes nowhere in it but in the latch increment
+// (so exactly one increment happens per iteration), `limit` is a constant or
+// never assigned in the loop, and the exit test computes nothing else the
+// loop reads.
+
+class LoopUnroller {
+public:
+    static const int kFactor = 4;
+    static const int kMaxBodySize = 40;   // instructions in one copy of the body
+
+    LoopUnroller(IrModule& module) : m_module(module) {}
+
+    // Returns the number of loops that were unrolled.
+    int run() {
+        int unrolled = 0;
+        for (IrFunction& function : m_module.functions) {
+            if (!function.defined) continue;
+            // A body that ends in the increment (a while loop) is merged into
+            // its latch when nothing else jumps there.
+            simplify_cfg(function);
+            int count = 0;
+            // Block ids stay valid while unrolling: blocks are only appended.
+            size_t original_blocks = function.blocks.size();
+            for (size_t h = 1; h < original_blocks; ++h) {
+                CountedLoop loop;
+                if (find_counted_loop(function, (int)h, loop)) {
+                    unroll(function, loop);
+                    count++;
+                }
+            }
+            if (count) simplify_cfg(function);
+            unrolled += count;
+        }
+        return unrolled;
+    }
+
+private:
+    IrModule& m_module;
+
+    struct CountedLoop {
+        int header = -1;
+        int latch = -1;
+        vector<int> body;          // every block of the loop, the header last
+        size_t test_at = 0;        // the exit test: latch instructions from here on
+        int induction = -1;        // i
+        int limit = -1;            // vreg, or -1 for a constant limit
+        long long limit_value = 0;
+        bool inclusive = false;    // i <= limit
+    };
+
+    static vector<vector<int>> predecessors(const IrFunction& function) {
+        vector<vector<int>> result(function.blocks.size());
+        for (const IrBlock& block : function.blocks) {
+            for (int succ : successors(block)) result[succ].push_back(block.id);
+        }
+        return result;
+    }
+
+    static bool uses(const IrInst& inst, int vreg) {
+        if (inst.a == vreg || inst.b == vreg) return true;
+        for (int arg : inst.args) {
+            if (arg == vreg) return true;
+        }
+        return false;
+    }
+
+    // Instructions in `blocks` that define `vreg`.
+    static int definitions(const IrFunction& function, const vector<int>& blocks, int vreg) {
+        int count = 0;
+        for (int id : blocks) {
+            for (const IrInst& inst : function.blocks[id].insts) {
+                if (inst.dest == vreg) count++;
+            }
+        }
+        return count;
+    }
+
+    // The instruction of `block` that defines `vreg` before position `before`.
+    static const IrInst* definition_in(const IrBlock& block, int vreg, size_t before) {
+        for (size_t i = before; i-- > 0;) {
+            if (block.insts[i].dest == vreg) return &block.insts[i];
+        }
+        return nullptr;
+    }
+
+    // The blocks from which `latch` can be reached without passing `header`,
+    // or false when that includes the entry (then `header` does not dominate
+    // `latch` and the edge is no back edge).
+    static bool natural_loop(const IrFunction& function, const vector<vector<int>>& preds, int header, int latch,
+                             vector<int>& body) {
+        vector<bool> in_loop(function.blocks.size(), false);
+        in_loop[header] = true;
+        vector<int> worklist;
+        if (latch != header) {
+            in_loop[latch] = true;
+            worklist.push_back(latch);
+            body.push_back(latch);
+        }
+        while (!worklist.empty()) {
+            int id = worklist.back();
+            worklist.pop_back();
+            if (id == 0) return false;
+            for (int pred : preds[id]) {
+                if (in_loop[pred]) continue;
+                in_loop[pred] = true;
+                worklist.push_back(pred);
+                body.push_back(pred);
+            }
+        }
+        return true;
+    }
+
+    // Whether the body contains a cycle of its own (an inner loop): one that
+    // does not pass the header.
+    static bool has_inner_cycle(const IrFunction& function, const CountedLoop& loop) {
+        vector<int> state(function.blocks.size(), 2);   // 2: not in the body
+        for (int id : loop.body) state[id] = 0;          // 0: unvisited, 1: on the path, 2: done
+        state[loop.header] = 2;
+        vector<pair<int, size_t>> stack;
+        for (int start : loop.body) {
+            if (state[start] != 0) continue;
+            state[start] = 1;
+            stack.push_back(make_pair(start, (size_t)0));
+            while (!stack.empty()) {
+                int id = stack.back().first;
+                vector<int> succs = successors(function.blocks[id]);
+                if (stack.back().second == succs.size()) {
+                    state[id] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+                int succ = succs[stack.back().second++];
+                if (state[succ] == 1) return true;
+                if (state[succ] == 0) {
+                    state[succ] = 1;
+                    stack.push_back(make_pair(succ, (size_t)0));
+                }
+            }
+        }
+        return false;
+    }
+
+    bool find_counted_loop(const IrFunction& function, int header, CountedLoop& loop) {
+        vector<vector<int>> preds = predecessors(function);
+        for (int pred : preds[header]) {
+            vector<int> body;
+            if (!natural_loop(function, preds, header, pred, body)) continue;
+            if (loop.latch >= 0) return false;   // several latches
+            loop.latch = pred;
+            loop.body = body;
+        }
+        if (loop.latch < 0) return false;
+        loop.header = header;
+        loop.body.push_back(header);
+        const IrBlock& latch = function.blocks[loop.latch];
+        const IrInst& branch = latch.insts.back();
+        if (branch.op != IrOp::Branch || branch.target != header) return false;
+
+        vector<bool> in_body(function.blocks.size(), false);
+        for (int id : loop.body) in_body[id] = true;
+        if (in_body[branch.target_false]) return false;
+        if (has_inner_cycle(function, loop)) return false;
+        int size = 0;
+        for (int id : loop.body) size += (int)function.blocks[id].insts.size() - 1;
+        if (size > kMaxBodySize) return false;
+
+        const IrInst* compare = definition_in(latch, branch.a, latch.insts.size() - 1);
+        if (!compare || compare->operand_type != IrType::Int) return false;
+        if (compare->op == IrOp::Lt || compare->op == IrOp::Le) {
+            loop.induction = compare->a;
+            loop.limit = compare->b;
+        } else if (compare->op == IrOp::Gt || compare->op == IrOp::Ge) {
+            loop.induction = compare->b;
+            loop.limit = compare->a;
+        } else {
+            return false;
+        }
+        loop.inclusive = compare->op == IrOp::Le || compare->op == IrOp::Ge;
+        if (loop.induction == loop.limit) return false;
+
+        // Latch: t = add i, k; k = const 1; i = copy t, then the exit test, with
+        // no other definition of i anywhere in the loop.
+        if (definitions(function, loop.body, loop.induction) != 1) return false;
+        size_t copy_at = latch.insts.size();
+        while (copy_at-- > 0 && latch.insts[copy_at].dest != loop.induction) {}
+        if (copy_at == (size_t)-1 || latch.insts[copy_at].op != IrOp::Copy) return false;
+        loop.test_at = copy_at + 1;
+        if (compare < &latch.insts[loop.test_at]) return false;   // tests i before the increment
+
+        // The exit test: constants and the comparison only, none of them read
+        // by the rest of the loop.
+        for (size_t i = loop.test_at; i + 1 < latch.insts.size(); ++i) {
+            const IrInst& inst = latch.insts[i];
+            if (inst.op != IrOp::Const && !is_comparison(inst.op)) return false;
+            for (int id : loop.body) {
+                const vector<IrInst>& insts = function.blocks[id].insts;
+                size_t end = id == loop.latch ? loop.test_at : insts.size();
+                for (size_t k = 0; k < end; ++k) {
+                    if (uses(insts[k], inst.dest)) return false;
+                }
+            }
+        }
+        const IrInst* limit = definition_in(latch, loop.limit, latch.insts.size() - 1);
+        if (limit && limit >= &latch.insts[loop.test_at]) {
+            if (limit->op != IrOp::Const) return false;
+            loop.limit_value = limit->imm;
+            loop.limit = -1;
+        } else if (definitions(function, loop.body, loop.limit) != 0) {
+            return false;
+        }
+
+        int step = latch.insts[copy_at].a;
+        const IrInst* add = definition_in(latch, step, copy_at);
+        if (!add || add->op != IrOp::Add || add->type != IrType::Int || definitions(function, loop.body, step) != 1) {
+            return false;
+        }
+        int one = add->a == loop.induction ? add->b : add->b == loop.induction ? add->a : -1;
+        const IrInst* constant = one >= 0 ? definition_in(latch, one, copy_at) : nullptr;
+        if (!constant || constant->op != IrOp::Const || constant->imm != 1 ||
+            definitions(function, loop.body, one) != 1) {
+            return false;
+        }
+        // The guards compare against limit - (kFactor - 1), which must not wrap.
+        if (loop.limit < 0 && loop.limit_value < (long long)INT_MIN + (kFactor - 1)) return false;
+        return true;
+    }
+
+    static long long scaled(long long count) { return count < 0 ? -1 : count / kFactor; }
+
+    static IrInst make_const(IrFunction& function, long long value) {
+        IrInst constant(IrOp::Const, IrType::Int);
+        constant.dest = function.new_vreg(IrType::Int);
+        constant.imm = value;
+        return constant;
+    }
+
+    static IrInst make_compare(IrFunction& function, IrOp op, int a, int b) {
+        IrInst compare(op, IrType::Int);
+        compare.operand_type = IrType::Int;
+        compare.dest = function.new_vreg(IrType::Int);
+        compare.a = a;
+        compare.b = b;
+        return compare;
+    }
+
+    static IrInst make_branch(int condition, int target, int target_false) {
+        IrInst branch(IrOp::Branch);
+        branch.a = condition;
+        branch.target = target;
+        branch.target_false = target_false;
+        return branch;
+    }
+
+    void unroll(IrFunction& function, const CountedLoop& loop) {
+        const int header = loop.header;
+        const int depth = function.blocks[header].loop_depth;
+        const long long header_count = function.blocks[header].exec_count;
+        const int exit = function.blocks[loop.latch].insts.back().target_false;
+
+        // The copies of the body, copy k of block b at copies[k][b].
+        const int first_new = (int)function.blocks.size();
+        vector<vector<int>> copies(kFactor, vector<int>(function.blocks.size(), -1));
+        for (int k = 0; k < kFactor; ++k) {
+            for (int id : loop.body) copies[k][id] = function.new_block(depth);
+        }
+        int entry = function.new_block(max(depth - 1, 0));
+        int guard = function.new_block(depth);
+        for (int k = 0; k < kFactor; ++k) {
+            int next = k + 1 < kFactor ? copies[k + 1][header] : guard;
+            for (int id : loop.body) {
+                IrBlock& copy = function.blocks[copies[k][id]];
+                copy.insts = function.blocks[id].insts;
+                copy.exec_count = scaled(function.blocks[id].exec_count);
+                if (id == loop.latch) {
+                    copy.insts.erase(copy.insts.begin() + loop.test_at, copy.insts.end());
+                    IrInst jump(IrOp::Jump);
+                    jump.target = next;
+                    copy.insts.push_back(jump);
+                    continue;
+                }
+                IrInst& last = copy.insts.back();
+                if (last.op == IrOp::Branch) last.taken_count = scaled(last.taken_count);
+                for_each_target(last, [&](int& target) {
+                    if (copies[k][target] >= 0) target = copies[k][target];
+                });
+            }
+        }
+
+        // Every way into the loop except the back edge now enters at `entry`.
+        for (int id = 0; id < first_new; ++id) {
+            if (id == loop.latch) continue;
+            for_each_target(function.blocks[id].insts.back(), [&](int& target) {
+                if (target == header) target = entry;
+            });
+        }
+
+        // The entry guard runs the body at least once whatever `i` is, as the
+        // loop did: only its exit test at the bottom may leave it.
+        emit_guard(function, loop, entry, copies[0][header], header, header, header_count);
+        emit_guard(function, loop, guard, copies[0][header], header, exit, header_count);
+    }
+
+    // Fills `block` with the test for kFactor more iterations from the top of
+    // the body: on to `enough` if they remain, else to `some` if the exit test
+    // would pass, else to `none`.
+    void emit_guard(IrFunction& function, const CountedLoop& loop, int block, int enough, int some, int none,
+                    long long count) {
+        const int depth = function.blocks[block].loop_depth;
+        IrOp op = loop.inclusive ? IrOp::Le : IrOp::Lt;
+        vector<IrInst> code;
+        if (loop.limit < 0) {
+            int rest = some;
+            if (some != none) {
+                rest = function.new_block(depth);
+                IrInst limit = make_const(function, loop.limit_value);
+                IrInst test = make_compare(function, op, loop.induction, limit.dest);
+                IrBlock& check = function.blocks[rest];
+                check.exec_count = scaled(count);
+                check.insts.push_back(limit);
+                check.insts.push_back(test);
+                check.insts.push_back(make_branch(test.dest, some, none));
+            }
+            IrInst limit = make_const(function, loop.limit_value - (kFactor - 1));
+            IrInst test = make_compare(function, op, loop.induction, limit.dest);
+            code.push_back(limit);
+            code.push_back(test);
+            code.push_back(make_branch(test.dest, enough, rest));
+        } else {
+            // i < limit and limit - i >= kFactor (> kFactor - 1 for <=). The
+            // difference only wraps when it exceeds INT_MAX, which sends the
+            // loop to the epilogue: slower, still correct.
+            int remaining = function.new_block(depth);
+            IrInst test = make_compare(function, op, loop.induction, loop.limit);
+            code.push_back(test);
+            code.push_back(make_branch(test.dest, remaining, none));
+
+            IrInst difference(IrOp::Sub, IrType::Int);
+            difference.operand_type = IrType::Int;
+            difference.dest = function.new_vreg(IrType::Int);
+            difference.a = loop.limit;
+            difference.b = loop.induction;
+            IrInst minimum = make_const(function, kFactor - 1);
+            IrInst test_enough = make_compare(function, loop.inclusive ? IrOp::Ge : IrOp::Gt, difference.dest,
+                                              minimum.dest);
+            IrBlock& rest = function.blocks[remaining];
+            rest.exec_count = scaled(count);
+            rest.insts.push_back(difference);
+            rest.insts.push_back(minimum);
+            rest.insts.push_back(test_enough);
+            rest.insts.push_back(make_branch(test_enough.dest, enough, some));
+        }
+        function.blocks[block].insts = code;
+        function.blocks[block].exec_count = scaled(count);
+    }
+};
+
+#endif
@@ -0,0 +1,735 @@
+#ifndef LSP_SERVER_H
+#define LSP_SERVER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include "ir.h"
+#include "json.h"
+#include "parse_tree.h"
+#include "parser.h"
+#include "scanner.h"
+#include "stream_capture.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         LANGUAGE SERVER                                     ===
+// ===================================================================
+// `parser --lsp` speaks the Language Server Protocol (JSON-RPC framed by
+// Content-Length headers) on stdin and stdout. Open documents live in memory
+// and are edited in place by incremental changes. Diagnostics — lexical,
+// syntax and semantic errors, as the compiler reports them — are published
+// once a document has not changed for kDiagnosticsDelayMs, so a burst of
+// keystrokes costs one analysis. Document symbols list the functions and
+// variables of the tree.
+//
+// Reparsing is incremental at the level of top-level declarations: tokens
+// that did not change at the start and at the end of the file keep the
+// declarations they contain (those at the end with their lines shifted), and
+// only the declarations between them are parsed again.
+
+const int kDiagnosticsDelayMs = 150;
+
+// The protocol's symbol kinds.
+const int kLspSymbolFunction = 12;
+const int kLspSymbolVariable = 13;
+const int kLspSymbolConstant = 14;
+
+// --- INCREMENTAL PARSE ---
+
+class IncrementalParse {
+public:
+    IncrementalParse() {}
+    IncrementalParse(const IncrementalParse&) = delete;
+    IncrementalParse& operator=(const IncrementalParse&) = delete;
+    ~IncrementalParse() {
+        for (const Declaration& declaration : m_declarations) delete declaration.node;
+    }
+
+    // Replaces all tokens (taking them from `tokens`) and brings the
+    // declarations up to date; the tokens that did not change at either end
+    // are found by comparison. Syntax errors are reported on cerr; false if
+    // there was one, with the declarations before it kept.
+    bool update(vector<Token>& tokens) {
+        vector<Token> old_tokens;
+        old_tokens.swap(m_tokens);
+        m_tokens.swap(tokens);
+        size_t old_size = old_tokens.size(), new_size = m_tokens.size();
+
+        size_t prefix = 0;
+        while (prefix < old_size && prefix < new_size && same_token(old_tokens[prefix], m_tokens[prefix], 0)) prefix++;
+        int delta = old_size && new_size ? m_tokens.back().line_number - old_tokens.back().line_number : 0;
+        size_t suffix = 0;
+        while (suffix < old_size - prefix && suffix < new_size - prefix &&
+               same_token(old_tokens[old_size - 1 - suffix], m_tokens[new_size - 1 - suffix], delta)) {
+            suffix++;
+        }
+        return reparse(prefix, suffix, old_size, delta);
+    }
+
+    // Replaces tokens [first, last) by `replacement` and moves the tokens
+    // after them by `delta` lines, as a rescan of the edited lines found.
+    bool update(size_t first, size_t last, vector<Token>& replacement, int delta) {
+        size_t old_size = m_tokens.size();
+        for (size_t i = last; i < old_size; ++i) m_tokens[i].line_number += delta;
+        m_tokens.erase(m_tokens.begin() + first, m_tokens.begin() + last);
+        m_tokens.insert(m_tokens.begin() + first, make_move_iterator(replacement.begin()),
+                        make_move_iterator(replacement.end()));
+        return reparse(first, old_size - last, old_size, delta);
+    }
+
+    const vector<Token>& tokens() const { return m_tokens; }
+
+    // The top-level declarations, in source order.
+    vector<const ParseNode*> declarations() const {
+        vector<const ParseNode*> nodes;
+        for (const Declaration& declaration : m_declarations) nodes.push_back(declaration.node);
+        return nodes;
+    }
+
+private:
+    struct Declaration {
+        size_t begin;      // first token (comments before the declaration included)
+        size_t end;        // one past its last token
+        ParseNode* node;
+    };
+
+    vector<Token> m_tokens;
+    vector<Declaration> m_declarations;
+
+    // The first `prefix` and the last `suffix` of the `old_size` tokens are
+    // unchanged, the latter moved by `delta` lines.
+    bool reparse(size_t prefix, size_t suffix, size_t old_size, int delta) {
+        size_t new_size = m_tokens.size();
+        // Declarations entirely within the unchanged ends survive.
+        vector<Declaration> front, back;
+        for (Declaration& declaration : m_declarations) {
+            if (declaration.end <= prefix) {
+                front.push_back(declaration);
+            } else if (declaration.begin >= old_size - suffix) {
+                declaration.begin = declaration.begin + new_size - old_size;
+                declaration.end = declaration.end + new_size - old_size;
+                if (delta != 0) shift_lines(declaration.node, delta);
+                back.push_back(declaration);
+            } else {
+                delete declaration.node;
+            }
+        }
+        m_declarations.swap(front);
+
+        // Parse from the last surviving declaration at the start; wherever the
+        // parse lines up with a surviving declaration at the end, that one is
+        // taken as it is.
+        Parser parser(m_tokens, false);
+        size_t position = m_declarations.empty() ? 0 : m_declarations.back().end;
+        size_t next = 0;
+        bool ok = true;
+        for (;;) {
+            while (next < back.size() && back[next].begin < position) delete back[next++].node;
+            if (next < back.size() && back[next].begin == position) {
+                position = back[next].end;
+                m_declarations.push_back(back[next++]);
+                continue;
+            }
+            if (parser.at_end(position)) break;
+            size_t begin = position;
+            ParseNode* node = parser.parse_declaration(position);
+            if (!node) {
+                ok = false;
+                break;
+            }
+            m_declarations.push_back(Declaration{begin, position, node});
+        }
+        for (; next < back.size(); ++next) delete back[next].node;
+        return ok;
+    }
+
+    static bool same_token(const Token& old_token, const Token& new_token, int delta) {
+        return new_token.line_number == old_token.line_number + delta && new_token.token_value == old_token.token_value &&
+               new_token.token_class == old_token.token_class;
+    }
+
+    static void shift_lines(ParseNode* node, int delta) {
+        node->line += delta;
+        for (ParseNode* child : node->children) shift_lines(child, delta);
+    }
+};
+
+// --- POSITIONS ---
+// The protocol counts lines from 0 and characters in UTF-16 code units.
+
+inline size_t utf8_sequence_length(unsigned char lead) {
+    if (lead < 0x80) return 1;
+    if (lead >= 0xF0) return 4;
+    if (lead >= 0xE0) return 3;
+    if (lead >= 0xC0) return 2;
+    return 1;
+}
+
+// The UTF-16 length of text[begin, end).
+inline int utf16_length(const string& text, size_t begin, size_t end) {
+    int units = 0;
+    while (begin < end) {
+        size_t length = utf8_sequence_length((unsigned char)text[begin]);
+        units += length == 4 ? 2 : 1;
+        begin += length;
+    }
+    return units;
+}
+
+// The offset of the start of `line`, or text.size() past the last line.
+inline size_t line_offset(const string& text, long long line) {
+    size_t offset = 0;
+    for (long long i = 0; i < line; ++i) {
+        const void* newline = memchr(text.data() + offset, '\n', text.size() - offset);
+        if (!newline) return text.size();
+        offset = (const char*)newline - text.data() + 1;
+    }
+    return offset;
+}
+
+// The offset of (line, character), clamped to the end of the line.
+inline size_t position_offset(const string& text, long long line, long long character) {
+    size_t offset = line_offset(text, line);
+    while (character > 0 && offset < text.size() && text[offset] != '\n') {
+        size_t length = utf8_sequence_length((unsigned char)text[offset]);
+        character -= length == 4 ? 2 : 1;
+        offset = min(text.size(), offset + length);
+    }
+    return offset;
+}
+
+// --- INCREMENTAL SCAN ---
+// Tokens end on the line they start on, except multi-line comments, so the
+// tokens of an edited text differ from the old ones only on the edited lines
+// — widened while a multi-line comment crosses the boundary of the range.
+
+struct TokenEdit {
+    size_t first = 0;       // the old tokens [first, last) ...
+    size_t last = 0;
+    vector<Token> tokens;   // ... are replaced by these
+    int delta = 0;          // lines gained by the edit
+};
+
+inline size_t first_token_on_or_after(const vector<Token>& tokens, int line) {
+    return lower_bound(tokens.begin(), tokens.end(), line,
+                       [](const Token& token, int value) { return token.line_number < value; }) -
+           tokens.begin();
+}
+
+// Scans the lines of `text` that differ from `old_text`, whose tokens are
+// `old_tokens`. False if the edit could reach beyond those lines (it opens a
+// comment that does not close in them); then only a full scan will do. A
+// lexical error is left in `scanner`, with its line in the whole text.
+inline bool scan_edit(const string& old_text, const vector<Token>& old_tokens, const string& text, TokenEdit& edit,
+                      Scanner& scanner) {
+    size_t common = min(old_text.size(), text.size());
+    size_t prefix = mismatch(old_text.begin(), old_text.begin() + common, text.begin()).first - old_text.begin();
+    size_t suffix = 0;
+    while (suffix < common - prefix && old_text[old_text.size() - 1 - suffix] == text[text.size() - 1 - suffix]) {
+        suffix++;
+    }
+    int first_line = 1 + (int)count(old_text.begin(), old_text.begin() + prefix, '\n');
+    int old_lines = (int)count(old_text.begin() + prefix, old_text.end() - suffix, '\n');
+    int last_line = first_line + old_lines;
+    edit.delta = (int)count(text.begin() + prefix, text.end() - suffix, '\n') - old_lines;
+
+    size_t first = first_token_on_or_after(old_tokens, first_line);
+    while (first > 0 && old_tokens[first - 1].token_class == "Multi-Line Comment") {
+        first_line = old_tokens[first - 1].line_number;
+        first = first_token_on_or_after(old_tokens, first_line);
+    }
+    size_t last = first_token_on_or_after(old_tokens, last_line + 1);
+    while (last > first && old_tokens[last - 1].token_class == "Multi-Line Comment") {
+        if (last == old_tokens.size()) {
+            last_line = 1 + (int)count(old_text.begin(), old_text.end(), '\n');
+            break;
+        }
+        last_line = old_tokens[last].line_number;
+        last = first_token_on_or_after(old_tokens, last_line + 1);
+    }
+
+    size_t begin = line_offset(old_text, first_line - 1);
+    size_t old_end = line_offset(old_text, last_line);
+    size_t end = old_end + text.size() - old_text.size();
+    scanner.scan(text.substr(begin, end - begin));
+    if (scanner.unterminated_comment_error) return false;
+    scanner.current_line += first_line - 1;
+    for (Token& token : scanner.tokens) token.line_number += first_line - 1;
+    edit.first = first;
+    edit.last = last;
+    edit.tokens.swap(scanner.tokens);
+    return true;
+}
+
+// --- DOCUMENTS ---
+
+struct LspDiagnostic {
+    int line;          // 1-based, as the compiler reports it
+    string message;
+};
+
+struct LspDocument {
+    string text;
+    long long version = 0;
+    vector<size_t> line_starts;           // of `text`, built by the analysis
+    string scanned_text;                  // the text `parse` holds the tokens of
+    bool scanned = false;
+    IncrementalParse parse;
+    bool parsed = false;                  // without lexical or syntax errors
+    vector<LspDiagnostic> diagnostics;
+    bool analysed = false;                // scanned and parsed since the last edit
+    bool checked = false;                 // semantic errors in `diagnostics` too
+
+    // The symbols of a declaration while it stays on the same, unchanged lines.
+    struct CachedSymbols {
+        int line;
+        uint64_t text_hash;
+        string json;
+    };
+    map<const ParseNode*, CachedSymbols> symbols;
+    bool diagnostics_due = false;
+    chrono::steady_clock::time_point due_time;
+
+    int line_count() const { return (int)line_starts.size(); }
+
+    // The text of the 1-based `line`, without its newline.
+    string line_text(int line) const {
+        if (line < 1 || line > line_count()) return "";
+        size_t begin = line_starts[line - 1];
+        size_t end = line < line_count() ? line_starts[line] - 1 : text.size();
+        if (end > begin && text[end - 1] == '\r') end--;
+        return text.substr(begin, end - begin);
+    }
+};
+
+// Turns the messages the compiler printed ("[Line N] Syntax Error: ...",
+// "[End of File] ...") into diagnostics; `last_line` stands for the end.
+inline vector<LspDiagnostic> collect_diagnostics(const string& report, int last_line) {
+    vector<LspDiagnostic> diagnostics;
+    size_t start = 0;
+    while (start < report.size()) {
+        size_t end = report.find('\n', start);
+        if (end == string::npos) end = report.size();
+        string line = report.substr(start, end - start);
+        start = end + 1;
+        if (line.empty()) continue;
+        LspDiagnostic diagnostic{1, line};
+        if (line.compare(0, 6, "[Line ") == 0) {
+            size_t close = line.find("] ");
+            if (close != string::npos) {
+                diagnostic.line = atoi(line.c_str() + 6);
+                diagnostic.message = line.substr(close + 2);
+            }
+        } else if (line.compare(0, 14, "[End of File] ") == 0) {
+            diagnostic.line = last_line;
+            diagnostic.message = line.substr(14);
+        }
+        diagnostics.push_back(diagnostic);
+    }
+    return diagnostics;
+}
+
+// --- THE SERVER ---
+
+class LanguageServer {
+public:
+    LanguageServer(int input = STDIN_FILENO, FILE* output = stdout) : m_input(input), m_output(output) {}
+
+    // Serves until `exit`; the exit status follows the protocol (0 only after
+    // a shutdown request).
+    int run() {
+        for (;;) {
+            string body;
+            while (next_message(body)) {
+                handle_message(body);
+                if (m_exit) return m_shutdown ? 0 : 1;
+            }
+            int timeout = publish_due_diagnostics();
+            pollfd input{m_input, POLLIN, 0};
+            int ready = poll(&input, 1, timeout);
+            if (ready < 0 && errno != EINTR) return 1;
+            if (ready <= 0) continue;
+            char chunk[1 << 16];
+            ssize_t got = read(m_input, chunk, sizeof(chunk));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return m_shutdown ? 0 : 1;
+            m_buffer.append(chunk, got);
+        }
+    }
+
+private:
+    int m_input;
+    FILE* m_output;
+    string m_buffer;
+    map<string, LspDocument> m_documents;
+    bool m_shutdown = false;
+    bool m_exit = false;
+
+    // --- framing ---
+
+    // Takes the next complete message off the input buffer.
+    bool next_message(string& body) {
+        for (;;) {
+            size_t header_end = m_buffer.find("\r\n\r\n");
+            if (header_end == string::npos) return false;
+            long long length = -1;
+            size_t start = 0;
+            while (start < header_end) {
+                size_t end = m_buffer.find("\r\n", start);
+                if (end == string::npos || end > header_end) end = header_end;
+                string field = m_buffer.substr(start, end - start);
+                start = end + 2;
+                size_t colon = field.find(':');
+                if (colon == string::npos) continue;
+                string name = field.substr(0, colon);
+                transform(name.begin(), name.end(), name.begin(), ::tolower);
+                if (name == "content-length") length = atoll(field.c_str() + colon + 1);
+            }
+            size_t body_start = header_end + 4;
+            if (length < 0) {
+                m_buffer.erase(0, body_start);   // no length: skip the header
+                continue;
+            }
+            if (m_buffer.size() - body_start < (size_t)length) return false;
+            body = m_buffer.substr(body_start, length);
+            m_buffer.erase(0, body_start + length);
+            return true;
+        }
+    }
+
+    void send(const JsonValue& message) { send_raw(message.dump()); }
+
+    void send_raw(const string& body) {
+        fprintf(m_output, "Content-Length: %zu\r\n\r\n", body.size());
+        fwrite(body.data(), 1, body.size(), m_output);
+        fflush(m_output);
+    }
+
+    void reply(const JsonValue& id, const JsonValue& result) {
+        send(JsonValue::object().set("jsonrpc", "2.0").set("id", id).set("result", result));
+    }
+
+    void reply_error(const JsonValue& id, int code, const string& message) {
+        JsonValue error = JsonValue::object().set("code", code).set("message", message);
+        send(JsonValue::object().set("jsonrpc", "2.0").set("id", id).set("error", error));
+    }
+
+    // --- dispatch ---
+
+    void handle_message(const string& body) {
+        JsonValue message;
+        if (!parse_json(body, message) || message.kind() != JsonValue::Kind::Object) {
+            reply_error(JsonValue(), -32700, "Parse error");
+            return;
+        }
+        const string& method = message["method"].as_string();
+        const JsonValue& id = message["id"];
+        const JsonValue& params = message["params"];
+        bool request = !id.is_null();
+
+        if (method == "initialize") {
+            JsonValue sync = JsonValue::object().set("openClose", true).set("change", 2);   // incremental
+            JsonValue capabilities =
+                JsonValue::object().set("textDocumentSync", sync).set("documentSymbolProvider", true);
+            reply(id, JsonValue::object()
+                          .set("capabilities", capabilities)
+                          .set("serverInfo", JsonValue::object().set("name", "parser")));
+        } else if (method == "shutdown") {
+            m_shutdown = true;
+            reply(id, JsonValue());
+        } else if (method == "exit") {
+            m_exit = true;
+        } else if (method == "textDocument/didOpen") {
+            const JsonValue& document = params["textDocument"];
+            LspDocument& open = m_documents[document["uri"].as_string()];
+            open.text = document["text"].as_string();
+            open.version = document["version"].as_int();
+            changed(open);
+        } else if (method == "textDocument/didChange") {
+            auto it = m_documents.find(params["textDocument"]["uri"].as_string());
+            if (it == m_documents.end()) return;
+            LspDocument& document = it->second;
+            for (const JsonValue& change : params["contentChanges"].items()) apply_change(document, change);
+            document.version = params["textDocument"]["version"].as_int();
+            changed(document);
+        } else if (method == "textDocument/didClose") {
+            string uri = params["textDocument"]["uri"].as_string();
+            m_documents.erase(uri);
+            send(JsonValue::object()
+                     .set("jsonrpc", "2.0")
+                     .set("method", "textDocument/publishDiagnostics")
+                     .set("params", JsonValue::object().set("uri", uri).set("diagnostics", JsonValue::array())));
+        } else if (method == "textDocument/documentSymbol") {
+            auto it = m_documents.find(params["textDocument"]["uri"].as_string());
+            if (it == m_documents.end()) {
+                reply(id, JsonValue::array());
+                return;
+            }
+            analyse(it->second);
+            send_raw("{\"jsonrpc\":\"2.0\",\"id\":" + id.dump() + ",\"result\":" + document_symbols(it->second) + "}");
+        } else if (request) {
+            reply_error(id, -32601, "Method not found: " + method);
+        }
+    }
+
+    // --- documents ---
+
+    void apply_change(LspDocument& document, const JsonValue& change) {
+        const JsonValue& range = change["range"];
+        if (range.is_null()) {
+            document.text = change["text"].as_string();
+            return;
+        }
+        size_t begin = position_offset(document.text, range["start"]["line"].as_int(),
+                                       range["start"]["character"].as_int());
+        size_t end = position_offset(document.text, range["end"]["line"].as_int(), range["end"]["character"].as_int());
+        if (end < begin) end = begin;
+        document.text.replace(begin, end - begin, change["text"].as_string());
+    }
+
+    void changed(LspDocument& document) {
+        document.analysed = false;
+        document.diagnostics_due = true;
+        document.due_time = chrono::steady_clock::now() + chrono::milliseconds(kDiagnosticsDelayMs);
+    }
+
+    // Publishes the diagnostics whose delay has passed. Returns how long to
+    // wait for input before the next ones are due (-1: none pending).
+    int publish_due_diagnostics() {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        long long timeout = -1;
+        for (auto& entry : m_documents) {
+            LspDocument& document = entry.second;
+            if (!document.diagnostics_due) continue;
+            if (document.due_time <= now) {
+                check(document);
+                publish_diagnostics(entry.first, document);
+                document.diagnostics_due = false;
+                continue;
+            }
+            long long wait = chrono::duration_cast<chrono::milliseconds>(document.due_time - now).count() + 1;
+            if (timeout < 0 || wait < timeout) timeout = wait;
+        }
+        return (int)timeout;
+    }
+
+    // Brings the tokens and the parse up to date with the text: only the
+    // edited lines are scanned again, and only the declarations on them
+    // parsed again. Lexical and syntax errors become the diagnostics.
+    void analyse(LspDocument& document) {
+        if (document.analysed) return;
+        document.analysed = true;
+        document.checked = false;
+        document.line_starts.assign(1, 0);
+        for (const char* at = document.text.data(), *end = at + document.text.size();
+             (at = (const char*)memchr(at, '\n', end - at)) != nullptr; ++at) {
+            document.line_starts.push_back(at - document.text.data() + 1);
+        }
+        document.diagnostics.clear();
+
+        Scanner scanner;
+        TokenEdit edit;
+        bool whole = !document.scanned ||
+                     !scan_edit(document.scanned_text, document.parse.tokens(), document.text, edit, scanner);
+        if (whole) {
+            scanner = Scanner();
+            scanner.scan(document.text);
+        }
+        document.parsed = false;
+        if (scanner.unterminated_comment_error) {
+            document.diagnostics.push_back(
+                LspDiagnostic{scanner.current_line, "Lexical Error: Unterminated multi-line comment."});
+            return;
+        }
+        if (scanner.unexpected_char_error) {
+            document.diagnostics.push_back(LspDiagnostic{
+                scanner.current_line, string("Lexical Error: Unexpected character '") + scanner.unexpected_char + "'."});
+            return;
+        }
+
+        StreamCapture capture;
+        document.parsed = whole ? document.parse.update(scanner.tokens)
+                                : document.parse.update(edit.first, edit.last, edit.tokens, edit.delta);
+        document.scanned_text = document.text;
+        document.scanned = true;
+        document.diagnostics = collect_diagnostics(capture.diagnostics(), document.line_count());
+    }
+
+    // analyse, plus the semantic errors IR lowering finds in a program that
+    // parses. Lowering takes the whole program, so this waits for the
+    // diagnostics delay instead of running on every request.
+    void check(LspDocument& document) {
+        analyse(document);
+        if (document.checked) return;
+        document.checked = true;
+        if (!document.parsed) return;
+        vector<const ParseNode*> declarations = document.parse.declarations();
+        ParseNode program{"Program", "", declarations.empty() ? 0 : declarations[0]->line};
+        for (const ParseNode* declaration : declarations) program.children.push_back((ParseNode*)declaration);
+        StreamCapture capture;
+        IrModule module;
+        IrLowering(&program).lower(module);
+        program.children.clear();   // the declarations belong to the parse
+        document.diagnostics = collect_diagnostics(capture.diagnostics(), document.line_count());
+    }
+
+    // (line, byte_column) on the 1-based `line`, whose text is `text`.
+    static JsonValue position(int line, const string& text, size_t byte_column) {
+        JsonValue result = JsonValue::object();
+        result.set("line", max(line - 1, 0)).set("character", utf16_length(text, 0, min(byte_column, text.size())));
+        return result;
+    }
+
+    static JsonValue range(JsonValue start, JsonValue end) {
+        JsonValue result = JsonValue::object();
+        result.set("start", move(start)).set("end", move(end));
+        return result;
+    }
+
+    // The range of the whole 1-based `line`.
+    JsonValue line_range(const LspDocument& document, int line) const {
+        string text = document.line_text(line);
+        return range(position(line, text, 0), position(line, text, string::npos));
+    }
+
+    void publish_diagnostics(const string& uri, const LspDocument& document) {
+        JsonValue diagnostics = JsonValue::array();
+        for (const LspDiagnostic& diagnostic : document.diagnostics) {
+            diagnostics.push(JsonValue::object()
+                                 .set("range", line_range(document, diagnostic.line))
+                                 .set("severity", 1)
+                                 .set("source", "parser")
+                                 .set("message", diagnostic.message));
+        }
+        JsonValue params = JsonValue::object().set("uri", uri).set("version", document.version);
+        params.set("diagnostics", move(diagnostics));
+        send(JsonValue::object().set("jsonrpc", "2.0").set("method", "textDocument/publishDiagnostics").set("params", params));
+    }
+
+    // --- symbols ---
+
+    static int last_line(const ParseNode* node) {
+        int line = node->line;
+        for (const ParseNode* child : node->children) line = max(line, last_line(child));
+        return line;
+    }
+
+    // A symbol spanning the lines of `node`, selecting `name` where it first
+    // appears as a word on the node's first line.
+    JsonValue symbol(const LspDocument& document, const ParseNode* node, const string& name, int kind,
+                     const string& detail) const {
+        string text = document.line_text(node->line);
+        size_t column = string::npos;
+        for (size_t at = text.find(name); at != string::npos; at = text.find(name, at + 1)) {
+            bool starts = at == 0 || !(isalnum((unsigned char)text[at - 1]) || text[at - 1] == '_');
+            size_t after = at + name.size();
+            bool ends = after >= text.size() || !(isalnum((unsigned char)text[after]) || text[after] == '_');
+            if (starts && ends) {
+                column = at;
+                break;
+            }
+        }
+        JsonValue selection = column == string::npos
+                                  ? range(position(node->line, text, 0), position(node->line, text, string::npos))
+                                  : range(position(node->line, text, column),
+                                          position(node->line, text, column + name.size()));
+        int end_line = last_line(node);
+        JsonValue end = end_line == node->line ? position(end_line, text, string::npos)
+                                               : position(end_line, document.line_text(end_line), string::npos);
+        JsonValue result = JsonValue::object();
+        result.set("name", name).set("detail", detail).set("kind", kind);
+        result.set("range", range(position(node->line, text, 0), move(end))).set("selectionRange", move(selection));
+        return result;
+    }
+
+    // The declarators of a VariableDeclarationStatement as symbols.
+    void variable_symbols(const LspDocument& document, const ParseNode* statement, JsonValue& symbols) const {
+        bool constant = false;
+        string type;
+        for (const ParseNode* child : statement->children) {
+            if (child->type == "Keyword" && child->value == "const") constant = true;
+            else if (child->type == "TypeSpecifier") type = child->value;
+            else if (child->type == "Declarator") {
+                symbols.push(symbol(document, child, child->value, constant ? kLspSymbolConstant : kLspSymbolVariable,
+                                    constant ? "const " + type : type));
+            }
+        }
+    }
+
+    // Parameters and local variables of a function, in source order.
+    void local_symbols(const LspDocument& document, const ParseNode* node, JsonValue& symbols) const {
+        for (const ParseNode* child : node->children) {
+            if (child->type == "Parameter" && !child->value.empty()) {
+                string type = child->children.empty() ? "" : child->children[0]->value;
+                symbols.push(symbol(document, child, child->value, kLspSymbolVariable, type));
+            } else if (child->type == "VariableDeclarationStatement") {
+                variable_symbols(document, child, symbols);
+            } else {
+                local_symbols(document, child, symbols);
+            }
+        }
+    }
+
+    // The symbols of one top-level declaration, as comma-separated JSON.
+    string declaration_symbols(const LspDocument& document, const ParseNode* declaration) const {
+        JsonValue symbols = JsonValue::array();
+        if (declaration->type == "VariableDeclarationStatement") {
+            variable_symbols(document, declaration, symbols);
+        } else if (declaration->type == "FunctionDefinition" || declaration->type == "FunctionPrototype") {
+            string type = declaration->children.empty() ? "" : declaration->children[0]->value;
+            JsonValue function = symbol(document, declaration, declaration->value, kLspSymbolFunction, type);
+            JsonValue children = JsonValue::array();
+            local_symbols(document, declaration, children);
+            function.set("children", move(children));
+            symbols.push(move(function));
+        }
+        string json = symbols.dump();
+        return json.substr(1, json.size() - 2);
+    }
+
+    // FNV-1a over the text of lines [first, last].
+    static uint64_t hash_lines(const LspDocument& document, int first, int last) {
+        size_t begin = document.line_starts[max(first, 1) - 1];
+        size_t end = last < document.line_count() ? document.line_starts[max(last, 1)] : document.text.size();
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = begin; i < end; ++i) hash = (hash ^ (unsigned char)document.text[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    // The symbols of the document as a JSON array. A declaration the
+    // incremental parse kept, on unchanged lines, reuses its symbols from the
+    // previous request, so a large file costs little more than its edit.
+    string document_symbols(LspDocument& document) const {
+        map<const ParseNode*, LspDocument::CachedSymbols> cache;
+        string json = "[";
+        for (const ParseNode* declaration : document.parse.declarations()) {
+            int end_line = last_line(declaration);
+            uint64_t hash = hash_lines(document, declaration->line, end_line);
+            LspDocument::CachedSymbols& entry = cache[declaration];
+            auto cached = document.symbols.find(declaration);
+            if (cached != document.symbols.end() && cached->second.line == declaration->line &&
+                cached->second.text_hash == hash) {
+                entry = move(cached->second);
+            } else {
+                entry = LspDocument::CachedSymbols{declaration->line, hash, declaration_symbols(document, declaration)};
+            }
+            if (entry.json.empty()) continue;
+            if (json.size() > 1) json += ',';
+            json += entry.json;
+        }
+        document.symbols.swap(cache);
+        return json + "]";
+    }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef NATIVE_CALL_H
+#define NATIVE_CALL_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "ir.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#define NATIVE_LOOKUP_SUPPORTED 1
+#else
+#define NATIVE_LOOKUP_SUPPORTED 0
+#endif
+
+// Calling through a pointer of a fixed "six integers, eight doubles" type puts
+// every argument in the register the C calling convention assigns it to; this
+// holds for System V x86-64 and AArch64, not for Windows x64.
+#if (defined(__x86_64__) || defined(__aarch64__)) && !defined(_WIN32)
+#define NATIVE_CALL_SUPPORTED 1
+#else
+#define NATIVE_CALL_SUPPORTED 0
+#endif
+
+using namespace std;
+
+// ===================================================================
+// ===         CALLS INTO NATIVE CODE                              ===
+// ===================================================================
+// The interpreters (bytecode VM, tree walker) run the program's own functions
+// themselves but call functions that are only declared, such as `putchar`,
+// in the C library of the running process.
+
+// One value of the source language while it is being interpreted.
+union RuntimeValue {
+    int32_t i;     // int and char (sign-extended)
+    float f;
+    double d;
+    uint64_t bits;
+};
+
+inline RuntimeValue make_int_value(int32_t value) {
+    RuntimeValue result;
+    result.bits = 0;
+    result.i = value;
+    return result;
+}
+
+// Address of a function of the running process (C library included), or nullptr.
+inline void* find_native_function(const string& name) {
+#if NATIVE_LOOKUP_SUPPORTED
+    return dlsym(RTLD_DEFAULT, name.c_str());
+#else
+    (void)name;
+    return nullptr;
+#endif
+}
+
+const int kNativeIntArgs = 6;
+const int kNativeFloatArgs = 8;
+
+// Whether a function with these parameters can be called by call_native().
+inline bool native_signature_supported(const vector<IrType>& param_types) {
+    if (!NATIVE_CALL_SUPPORTED) return false;
+    int ints = 0, floats = 0;
+    for (IrType type : param_types) {
+        if (type == IrType::Float || type == IrType::Double) floats++;
+        else ints++;
+    }
+    return ints <= kNativeIntArgs && floats <= kNativeFloatArgs;
+}
+
+inline RuntimeValue call_native(void* function, IrType return_type, const vector<IrType>& param_types,
+                                const RuntimeValue* args) {
+    RuntimeValue result;
+    result.bits = 0;
+#if NATIVE_CALL_SUPPORTED
+    long ints[kNativeIntArgs] = {0};
+    double floats[kNativeFloatArgs] = {0};
+    int int_count = 0, float_count = 0;
+    for (size_t i = 0; i < param_types.size(); ++i) {
+        if (param_types[i] == IrType::Double) {
+            floats[float_count++] = args[i].d;
+        } else if (param_types[i] == IrType::Float) {
+            // A float argument is read from the low 32 bits of the register.
+            uint64_t bits = 0;
+            memcpy(&bits, &args[i].f, 4);
+            memcpy(&floats[float_count++], &bits, 8);
+        } else {
+            ints[int_count++] = args[i].i;
+        }
+    }
+    typedef long (*IntFunction)(long, long, long, long, long, long,
+                                double, double, double, double, double, double, double, double);
+    typedef double (*FloatFunction)(long, long, long, long, long, long,
+                                    double, double, double, double, double, double, double, double);
+    if (return_type == IrType::Float || return_type == IrType::Double) {
+        double value = ((FloatFunction)function)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5],
+                                                 floats[0], floats[1], floats[2], floats[3],
+                                                 floats[4], floats[5], floats[6], floats[7]);
+        if (return_type == IrType::Double) result.d = value;
+        else memcpy(&result.f, &value, 4);
+    } else {
+        long value = ((IntFunction)function)(ints[0], ints[1], ints[2], ints[3], ints[4], ints[5],
+                                             floats[0], floats[1], floats[2], floats[3],
+                                             floats[4], floats[5], floats[6], floats[7]);
+        // Only the low bits of a char result are defined by the ABI.
+        result.i = return_type == IrType::Char ? (int32_t)(int8_t)value : (int32_t)value;
+    }
+#else
+    (void)function;
+    (void)return_type;
+    (void)param_types;
+    (void)args;
+#endif
+    return result;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// ===================================================================
+// ===         BUFFERED OUTPUT                                     ===
+// ===================================================================
+// A plain byte buffer in front of a FILE*. Generated assembly consists of many
+// tiny writes; collecting them here and handing the C library large blocks is
+// considerably cheaper than going through an ostream for every token.
+
+class OutputBuffer {
+public:
+    explicit OutputBuffer(FILE* file, size_t capacity = 1 << 16)
+        : m_file(file), m_buffer(capacity), m_used(0), m_failed(file == nullptr) {}
+    ~OutputBuffer() { flush(); }
+
+    void write(const char* data, size_t size) {
+        if (m_used + size > m_buffer.size()) {
+            flush();
+            if (size > m_buffer.size()) {
+                write_through(data, size);
+                return;
+            }
+        }
+        memcpy(&m_buffer[m_used], data, size);
+        m_used += size;
+    }
+
+    OutputBuffer& operator<<(const string& text) {
+        write(text.data(), text.size());
+        return *this;
+    }
+    OutputBuffer& operator<<(const char* text) {
+        write(text, strlen(text));
+        return *this;
+    }
+    OutputBuffer& operator<<(char c) {
+        write(&c, 1);
+        return *this;
+    }
+    OutputBuffer& operator<<(long long value) {
+        char digits[24];
+        int length = snprintf(digits, sizeof(digits), "%lld", value);
+        write(digits, (size_t)length);
+        return *this;
+    }
+    OutputBuffer& operator<<(int value) { return *this << (long long)value; }
+
+    void flush() {
+        if (m_used > 0) write_through(m_buffer.data(), m_used);
+        m_used = 0;
+        if (m_file && fflush(m_file) != 0) m_failed = true;
+    }
+
+    bool ok() const { return !m_failed; }
+
+private:
+    FILE* m_file;
+    vector<char> m_buffer;
+    size_t m_used;
+    bool m_failed;
+
+    void write_through(const char* data, size_t size) {
+        if (!m_file || fwrite(data, 1, size, m_file) != size) m_failed = true;
+    }
+};
+
+#endif
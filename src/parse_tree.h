@@ -0,0 +1,126 @@
+#ifndef PARSE_TREE_H
+#define PARSE_TREE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// --- DATA STRUCTURES ---
+
+// One node of the tree built by the parser. The node `type` names the grammar
+// construct (e.g. "IfStatement", "BinaryExpression") and `value` carries the
+// lexeme that matters for it (operator, identifier name, constant ...).
+struct ParseNode {
+    string type;
+    string value;
+    int line;
+    vector<ParseNode*> children;
+    ~ParseNode() {
+        for (ParseNode* child : children) {
+            delete child;
+        }
+    }
+};
+
+// --- BINARY FORM ---
+// The tree as bytes (--emit-ast, the compile server): the magic "CPT1", a
+// string table, then the nodes in pre-order. Each distinct type or value
+// string is stored once:
+//
+//   u32 string count, then per string: u32 length, bytes
+//   per node: u32 type index, u32 value index, i32 line, u32 child count
+//
+// Integers are little-endian.
+
+inline void put_u32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out += (char)((value >> (8 * i)) & 0xFF);
+}
+
+class ParseTreeWriter {
+public:
+    string write(const ParseNode* root) {
+        string nodes;
+        if (root) write_node(root, nodes);
+        string out = "CPT1";
+        put_u32(out, (uint32_t)m_strings.size());
+        for (const string* text : m_strings) {
+            put_u32(out, (uint32_t)text->size());
+            out += *text;
+        }
+        return out + nodes;
+    }
+
+private:
+    unordered_map<string, uint32_t> m_index;
+    vector<const string*> m_strings;
+
+    uint32_t intern(const string& text) {
+        auto inserted = m_index.insert(make_pair(text, (uint32_t)m_strings.size()));
+        if (inserted.second) m_strings.push_back(&inserted.first->first);
+        return inserted.first->second;
+    }
+
+    void write_node(const ParseNode* node, string& out) {
+        put_u32(out, intern(node->type));
+        put_u32(out, intern(node->value));
+        put_u32(out, (uint32_t)node->line);
+        put_u32(out, (uint32_t)node->children.size());
+        for (const ParseNode* child : node->children) write_node(child, out);
+    }
+};
+
+// Reads what ParseTreeWriter wrote; null if `data` is not such a tree.
+class ParseTreeReader {
+public:
+    ParseNode* read(const string& data) {
+        m_data = &data;
+        m_pos = 4;
+        uint32_t count;
+        if (data.compare(0, 4, "CPT1") != 0 || !get_u32(count)) return nullptr;
+        m_strings.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t size;
+            if (!get_u32(size) || data.size() - m_pos < size) return nullptr;
+            m_strings.push_back(data.substr(m_pos, size));
+            m_pos += size;
+        }
+        if (m_pos == data.size()) return nullptr;
+        return read_node();
+    }
+
+private:
+    const string* m_data = nullptr;
+    size_t m_pos = 0;
+    vector<string> m_strings;
+
+    bool get_u32(uint32_t& value) {
+        if (m_data->size() - m_pos < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) value |= (uint32_t)(unsigned char)(*m_data)[m_pos + i] << (8 * i);
+        m_pos += 4;
+        return true;
+    }
+
+    ParseNode* read_node() {
+        uint32_t type, value, line, children;
+        if (!get_u32(type) || !get_u32(value) || !get_u32(line) || !get_u32(children) ||
+            type >= m_strings.size() || value >= m_strings.size() || (m_data->size() - m_pos) / 16 < children) {
+            return nullptr;
+        }
+        ParseNode* node = new ParseNode{m_strings[type], m_strings[value], (int)line};
+        for (uint32_t i = 0; i < children; ++i) {
+            ParseNode* child = read_node();
+            if (!child) {
+                delete node;
+                return nullptr;
+            }
+            node->children.push_back(child);
+        }
+        return node;
+    }
+};
+
+#endif
@@ -0,0 +1,591 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <iostream>
+#include <stdexcept> // Required for std::runtime_error
+#include <string>
+#include <vector>
+#include "scanner.h"
+#include "parse_tree.h"
+
+using namespace std;
+
+// --- THE PARSER CLASS ---
+
+class Parser {
+public:
+    // Syntax errors go to `diagnostics`; a stream per parser lets threads
+    // parse side by side.
+    Parser(const vector<Token>& tokens, bool verbose = true, ostream& diagnostics = cerr)
+        : m_tokens(tokens), m_verbose(verbose), m_diagnostics(diagnostics) {}
+
+    ParseNode* parse() {
+        try {
+            return parse_program();
+        } catch (const runtime_error& e) {
+            return nullptr;
+        }
+    }
+
+    // Parses the one top-level declaration at token `position` and moves
+    // `position` past it; null after a syntax error. Declarations do not look
+    // beyond their last token, so a caller can reparse a file one declaration
+    // at a time and keep those whose tokens did not change.
+    ParseNode* parse_declaration(size_t& position) {
+        m_current_pos = position;
+        try {
+            ParseNode* declaration = parse_top_level_declaration();
+            position = m_current_pos;
+            return declaration;
+        } catch (const runtime_error& e) {
+            return nullptr;
+        }
+    }
+
+    // Whether only comments remain from token `position` on.
+    bool at_end(size_t position) {
+        m_current_pos = position;
+        skip_comments();
+        return is_at_end();
+    }
+
+private:
+    const vector<Token>& m_tokens;
+    size_t m_current_pos = 0;
+    bool m_verbose;
+    ostream& m_diagnostics;
+
+    // ===================================================================
+    // ===       UTILITY METHODS (REVISED FOR CORRECTNESS)           ===
+    // ===================================================================
+    // The previous versions of these functions had several logical bugs that
+    // could cause infinite loops or segmentation faults. This new design is
+    // simpler, safer, and correct.
+
+    // **FIXED**: This is the simplest, most fundamental check. It must be
+    // independent and not call any other parser methods.
+    bool is_at_end() {
+        return m_current_pos >= m_tokens.size();
+    }
+
+    // **FIXED**: This function's only job is to move the main cursor forward
+    // until it points to a meaningful (non-comment) token.
+    void skip_comments() {
+        while (!is_at_end() &&
+               (m_tokens[m_current_pos].token_class == "Single-Line Comment" ||
+                m_tokens[m_current_pos].token_class == "Multi-Line Comment")) {
+            m_current_pos++;
+        }
+    }
+
+    // **FIXED**: `peek` is now much simpler. It ensures comments are skipped
+    // and then safely returns the current token. The complex lookahead logic
+    // has been moved into the functions that actually need it.
+    const Token& peek() {
+        skip_comments(); // ALWAYS ensure we are on a meaningful token before peeking.
+        if (is_at_end()) {
+            static Token eof_token = {"", "EOF", -1}; // A safe, static EOF token.
+            return eof_token;
+        }
+        return m_tokens[m_current_pos];
+    }
+    
+    // **NEW**: A dedicated lookahead function for the one case where we need it.
+    // This is much cleaner than complicating the main `peek` function.
+    const Token& lookahead(int offset) {
+        skip_comments(); // Start from the current meaningful token.
+        size_t lookahead_pos = m_current_pos;
+        while (offset > 0 && lookahead_pos < m_tokens.size()) {
+            lookahead_pos++;
+            // Skip comments at the lookahead position.
+            while (lookahead_pos < m_tokens.size() &&
+                   (m_tokens[lookahead_pos].token_class == "Single-Line Comment" ||
+                    m_tokens[lookahead_pos].token_class == "Multi-Line Comment")) {
+                lookahead_pos++;
+            }
+            offset--;
+        }
+
+        if (lookahead_pos >= m_tokens.size()) {
+            static Token eof_token = {"", "EOF", -1};
+            return eof_token;
+        }
+        return m_tokens[lookahead_pos];
+    }
+
+
+    // **FIXED**: `advance` should only ever do one thing: move the cursor.
+    // The next call to `peek()` will handle any comments that follow.
+    void advance() {
+        if (!is_at_end()) {
+            m_current_pos++;
+        }
+    }
+
+    // `match` remains the same, but it's now supported by the corrected helpers.
+    Token match(const string& expected_class, const string& expected_value = "") {
+        const Token& token = peek();
+        if (token.token_class == expected_class && (expected_value.empty() || token.token_value == expected_value)) {
+            Token matched_token = token;
+            advance();
+            return matched_token;
+        }
+        string error_message = "Expected " + expected_class;
+        if (!expected_value.empty()) error_message += " with value '" + expected_value + "'";
+        error_message += ", but got " + token.token_class + " with value '" + token.token_value + "'";
+        report_error(error_message);
+        throw runtime_error("Syntax Error");
+    }
+
+    // --- ERROR REPORTING ---
+    void report_error(const string& message) {
+        if (is_at_end()) {
+            m_diagnostics << "[End of File] Syntax Error: " << message << endl;
+        } else {
+            m_diagnostics << "[Line " << peek().line_number << "] Syntax Error: " << message << endl;
+        }
+    }
+
+    // --- RECURSIVE DESCENT PARSING FUNCTIONS ---
+
+    // **FIXED**: Removed the stray `advance()` call that was eating the first token.
+    ParseNode* parse_program() {
+        ParseNode* program_node = new ParseNode{"Program", "", (m_tokens.empty() ? 0 : peek().line_number)};
+        while (!is_at_end()) {
+            program_node->children.push_back(parse_top_level_declaration());
+        }
+        if (m_verbose) cout << "Parsing completed successfully." << endl;
+        return program_node;
+    }
+
+    // **FIXED**: Now uses the new, safer `lookahead()` function.
+    ParseNode* parse_top_level_declaration() {
+        if (peek().token_class == "PREPROCESSOR DIRECTIVE") {
+            Token directive = match("PREPROCESSOR DIRECTIVE");
+            return new ParseNode{"PreprocessorDirective", directive.token_value, directive.line_number};
+        }
+        if (peek().token_class == "KEYWORD" &&
+            (peek().token_value == "int" || peek().token_value == "float" ||
+             peek().token_value == "char" || peek().token_value == "void" || peek().token_value == "const")) {
+            
+            // Look at the token AFTER the identifier to resolve ambiguity.
+            // A type is token 0, an identifier is token 1. We need to see token 2.
+            const Token& future_token = lookahead(2);
+
+            if (future_token.token_value == "(") {
+                return parse_function_or_prototype();
+            } else {
+                return parse_variable_declaration();
+            }
+        }
+        report_error("Unrecognized top-level statement. Expected a global variable or function.");
+        throw runtime_error("Syntax Error");
+    }
+
+    // The rest of the parsing functions are correct and do not need changes.
+    // I am including them here for completeness of the class.
+
+    ParseNode* parse_function_or_prototype() {
+        int start_line = peek().line_number;
+        Token type_token = match("KEYWORD");
+        Token name_token = match("IDENTIFIER");
+        match("SPECIAL CHARACTER", "(");
+        ParseNode* param_list_node = nullptr;
+        if (peek().token_value == "void" && lookahead(1).token_value == ")") {
+            match("KEYWORD", "void"); // `f(void)` is an explicitly empty parameter list.
+        } else if (peek().token_value != ")") {
+            param_list_node = parse_parameter_list();
+        }
+        match("SPECIAL CHARACTER", ")");
+        if (peek().token_value == "{") {
+            ParseNode* func_def_node = new ParseNode{"FunctionDefinition", name_token.token_value, start_line};
+            func_def_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
+            if (param_list_node) func_def_node->children.push_back(param_list_node);
+            func_def_node->children.push_back(parse_block_statement());
+            return func_def_node;
+        } else if (peek().token_value == ";") {
+            match("SPECIAL CHARACTER", ";");
+            ParseNode* func_proto_node = new ParseNode{"FunctionPrototype", name_token.token_value, start_line};
+            func_proto_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
+            if (param_list_node) func_proto_node->children.push_back(param_list_node);
+            return func_proto_node;
+        } else {
+            report_error("Expected '{' for function body or ';' for prototype after function signature.");
+            throw runtime_error("Syntax Error");
+        }
+    }
+
+    // Rule: parameter_list -> parameter ( ',' parameter )*
+    //       parameter      -> type_specifier IDENTIFIER?
+    // The name is optional so that prototypes such as `int f(int);` are accepted.
+    ParseNode* parse_parameter_list() {
+        ParseNode* param_list_node = new ParseNode{"ParameterList", "", peek().line_number};
+        do {
+            if (peek().token_value == ",") {
+                match("SPECIAL CHARACTER", ",");
+            }
+            Token type_token = match("KEYWORD");
+            string param_name;
+            if (peek().token_class == "IDENTIFIER") {
+                param_name = match("IDENTIFIER").token_value;
+            }
+            ParseNode* param_node = new ParseNode{"Parameter", param_name, type_token.line_number};
+            param_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
+            param_list_node->children.push_back(param_node);
+        } while (peek().token_value == ",");
+        return param_list_node;
+    }
+
+    ParseNode* parse_variable_declaration() {
+        int start_line = peek().line_number;
+        ParseNode* decl_statement_node = new ParseNode{"VariableDeclarationStatement", "", start_line};
+        if (peek().token_value == "const") {
+            Token t = match("KEYWORD", "const");
+            decl_statement_node->children.push_back(new ParseNode{"Keyword", t.token_value, t.line_number});
+        }
+        Token type_token = match("KEYWORD");
+        decl_statement_node->children.push_back(new ParseNode{"TypeSpecifier", type_token.token_value, type_token.line_number});
+        do {
+            if (peek().token_value == ",") {
+                match("SPECIAL CHARACTER", ",");
+            }
+            Token var_token = match("IDENTIFIER");
+            ParseNode* declarator_node = new ParseNode{"Declarator", var_token.token_value, var_token.line_number};
+            if (peek().token_value == "=") {
+                match("OPERATOR", "=");
+                ParseNode* initializer_node = new ParseNode{"Initializer", "=", peek().line_number};
+                initializer_node->children.push_back(parse_expression());
+                declarator_node->children.push_back(initializer_node);
+            }
+            decl_statement_node->children.push_back(declarator_node);
+        } while (peek().token_value == ",");
+        match("SPECIAL CHARACTER", ";");
+        return decl_statement_node;
+    }
+
+    ParseNode* parse_statement() {
+        const string& token_value = peek().token_value;
+        if (token_value == "if") return parse_if_statement();
+        if (token_value == "for") return parse_for_statement();
+        if (token_value == "while") return parse_while_statement();
+        if (token_value == "do") return parse_do_while_statement();
+        if (token_value == "switch") return parse_switch_statement();
+        if (token_value == "case" || token_value == "default") return parse_labeled_statement();
+        if (peek().token_class == "IDENTIFIER" && lookahead(1).token_value == ":") return parse_labeled_statement();
+        if (token_value == "break" || token_value == "continue") {
+            int line = peek().line_number;
+            Token keyword = match("KEYWORD");
+            match("SPECIAL CHARACTER", ";");
+            return new ParseNode{keyword.token_value == "break" ? "BreakStatement" : "ContinueStatement",
+                                 keyword.token_value, line};
+        }
+        if (token_value == "goto") {
+            int line = peek().line_number;
+            match("KEYWORD", "goto");
+            Token label = match("IDENTIFIER");
+            match("SPECIAL CHARACTER", ";");
+            return new ParseNode{"GotoStatement", label.token_value, line};
+        }
+        if (token_value == "return") return parse_return_statement();
+        if (token_value == "{") return parse_block_statement();
+        if (token_value == ";") {
+            int line = peek().line_number;
+            match("SPECIAL CHARACTER", ";");
+            return new ParseNode{"EmptyStatement", ";", line};
+        }
+        if (token_value == "const" || token_value == "int" ||
+            token_value == "float" || token_value == "char") {
+            return parse_variable_declaration();
+        }
+        return parse_expression_statement();
+    }
+
+    ParseNode* parse_block_statement() {
+        int start_line = peek().line_number;
+        match("SPECIAL CHARACTER", "{");
+        ParseNode* block_node = new ParseNode{"BlockStatement", "{}", start_line};
+        while (peek().token_value != "}") {
+            block_node->children.push_back(parse_statement());
+        }
+        match("SPECIAL CHARACTER", "}");
+        return block_node;
+    }
+
+    ParseNode* parse_if_statement() {
+        int start_line = peek().line_number;
+        match("KEYWORD", "if");
+        ParseNode* if_node = new ParseNode{"IfStatement", "if", start_line};
+        match("SPECIAL CHARACTER", "(");
+        if_node->children.push_back(parse_expression());
+        match("SPECIAL CHARACTER", ")");
+        if_node->children.push_back(parse_statement());
+        if (peek().token_value == "else") {
+            match("KEYWORD", "else");
+            if_node->children.push_back(parse_statement());
+        }
+        return if_node;
+    }
+
+    // Rule: switch_statement -> 'switch' '(' expression ')' statement
+    ParseNode* parse_switch_statement() {
+        int start_line = peek().line_number;
+        match("KEYWORD", "switch");
+        ParseNode* switch_node = new ParseNode{"SwitchStatement", "switch", start_line};
+        match("SPECIAL CHARACTER", "(");
+        switch_node->children.push_back(parse_expression());
+        match("SPECIAL CHARACTER", ")");
+        switch_node->children.push_back(parse_statement());
+        return switch_node;
+    }
+
+    // Rule: while_statement -> 'while' '(' expression ')' statement
+    ParseNode* parse_while_statement() {
+        int start_line = peek().line_number;
+        match("KEYWORD", "while");
+        ParseNode* while_node = new ParseNode{"WhileStatement", "while", start_line};
+        match("SPECIAL CHARACTER", "(");
+        while_node->children.push_back(parse_expression());
+        match("SPECIAL CHARACTER", ")");
+        while_node->children.push_back(parse_statement());
+        return while_node;
+    }
+
+    // Rule: do_while_statement -> 'do' statement 'while' '(' expression ')' ';'
+    // The children are in source order: body, then condition.
+    ParseNode* parse_do_while_statement() {
+        int start_line = peek().line_number;
+        match("KEYWORD", "do");
+        ParseNode* do_node = new ParseNode{"DoWhileStatement", "do", start_line};
+        do_node->children.push_back(parse_statement());
+        match("KEYWORD", "while");
+        match("SPECIAL CHARACTER", "(");
+        do_node->children.push_back(parse_expression());
+        match("SPECIAL CHARACTER", ")");
+        match("SPECIAL CHARACTER", ";");
+        return do_node;
+    }
+
+    // Rule: labeled_statement -> 'case' expression ':' statement
+    //                          | 'default' ':' statement
+    //                          | IDENTIFIER ':' statement
+    ParseNode* parse_labeled_statement() {
+        int start_line = peek().line_number;
+        ParseNode* label_node;
+        if (peek().token_class == "IDENTIFIER") {
+            Token name = match("IDENTIFIER");
+            label_node = new ParseNode{"LabeledStatement", name.token_value, start_line};
+        } else if (peek().token_value == "case") {
+            match("KEYWORD", "case");
+            label_node = new ParseNode{"CaseStatement", "case", start_line};
+            label_node->children.push_back(parse_expression());
+        } else {
+            match("KEYWORD", "default");
+            label_node = new ParseNode{"DefaultStatement", "default", start_line};
+        }
+        match("SPECIAL CHARACTER", ":");
+        label_node->children.push_back(parse_statement());
+        return label_node;
+    }
+
+    ParseNode* parse_return_statement() {
+        int start_line = peek().line_number;
+        match("KEYWORD", "return");
+        ParseNode* return_node = new ParseNode{"ReturnStatement", "return", start_line};
+        if (peek().token_value != ";") {
+            return_node->children.push_back(parse_expression());
+        }
+        match("SPECIAL CHARACTER", ";");
+        return return_node;
+    }
+
+    ParseNode* parse_expression_statement() {
+        int start_line = peek().line_number;
+        ParseNode* expr_stmt_node = new ParseNode{"ExpressionStatement", "", start_line};
+        expr_stmt_node->children.push_back(parse_expression());
+        match("SPECIAL CHARACTER", ";");
+        return expr_stmt_node;
+    }
+/*-------------
+    ParseNode* parse_for_statement() {
+        int start_line = peek().line_number;
+        match("KEYWORD", "for");
+        ParseNode* for_node = new ParseNode{"ForStatement", "for", start_line};
+        match("SPECIAL CHARACTER", "(");
+        if (peek().token_value == ";") {
+            match("SPECIAL CHARACTER", ";");
+            for_node->children.push_back(new ParseNode{"Empty", "initializer", start_line});
+        } else if (peek().token_value == "int" || peek().token_value == "char" || peek().token_value == "float") {
+            for_node->children.push_back(parse_variable_declaration());
+        } else {
+            for_node->children.push_back(parse_expression_statement());
+        }
+        if (peek().token_value == ";") {
+            match("SPECIAL CHARACTER", ";");
+            for_node->children.push_back(new ParseNode{"Empty", "condition", start_line});
+        } else {
+            for_node->children.push_back(parse_expression());
+            match("SPECIAL CHARACTER", ";");
+        }
+        if (peek().token_value == ")") {
+            for_node->children.push_back(new ParseNode{"Empty", "increment", start_line});
+        } else {
+            for_node->children.push_back(parse_expression());
+        }
+        match("SPECIAL CHARACTER", ")");
+        for_node->children.push_back(parse_statement());
+        return for_node;
+    }
+----------------*/
+// REPLACE your old parse_for_statement() with this new, cleaner version.
+
+// Rule: for_statement -> 'for' '(' initializer condition increment ')' statement
+ParseNode* parse_for_statement() {
+    int start_line = peek().line_number;
+    match("KEYWORD", "for");
+    ParseNode* for_node = new ParseNode{"ForStatement", "for", start_line};
+    
+    match("SPECIAL CHARACTER", "(");
+
+    // --- 1. Parse Initializer ---
+    // This part can remain the same. It correctly handles the three cases.
+    if (peek().token_value == ";") {
+        match("SPECIAL CHARACTER", ";");
+        for_node->children.push_back(new ParseNode{"Empty", "initializer", start_line});
+    } else if (peek().token_value == "int" || peek().token_value == "char" || peek().token_value == "float") {
+        for_node->children.push_back(parse_variable_declaration());
+    } else {
+        for_node->children.push_back(parse_expression_statement());
+    }
+
+    // --- 2. Parse Condition (REVISED) ---
+    // If the condition is not empty, parse the expression and add it DIRECTLY.
+    if (peek().token_value == ";") {
+        match("SPECIAL CHARACTER", ";");
+        for_node->children.push_back(new ParseNode{"Empty", "condition", start_line});
+    } else {
+        // THE FIX: No extra "Condition" wrapper node is created.
+        for_node->children.push_back(parse_expression());
+        match("SPECIAL CHARACTER", ";");
+    }
+
+    // --- 3. Parse Increment (REVISED) ---
+    // If the increment is not empty, parse the expression and add it DIRECTLY.
+    if (peek().token_value == ")") {
+        // Empty increment
+        for_node->children.push_back(new ParseNode{"Empty", "increment", start_line});
+    } else {
+        // THE FIX: No extra "UPDATE" or "Increment" wrapper node is created.
+        for_node->children.push_back(parse_expression());
+    }
+
+    match("SPECIAL CHARACTER", ")");
+    
+    // --- 4. Parse the Body Statement ---
+    // This part remains the same.
+    for_node->children.push_back(parse_statement());
+
+    return for_node;
+}
+    ParseNode* parse_expression() { return parse_assignment(); }
+    ParseNode* parse_assignment() {
+        int start_line = peek().line_number;
+        ParseNode* left_node = parse_equality();
+        if (peek().token_value == "=") {
+            Token op = match("OPERATOR", "=");
+            ParseNode* right_node = parse_assignment();
+            ParseNode* assignment_node = new ParseNode{"AssignmentExpression", op.token_value, start_line};
+            assignment_node->children.push_back(left_node);
+            assignment_node->children.push_back(right_node);
+            return assignment_node;
+        }
+        return left_node;
+    }
+    ParseNode* parse_equality() {
+        ParseNode* left_node = parse_relational();
+        while (peek().token_value == "==" || peek().token_value == "!=") {
+            Token op = match("OPERATOR");
+            ParseNode* right_node = parse_relational();
+            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
+            new_left->children.push_back(left_node);
+            new_left->children.push_back(right_node);
+            left_node = new_left;
+        }
+        return left_node;
+    }
+    ParseNode* parse_relational() {
+        ParseNode* left_node = parse_additive();
+        while (peek().token_value == "<" || peek().token_value == ">" ||
+               peek().token_value == "<=" || peek().token_value == ">=") {
+            Token op = match("OPERATOR");
+            ParseNode* right_node = parse_additive();
+            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
+            new_left->children.push_back(left_node);
+            new_left->children.push_back(right_node);
+            left_node = new_left;
+        }
+        return left_node;
+    }
+    ParseNode* parse_additive() {
+        ParseNode* left_node = parse_multiplicative();
+        while (peek().token_value == "+" || peek().token_value == "-") {
+            Token op = match("OPERATOR");
+            ParseNode* right_node = parse_multiplicative();
+            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
+            new_left->children.push_back(left_node);
+            new_left->children.push_back(right_node);
+            left_node = new_left;
+        }
+        return left_node;
+    }
+    ParseNode* parse_multiplicative() {
+        ParseNode* left_node = parse_primary();
+        while (peek().token_value == "*" || peek().token_value == "/") {
+            Token op = match("OPERATOR");
+            ParseNode* right_node = parse_primary();
+            ParseNode* new_left = new ParseNode{"BinaryExpression", op.token_value, op.line_number};
+            new_left->children.push_back(left_node);
+            new_left->children.push_back(right_node);
+            left_node = new_left;
+        }
+        return left_node;
+    }
+    ParseNode* parse_primary() {
+        int line = peek().line_number;
+        if (peek().token_class == "NUMERIC CONSTANT") {
+            Token value = match("NUMERIC CONSTANT");
+            return new ParseNode{"Constant", value.token_value, line};
+        }
+        if (peek().token_class == "IDENTIFIER") {
+            Token value = match("IDENTIFIER");
+            if (peek().token_value == "(") {
+                return parse_call_arguments(value);
+            }
+            return new ParseNode{"Identifier", value.token_value, line};
+        }
+        if (peek().token_value == "(") {
+            match("SPECIAL CHARACTER", "(");
+            ParseNode* expr_node = parse_expression();
+            match("SPECIAL CHARACTER", ")");
+            return expr_node;
+        }
+        report_error("Expected a value, variable, or expression in parentheses.");
+        throw runtime_error("Syntax Error");
+    }
+
+    // Rule: call -> IDENTIFIER '(' ( expression ( ',' expression )* )? ')'
+    ParseNode* parse_call_arguments(const Token& callee) {
+        ParseNode* call_node = new ParseNode{"CallExpression", callee.token_value, callee.line_number};
+        match("SPECIAL CHARACTER", "(");
+        if (peek().token_value != ")") {
+            call_node->children.push_back(parse_expression());
+            while (peek().token_value == ",") {
+                match("SPECIAL CHARACTER", ",");
+                call_node->children.push_back(parse_expression());
+            }
+        }
+        match("SPECIAL CHARACTER", ")");
+        return call_node;
+    }
+};
+
+#endif
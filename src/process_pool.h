@@ -0,0 +1,195 @@
+#ifndef PROCESS_POOL_H
+#define PROCESS_POOL_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "batch.h"
+#include "compile_server.h"
+#include "parse_tree.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         BATCH CHECKING IN WORKER PROCESSES                  ===
+// ===================================================================
+// `parser --batch PATH --processes=N` forks N workers instead of starting
+// threads. A file that crashes the checker (a parse nested deeply enough to
+// overflow the stack, say) then takes down one worker, not the batch: the
+// file is reported as crashed and a new worker takes over the rest of the
+// queue. Each worker has its own heap, so there is no allocator contention,
+// and its own header cache.
+//
+// The queue is an array of file indices in shared memory, largest file first,
+// with an atomic cursor the workers advance. Each worker appends its results
+// to a shared segment of its own (the file index and the report, in the wire
+// format of the compile server), publishing a record by advancing the
+// segment's end, and notes which file it is on so the parent knows what a
+// crash was checking. When every worker has exited the parent reads the
+// segments and prints the reports as the threaded batch does.
+
+const size_t kResultSegmentBytes = 256u << 20;   // reserved, not committed
+const int kWorkerSegmentFull = 3;                 // exit status: start a new segment
+
+struct WorkerQueue {
+    atomic<uint32_t> next;
+    uint32_t count;
+    uint32_t order[1];   // `count` file indices
+};
+
+struct ResultSegment {
+    atomic<int64_t> current;   // the file being checked, -1 between files
+    atomic<uint64_t> used;     // bytes of published records
+    char data[1];
+};
+
+inline void* map_shared_memory(size_t size) {
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return memory == MAP_FAILED ? nullptr : memory;
+}
+
+class BatchProcessChecker {
+public:
+    // `max_memory` (0 for none) is shared out among the workers.
+    explicit BatchProcessChecker(unsigned processes, size_t max_memory = 0)
+        : m_processes(processes == 0 ? 1 : processes), m_max_memory(max_memory) {}
+
+    // Like BatchChecker::run.
+    size_t run(vector<BatchInput> inputs, ostream& out = cout) {
+        vector<size_t> order = prepare_batch(inputs);
+        vector<string> reports(inputs.size());
+        vector<bool> done(inputs.size(), false);
+
+        size_t queue_size = sizeof(WorkerQueue) + order.size() * sizeof(uint32_t);
+        WorkerQueue* queue = (WorkerQueue*)map_shared_memory(queue_size);
+        if (queue) {
+            queue->next = 0;
+            queue->count = (uint32_t)order.size();
+            for (size_t i = 0; i < order.size(); ++i) queue->order[i] = (uint32_t)order[i];
+
+            map<pid_t, ResultSegment*> running;
+            vector<ResultSegment*> segments;
+            auto start_worker = [&](int64_t first) {
+                ResultSegment* segment = (ResultSegment*)map_shared_memory(kResultSegmentBytes);
+                if (!segment) return false;
+                segment->current = -1;
+                segment->used = 0;
+                segments.push_back(segment);
+                cout.flush();
+                cerr.flush();
+                fflush(nullptr);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    work(inputs, queue, segment, first, (m_max_memory + m_processes - 1) / m_processes);
+                    _exit(0);
+                }
+                if (pid < 0) return false;
+                running[pid] = segment;
+                return true;
+            };
+            for (unsigned i = 0; i < m_processes && i < order.size(); ++i) {
+                if (!start_worker(-1)) break;
+            }
+            while (!running.empty()) {
+                int status;
+                pid_t pid = waitpid(-1, &status, 0);
+                if (pid < 0) {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+                auto worker = running.find(pid);
+                if (worker == running.end()) continue;
+                ResultSegment* segment = worker->second;
+                running.erase(worker);
+                int64_t current = segment->current;
+                if (WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+                if (WIFEXITED(status) && WEXITSTATUS(status) == kWorkerSegmentFull) {
+                    start_worker(current);
+                    continue;
+                }
+                if (current >= 0) {
+                    reports[current] = crash_report(status);
+                    done[current] = true;
+                }
+                if (queue->next < queue->count) start_worker(-1);
+            }
+            for (ResultSegment* segment : segments) {
+                read_results(segment, reports, done);
+                munmap(segment, kResultSegmentBytes);
+            }
+            munmap(queue, queue_size);
+        }
+
+        // Whatever no worker got to (fork failed) is checked here.
+        BatchChecker checker(1, ReadMethod::IoUring, m_max_memory);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (!done[i]) reports[i] = checker.check(inputs[i]);
+        }
+        return print_batch_reports(inputs, reports, out);
+    }
+
+private:
+    unsigned m_processes;
+    size_t m_max_memory;
+
+    // The worker: checks files from the queue until it is empty, starting
+    // with `first` if that is not -1.
+    static void work(const vector<BatchInput>& inputs, WorkerQueue* queue, ResultSegment* segment, int64_t first,
+                     size_t max_memory) {
+        BatchChecker checker(1, ReadMethod::IoUring, max_memory);
+        size_t capacity = kResultSegmentBytes - offsetof(ResultSegment, data);
+        int64_t index = first;
+        for (;;) {
+            if (index < 0) {
+                uint32_t slot = queue->next.fetch_add(1);
+                if (slot >= queue->count) return;
+                index = queue->order[slot];
+            }
+            segment->current = index;
+            string record;
+            put_u32(record, (uint32_t)index);
+            put_string(record, checker.check(inputs[index]));
+            uint64_t used = segment->used;
+            if (used + record.size() > capacity) {
+                if (used > 0) _exit(kWorkerSegmentFull);
+                record.clear();
+                put_u32(record, (uint32_t)index);
+                put_string(record, "Error: The report of this file is too large.\n");
+            }
+            memcpy(segment->data + used, record.data(), record.size());
+            segment->used.store(used + record.size(), memory_order_release);
+            segment->current = -1;
+            index = -1;
+        }
+    }
+
+    static string crash_report(int status) {
+        if (WIFSIGNALED(status)) {
+            return string("Error: The checker crashed on this file (") + strsignal(WTERMSIG(status)) + ").\n";
+        }
+        return "Error: The checker exited with status " + to_string(WEXITSTATUS(status)) + " on this file.\n";
+    }
+
+    static void read_results(const ResultSegment* segment, vector<string>& reports, vector<bool>& done) {
+        string data(segment->data, segment->used.load(memory_order_acquire));
+        WireReader reader(data);
+        uint32_t index;
+        string report;
+        while (!reader.at_end() && reader.get_u32(index) && reader.get_string(report) && index < reports.size()) {
+            reports[index] = report;
+            done[index] = true;
+        }
+    }
+};
+
+#endif
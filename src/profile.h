@@ -0,0 +1,334 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ir.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         PROFILE-GUIDED OPTIMISATION                         ===
+// ===================================================================
+// Two runs:
+//
+//   --profile-generate=FILE  The freshly lowered IR is instrumented: every
+//       block increments a counter when it runs, and every conditional branch
+//       counts how often its `target` edge is taken. The counters are ordinary
+//       int globals named `__profile.<function>.<block>[.taken]` (a name no
+//       program can declare), so every engine that runs the IR counts the same
+//       way. When the program returns, the counters are written to FILE.
+//
+//   --profile-use=FILE  The counts are attached to the freshly lowered IR
+//       (IrBlock::exec_count, IrInst::taken_count), which has the same shape as
+//       the one that was instrumented. The inliner skips call sites that never
+//       ran and weighs the others by measured frequency; tail-call elimination
+//       and inlining keep the counts up to date; and a final layout pass orders
+//       the blocks so that the likely successor of every block falls through
+//       (the code generator then branches only on the unlikely edge) and blocks
+//       that never ran move to the end of the function.
+//
+// Profile file format (text), one record per line:
+//     function <name> <blocks> <instructions>
+//     block <id> <count> [<taken>]
+// The block and instruction counts identify the version of the function; a
+// profile that does not match is ignored with a warning.
+
+const char* const kProfileCounterPrefix = "__profile.";
+
+inline string profile_counter_name(const string& function, int block) {
+    return kProfileCounterPrefix + function + "." + to_string(block);
+}
+
+inline string profile_taken_name(const string& function, int block) {
+    return profile_counter_name(function, block) + ".taken";
+}
+
+// --- INSTRUMENTATION ---
+
+class ProfileInstrumenter {
+public:
+    ProfileInstrumenter(IrModule& module) : m_module(module) {}
+
+    void run() {
+        for (IrFunction& function : m_module.functions) {
+            if (function.defined) instrument(function);
+        }
+    }
+
+private:
+    IrModule& m_module;
+
+    void add_counter(const string& name) {
+        IrGlobal counter;
+        counter.name = name;
+        counter.type = IrType::Int;
+        m_module.globals.push_back(counter);
+    }
+
+    // counter = counter + 1
+    static vector<IrInst> increment(IrFunction& function, const string& counter) {
+        vector<IrInst> code;
+        IrInst load(IrOp::LoadGlobal, IrType::Int);
+        load.operand_type = IrType::Int;
+        load.dest = function.new_vreg(IrType::Int);
+        load.symbol = counter;
+        code.push_back(load);
+        IrInst one(IrOp::Const, IrType::Int);
+        one.dest = function.new_vreg(IrType::Int);
+        one.imm = 1;
+        code.push_back(one);
+        IrInst add(IrOp::Add, IrType::Int);
+        add.operand_type = IrType::Int;
+        add.dest = function.new_vreg(IrType::Int);
+        add.a = load.dest;
+        add.b = one.dest;
+        code.push_back(add);
+        IrInst store(IrOp::StoreGlobal, IrType::Int);
+        store.operand_type = IrType::Int;
+        store.a = add.dest;
+        store.symbol = counter;
+        code.push_back(store);
+        return code;
+    }
+
+    // Records the function's shape first: the profile is matched against the
+    // uninstrumented IR.
+    void instrument(IrFunction& function) {
+        function_signature_counter(function);
+        int original_blocks = (int)function.blocks.size();
+        for (int b = 0; b < original_blocks; ++b) {
+            string counter = profile_counter_name(function.name, b);
+            add_counter(counter);
+            vector<IrInst> code = increment(function, counter);
+            IrBlock& block = function.blocks[b];
+            block.insts.insert(block.insts.begin(), code.begin(), code.end());
+
+            if (block.insts.back().op != IrOp::Branch) continue;
+            // The taken edge gets a block of its own that counts it.
+            string taken = profile_taken_name(function.name, b);
+            add_counter(taken);
+            int target = function.blocks[b].insts.back().target;
+            int edge = function.new_block(function.blocks[target].loop_depth);
+            function.blocks[edge].insts = increment(function, taken);
+            IrInst jump(IrOp::Jump);
+            jump.target = target;
+            function.blocks[edge].insts.push_back(jump);
+            function.blocks[b].insts.back().target = edge;
+        }
+    }
+
+    // A global per function holding nothing but its shape in the name, so that
+    // the profile writer knows the function without access to the original IR.
+    void function_signature_counter(const IrFunction& function) {
+        add_counter(kProfileCounterPrefix + function.name + ".shape." + to_string(function.blocks.size()) + "." +
+                    to_string(instruction_count(function)));
+    }
+};
+
+// --- PROFILE DATA ---
+
+struct FunctionProfile {
+    int blocks = 0;
+    int instructions = 0;
+    vector<long long> counts;
+    vector<long long> taken;   // -1 for blocks without a conditional branch
+};
+
+typedef map<string, FunctionProfile> Profile;
+
+// Collects the counters of an instrumented module after its run.
+// `read_counter(name)` returns the address of a counter global.
+template <typename CounterReader>
+Profile collect_profile(const IrModule& module, CounterReader read_counter) {
+    Profile profile;
+    const string prefix = kProfileCounterPrefix;
+    for (const IrGlobal& global : module.globals) {
+        if (global.name.compare(0, prefix.size(), prefix) != 0) continue;
+        size_t shape = global.name.find(".shape.");
+        if (shape == string::npos) continue;
+        string name = global.name.substr(prefix.size(), shape - prefix.size());
+        FunctionProfile& function = profile[name];
+        istringstream numbers(global.name.substr(shape + 7));
+        char dot;
+        numbers >> function.blocks >> dot >> function.instructions;
+        function.counts.assign(function.blocks, 0);
+        function.taken.assign(function.blocks, -1);
+        for (int b = 0; b < function.blocks; ++b) {
+            // The counters are 32-bit; they are read as unsigned to double the range.
+            uint32_t value;
+            const void* counter = read_counter(profile_counter_name(name, b));
+            if (counter) {
+                memcpy(&value, counter, 4);
+                function.counts[b] = value;
+            }
+            if (const IrGlobal* taken = module.find_global(profile_taken_name(name, b))) {
+                if (const void* taken_counter = read_counter(taken->name)) {
+                    memcpy(&value, taken_counter, 4);
+                    function.taken[b] = value;
+                }
+            }
+        }
+    }
+    return profile;
+}
+
+inline bool write_profile(const Profile& profile, const string& path) {
+    ofstream out(path);
+    if (!out.is_open()) return false;
+    for (const auto& entry : profile) {
+        const FunctionProfile& function = entry.second;
+        out << "function " << entry.first << " " << function.blocks << " " << function.instructions << "\n";
+        for (int b = 0; b < function.blocks; ++b) {
+            out << "block " << b << " " << function.counts[b];
+            if (function.taken[b] >= 0) out << " " << function.taken[b];
+            out << "\n";
+        }
+    }
+    out.flush();
+    return out.good();
+}
+
+// Returns false with a message in `error` when the file cannot be read.
+inline bool read_profile(const string& path, Profile& profile, string& error) {
+    ifstream in(path);
+    if (!in.is_open()) {
+        error = "could not open profile '" + path + "'";
+        return false;
+    }
+    string line;
+    FunctionProfile* current = nullptr;
+    int line_number = 0;
+    while (getline(in, line)) {
+        line_number++;
+        istringstream fields(line);
+        string keyword;
+        if (!(fields >> keyword)) continue;
+        bool ok = true;
+        if (keyword == "function") {
+            string name;
+            FunctionProfile function;
+            ok = (bool)(fields >> name >> function.blocks >> function.instructions) && function.blocks >= 0;
+            if (ok) {
+                function.counts.assign(function.blocks, 0);
+                function.taken.assign(function.blocks, -1);
+                current = &(profile[name] = function);
+            }
+        } else if (keyword == "block" && current) {
+            int id;
+            long long count;
+            ok = (bool)(fields >> id >> count) && id >= 0 && id < current->blocks;
+            if (ok) {
+                current->counts[id] = count;
+                long long taken;
+                if (fields >> taken) current->taken[id] = taken;
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = "malformed profile '" + path + "' at line " + to_string(line_number);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Attaches the counts to freshly lowered IR.
+inline void apply_profile(IrModule& module, const Profile& profile) {
+    for (IrFunction& function : module.functions) {
+        if (!function.defined) continue;
+        auto entry = profile.find(function.name);
+        if (entry == profile.end()) continue;
+        const FunctionProfile& counts = entry->second;
+        if (counts.blocks != (int)function.blocks.size() || counts.instructions != instruction_count(function)) {
+            cerr << "Warning: The profile of '" << function.name << "' does not match the program; it is ignored."
+                 << endl;
+            continue;
+        }
+        for (IrBlock& block : function.blocks) {
+            block.exec_count = counts.counts[block.id];
+            if (block.insts.back().op == IrOp::Branch) block.insts.back().taken_count = counts.taken[block.id];
+        }
+    }
+}
+
+// --- BLOCK LAYOUT ---
+
+// Greedy chains: after each block comes its most frequent successor that is
+// not placed yet; when there is none, the chain restarts at the most frequent
+// unplaced block. Unknown counts sort as zero, and ties keep the current
+// order, so functions without a profile keep their layout.
+class ProfileGuidedLayout {
+public:
+    ProfileGuidedLayout(IrModule& module) : m_module(module) {}
+
+    void run() {
+        for (IrFunction& function : m_module.functions) {
+            if (function.defined && has_profile(function)) layout(function);
+        }
+    }
+
+private:
+    IrModule& m_module;
+
+    static bool has_profile(const IrFunction& function) {
+        for (const IrBlock& block : function.blocks) {
+            if (block.exec_count >= 0) return true;
+        }
+        return false;
+    }
+
+    static long long count_of(const IrBlock& block) { return max(block.exec_count, 0LL); }
+
+    // How often control goes from `block` to `successor`, as far as known.
+    static long long edge_count(const IrFunction& function, const IrBlock& block, int successor) {
+        const IrInst& last = block.insts.back();
+        if (last.op == IrOp::Branch && last.taken_count >= 0 && block.exec_count >= 0 &&
+            last.target != last.target_false) {
+            return successor == last.target ? last.taken_count : max(block.exec_count - last.taken_count, 0LL);
+        }
+        return min(count_of(block), count_of(function.blocks[successor]));
+    }
+
+    static void layout(IrFunction& function) {
+        size_t n = function.blocks.size();
+        vector<bool> placed(n, false);
+        vector<int> order;
+        int current = 0;
+        while (current >= 0) {
+            placed[current] = true;
+            order.push_back(current);
+            int next = -1;
+            long long best = -1;
+            const IrBlock& block = function.blocks[current];
+            for (int successor : successors(block)) {
+                if (placed[successor]) continue;
+                long long weight = edge_count(function, block, successor);
+                if (weight > best) {
+                    best = weight;
+                    next = successor;
+                }
+            }
+            if (next < 0) {
+                for (size_t b = 0; b < n; ++b) {
+                    if (!placed[b] && count_of(function.blocks[b]) > best) {
+                        best = count_of(function.blocks[b]);
+                        next = (int)b;
+                    }
+                }
+            }
+            current = next;
+        }
+        reorder_blocks(function, order);
+    }
+};
+
+#endif
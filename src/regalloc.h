@@ -0,0 +1,780 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <string>
+#include <vector>
+#include "ir.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         TARGET REGISTER FILE                                ===
+// ===================================================================
+
+enum class RegClass { General, Vector };
+
+// x86-64 registers, numbered as in the instruction encoding; the xmm
+// registers follow the 16 general-purpose ones.
+enum X86Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+    XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+    kNumX86Regs
+};
+
+struct RegisterFile {
+    vector<string> names;          // indexed by register number
+    vector<RegClass> classes;
+    vector<bool> caller_saved;     // clobbered by every call
+    vector<int> allocation_order;  // allocatable registers, preferred first
+    int scratch[2];                // per class: never allocated, free for the code generator
+};
+
+// System V x86-64. rax/rdx (return value, division) and xmm14/xmm15 are kept
+// out of allocation as scratch registers for the code generator, rsp/rbp hold
+// the frame. Caller-saved registers come first in the allocation order: they
+// cost nothing to use as long as the value does not live across a call, and
+// values that do are steered to callee-saved registers by the call clobbers.
+inline const RegisterFile& sysv_x86_64_register_file() {
+    static RegisterFile file;
+    if (file.names.empty()) {
+        file.names = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                      "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+        for (int i = 0; i < 16; ++i) file.names.push_back("xmm" + to_string(i));
+        file.classes.assign(kNumX86Regs, RegClass::General);
+        file.caller_saved.assign(kNumX86Regs, true);
+        for (int r = XMM0; r <= XMM15; ++r) file.classes[r] = RegClass::Vector;
+        for (int r : {RBX, RSP, RBP, R12, R13, R14, R15}) file.caller_saved[r] = false;
+        file.allocation_order = {RCX, RSI, RDI, R8, R9, R10, R11, RBX, R12, R13, R14, R15};
+        for (int r = XMM0; r <= XMM13; ++r) file.allocation_order.push_back(r);
+        file.scratch[(int)RegClass::General] = RAX;
+        file.scratch[(int)RegClass::Vector] = XMM15;
+    }
+    return file;
+}
+
+inline RegClass register_class(IrType type) {
+    return (type == IrType::Float || type == IrType::Double) ? RegClass::Vector : RegClass::General;
+}
+
+// ===================================================================
+// ===         ALLOCATION INPUT                                    ===
+// ===================================================================
+// The allocator does not look at IR or machine instructions directly; a code
+// generator describes its instruction stream with the structures below. Each
+// instruction k occupies two positions: 2k where its operands are read and
+// 2k+1 where its results are written, so a value may share a register with an
+// operand that dies in the same instruction.
+
+struct AllocInst {
+    vector<int> uses;
+    vector<int> defs;
+    bool is_call = false;   // clobbers every caller-saved register
+    int copy_source = -1;   // for `def = copy source`: try to share the register
+};
+
+struct AllocBlock {
+    vector<AllocInst> insts;   // the last one is the block's terminator
+    vector<int> successors;
+    int loop_depth = 0;
+};
+
+struct AllocInput {
+    vector<RegClass> vreg_classes;
+    vector<AllocBlock> blocks;  // in layout order, blocks[0] is the entry
+};
+
+// Describes an IR function. Parameters are live-in at the entry and need no
+// definition; the code generator moves them out of the argument registers.
+inline AllocInput allocation_input_from_ir(const IrFunction& function) {
+    AllocInput input;
+    for (IrType type : function.vreg_types) input.vreg_classes.push_back(register_class(type));
+    for (const IrBlock& block : function.blocks) {
+        AllocBlock alloc_block;
+        alloc_block.loop_depth = block.loop_depth;
+        alloc_block.successors = successors(block);
+        for (const IrInst& inst : block.insts) {
+            AllocInst alloc_inst;
+            if (inst.a >= 0) alloc_inst.uses.push_back(inst.a);
+            if (inst.b >= 0) alloc_inst.uses.push_back(inst.b);
+            for (int arg : inst.args) alloc_inst.uses.push_back(arg);
+            if (inst.dest >= 0) alloc_inst.defs.push_back(inst.dest);
+            alloc_inst.is_call = inst.op == IrOp::Call;
+            if (inst.op == IrOp::Copy) alloc_inst.copy_source = inst.a;
+            alloc_block.insts.push_back(alloc_inst);
+        }
+        input.blocks.push_back(alloc_block);
+    }
+    return input;
+}
+
+// ===================================================================
+// ===         LINEAR-SCAN REGISTER ALLOCATION                     ===
+// ===================================================================
+// Linear scan with lifetime holes and interval splitting, after Wimmer &
+// Mössenböck ("Optimized Interval Splitting in a Linear Scan Register
+// Allocator"):
+//
+//   1. Liveness: live-in/live-out sets per block by iterative data flow.
+//   2. Intervals: one per vreg, a sorted list of ranges built in a single
+//      backward pass over the blocks, plus the positions of its uses. Calls
+//      produce short "fixed" intervals on every caller-saved register.
+//   3. Allocation: intervals are visited by start position. A register that is
+//      free for the whole interval is taken; one that is free only for a
+//      prefix is taken for that prefix and the rest is split off and queued.
+//      When every register is occupied, the interval with the lowest spill
+//      cost (uses weighted by 10^loop depth) loses: either the current
+//      interval goes to the stack, or the cheapest occupant is split and its
+//      remainder goes to the stack until shortly before its next use.
+//   4. Resolution: moves are recorded where a split interval changes location
+//      within a block, and on control-flow edges whose ends disagree.
+//
+// The IR is not in SSA form, so local variables with several definitions
+// simply get intervals with holes; the algorithm does not depend on SSA.
+//
+// Each step only looks at the registers and the intervals currently active or
+// inactive, so large functions are allocated in close to linear time.
+
+// Larger than any instruction position.
+const int kMaxLivePosition = numeric_limits<int>::max();
+
+struct Location {
+    int reg = -1;
+    int slot = -1;   // spill slot index, in units of 8 bytes
+
+    bool is_reg() const { return reg >= 0; }
+    bool operator==(const Location& other) const { return reg == other.reg && slot == other.slot; }
+    bool operator!=(const Location& other) const { return !(*this == other); }
+};
+
+struct Move {
+    Location from;
+    Location to;
+    RegClass cls;
+};
+
+struct LiveRange {
+    int from;
+    int to;   // exclusive
+};
+
+struct UsePosition {
+    int position;
+    double weight;
+};
+
+struct LiveInterval {
+    int vreg = -1;          // -1 for fixed intervals
+    RegClass cls = RegClass::General;
+    vector<LiveRange> ranges;
+    vector<UsePosition> uses;
+    int reg = -1;
+    bool spilled = false;
+    int parent = -1;        // the interval this one was split from
+    vector<int> children;   // split children (only on the original interval), sorted by start
+
+    int start() const { return ranges.front().from; }
+    int end() const { return ranges.back().to; }
+    bool covers(int position) const {
+        for (const LiveRange& range : ranges) {
+            if (position < range.from) return false;
+            if (position < range.to) return true;
+        }
+        return false;
+    }
+    // First position at or after `from` covered by both intervals, or INT_MAX.
+    int next_intersection(const LiveInterval& other, int from) const {
+        size_t i = 0, j = 0;
+        while (i < ranges.size() && j < other.ranges.size()) {
+            int lo = max(max(ranges[i].from, other.ranges[j].from), from);
+            int hi = min(ranges[i].to, other.ranges[j].to);
+            if (lo < hi) return lo;
+            if (ranges[i].to < other.ranges[j].to) i++;
+            else j++;
+        }
+        return kMaxLivePosition;
+    }
+    int next_use_after(int position) const {
+        for (const UsePosition& use : uses) {
+            if (use.position >= position) return use.position;
+        }
+        return kMaxLivePosition;
+    }
+    double spill_cost() const {
+        double cost = 0;
+        for (const UsePosition& use : uses) cost += use.weight;
+        return cost;
+    }
+};
+
+class LinearScanAllocator {
+public:
+    LinearScanAllocator(const AllocInput& input, const RegisterFile& registers)
+        : m_input(input), m_registers(registers) {}
+
+    void run() {
+        number_instructions();
+        compute_liveness();
+        build_intervals();
+        allocate();
+        resolve();
+    }
+
+    // --- RESULTS ---
+    // Where `vreg` is at a position (2k: operands of instruction k, 2k+1: results).
+    Location location(int vreg, int position) const {
+        const LiveInterval& root = m_intervals[vreg];
+        const LiveInterval* found = &root;
+        for (int child : root.children) {
+            if (m_intervals[child].start() <= position) found = &m_intervals[child];
+            else break;
+        }
+        Location where;
+        if (found->spilled) where.slot = m_spill_slot[vreg];
+        else where.reg = found->reg;
+        return where;
+    }
+    // Whether `vreg` holds a value at a position (a parameter that is
+    // overwritten before it is read is not live at the entry).
+    bool live_at(int vreg, int position) const {
+        if (m_intervals[vreg].covers(position)) return true;
+        for (int child : m_intervals[vreg].children) {
+            if (m_intervals[child].covers(position)) return true;
+        }
+        return false;
+    }
+    Location use_location(int vreg, int inst_index) const { return location(vreg, 2 * inst_index); }
+    Location def_location(int vreg, int inst_index) const { return location(vreg, 2 * inst_index + 1); }
+
+    // Moves to perform just before instruction `inst_index` (a global index in
+    // layout order) because an interval was split there.
+    const vector<Move>& moves_before(int inst_index) const { return m_split_moves[inst_index]; }
+    // Moves to perform when control passes from `pred` to `succ`.
+    const vector<Move>& edge_moves(int pred, int succ) const {
+        static const vector<Move> none;
+        for (const EdgeMoves& edge : m_edge_moves) {
+            if (edge.pred == pred && edge.succ == succ) return edge.moves;
+        }
+        return none;
+    }
+    int block_first_index(int block) const { return m_block_start[block]; }
+    int spill_slot_count() const { return m_spill_slot_count; }
+    // Callee-saved registers that received an interval and must be preserved.
+    vector<int> used_callee_saved() const {
+        vector<bool> used(m_registers.names.size(), false);
+        for (const LiveInterval& interval : m_intervals) {
+            if (interval.vreg >= 0 && interval.reg >= 0 && !interval.spilled) used[interval.reg] = true;
+        }
+        vector<int> result;
+        for (size_t r = 0; r < used.size(); ++r) {
+            if (used[r] && !m_registers.caller_saved[r]) result.push_back((int)r);
+        }
+        return result;
+    }
+
+    void print(ostream& out) const {
+        for (size_t v = 0; v < m_input.vreg_classes.size(); ++v) {
+            const LiveInterval& root = m_intervals[v];
+            if (root.ranges.empty()) continue;
+            out << "  v" << v << ":";
+            vector<int> parts = {(int)v};
+            parts.insert(parts.end(), root.children.begin(), root.children.end());
+            for (int part : parts) {
+                const LiveInterval& interval = m_intervals[part];
+                out << " ";
+                for (const LiveRange& range : interval.ranges) out << "[" << range.from << "," << range.to << ")";
+                if (interval.spilled) out << "->stack" << m_spill_slot[v];
+                else out << "->" << m_registers.names[interval.reg];
+            }
+            out << "  cost " << root.spill_cost() << endl;
+        }
+        out << "  spill slots: " << m_spill_slot_count << endl;
+    }
+
+private:
+    struct EdgeMoves {
+        int pred;
+        int succ;
+        vector<Move> moves;
+    };
+
+    // A simple fixed-size bit set; liveness works on one per block.
+    struct BitSet {
+        vector<uint64_t> words;
+        void resize(size_t bits) { words.assign((bits + 63) / 64, 0); }
+        bool test(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+        void set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+        void reset(size_t i) { words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+        template <typename F> void for_each(F f) const {
+            for (size_t w = 0; w < words.size(); ++w) {
+                uint64_t bits = words[w];
+                while (bits) {
+                    int b = __builtin_ctzll(bits);
+                    f(w * 64 + b);
+                    bits &= bits - 1;
+                }
+            }
+        }
+    };
+
+    const AllocInput& m_input;
+    const RegisterFile& m_registers;
+    vector<int> m_block_start;         // global index of each block's first instruction
+    int m_instruction_count = 0;
+    vector<BitSet> m_live_in, m_live_out;
+    vector<LiveInterval> m_intervals;  // [0, vregs): originals, then split children
+    vector<int> m_fixed;               // fixed interval per physical register (or -1)
+    vector<int> m_spill_slot;          // per vreg
+    int m_spill_slot_count = 0;
+    vector<vector<Move>> m_split_moves;
+    vector<EdgeMoves> m_edge_moves;
+
+    static double use_weight(int loop_depth) {
+        double weight = 1;
+        for (int i = 0; i < min(loop_depth, 6); ++i) weight *= 10;
+        return weight;
+    }
+
+    void number_instructions() {
+        m_block_start.clear();
+        m_instruction_count = 0;
+        for (const AllocBlock& block : m_input.blocks) {
+            m_block_start.push_back(m_instruction_count);
+            m_instruction_count += (int)block.insts.size();
+        }
+        m_split_moves.assign(m_instruction_count, vector<Move>());
+    }
+
+    int block_from(int b) const { return 2 * m_block_start[b]; }
+    int block_to(int b) const { return 2 * (m_block_start[b] + (int)m_input.blocks[b].insts.size()); }
+
+    // --- 1. LIVENESS ---
+    void compute_liveness() {
+        size_t vregs = m_input.vreg_classes.size();
+        size_t n = m_input.blocks.size();
+        vector<BitSet> gen(n), kill(n);
+        m_live_in.assign(n, BitSet());
+        m_live_out.assign(n, BitSet());
+        for (size_t b = 0; b < n; ++b) {
+            gen[b].resize(vregs);
+            kill[b].resize(vregs);
+            m_live_in[b].resize(vregs);
+            m_live_out[b].resize(vregs);
+            for (const AllocInst& inst : m_input.blocks[b].insts) {
+                for (int use : inst.uses) {
+                    if (!kill[b].test(use)) gen[b].set(use);
+                }
+                for (int def : inst.defs) kill[b].set(def);
+            }
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t b = n; b-- > 0;) {
+                BitSet out;
+                out.resize(vregs);
+                for (int succ : m_input.blocks[b].successors) {
+                    for (size_t w = 0; w < out.words.size(); ++w) out.words[w] |= m_live_in[succ].words[w];
+                }
+                BitSet in = out;
+                for (size_t w = 0; w < in.words.size(); ++w) {
+                    in.words[w] = gen[b].words[w] | (out.words[w] & ~kill[b].words[w]);
+                }
+                if (in.words != m_live_in[b].words || out.words != m_live_out[b].words) {
+                    m_live_in[b] = in;
+                    m_live_out[b] = out;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // --- 2. INTERVALS ---
+    // Ranges are added back to front, so a new range only ever has to be
+    // merged with the first one.
+    static void add_range(LiveInterval& interval, int from, int to) {
+        if (!interval.ranges.empty() && interval.ranges.front().from <= to) {
+            interval.ranges.front().from = min(interval.ranges.front().from, from);
+            interval.ranges.front().to = max(interval.ranges.front().to, to);
+        } else {
+            interval.ranges.insert(interval.ranges.begin(), LiveRange{from, to});
+        }
+    }
+
+    void build_intervals() {
+        size_t vregs = m_input.vreg_classes.size();
+        m_intervals.assign(vregs, LiveInterval());
+        for (size_t v = 0; v < vregs; ++v) {
+            m_intervals[v].vreg = (int)v;
+            m_intervals[v].cls = m_input.vreg_classes[v];
+        }
+        m_fixed.assign(m_registers.names.size(), -1);
+        vector<int> call_positions;
+
+        for (size_t b = m_input.blocks.size(); b-- > 0;) {
+            const AllocBlock& block = m_input.blocks[b];
+            int from = block_from((int)b);
+            double weight = use_weight(block.loop_depth);
+            BitSet live = m_live_out[b];
+            live.for_each([&](size_t v) { add_range(m_intervals[v], from, block_to((int)b)); });
+            for (size_t i = block.insts.size(); i-- > 0;) {
+                const AllocInst& inst = block.insts[i];
+                int position = 2 * (m_block_start[b] + (int)i);
+                if (inst.is_call) call_positions.push_back(position + 1);
+                for (int def : inst.defs) {
+                    LiveInterval& interval = m_intervals[def];
+                    if (live.test(def)) {
+                        interval.ranges.front().from = position + 1;
+                        live.reset(def);
+                    } else {
+                        add_range(interval, position + 1, position + 2); // dead definition
+                    }
+                    interval.uses.insert(interval.uses.begin(), UsePosition{position + 1, weight});
+                }
+                for (int use : inst.uses) {
+                    add_range(m_intervals[use], from, position + 1);
+                    live.set(use);
+                    if (interval_first_use(use) != position) {
+                        m_intervals[use].uses.insert(m_intervals[use].uses.begin(), UsePosition{position, weight});
+                    }
+                }
+            }
+        }
+
+        // Calls clobber the caller-saved registers at their result position.
+        sort(call_positions.begin(), call_positions.end());
+        for (int reg : m_registers.allocation_order) {
+            if (!m_registers.caller_saved[reg] || call_positions.empty()) continue;
+            LiveInterval fixed;
+            fixed.cls = m_registers.classes[reg];
+            fixed.reg = reg;
+            for (int position : call_positions) fixed.ranges.push_back(LiveRange{position, position + 1});
+            m_fixed[reg] = (int)m_intervals.size();
+            m_intervals.push_back(fixed);
+        }
+    }
+
+    int interval_first_use(int vreg) const {
+        const vector<UsePosition>& uses = m_intervals[vreg].uses;
+        return uses.empty() ? -1 : uses.front().position;
+    }
+
+    // --- 3. ALLOCATION ---
+    struct LaterStart {
+        const vector<LiveInterval>* intervals;
+        bool operator()(int a, int b) const {
+            return (*intervals)[a].start() > (*intervals)[b].start();
+        }
+    };
+
+    vector<int> m_active, m_inactive;
+    priority_queue<int, vector<int>, LaterStart>* m_unhandled = nullptr;
+
+    // Splits `index` so that the part from `position` on becomes a new interval.
+    int split(int index, int position) {
+        LiveInterval child;
+        {
+            LiveInterval& interval = m_intervals[index];
+            child.vreg = interval.vreg;
+            child.cls = interval.cls;
+            child.parent = interval.parent >= 0 ? interval.parent : index;
+            vector<LiveRange> kept;
+            for (const LiveRange& range : interval.ranges) {
+                if (range.to <= position) kept.push_back(range);
+                else if (range.from >= position) child.ranges.push_back(range);
+                else {
+                    kept.push_back(LiveRange{range.from, position});
+                    child.ranges.push_back(LiveRange{position, range.to});
+                }
+            }
+            interval.ranges.swap(kept);
+            vector<UsePosition> kept_uses;
+            for (const UsePosition& use : interval.uses) {
+                if (use.position < position) kept_uses.push_back(use);
+                else child.uses.push_back(use);
+            }
+            interval.uses.swap(kept_uses);
+        }
+        int child_index = (int)m_intervals.size();
+        m_intervals.push_back(child);
+        vector<int>& siblings = m_intervals[child.parent].children;
+        siblings.insert(upper_bound(siblings.begin(), siblings.end(), child_index,
+                                    [this](int a, int b) { return m_intervals[a].start() < m_intervals[b].start(); }),
+                        child_index);
+        return child_index;
+    }
+
+    // Splits are placed on instruction boundaries (even positions) so that the
+    // connecting move can be inserted before an instruction.
+    static int boundary_at_or_before(int position) { return position & ~1; }
+
+    void spill(int index) {
+        m_intervals[index].spilled = true;
+        m_intervals[index].reg = -1;
+        int vreg = m_intervals[index].vreg;
+        if (m_spill_slot[vreg] < 0) m_spill_slot[vreg] = m_spill_slot_count++;
+    }
+
+    // Sends the part of `index` from `position` on to the stack, and queues what
+    // follows its next use again so that it can get a register back.
+    void spill_from(int index, int position) {
+        int stack_part = position <= m_intervals[index].start() ? index : split(index, position);
+        int next_use = m_intervals[stack_part].next_use_after(position);
+        if (next_use != kMaxLivePosition) {
+            int reload_at = boundary_at_or_before(next_use);
+            if (reload_at > m_intervals[stack_part].start()) {
+                m_unhandled->push(split(stack_part, reload_at));
+            }
+        }
+        spill(stack_part);
+    }
+
+    void allocate() {
+        m_spill_slot.assign(m_input.vreg_classes.size(), -1);
+        m_spill_slot_count = 0;
+        priority_queue<int, vector<int>, LaterStart> unhandled(LaterStart{&m_intervals});
+        m_unhandled = &unhandled;
+        for (size_t v = 0; v < m_input.vreg_classes.size(); ++v) {
+            if (!m_intervals[v].ranges.empty()) unhandled.push((int)v);
+        }
+        m_active.clear();
+        m_inactive.clear();
+        for (int fixed : m_fixed) {
+            if (fixed >= 0) m_inactive.push_back(fixed);
+        }
+
+        while (!unhandled.empty()) {
+            int current = unhandled.top();
+            unhandled.pop();
+            int position = m_intervals[current].start();
+            update_active_sets(position);
+            if (!try_allocate_free_register(current)) allocate_blocked_register(current);
+            if (!m_intervals[current].spilled) m_active.push_back(current);
+        }
+        m_unhandled = nullptr;
+    }
+
+    void update_active_sets(int position) {
+        vector<int> still_active, still_inactive;
+        for (int index : m_active) {
+            const LiveInterval& interval = m_intervals[index];
+            if (interval.end() <= position) continue;
+            (interval.covers(position) ? still_active : still_inactive).push_back(index);
+        }
+        for (int index : m_inactive) {
+            const LiveInterval& interval = m_intervals[index];
+            if (interval.end() <= position) continue;
+            (interval.covers(position) ? still_active : still_inactive).push_back(index);
+        }
+        m_active.swap(still_active);
+        m_inactive.swap(still_inactive);
+    }
+
+    bool try_allocate_free_register(int current) {
+        LiveInterval& interval = m_intervals[current];
+        vector<int> free_until(m_registers.names.size(), -1);
+        for (int reg : m_registers.allocation_order) {
+            if (m_registers.classes[reg] == interval.cls) free_until[reg] = kMaxLivePosition;
+        }
+        for (int index : m_active) {
+            int reg = m_intervals[index].reg;
+            if (free_until[reg] >= 0) free_until[reg] = 0;
+        }
+        for (int index : m_inactive) {
+            int reg = m_intervals[index].reg;
+            if (free_until[reg] <= 0) continue;
+            int intersection = m_intervals[index].next_intersection(interval, interval.start());
+            free_until[reg] = min(free_until[reg], intersection);
+        }
+
+        int best = -1;
+        int hint = copy_hint(current);
+        if (hint >= 0 && free_until[hint] >= interval.end()) {
+            best = hint;
+        } else {
+            for (int reg : m_registers.allocation_order) {
+                if (free_until[reg] < 0) continue;
+                if (best < 0 || free_until[reg] > free_until[best]) best = reg;
+            }
+        }
+        if (best < 0 || free_until[best] <= interval.start()) return false;
+
+        if (free_until[best] < interval.end()) {
+            // Free for a prefix only: take it for the prefix, queue the rest.
+            int split_at = boundary_at_or_before(free_until[best]);
+            if (split_at <= interval.start()) return false;
+            m_unhandled->push(split(current, split_at));
+        }
+        m_intervals[current].reg = best;
+        return true;
+    }
+
+    // The register of the copy source, when this interval starts at a copy.
+    int copy_hint(int current) const {
+        const LiveInterval& interval = m_intervals[current];
+        if (interval.parent >= 0) return -1;
+        int position = interval.start();
+        if (position % 2 == 0) return -1;
+        int index = position / 2;
+        int b = (int)(upper_bound(m_block_start.begin(), m_block_start.end(), index) - m_block_start.begin()) - 1;
+        const AllocInst& inst = m_input.blocks[b].insts[index - m_block_start[b]];
+        if (inst.copy_source < 0) return -1;
+        const LiveInterval& source = m_intervals[inst.copy_source];
+        if (source.ranges.empty()) return -1;
+        Location where = location(inst.copy_source, position - 1);
+        return where.reg;
+    }
+
+    void allocate_blocked_register(int current) {
+        LiveInterval& interval = m_intervals[current];
+        int start = interval.start();
+        size_t n = m_registers.names.size();
+        vector<double> cost(n, -1);
+        vector<int> blocked_at(n, kMaxLivePosition);
+        for (int reg : m_registers.allocation_order) {
+            if (m_registers.classes[reg] == interval.cls) cost[reg] = 0;
+        }
+        for (int index : m_active) {
+            const LiveInterval& other = m_intervals[index];
+            if (cost[other.reg] < 0) continue;
+            if (other.vreg < 0) cost[other.reg] = -1; // a call is in progress
+            else cost[other.reg] += remaining_cost(other, start);
+        }
+        for (int index : m_inactive) {
+            const LiveInterval& other = m_intervals[index];
+            if (cost[other.reg] < 0) continue;
+            int intersection = other.next_intersection(interval, start);
+            if (intersection == kMaxLivePosition) continue;
+            if (other.vreg < 0) blocked_at[other.reg] = min(blocked_at[other.reg], intersection);
+            else cost[other.reg] += remaining_cost(other, start);
+        }
+
+        int best = -1;
+        for (int reg : m_registers.allocation_order) {
+            if (cost[reg] < 0 || blocked_at[reg] <= start) continue;
+            if (best < 0 || cost[reg] < cost[best] ||
+                (cost[reg] == cost[best] && blocked_at[reg] > blocked_at[best])) {
+                best = reg;
+            }
+        }
+
+        if (best < 0 || interval.spill_cost() <= cost[best]) {
+            spill_from(current, start);
+            return;
+        }
+
+        // Evict the cheaper occupants of `best` from here on. Splitting appends
+        // to m_intervals, so intervals are only referred to by index below.
+        for (vector<int>* set : {&m_active, &m_inactive}) {
+            vector<int> kept;
+            for (int index : *set) {
+                bool conflicts = m_intervals[index].reg == best && m_intervals[index].vreg >= 0 &&
+                                 (set == &m_active ||
+                                  m_intervals[index].next_intersection(m_intervals[current], start) != kMaxLivePosition);
+                if (!conflicts) {
+                    kept.push_back(index);
+                    continue;
+                }
+                int split_at = boundary_at_or_before(start);
+                if (split_at <= m_intervals[index].start()) {
+                    spill_from(index, m_intervals[index].start());
+                } else {
+                    spill_from(index, split_at);
+                    kept.push_back(index); // the part before the split keeps the register
+                }
+            }
+            set->swap(kept);
+        }
+        m_intervals[current].reg = best;
+        if (blocked_at[best] < m_intervals[current].end()) {
+            int split_at = boundary_at_or_before(blocked_at[best]);
+            if (split_at > m_intervals[current].start()) {
+                m_unhandled->push(split(current, split_at));
+            } else {
+                spill_from(current, m_intervals[current].start());
+            }
+        }
+    }
+
+    static double remaining_cost(const LiveInterval& interval, int from) {
+        double cost = 0;
+        for (const UsePosition& use : interval.uses) {
+            if (use.position >= from) cost += use.weight;
+        }
+        return cost;
+    }
+
+    // --- 4. RESOLUTION ---
+    void resolve() {
+        // Splits inside a block: move from the previous part to the next one.
+        for (size_t v = 0; v < m_input.vreg_classes.size(); ++v) {
+            const LiveInterval& root = m_intervals[v];
+            for (int child : root.children) {
+                int position = m_intervals[child].start();
+                if (position % 2 != 0 || is_block_start(position)) continue;
+                Location from = location((int)v, position - 1);
+                Location to = location((int)v, position);
+                if (from != to) m_split_moves[position / 2].push_back(Move{from, to, root.cls});
+            }
+        }
+        // Control-flow edges.
+        m_edge_moves.clear();
+        for (size_t b = 0; b < m_input.blocks.size(); ++b) {
+            for (int succ : m_input.blocks[b].successors) {
+                EdgeMoves edge{(int)b, succ, vector<Move>()};
+                m_live_in[succ].for_each([&](size_t v) {
+                    Location from = location((int)v, block_to((int)b) - 1);
+                    Location to = location((int)v, block_from(succ));
+                    if (from != to) edge.moves.push_back(Move{from, to, m_input.vreg_classes[v]});
+                });
+                if (!edge.moves.empty()) m_edge_moves.push_back(edge);
+            }
+        }
+    }
+
+    bool is_block_start(int position) const {
+        return binary_search(m_block_start.begin(), m_block_start.end(), position / 2);
+    }
+};
+
+// Orders a set of moves that conceptually happen at once (every source is
+// read before any destination is written) into a sequence of plain moves.
+// Cycles between registers are broken through the class's scratch register.
+inline vector<Move> sequence_parallel_moves(vector<Move> pending, const RegisterFile& registers) {
+    vector<Move> ordered;
+    pending.erase(remove_if(pending.begin(), pending.end(), [](const Move& m) { return m.from == m.to; }),
+                  pending.end());
+    while (!pending.empty()) {
+        bool progress = false;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            bool blocked = false;
+            for (size_t j = 0; j < pending.size(); ++j) {
+                if (j != i && pending[j].from == pending[i].to) blocked = true;
+            }
+            if (!blocked) {
+                ordered.push_back(pending[i]);
+                pending.erase(pending.begin() + i);
+                progress = true;
+                break;
+            }
+        }
+        if (progress) continue;
+        // Only cycles are left: park one source in the scratch register.
+        Move& first = pending.front();
+        Location scratch;
+        scratch.reg = registers.scratch[(int)first.cls];
+        ordered.push_back(Move{first.from, scratch, first.cls});
+        for (Move& move : pending) {
+            if (move.from == first.from) move.from = scratch;
+        }
+    }
+    return ordered;
+}
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef SOURCE_ANALYSIS_H
+#define SOURCE_ANALYSIS_H
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ir.h"
+#include "parse_tree.h"
+#include "parser.h"
+#include "scanner.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         SOURCE FILE ANALYSIS                                ===
+// ===================================================================
+// The front end for a file that is checked rather than compiled: scan,
+// parse, and lower to IR for the semantic errors, collecting the messages
+// the compiler would print. The modes that keep many files in memory (the
+// watcher and the batch drivers) build on this. Nothing here touches cout
+// or cerr, so threads can analyse files side by side.
+//
+// There is no preprocessor: an #include stays a PreprocessorDirective in the
+// tree. The quoted names are still recorded, so a file can be checked
+// together with the declarations of the headers it includes.
+
+// Scans `source`, reporting a lexical error the way the compiler does.
+inline bool scan_source(const string& source, vector<Token>& tokens, ostream& diagnostics = cerr) {
+    Scanner scanner;
+    scanner.scan(source);
+    if (scanner.unterminated_comment_error) {
+        diagnostics << "[Line " << scanner.current_line << "] Lexical Error: Unterminated multi-line comment." << endl;
+        return false;
+    }
+    if (scanner.unexpected_char_error) {
+        diagnostics << "[Line " << scanner.current_line << "] Lexical Error: Unexpected character '"
+                    << scanner.unexpected_char << "'." << endl;
+        return false;
+    }
+    tokens.swap(scanner.tokens);
+    return true;
+}
+
+// The file name of `#include "name"`; empty for <name> and other directives.
+inline string quoted_include(const string& directive) {
+    size_t pos = 0;
+    auto skip_blanks = [&]() {
+        while (pos < directive.size() && (directive[pos] == ' ' || directive[pos] == '\t')) pos++;
+    };
+    skip_blanks();
+    if (pos >= directive.size() || directive[pos] != '#') return "";
+    pos++;
+    skip_blanks();
+    if (directive.compare(pos, 7, "include") != 0) return "";
+    pos += 7;
+    skip_blanks();
+    if (pos >= directive.size() || directive[pos] != '"') return "";
+    size_t close = directive.find('"', pos + 1);
+    if (close == string::npos) return "";
+    return directive.substr(pos + 1, close - pos - 1);
+}
+
+struct ParsedSource {
+    shared_ptr<const ParseNode> tree;   // null after a lexical or syntax error
+    vector<string> includes;            // names of the #include "..." directives
+    size_t token_count = 0;
+    string diagnostics;                 // what scanning and parsing reported
+};
+
+// The first half of parse_source: false after a lexical error. The includes
+// come from the tokens, so a file with a syntax error keeps them.
+inline bool scan_parsed_source(const string& source, vector<Token>& tokens, ParsedSource& result) {
+    ostringstream diagnostics;
+    bool ok = scan_source(source, tokens, diagnostics);
+    result.diagnostics += diagnostics.str();
+    if (!ok) return false;
+    result.token_count = tokens.size();
+    for (const Token& token : tokens) {
+        if (token.token_class != "PREPROCESSOR DIRECTIVE") continue;
+        string name = quoted_include(token.token_value);
+        if (!name.empty()) result.includes.push_back(name);
+    }
+    return true;
+}
+
+// The second half: parses the tokens scan_parsed_source produced.
+inline void parse_scanned_source(const vector<Token>& tokens, ParsedSource& result) {
+    ostringstream diagnostics;
+    Parser parser(tokens, false, diagnostics);
+    result.tree.reset(parser.parse());
+    result.diagnostics += diagnostics.str();
+}
+
+// Scans and parses `source` without printing anything.
+inline ParsedSource parse_source(const string& source) {
+    ParsedSource result;
+    vector<Token> tokens;
+    if (scan_parsed_source(source, tokens, result)) parse_scanned_source(tokens, result);
+    return result;
+}
+
+// --- STREAMING ---
+// parse_source without the token vector of the whole file, for when memory
+// is short (--max-memory). The text is scanned a chunk of whole lines at a
+// time, and every top-level declaration is parsed as soon as its tokens are
+// all there, after which they are dropped: at any time only the tokens of
+// one chunk and of the declaration it continues are held. A declaration does
+// not look beyond its last token, so one that fails at the end of the tokens
+// so far ("[End of File]") is tried again with the next chunk, and the
+// result is the same as parse_source's, diagnostics included.
+
+const size_t kStreamChunkBytes = 16u << 10;
+
+// Scans and parses `source` as parse_source does, `chunk_bytes` at a time.
+inline ParsedSource stream_parsed_source(const string& source, size_t chunk_bytes = kStreamChunkBytes) {
+    ParsedSource result;
+    vector<Token> window;   // scanned, from the first token not parsed yet on
+    ostringstream diagnostics;
+    Parser parser(window, false, diagnostics);
+    unique_ptr<ParseNode> program(new ParseNode{"Program", "", 0});
+    bool program_line_known = false;
+    bool parse_failed = false;
+    string syntax_error;
+    size_t scanned = 0;
+    int line = 1;   // the line `scanned` is on
+    while (scanned < source.size()) {
+        // The next chunk, whole lines, longer if it ends inside a comment.
+        Scanner scanner;
+        size_t length = chunk_bytes;
+        size_t end;
+        for (;;) {
+            end = scanned + length < source.size() ? source.find('\n', scanned + length) : string::npos;
+            end = end == string::npos ? source.size() : end + 1;
+            scanner = Scanner();
+            scanner.scan(source.substr(scanned, end - scanned));
+            if (!scanner.unterminated_comment_error || end == source.size()) break;
+            length *= 2;
+        }
+        if (scanner.unterminated_comment_error || scanner.unexpected_char_error) {
+            ParsedSource failed;
+            failed.diagnostics = "[Line " + to_string(scanner.current_line + line - 1) + "] Lexical Error: " +
+                                 (scanner.unterminated_comment_error
+                                      ? string("Unterminated multi-line comment.")
+                                      : string("Unexpected character '") + scanner.unexpected_char + "'.") +
+                                 "\n";
+            return failed;
+        }
+        result.token_count += scanner.tokens.size();
+        for (Token& token : scanner.tokens) {
+            token.line_number += line - 1;
+            if (token.token_class != "PREPROCESSOR DIRECTIVE") continue;
+            string name = quoted_include(token.token_value);
+            if (!name.empty()) result.includes.push_back(name);
+        }
+        line += (int)count(source.begin() + scanned, source.begin() + end, '\n');
+        scanned = end;
+        if (parse_failed) continue;   // scanned on for a lexical error only
+        window.insert(window.end(), make_move_iterator(scanner.tokens.begin()), make_move_iterator(scanner.tokens.end()));
+
+        bool more = scanned < source.size();
+        size_t position = 0;
+        // Parser::parse skips the comments before the first declaration.
+        while (!program_line_known && position < window.size()) {
+            const Token& token = window[position];
+            if (token.token_class != "Single-Line Comment" && token.token_class != "Multi-Line Comment") {
+                program->line = token.line_number;
+                program_line_known = true;
+            } else {
+                position++;
+            }
+        }
+        while (position < window.size()) {
+            diagnostics.str("");
+            size_t next = position;
+            ParseNode* declaration = parser.parse_declaration(next);
+            if (declaration) {
+                program->children.push_back(declaration);
+                position = next;
+                continue;
+            }
+            string message = diagnostics.str();
+            if (more && message.compare(0, 13, "[End of File]") == 0) break;
+            syntax_error = message;
+            parse_failed = true;
+            break;
+        }
+        if (parse_failed) vector<Token>().swap(window);
+        else window.erase(window.begin(), window.begin() + position);
+    }
+    if (parse_failed) {
+        result.diagnostics = syntax_error;
+    } else {
+        if (!program_line_known && result.token_count > 0) program->line = -1;   // comments only
+        result.tree.reset(program.release());
+    }
+    return result;
+}
+
+// Lowers `declarations` as one program and returns the semantic errors.
+inline string check_declarations(const vector<const ParseNode*>& declarations) {
+    ParseNode program{"Program", "", declarations.empty() ? 0 : declarations[0]->line};
+    for (const ParseNode* declaration : declarations) program.children.push_back((ParseNode*)declaration);
+    ostringstream diagnostics;
+    IrModule module;
+    IrLowering(&program, diagnostics).lower(module);
+    program.children.clear();   // the declarations belong to their trees
+    return diagnostics.str();
+}
+
+// Prints every line of `report` as "name: line", or "name: OK" for an
+// empty report unless `quiet_if_clean`.
+inline void print_file_report(const string& name, const string& report, bool quiet_if_clean, ostream& out = cout) {
+    if (report.empty()) {
+        if (!quiet_if_clean) out << name << ": OK" << endl;
+        return;
+    }
+    size_t start = 0;
+    while (start < report.size()) {
+        size_t end = report.find('\n', start);
+        if (end == string::npos) end = report.size();
+        out << name << ": " << report.substr(start, end - start) << endl;
+        start = end + 1;
+    }
+}
+
+// --- FILE NAMES ---
+
+inline bool is_source_name(const string& name) {
+    return name.size() > 2 && name[name.size() - 2] == '.' &&
+           (name[name.size() - 1] == 'c' || name[name.size() - 1] == 'h');
+}
+
+inline bool is_header_name(const string& name) {
+    return is_source_name(name) && name[name.size() - 1] == 'h';
+}
+
+// `path` without "." and ".." components; the files need not exist.
+inline string normalize_path(const string& path) {
+    vector<string> parts;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == string::npos) end = path.size();
+        string part = path.substr(start, end - start);
+        if (part == "..") {
+            if (!parts.empty()) parts.pop_back();
+        } else if (!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+        start = end + 1;
+    }
+    string result;
+    for (const string& part : parts) result += "/" + part;
+    return result.empty() ? "/" : result;
+}
+
+inline string directory_of(const string& path) {
+    size_t slash = path.rfind('/');
+    return slash == string::npos || slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Where `#include "name"` in the file `from` may refer to, in lookup order:
+// next to `from`, then in each of `include_directories`.
+inline vector<string> include_candidates(const string& from, const string& name,
+                                         const vector<string>& include_directories) {
+    if (!name.empty() && name[0] == '/') return {normalize_path(name)};
+    vector<string> candidates = {normalize_path(directory_of(from) + "/" + name)};
+    for (const string& directory : include_directories) candidates.push_back(normalize_path(directory + "/" + name));
+    return candidates;
+}
+
+#endif
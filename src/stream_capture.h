@@ -0,0 +1,31 @@
+#ifndef STREAM_CAPTURE_H
+#define STREAM_CAPTURE_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+// Redirects cout and cerr into strings for as long as it lives. The compiler
+// reports through those streams; the compile server and the language server
+// collect what it prints for one request this way.
+class StreamCapture {
+public:
+    StreamCapture() : m_out(cout.rdbuf(m_output.rdbuf())), m_err(cerr.rdbuf(m_diagnostics.rdbuf())) {}
+    ~StreamCapture() {
+        cout.rdbuf(m_out);
+        cerr.rdbuf(m_err);
+    }
+
+    string output() const { return m_output.str(); }
+    string diagnostics() const { return m_diagnostics.str(); }
+
+private:
+    ostringstream m_output;
+    ostringstream m_diagnostics;
+    streambuf* m_out;
+    streambuf* m_err;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef SWITCH_LOWERING_H
+#define SWITCH_LOWERING_H
+
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+// ===================================================================
+// ===         SWITCH LOWERING: CASE CLUSTERS                      ===
+// ===================================================================
+// Decides how a switch statement dispatches on its value, from its case
+// values alone. Consecutive values that go to the same block are merged into
+// ranges first; the ranges are then grouped into clusters of three kinds:
+//
+//   - Range: one range, tested with one or two comparisons;
+//   - JumpTable: a dense run of ranges (at least kMinJumpTableRanges of them,
+//     whose values fill at least kMinJumpTableDensity percent of the span),
+//     dispatched by one indexed jump (IrOp::Switch);
+//   - BitTest: ranges within a kBitTestWidth-wide window that go to at most
+//     kMaxBitTestTargets blocks, tested as the bits of one mask per block
+//     (IrOp::TestBit) instead of one comparison per value.
+//
+// Jump tables are chosen first, so that the fewest clusters remain (dynamic
+// programming over the sorted ranges); bit tests are formed greedily from the
+// runs between tables. IrLowering then emits a binary search over the
+// clusters, so any case is O(log clusters) comparisons away and a dense
+// switch is a single indexed jump.
+
+const int kMinJumpTableRanges = 4;
+const int kMinJumpTableDensity = 40;           // percent
+const long long kMaxJumpTableSize = 1 << 12;   // entries
+const int kBitTestWidth = 64;
+const int kMaxBitTestTargets = 3;
+
+struct SwitchCase {
+    long long value;
+    int block;
+};
+
+enum class SwitchClusterKind { Range, JumpTable, BitTest };
+
+struct SwitchCluster {
+    SwitchClusterKind kind;
+    long long low;
+    long long high;
+    int block = -1;              // Range: where its values go
+    vector<SwitchCase> cases;    // JumpTable, BitTest: every value and its block
+};
+
+// Merges the sorted, distinct case values into ranges of one block each.
+inline vector<SwitchCluster> switch_ranges(const vector<SwitchCase>& cases) {
+    vector<SwitchCluster> ranges;
+    for (const SwitchCase& c : cases) {
+        if (!ranges.empty() && ranges.back().block == c.block && ranges.back().high + 1 == c.value) {
+            ranges.back().high = c.value;
+            continue;
+        }
+        SwitchCluster range;
+        range.kind = SwitchClusterKind::Range;
+        range.low = range.high = c.value;
+        range.block = c.block;
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+// Whether ranges[first..last] are dense enough for a jump table;
+// values_before[i] counts the case values of ranges[0..i).
+inline bool fits_jump_table(const vector<SwitchCluster>& ranges, const vector<long long>& values_before,
+                            size_t first, size_t last) {
+    if (last - first + 1 < (size_t)kMinJumpTableRanges) return false;
+    long long span = ranges[last].high - ranges[first].low + 1;
+    long long values = values_before[last + 1] - values_before[first];
+    return span <= kMaxJumpTableSize && values * 100 >= span * kMinJumpTableDensity;
+}
+
+// Comparisons a plain search would spend on ranges[first..last]: one for a
+// single value, two for a wider range.
+inline int comparisons(const vector<SwitchCluster>& ranges, size_t first, size_t last) {
+    int count = 0;
+    for (size_t i = first; i <= last; ++i) count += ranges[i].low == ranges[i].high ? 1 : 2;
+    return count;
+}
+
+// The thresholds at which one mask test per target beats the comparisons.
+inline bool bit_test_pays_off(int targets, int compares) {
+    return (targets == 1 && compares >= 3) || (targets == 2 && compares >= 5) || (targets == 3 && compares >= 6);
+}
+
+inline SwitchCluster merge_ranges(SwitchClusterKind kind, const vector<SwitchCluster>& ranges, size_t first,
+                                  size_t last) {
+    SwitchCluster cluster;
+    cluster.kind = kind;
+    cluster.low = ranges[first].low;
+    cluster.high = ranges[last].high;
+    for (size_t i = first; i <= last; ++i) {
+        for (long long value = ranges[i].low; value <= ranges[i].high; ++value) {
+            cluster.cases.push_back(SwitchCase{value, ranges[i].block});
+        }
+    }
+    return cluster;
+}
+
+// Groups ranges[first..last) (no jump table among them) into bit tests where
+// they pay off, ranges otherwise.
+inline void cluster_bit_tests(const vector<SwitchCluster>& ranges, size_t first, size_t last,
+                              vector<SwitchCluster>& clusters) {
+    size_t i = first;
+    while (i < last) {
+        // The longest run from i that fits one mask per target.
+        vector<int> targets;
+        size_t end = i;
+        while (end < last && ranges[end].high - ranges[i].low < kBitTestWidth) {
+            if (find(targets.begin(), targets.end(), ranges[end].block) == targets.end()) {
+                if ((int)targets.size() == kMaxBitTestTargets) break;
+                targets.push_back(ranges[end].block);
+            }
+            end++;
+        }
+        if (end - i > 1 && bit_test_pays_off((int)targets.size(), comparisons(ranges, i, end - 1))) {
+            clusters.push_back(merge_ranges(SwitchClusterKind::BitTest, ranges, i, end - 1));
+            i = end;
+        } else {
+            clusters.push_back(ranges[i]);
+            i++;
+        }
+    }
+}
+
+// `cases` sorted by value, without duplicates. The clusters come out sorted
+// and do not overlap.
+inline vector<SwitchCluster> cluster_switch_cases(const vector<SwitchCase>& cases) {
+    vector<SwitchCluster> ranges = switch_ranges(cases);
+    size_t n = ranges.size();
+    vector<long long> values_before(n + 1, 0);
+    for (size_t i = 0; i < n; ++i) values_before[i + 1] = values_before[i] + ranges[i].high - ranges[i].low + 1;
+    // fewest[i]: clusters needed for ranges[i..n) when ranges[i..next[i]) is
+    // one cluster (a jump table when it holds more than one range).
+    vector<size_t> fewest(n + 1, 0), next(n + 1, 0);
+    for (size_t i = n; i-- > 0;) {
+        fewest[i] = fewest[i + 1] + 1;
+        next[i] = i + 1;
+        for (size_t j = i + 1; j < n && ranges[j].high - ranges[i].low < kMaxJumpTableSize; ++j) {
+            if (fits_jump_table(ranges, values_before, i, j) && fewest[j + 1] + 1 < fewest[i]) {
+                fewest[i] = fewest[j + 1] + 1;
+                next[i] = j + 1;
+            }
+        }
+    }
+    vector<SwitchCluster> clusters;
+    size_t run = 0;   // start of the ranges not yet clustered
+    for (size_t i = 0; i < n; i = next[i]) {
+        if (next[i] == i + 1) continue;
+        cluster_bit_tests(ranges, run, i, clusters);
+        clusters.push_back(merge_ranges(SwitchClusterKind::JumpTable, ranges, i, next[i] - 1));
+        run = next[i];
+    }
+    cluster_bit_tests(ranges, run, n, clusters);
+    return clusters;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef TAIL_CALLS_H
+#define TAIL_CALLS_H
+
+#include <vector>
+#include "ir.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         TAIL-CALL ELIMINATION                               ===
+// ===================================================================
+// Two related transformations on calls whose result is returned unchanged:
+//
+// 1. Self-recursive tail calls (`return f(...)` inside f) become loops. The
+//    body of the entry block moves into a new loop header, and each tail call
+//    is replaced by copies of the arguments into the parameter vregs followed
+//    by a jump back to that header. No stack grows and no call is made.
+//
+// 2. Any other call in tail position ("sibling" call) is flagged with
+//    `tail_call`. The native back end turns such a call into a jump once the
+//    caller's frame is torn down, provided the callee's arguments all travel
+//    in registers; otherwise it simply emits an ordinary call.
+//
+// Self-recursion is removed before inlining (a function that became a loop is
+// no longer recursive and may then be inlined); siblings are flagged after
+// inlining, when the remaining calls are final.
+
+class TailCallElimination {
+public:
+    TailCallElimination(IrModule& module) : m_module(module) {}
+
+    // Returns the number of self-recursive calls turned into jumps.
+    int eliminate_self_recursion() {
+        int eliminated = 0;
+        for (IrFunction& function : m_module.functions) {
+            if (function.defined) eliminated += eliminate_in(function);
+        }
+        return eliminated;
+    }
+
+    // Returns the number of calls flagged as sibling tail calls.
+    int mark_sibling_calls() {
+        int marked = 0;
+        for (IrFunction& function : m_module.functions) {
+            if (!function.defined) continue;
+            for (IrBlock& block : function.blocks) {
+                size_t n = block.insts.size();
+                if (n < 2) continue;
+                IrInst& call = block.insts[n - 2];
+                const IrInst& ret = block.insts[n - 1];
+                if (call.op == IrOp::Call && ret.op == IrOp::Ret && call.dest == ret.a) {
+                    call.tail_call = true;
+                    marked++;
+                }
+            }
+        }
+        return marked;
+    }
+
+private:
+    IrModule& m_module;
+
+    // Index of a self call that is only followed by the return of its result
+    // (through char truncations, which are idempotent on a char result), or -1.
+    static int find_self_tail_call(const IrFunction& function, const IrBlock& block) {
+        for (size_t i = 0; i < block.insts.size(); ++i) {
+            const IrInst& call = block.insts[i];
+            if (call.op != IrOp::Call || call.symbol != function.name) continue;
+            int value = call.dest;
+            size_t k = i + 1;
+            while (k < block.insts.size() && block.insts[k].op == IrOp::TruncChar &&
+                   value >= 0 && block.insts[k].a == value) {
+                value = block.insts[k].dest;
+                k++;
+            }
+            if (k == block.insts.size() - 1 && block.insts[k].op == IrOp::Ret && block.insts[k].a == value) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    int eliminate_in(IrFunction& function) {
+        vector<int> tail_blocks;
+        vector<int> call_index;
+        for (const IrBlock& block : function.blocks) {
+            int index = find_self_tail_call(function, block);
+            if (index >= 0) {
+                tail_blocks.push_back(block.id);
+                call_index.push_back(index);
+            }
+        }
+        if (tail_blocks.empty()) return 0;
+
+        // The entry keeps only a jump to the new header, which takes over its
+        // code (including the char parameter truncations) and is re-entered by
+        // every eliminated call.
+        int header = function.new_block(function.blocks[0].loop_depth);
+        function.blocks[header].insts.swap(function.blocks[0].insts);
+        // Profiled: every call, recursive or not, used to run the old entry
+        // once and now runs the header; only the outside calls run the entry.
+        long long calls = function.blocks[0].exec_count;
+        function.blocks[header].exec_count = calls;
+        for (int id : tail_blocks) {
+            long long count = function.blocks[id == 0 ? header : id].exec_count;
+            calls = calls < 0 || count < 0 ? -1 : calls - count;
+        }
+        function.blocks[0].exec_count = calls;
+        IrInst enter(IrOp::Jump);
+        enter.target = header;
+        function.blocks[0].insts.push_back(enter);
+
+        for (size_t t = 0; t < tail_blocks.size(); ++t) {
+            int id = tail_blocks[t] == 0 ? header : tail_blocks[t];
+            IrBlock& block = function.blocks[id];
+            IrInst call = block.insts[call_index[t]];
+            block.insts.erase(block.insts.begin() + call_index[t], block.insts.end());
+            // Arguments may read parameters, so all of them are evaluated into
+            // temporaries before any parameter is overwritten.
+            vector<int> temps;
+            for (size_t p = 0; p < call.args.size(); ++p) {
+                IrInst copy(IrOp::Copy, function.vreg_types[call.args[p]]);
+                copy.dest = function.new_vreg(copy.type);
+                copy.a = call.args[p];
+                temps.push_back(copy.dest);
+                block.insts.push_back(copy);
+            }
+            for (size_t p = 0; p < temps.size(); ++p) {
+                IrInst copy(IrOp::Copy, function.vreg_types[temps[p]]);
+                copy.dest = function.params[p];
+                copy.a = temps[p];
+                block.insts.push_back(copy);
+            }
+            IrInst back_edge(IrOp::Jump);
+            back_edge.target = header;
+            block.insts.push_back(back_edge);
+            tail_blocks[t] = id;
+        }
+        deepen_loop(function, header, tail_blocks);
+
+        // Keep the header right after the entry in the layout.
+        vector<int> order = {0, header};
+        for (int id = 1; id < header; ++id) order.push_back(id);
+        reorder_blocks(function, order);
+        simplify_cfg(function);
+        return (int)tail_blocks.size();
+    }
+
+    // The blocks of the new natural loop are one level deeper, which the
+    // register allocator's spill costs depend on.
+    static void deepen_loop(IrFunction& function, int header, const vector<int>& latches) {
+        vector<vector<int>> predecessors(function.blocks.size());
+        for (const IrBlock& block : function.blocks) {
+            for (int succ : successors(block)) predecessors[succ].push_back(block.id);
+        }
+        vector<bool> in_loop(function.blocks.size(), false);
+        in_loop[header] = true;
+        vector<int> worklist;
+        for (int latch : latches) {
+            if (!in_loop[latch]) {
+                in_loop[latch] = true;
+                worklist.push_back(latch);
+            }
+        }
+        while (!worklist.empty()) {
+            int id = worklist.back();
+            worklist.pop_back();
+            for (int pred : predecessors[id]) {
+                if (!in_loop[pred]) {
+                    in_loop[pred] = true;
+                    worklist.push_back(pred);
+                }
+            }
+        }
+        for (IrBlock& block : function.blocks) {
+            if (in_loop[block.id]) block.loop_depth++;
+        }
+    }
+};
+
+#endif
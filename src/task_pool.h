@@ -0,0 +1,120 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// ===================================================================
+// ===         WORK-STEALING TASK POOL                             ===
+// ===================================================================
+// Runs a batch of tasks on a fixed number of threads. The initial tasks are
+// taken in the order given, so a caller that sorts them by expected cost
+// gets longest-first scheduling. A task can spawn follow-up tasks (the next
+// stage of the same file); they go to the deque of the worker that spawned
+// them, which takes its newest work first while its data is still in cache.
+// A worker without work takes the next initial task, and once those are
+// gone steals the oldest task of another worker.
+
+class TaskPool {
+public:
+    typedef function<void()> Task;
+
+    explicit TaskPool(unsigned workers) : m_workers(workers == 0 ? 1 : workers) {}
+
+    unsigned workers() const { return m_workers; }
+
+    // Runs `tasks` and everything they spawn; returns when all have finished.
+    // The calling thread is one of the workers.
+    void run(vector<Task> tasks) {
+        m_initial.swap(tasks);
+        m_next_initial = 0;
+        m_pending = m_initial.size();
+        m_queues.clear();
+        for (unsigned i = 0; i < m_workers; ++i) m_queues.emplace_back(new WorkerQueue);
+        vector<thread> threads;
+        for (unsigned i = 1; i < m_workers; ++i) threads.emplace_back(&TaskPool::work, this, i);
+        work(0);
+        for (thread& t : threads) t.join();
+        m_initial.clear();
+    }
+
+    // From inside a task: queues `task` on the current worker.
+    void spawn(Task task) {
+        m_pending++;
+        WorkerQueue& queue = *m_queues[current_worker()];
+        lock_guard<mutex> lock(queue.lock);
+        queue.tasks.push_back(move(task));
+    }
+
+private:
+    struct WorkerQueue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    unsigned m_workers;
+    vector<Task> m_initial;
+    atomic<size_t> m_next_initial{0};
+    atomic<size_t> m_pending{0};   // tasks queued or running
+    vector<unique_ptr<WorkerQueue>> m_queues;
+
+    static unsigned& current_worker() {
+        static thread_local unsigned worker = 0;
+        return worker;
+    }
+
+    bool take(unsigned self, Task& task) {
+        {
+            WorkerQueue& own = *m_queues[self];
+            lock_guard<mutex> lock(own.lock);
+            if (!own.tasks.empty()) {
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        size_t index = m_next_initial.fetch_add(1);
+        if (index < m_initial.size()) {
+            task = move(m_initial[index]);
+            return true;
+        }
+        for (unsigned i = 1; i < m_workers; ++i) {
+            WorkerQueue& victim = *m_queues[(self + i) % m_workers];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(unsigned self) {
+        current_worker() = self;
+        unsigned idle_rounds = 0;
+        for (;;) {
+            Task task;
+            if (take(self, task)) {
+                idle_rounds = 0;
+                task();
+                m_pending--;
+                continue;
+            }
+            if (m_pending == 0) return;
+            // Someone is still running and may spawn more: back off gently.
+            if (++idle_rounds < 64) this_thread::yield();
+            else this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef TIERED_H
+#define TIERED_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bytecode.h"
+#include "ir.h"
+#include "jit.h"
+#include "vm.h"
+#include "x86_64_codegen.h"
+#include "x86_64_encoder.h"
+#include "x86_64_scheduler.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         TIERED EXECUTION                                    ===
+// ===================================================================
+// Starts the program in the bytecode VM at once and moves the functions that
+// turn out to be hot to native code:
+//
+//   1. The VM counts calls and loop iterations per function. At a threshold
+//      the function is queued for compilation.
+//   2. A background thread generates machine code for the function together
+//      with every function it can call (so the native code never has to call
+//      back into the VM), and loads it with the JIT. Its globals are linked to
+//      the memory the VM itself uses, so both tiers see the same values.
+//   3. The code address is published; the next call to the function made by
+//      the VM runs the native code instead. Activations already running in the
+//      VM finish there (the switch happens at function entry only).
+//
+// Where the JIT is not supported this is simply the VM.
+
+class TieredEngine : private HotFunctionListener {
+public:
+    // `opt_level` selects the machine-code optimisations, as for the JIT.
+    TieredEngine(const IrModule& module, int opt_level)
+        : m_module(module),
+          m_opt_level(opt_level),
+          m_program(BytecodeCompiler(module, true).compile()),
+          m_vm(m_program),
+          m_native_code(new atomic<void*>[m_program.functions.size()]),
+          m_requested(m_program.functions.size(), false) {
+        for (size_t i = 0; i < m_program.functions.size(); ++i) m_native_code[i].store(nullptr);
+    }
+
+    ~TieredEngine() {
+        if (m_compiler.joinable()) {
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_wakeup.notify_one();
+            m_compiler.join();
+        }
+        m_modules.clear();
+        release_global_memory();
+    }
+
+    TieredEngine(const TieredEngine&) = delete;
+    TieredEngine& operator=(const TieredEngine&) = delete;
+
+    bool load(string& error) {
+        if (!allocate_global_memory(error)) return false;
+        if (!m_vm.load(error, m_global_memory)) return false;
+#if JIT_SUPPORTED
+        m_vm.enable_tiering(this, m_native_code.get());
+        m_compiler = thread(&TieredEngine::compile_hot_functions, this);
+#endif
+        return true;
+    }
+
+    bool run(const string& name, RuntimeValue& result, string& error) { return m_vm.run(name, result, error); }
+
+    // Both tiers share the VM's globals.
+    void* global_address(const string& name) { return m_vm.global_address(name); }
+
+    // Waits until every function queued so far is compiled (or has failed to
+    // compile), so that native_functions() is exact.
+    void wait_for_compilations() {
+        if (!m_compiler.joinable()) return;
+        unique_lock<mutex> lock(m_mutex);
+        m_idle.wait(lock, [this] { return m_queue.empty() && !m_compiling; });
+    }
+
+    // Number of functions with native code (--tier-stats).
+    int native_functions() const {
+        int count = 0;
+        for (size_t i = 0; i < m_program.functions.size(); ++i) {
+            if (m_native_code[i].load()) count++;
+        }
+        return count;
+    }
+
+private:
+    const IrModule& m_module;
+    int m_opt_level;
+    BcProgram m_program;
+    BytecodeVM m_vm;
+    unique_ptr<atomic<void*>[]> m_native_code;   // per bytecode function
+    vector<bool> m_requested;                     // VM thread only
+    uint8_t* m_global_memory = nullptr;
+    size_t m_global_size = 0;
+    vector<uint8_t> m_global_storage;             // when the JIT is not supported
+
+    // Compilation queue, shared with the compiler thread.
+    thread m_compiler;
+    mutex m_mutex;
+    condition_variable m_wakeup;
+    condition_variable m_idle;                    // the queue ran empty
+    deque<uint32_t> m_queue;
+    bool m_compiling = false;
+    bool m_stopping = false;
+    vector<unique_ptr<JitModule>> m_modules;      // compiler thread only, until destruction
+
+    // Called by the VM. Never blocks on a compilation.
+    void function_is_hot(uint32_t function) override {
+        if (m_requested[function]) return;
+        m_requested[function] = true;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_queue.push_back(function);
+        }
+        m_wakeup.notify_one();
+    }
+
+    void compile_hot_functions() {
+        for (;;) {
+            uint32_t function;
+            {
+                unique_lock<mutex> lock(m_mutex);
+                m_wakeup.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+                if (m_stopping) return;
+                function = m_queue.front();
+                m_queue.pop_front();
+                m_compiling = true;
+            }
+            if (!m_native_code[function].load(memory_order_acquire)) compile(function);
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_compiling = false;
+            }
+            m_idle.notify_all();
+        }
+    }
+
+    // Generates and loads native code for `function` and everything it calls.
+    // On any failure the functions simply stay in the VM.
+    void compile(uint32_t function) {
+        set<string> closure;
+        vector<string> pending(1, m_program.functions[function].name);
+        while (!pending.empty()) {
+            string name = pending.back();
+            pending.pop_back();
+            if (!closure.insert(name).second) continue;
+            const IrFunction* ir_function = find_ir_function(name);
+            for (const IrBlock& block : ir_function->blocks) {
+                for (const IrInst& inst : block.insts) {
+                    if (inst.op != IrOp::Call) continue;
+                    const IrFunction* callee = find_ir_function(inst.symbol);
+                    if (callee && callee->defined && !closure.count(inst.symbol)) pending.push_back(inst.symbol);
+                }
+            }
+        }
+
+        IrModule part;
+        part.globals = m_module.globals;
+        for (const IrFunction& ir_function : m_module.functions) {
+            if (closure.count(ir_function.name)) part.functions.push_back(ir_function);
+        }
+        MModule machine_code = X86CodeGenerator(part).generate();
+        if (m_opt_level >= 1) optimise_machine_code(machine_code);
+        EncodedModule encoded = X86Encoder().encode(machine_code);
+
+        JitLinkOptions options;
+        for (const IrGlobal& global : m_module.globals) {
+            options.globals[global.name] = m_global_memory + m_program.global_offsets.at(global.name);
+        }
+        options.near = m_global_memory;
+        unique_ptr<JitModule> jit(new JitModule());
+        string error;
+        if (!jit->load(encoded, error, &options)) return;
+        for (const string& name : closure) {
+            int index = m_program.find_function(name);
+            void* expected = nullptr;
+            if (index >= 0) m_native_code[index].compare_exchange_strong(expected, jit->function(name), memory_order_release);
+        }
+        m_modules.push_back(move(jit));
+    }
+
+    const IrFunction* find_ir_function(const string& name) const {
+        for (const IrFunction& ir_function : m_module.functions) {
+            if (ir_function.name == name) return &ir_function;
+        }
+        return nullptr;
+    }
+
+    // Globals are mapped separately from the heap so that code the JIT maps
+    // next to them can reach them with rel32 addressing.
+    bool allocate_global_memory(string& error) {
+        m_global_size = m_program.globals.empty() ? 1 : m_program.globals.size();
+#if JIT_SUPPORTED
+        void* memory = mmap(nullptr, m_global_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            error = "could not allocate memory for the program";
+            return false;
+        }
+        m_global_memory = (uint8_t*)memory;
+#else
+        (void)error;
+        m_global_storage.assign(m_global_size, 0);
+        m_global_memory = m_global_storage.data();
+#endif
+        return true;
+    }
+
+    void release_global_memory() {
+#if JIT_SUPPORTED
+        if (m_global_memory) munmap(m_global_memory, m_global_size);
+#endif
+        m_global_memory = nullptr;
+    }
+};
+
+#endif
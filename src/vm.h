@@ -0,0 +1,357 @@
+#ifndef VM_H
+#define VM_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bytecode.h"
+#include "native_call.h"
+
+// GCC and Clang can jump straight to the handler of the next instruction
+// ("computed goto"), which predicts much better than one shared switch.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+using namespace std;
+
+// ===================================================================
+// ===         BYTECODE VIRTUAL MACHINE                            ===
+// ===================================================================
+// Executes a BcProgram. All frames live on one register stack: a call puts
+// the callee's registers right above the caller's, copies the arguments into
+// the callee's parameter registers and records where the result goes. Nothing
+// is allocated while the program runs.
+//
+// The arithmetic follows the native code: int operations wrap around, and a
+// float converted to an int that does not fit gives INT_MIN (as cvttss2si).
+// Functions the program only declares are called in the running process.
+//
+// With tiering enabled (see tiered.h) the VM counts calls and loop iterations
+// per function, reports functions that become hot, and calls a function's
+// native code instead of interpreting it once that has been published.
+
+class HotFunctionListener {
+public:
+    virtual ~HotFunctionListener() {}
+    // Called on the VM's thread; must not block for long.
+    virtual void function_is_hot(uint32_t function) = 0;
+};
+
+class BytecodeVM {
+public:
+    BytecodeVM(const BcProgram& program) : m_program(program), m_stack(kStackSlots) {}
+
+    // Resolves the external functions. Returns false with a message in `error`
+    // when one of them cannot be called. The globals live in `global_memory`
+    // when it is given (laid out as in BcProgram::globals), else in the VM.
+    bool load(string& error, uint8_t* global_memory = nullptr) {
+        m_natives.clear();
+        for (const BcNative& native : m_program.natives) {
+            void* address = find_native_function(native.name);
+            if (!address) {
+                error = "undefined reference to '" + native.name + "'";
+                return false;
+            }
+            if (!native_signature_supported(native.param_types)) {
+                error = "cannot call external function '" + native.name + "' from the interpreter";
+                return false;
+            }
+            m_natives.push_back(address);
+        }
+        if (global_memory) {
+            if (!m_program.globals.empty()) memcpy(global_memory, m_program.globals.data(), m_program.globals.size());
+            m_global_memory = global_memory;
+        } else {
+            m_globals = m_program.globals;
+            m_global_memory = m_globals.data();
+        }
+        return true;
+    }
+
+    // `native_code[f]` is null while function f is interpreted and may be set
+    // (by another thread) to the address of native code for it. Only functions
+    // whose signature call_native() supports are reported as hot.
+    void enable_tiering(HotFunctionListener* listener, const atomic<void*>* native_code) {
+        m_listener = listener;
+        m_native_code = native_code;
+        m_hotness.assign(m_program.functions.size(), 0);
+    }
+
+    // Runs the function `name`, which takes no arguments. Returns false with a
+    // message in `error` when the program fails at run time.
+    bool run(const string& name, RuntimeValue& result, string& error) {
+        int index = m_program.find_function(name);
+        if (index < 0) {
+            error = "no function '" + name + "'";
+            return false;
+        }
+        m_frames.clear();
+        return execute((uint32_t)index, result, error);
+    }
+
+    // Address of a global after load(), or nullptr.
+    void* global_address(const string& name) {
+        auto it = m_program.global_offsets.find(name);
+        return it == m_program.global_offsets.end() || !m_global_memory ? nullptr : m_global_memory + it->second;
+    }
+
+private:
+    static const size_t kStackSlots = 1 << 20;
+    static const uint32_t kHotThreshold = 1000;   // calls plus loop iterations
+
+    struct CallFrame {
+        uint32_t function;
+        const uint32_t* return_pc;   // in the caller
+        size_t base;                 // first register of the caller
+        uint32_t result;             // caller's register for the result, or kNoRegister
+    };
+
+    const BcProgram& m_program;
+    vector<RuntimeValue> m_stack;
+    vector<CallFrame> m_frames;
+    vector<void*> m_natives;
+    vector<uint8_t> m_globals;
+    uint8_t* m_global_memory = nullptr;
+    vector<RuntimeValue> m_arguments;   // scratch for tail and native calls
+    HotFunctionListener* m_listener = nullptr;
+    const atomic<void*>* m_native_code = nullptr;
+    vector<uint32_t> m_hotness;
+
+    static int32_t wrap_add(int32_t a, int32_t b) { return (int32_t)((uint32_t)a + (uint32_t)b); }
+    static int32_t wrap_sub(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+    static int32_t wrap_mul(int32_t a, int32_t b) { return (int32_t)((uint32_t)a * (uint32_t)b); }
+    static int32_t to_int(double value) {
+        if (!(value > -2147483649.0 && value < 2147483648.0)) return INT_MIN;
+        return (int32_t)value;
+    }
+
+    void count_use(uint32_t function) {
+        if (++m_hotness[function] == kHotThreshold && native_signature_supported(m_program.functions[function].param_types)) {
+            m_listener->function_is_hot(function);
+        }
+    }
+
+    // Native code published for `function`, or nullptr.
+    void* native_code(uint32_t function) const {
+        return m_native_code ? m_native_code[function].load(memory_order_acquire) : nullptr;
+    }
+
+    RuntimeValue call_compiled(void* code, const BcFunction& callee, const uint32_t* args, uint32_t argc,
+                               const RuntimeValue* r) {
+        m_arguments.resize(argc);
+        for (uint32_t i = 0; i < argc; ++i) m_arguments[i] = r[args[i]];
+        return call_native(code, callee.return_type, callee.param_types, m_arguments.data());
+    }
+
+    bool execute(uint32_t entry, RuntimeValue& result, string& error) {
+        const vector<BcFunction>& functions = m_program.functions;
+        const RuntimeValue* constants = m_program.constants.data();
+        uint8_t* globals = m_global_memory;
+        uint32_t current = entry;
+        size_t base = 0;
+        if (functions[current].num_registers > kStackSlots) {
+            error = "stack overflow";
+            return false;
+        }
+        const uint32_t* code = functions[current].code.data();
+        const uint32_t* pc = code;
+        RuntimeValue* r = m_stack.data();
+        RuntimeValue value;
+
+#if VM_COMPUTED_GOTO
+        static void* const dispatch[] = {
+#define VM_LABEL_ADDRESS(name) &&op_##name,
+            BYTECODE_OPS(VM_LABEL_ADDRESS)
+#undef VM_LABEL_ADDRESS
+        };
+#define VM_CASE(name) op_##name
+#define VM_NEXT() goto *dispatch[*pc]
+        VM_NEXT();
+#else
+#define VM_CASE(name) case BcOp::name
+#define VM_NEXT() continue
+    resume:
+        for (;;) switch ((BcOp)*pc) {
+#endif
+
+        VM_CASE(LoadK): r[pc[1]] = constants[pc[2]]; pc += 3; VM_NEXT();
+        VM_CASE(Move): r[pc[1]] = r[pc[2]]; pc += 3; VM_NEXT();
+
+        VM_CASE(AddI): r[pc[1]].i = wrap_add(r[pc[2]].i, r[pc[3]].i); pc += 4; VM_NEXT();
+        VM_CASE(SubI): r[pc[1]].i = wrap_sub(r[pc[2]].i, r[pc[3]].i); pc += 4; VM_NEXT();
+        VM_CASE(MulI): r[pc[1]].i = wrap_mul(r[pc[2]].i, r[pc[3]].i); pc += 4; VM_NEXT();
+        VM_CASE(DivI): {
+            int32_t divisor = r[pc[3]].i;
+            if (divisor == 0) {
+                error = "division by zero";
+                return false;
+            }
+            int32_t dividend = r[pc[2]].i;
+            r[pc[1]].i = divisor == -1 ? wrap_sub(0, dividend) : dividend / divisor;
+            pc += 4;
+            VM_NEXT();
+        }
+        VM_CASE(AddIK): r[pc[1]].i = wrap_add(r[pc[2]].i, (int32_t)pc[3]); pc += 4; VM_NEXT();
+        VM_CASE(SubIK): r[pc[1]].i = wrap_sub(r[pc[2]].i, (int32_t)pc[3]); pc += 4; VM_NEXT();
+
+        VM_CASE(AddF): r[pc[1]].f = r[pc[2]].f + r[pc[3]].f; pc += 4; VM_NEXT();
+        VM_CASE(SubF): r[pc[1]].f = r[pc[2]].f - r[pc[3]].f; pc += 4; VM_NEXT();
+        VM_CASE(MulF): r[pc[1]].f = r[pc[2]].f * r[pc[3]].f; pc += 4; VM_NEXT();
+        VM_CASE(DivF): r[pc[1]].f = r[pc[2]].f / r[pc[3]].f; pc += 4; VM_NEXT();
+        VM_CASE(AddD): r[pc[1]].d = r[pc[2]].d + r[pc[3]].d; pc += 4; VM_NEXT();
+        VM_CASE(SubD): r[pc[1]].d = r[pc[2]].d - r[pc[3]].d; pc += 4; VM_NEXT();
+        VM_CASE(MulD): r[pc[1]].d = r[pc[2]].d * r[pc[3]].d; pc += 4; VM_NEXT();
+        VM_CASE(DivD): r[pc[1]].d = r[pc[2]].d / r[pc[3]].d; pc += 4; VM_NEXT();
+
+#define VM_COMPARE(name, field, op) \
+        VM_CASE(name): r[pc[1]] = make_int_value(r[pc[2]].field op r[pc[3]].field); pc += 4; VM_NEXT();
+        VM_COMPARE(EqI, i, ==) VM_COMPARE(NeI, i, !=) VM_COMPARE(LtI, i, <)
+        VM_COMPARE(GtI, i, >) VM_COMPARE(LeI, i, <=) VM_COMPARE(GeI, i, >=)
+        VM_COMPARE(EqF, f, ==) VM_COMPARE(NeF, f, !=) VM_COMPARE(LtF, f, <)
+        VM_COMPARE(GtF, f, >) VM_COMPARE(LeF, f, <=) VM_COMPARE(GeF, f, >=)
+        VM_COMPARE(EqD, d, ==) VM_COMPARE(NeD, d, !=) VM_COMPARE(LtD, d, <)
+        VM_COMPARE(GtD, d, >) VM_COMPARE(LeD, d, <=) VM_COMPARE(GeD, d, >=)
+#undef VM_COMPARE
+
+        VM_CASE(I2F): value.bits = 0; value.f = (float)r[pc[2]].i; r[pc[1]] = value; pc += 3; VM_NEXT();
+        VM_CASE(I2D): r[pc[1]].d = (double)r[pc[2]].i; pc += 3; VM_NEXT();
+        VM_CASE(F2I): r[pc[1]] = make_int_value(to_int(r[pc[2]].f)); pc += 3; VM_NEXT();
+        VM_CASE(D2I): r[pc[1]] = make_int_value(to_int(r[pc[2]].d)); pc += 3; VM_NEXT();
+        VM_CASE(F2D): r[pc[1]].d = (double)r[pc[2]].f; pc += 3; VM_NEXT();
+        VM_CASE(D2F): value.bits = 0; value.f = (float)r[pc[2]].d; r[pc[1]] = value; pc += 3; VM_NEXT();
+        VM_CASE(TruncChar): r[pc[1]] = make_int_value((int8_t)r[pc[2]].i); pc += 3; VM_NEXT();
+        VM_CASE(TestBit):
+            r[pc[1]] = make_int_value((int32_t)((constants[pc[3]].bits >> (r[pc[2]].i & 63)) & 1));
+            pc += 4;
+            VM_NEXT();
+
+        VM_CASE(LoadGI): value.bits = 0; memcpy(&value.i, globals + pc[2], 4); r[pc[1]] = value; pc += 3; VM_NEXT();
+        VM_CASE(LoadGC): r[pc[1]] = make_int_value((int8_t)globals[pc[2]]); pc += 3; VM_NEXT();
+        VM_CASE(LoadGF): value.bits = 0; memcpy(&value.f, globals + pc[2], 4); r[pc[1]] = value; pc += 3; VM_NEXT();
+        VM_CASE(LoadGD): memcpy(&r[pc[1]].d, globals + pc[2], 8); pc += 3; VM_NEXT();
+        VM_CASE(StoreGI): memcpy(globals + pc[1], &r[pc[2]].i, 4); pc += 3; VM_NEXT();
+        VM_CASE(StoreGC): globals[pc[1]] = (uint8_t)r[pc[2]].i; pc += 3; VM_NEXT();
+        VM_CASE(StoreGF): memcpy(globals + pc[1], &r[pc[2]].f, 4); pc += 3; VM_NEXT();
+        VM_CASE(StoreGD): memcpy(globals + pc[1], &r[pc[2]].d, 8); pc += 3; VM_NEXT();
+
+        VM_CASE(Jmp): pc = code + pc[1]; VM_NEXT();
+        VM_CASE(Jnz): pc = r[pc[1]].i != 0 ? code + pc[2] : pc + 3; VM_NEXT();
+        VM_CASE(Jz): pc = r[pc[1]].i == 0 ? code + pc[2] : pc + 3; VM_NEXT();
+        VM_CASE(JumpTable): {
+            uint32_t index = (uint32_t)r[pc[1]].i - pc[2];
+            pc = code + (index < pc[3] ? pc[5 + index] : pc[4]);
+            VM_NEXT();
+        }
+
+#define VM_JUMP(name, op, rhs) \
+        VM_CASE(name): pc = r[pc[1]].i op (rhs) ? code + pc[3] : pc + 4; VM_NEXT();
+        VM_JUMP(JeqI, ==, r[pc[2]].i) VM_JUMP(JneI, !=, r[pc[2]].i) VM_JUMP(JltI, <, r[pc[2]].i)
+        VM_JUMP(JgtI, >, r[pc[2]].i) VM_JUMP(JleI, <=, r[pc[2]].i) VM_JUMP(JgeI, >=, r[pc[2]].i)
+        VM_JUMP(JeqIK, ==, (int32_t)pc[2]) VM_JUMP(JneIK, !=, (int32_t)pc[2]) VM_JUMP(JltIK, <, (int32_t)pc[2])
+        VM_JUMP(JgtIK, >, (int32_t)pc[2]) VM_JUMP(JleIK, <=, (int32_t)pc[2]) VM_JUMP(JgeIK, >=, (int32_t)pc[2])
+#undef VM_JUMP
+
+        VM_CASE(Call): {
+            const BcFunction& callee = functions[pc[2]];
+            if (m_listener) {
+                if (void* compiled = native_code(pc[2])) {
+                    value = call_compiled(compiled, callee, pc + 4, pc[3], r);
+                    if (pc[1] != kNoRegister) r[pc[1]] = value;
+                    pc += 4 + pc[3];
+                    VM_NEXT();
+                }
+                count_use(pc[2]);
+            }
+            size_t callee_base = base + functions[current].num_registers + 1;
+            if (callee_base + callee.num_registers > kStackSlots) {
+                error = "stack overflow";
+                return false;
+            }
+            uint32_t argc = pc[3];
+            RuntimeValue* callee_registers = m_stack.data() + callee_base;
+            for (uint32_t i = 0; i < argc; ++i) callee_registers[callee.params[i]] = r[pc[4 + i]];
+            m_frames.push_back(CallFrame{current, pc + 4 + argc, base, pc[1]});
+            current = pc[2];
+            base = callee_base;
+            r = callee_registers;
+            code = callee.code.data();
+            pc = code;
+            VM_NEXT();
+        }
+        VM_CASE(TailCall): {
+            // The callee replaces the current frame; the arguments may overlap it.
+            const BcFunction& callee = functions[pc[2]];
+            if (m_listener) {
+                if (void* compiled = native_code(pc[2])) {
+                    value = call_compiled(compiled, callee, pc + 4, pc[3], r);
+                    goto return_value;
+                }
+                count_use(pc[2]);
+            }
+            if (base + callee.num_registers > kStackSlots) {
+                error = "stack overflow";
+                return false;
+            }
+            uint32_t argc = pc[3];
+            m_arguments.resize(argc);
+            for (uint32_t i = 0; i < argc; ++i) m_arguments[i] = r[pc[4 + i]];
+            for (uint32_t i = 0; i < argc; ++i) r[callee.params[i]] = m_arguments[i];
+            current = pc[2];
+            code = callee.code.data();
+            pc = code;
+            VM_NEXT();
+        }
+        VM_CASE(CallNative): {
+            const BcNative& native = m_program.natives[pc[2]];
+            uint32_t argc = pc[3];
+            m_arguments.resize(argc);
+            for (uint32_t i = 0; i < argc; ++i) m_arguments[i] = r[pc[4 + i]];
+            value = call_native(m_natives[pc[2]], native.return_type, native.param_types, m_arguments.data());
+            if (pc[1] != kNoRegister) r[pc[1]] = value;
+            pc += 4 + argc;
+            VM_NEXT();
+        }
+        VM_CASE(LoopHeader):
+            if (m_listener) count_use(current);
+            pc += 1;
+            VM_NEXT();
+        VM_CASE(Ret): value = r[pc[1]]; goto return_value;
+        VM_CASE(RetVoid): value.bits = 0; goto return_value;
+
+#if !VM_COMPUTED_GOTO
+        case BcOp::Count: break;
+        }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+
+    return_value:
+        if (m_frames.empty()) {
+            result = value;
+            return true;
+        }
+        {
+            const CallFrame& frame = m_frames.back();
+            current = frame.function;
+            base = frame.base;
+            r = m_stack.data() + base;
+            code = functions[current].code.data();
+            pc = frame.return_pc;
+            if (frame.result != kNoRegister) r[frame.result] = value;
+            m_frames.pop_back();
+        }
+#if VM_COMPUTED_GOTO
+        goto *dispatch[*pc];
+#else
+        goto resume;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "source_analysis.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         WATCH MODE                                          ===
+// ===================================================================
+// `parser --watch DIR` checks every .c and .h file below DIR, then waits for
+// inotify to report writes, renames and deletions and checks again only what
+// they affect: the changed files and, through the include graph, every file
+// that includes one of them directly or indirectly. The parse of every other
+// file stays in memory, so a header that changes is parsed once however many
+// files include it, and a file whose header changed is lowered again without
+// being parsed again.
+//
+// A file is checked together with the declarations of the headers it
+// includes, the way the preprocessor would see them: each header once, in
+// include order, before the file's own declarations. Quoted names resolve
+// against the directory of the including file first, then against DIR.
+
+const int kWatchSettleMs = 50;   // editors save in several steps
+const uint32_t kWatchEvents = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+class SourceWatcher {
+public:
+    explicit SourceWatcher(const string& directory) : m_directory(directory) {}
+
+    ~SourceWatcher() {
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    // Checks the tree and then follows its changes until watching fails.
+    int run() {
+        char resolved[PATH_MAX];
+        if (!realpath(m_directory.c_str(), resolved)) {
+            cerr << "Error: Could not watch '" << m_directory << "': " << strerror(errno) << endl;
+            return 1;
+        }
+        m_root = resolved;
+        m_fd = inotify_init1(IN_CLOEXEC);
+        if (m_fd < 0) {
+            cerr << "Error: Could not start inotify: " << strerror(errno) << endl;
+            return 1;
+        }
+        set<string> changed;
+        if (!add_directory(m_root, changed)) {
+            cerr << "Error: Could not watch '" << m_directory << "': " << strerror(errno) << endl;
+            return 1;
+        }
+        update(changed, true);
+        for (;;) {
+            changed.clear();
+            bool rescan = false;
+            if (!wait_for_changes(changed, rescan)) {
+                cerr << "Error: Watching '" << m_directory << "' failed: " << strerror(errno) << endl;
+                return 1;
+            }
+            if (rescan) {
+                // Events were lost: look at everything again.
+                for (const auto& file : m_files) changed.insert(file.first);
+                add_directory(m_root, changed);
+            }
+            update(changed, false);
+        }
+    }
+
+private:
+    struct WatchedFile {
+        size_t text_hash = 0;
+        ParsedSource parse;
+    };
+
+    string m_directory;
+    string m_root;                    // m_directory as an absolute path
+    int m_fd = -1;
+    map<int, string> m_watches;       // inotify watch descriptor -> directory
+    map<string, WatchedFile> m_files;
+
+    string display_name(const string& path) const {
+        if (path.compare(0, m_root.size() + 1, m_root + "/") == 0) return path.substr(m_root.size() + 1);
+        return path;
+    }
+
+    // Watches `path` and the directories below it, adding their source files
+    // to `found`. Hidden directories (.git and the like) are left out.
+    bool add_directory(const string& path, set<string>& found) {
+        int wd = inotify_add_watch(m_fd, path.c_str(), kWatchEvents | IN_ONLYDIR);
+        if (wd < 0) return false;
+        m_watches[wd] = path;
+        DIR* dir = opendir(path.c_str());
+        if (!dir) return false;
+        vector<string> subdirectories;
+        while (dirent* entry = readdir(dir)) {
+            string name = entry->d_name;
+            if (name.empty() || name[0] == '.') continue;
+            string child = path + "/" + name;
+            struct stat info;
+            if (lstat(child.c_str(), &info) != 0) continue;
+            if (S_ISDIR(info.st_mode)) subdirectories.push_back(child);
+            else if (S_ISREG(info.st_mode) && is_source_name(name)) found.insert(child);
+        }
+        closedir(dir);
+        for (const string& subdirectory : subdirectories) add_directory(subdirectory, found);
+        return true;
+    }
+
+    // A directory moved or deleted: its files are gone, and so are the
+    // watches of a moved one, whose events would carry the old names.
+    void remove_directory(const string& path, set<string>& changed) {
+        string prefix = path + "/";
+        for (const auto& file : m_files) {
+            if (file.first.compare(0, prefix.size(), prefix) == 0) changed.insert(file.first);
+        }
+        for (auto it = m_watches.begin(); it != m_watches.end();) {
+            if (it->second == path || it->second.compare(0, prefix.size(), prefix) == 0) {
+                inotify_rm_watch(m_fd, it->first);
+                it = m_watches.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Blocks until something changed, then collects events until the tree
+    // has been quiet for kWatchSettleMs.
+    bool wait_for_changes(set<string>& changed, bool& rescan) {
+        int timeout = -1;
+        for (;;) {
+            pollfd descriptor = {m_fd, POLLIN, 0};
+            int ready = poll(&descriptor, 1, timeout);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (ready == 0) {
+                if (!changed.empty() || rescan) return true;
+                timeout = -1;
+                continue;
+            }
+            if (!read_events(changed, rescan)) return false;
+            timeout = kWatchSettleMs;
+        }
+    }
+
+    bool read_events(set<string>& changed, bool& rescan) {
+        alignas(inotify_event) char buffer[64 * 1024];
+        ssize_t size = read(m_fd, buffer, sizeof(buffer));
+        if (size < 0) return errno == EINTR || errno == EAGAIN;
+        for (char* p = buffer; p < buffer + size;) {
+            const inotify_event* event = (const inotify_event*)p;
+            p += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                rescan = true;
+                continue;
+            }
+            auto watch = m_watches.find(event->wd);
+            if (watch == m_watches.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                m_watches.erase(watch);
+                continue;
+            }
+            if (event->len == 0) continue;
+            string name = event->name;
+            string path = watch->second + "/" + name;
+            if (event->mask & IN_ISDIR) {
+                if (name[0] == '.') continue;
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) add_directory(path, changed);
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM)) remove_directory(path, changed);
+            } else if (is_source_name(name) && !(event->mask & IN_CREATE)) {
+                // A new file is checked once it has been written and closed.
+                changed.insert(path);
+            }
+        }
+        return true;
+    }
+
+    // Reads and parses `path` again, or forgets it if it is gone; false when
+    // nothing changed.
+    bool reload(const string& path) {
+        ifstream input(path);
+        if (!input.is_open()) return m_files.erase(path) > 0;
+        string text((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+        size_t text_hash = hash<string>()(text);
+        auto it = m_files.find(path);
+        if (it != m_files.end() && it->second.text_hash == text_hash) return false;
+        WatchedFile& file = m_files[path];
+        file.text_hash = text_hash;
+        file.parse = parse_source(text);
+        return true;
+    }
+
+    vector<string> include_candidates(const string& from, const string& name) const {
+        return ::include_candidates(from, name, {m_root});
+    }
+
+    // The watched file `#include "name"` in `from` refers to; empty if none.
+    string resolve_include(const string& from, const string& name) const {
+        for (const string& candidate : include_candidates(from, name)) {
+            if (m_files.count(candidate)) return candidate;
+        }
+        return "";
+    }
+
+    // Adds to `files` every file that includes one of them, directly or not.
+    // Candidates rather than resolved includes are compared, so files whose
+    // includes now resolve differently (a header appeared or went away)
+    // count as well.
+    void add_dependents(set<string>& files) const {
+        vector<string> work(files.begin(), files.end());
+        while (!work.empty()) {
+            string changed = work.back();
+            work.pop_back();
+            for (const auto& file : m_files) {
+                if (files.count(file.first)) continue;
+                for (const string& name : file.second.parse.includes) {
+                    vector<string> candidates = include_candidates(file.first, name);
+                    if (find(candidates.begin(), candidates.end(), changed) == candidates.end()) continue;
+                    files.insert(file.first);
+                    work.push_back(file.first);
+                    break;
+                }
+            }
+        }
+    }
+
+    // The declarations of the headers `path` includes, then its own.
+    void collect_declarations(const string& path, set<string>& seen, vector<const ParseNode*>& declarations) const {
+        const ParsedSource& parse = m_files.at(path).parse;
+        for (const string& name : parse.includes) {
+            string header = resolve_include(path, name);
+            if (header.empty() || !seen.insert(header).second) continue;
+            if (m_files.at(header).parse.tree) collect_declarations(header, seen, declarations);
+        }
+        for (const ParseNode* node : parse.tree->children) declarations.push_back(node);
+    }
+
+    // Prints the diagnostics of `path`; false if it has errors.
+    bool check(const string& path, bool quiet_if_clean) const {
+        const ParsedSource& parse = m_files.at(path).parse;
+        string report = parse.diagnostics;
+        if (parse.tree) {
+            set<string> seen = {path};
+            vector<const ParseNode*> declarations;
+            collect_declarations(path, seen, declarations);
+            report += check_declarations(declarations);
+        }
+        print_file_report(display_name(path), report, quiet_if_clean);
+        return report.empty();
+    }
+
+    // Parses the changed files, then checks them and their dependents. The
+    // first round prints only the files with errors.
+    void update(const set<string>& changed, bool initial) {
+        set<string> affected;
+        for (const string& path : changed) {
+            if (!reload(path)) continue;
+            if (!m_files.count(path)) cout << display_name(path) << ": removed" << endl;
+            affected.insert(path);
+        }
+        if (affected.empty()) return;
+        add_dependents(affected);
+        size_t checked = 0, failed = 0;
+        for (const string& path : affected) {
+            if (!m_files.count(path)) continue;
+            checked++;
+            if (!check(path, initial)) failed++;
+        }
+        if (initial) {
+            cout << "Watching '" << m_directory << "': " << checked << " files, " << failed << " with errors." << endl;
+        } else {
+            cout << "Checked " << checked << " of " << m_files.size() << " files, " << failed << " with errors." << endl;
+        }
+    }
+};
+
+#endif
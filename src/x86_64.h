@@ -0,0 +1,550 @@
+#ifndef X86_64_H
+#define X86_64_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "output_buffer.h"
+#include "regalloc.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         x86-64 MACHINE INSTRUCTIONS                         ===
+// ===================================================================
+// The back end's view of a program: real x86-64 instructions with physical
+// registers, grouped into blocks that correspond to assembler labels. Operands
+// follow the Intel order (destination first); the AT&T printer reverses them.
+
+enum class MOp {
+    Mov, Movsx8, Movzx8, Lea, Add, Sub, Imul, Idiv, Cdq, And, Or, Xor, Cmp, Test, Bt,
+    Setcc, Jmp, Jcc, JmpTable, Call, Ret, Push, Pop,
+    MovSS, MovSD, Movaps, AddSS, SubSS, MulSS, DivSS, AddSD, SubSD, MulSD, DivSD,
+    UcomiSS, UcomiSD, Cvtsi2SS, Cvtsi2SD, CvttSS2si, CvttSD2si, CvtSS2SD, CvtSD2SS, Xorps
+};
+
+// Condition codes, numbered as in the Jcc/SETcc encodings.
+enum class Cond { O, NO, B, AE, E, NE, BE, A, S, NS, P, NP, L, GE, LE, G };
+
+enum class MOperandKind { None, Reg, Imm, Mem, Label, Symbol };
+
+struct MOperand {
+    MOperandKind kind = MOperandKind::None;
+    int reg = -1;          // Reg; base register for Mem (-1 with a symbol: RIP-relative)
+    long long imm = 0;
+    int index = -1;        // Mem: optional index register
+    int scale = 1;
+    int disp = 0;
+    string symbol;         // Mem (RIP-relative) or Symbol (call target)
+    int label = -1;        // Label: block index within the function
+
+    static MOperand make_reg(int reg) {
+        MOperand op;
+        op.kind = MOperandKind::Reg;
+        op.reg = reg;
+        return op;
+    }
+    static MOperand make_imm(long long value) {
+        MOperand op;
+        op.kind = MOperandKind::Imm;
+        op.imm = value;
+        return op;
+    }
+    static MOperand make_mem(int base, int disp) {
+        MOperand op;
+        op.kind = MOperandKind::Mem;
+        op.reg = base;
+        op.disp = disp;
+        return op;
+    }
+    static MOperand make_global(const string& symbol) {
+        MOperand op;
+        op.kind = MOperandKind::Mem;
+        op.symbol = symbol;
+        return op;
+    }
+    static MOperand make_label(int block) {
+        MOperand op;
+        op.kind = MOperandKind::Label;
+        op.label = block;
+        return op;
+    }
+    static MOperand make_symbol(const string& symbol) {
+        MOperand op;
+        op.kind = MOperandKind::Symbol;
+        op.symbol = symbol;
+        return op;
+    }
+    bool is_reg() const { return kind == MOperandKind::Reg; }
+    bool is_mem() const { return kind == MOperandKind::Mem; }
+    bool is_imm() const { return kind == MOperandKind::Imm; }
+    bool operator==(const MOperand& other) const {
+        return kind == other.kind && reg == other.reg && imm == other.imm && index == other.index &&
+               scale == other.scale && disp == other.disp && symbol == other.symbol && label == other.label;
+    }
+    bool operator!=(const MOperand& other) const { return !(*this == other); }
+};
+
+struct MInst {
+    MOp op;
+    int size = 4;              // operand size in bytes of integer instructions (1, 4 or 8)
+    Cond cond = Cond::E;       // Jcc / Setcc
+    int int_arguments = 6;     // Call / Jmp to a symbol: argument registers in use
+    int float_arguments = 8;
+    MOperand dst;
+    MOperand src;
+    vector<int> table;         // JmpTable: the label of each entry
+
+    MInst(MOp op_, int size_ = 4) : op(op_), size(size_) {}
+};
+
+struct MBlock {
+    vector<MInst> insts;
+};
+
+struct MFunction {
+    string name;
+    vector<MBlock> blocks;     // laid out in order; the label of block i is local
+};
+
+// Initialised storage for one global variable.
+struct MGlobal {
+    string name;
+    int size;
+    int align;
+    vector<uint8_t> bytes;
+};
+
+// A floating-point literal kept in read-only data.
+struct MConstant {
+    string label;
+    int size;                  // 4 (float) or 8 (double)
+    uint64_t bits;
+};
+
+struct MModule {
+    vector<MGlobal> globals;
+    vector<MConstant> constants;
+    vector<MFunction> functions;
+};
+
+// JmpTable jumps to table[dst]: it expands to a load of the entry (an offset
+// from the table, which follows the jump in the code) and an indirect jump,
+// using rdx as well. The index register is clobbered.
+inline bool is_block_terminator(MOp op) {
+    return op == MOp::Jmp || op == MOp::JmpTable || op == MOp::Ret;
+}
+
+// --- INSTRUCTION EFFECTS ---
+// What an instruction reads and writes, for the passes that rearrange machine
+// code (x86_64_peephole.h, x86_64_scheduler.h). Registers are bits of a mask,
+// numbered as X86Reg; the flags are one more bit. Writes to part of a
+// register (setcc, movss between registers, cvtsi2ss) count as a read too.
+
+typedef uint64_t RegMask;
+
+const RegMask kFlagsBit = (RegMask)1 << kNumX86Regs;
+
+inline RegMask reg_bit(int reg) { return (RegMask)1 << reg; }
+
+struct MEffects {
+    RegMask uses = 0;
+    RegMask defs = 0;
+    bool reads_memory = false;
+    bool writes_memory = false;
+    bool may_trap = false;     // idiv: must stay in order with stores
+    bool control = false;      // jumps, calls and returns end a straight-line region
+};
+
+// Registers an operand reads when it is a source: the register itself, or the
+// address registers of a memory operand.
+inline RegMask operand_reads(const MOperand& op) {
+    if (op.is_reg()) return reg_bit(op.reg);
+    RegMask mask = 0;
+    if (op.is_mem() && op.symbol.empty()) {
+        mask |= reg_bit(op.reg);
+        if (op.index >= 0) mask |= reg_bit(op.index);
+    }
+    return mask;
+}
+
+// The registers carrying the arguments of a call.
+inline RegMask argument_registers(const MInst& call) {
+    static const int int_registers[] = {RDI, RSI, RDX, RCX, R8, R9};
+    RegMask mask = 0;
+    for (int i = 0; i < call.int_arguments && i < 6; ++i) mask |= reg_bit(int_registers[i]);
+    for (int i = 0; i < call.float_arguments && i < 8; ++i) mask |= reg_bit(XMM0 + i);
+    return mask;
+}
+
+inline RegMask callee_saved_registers() {
+    return reg_bit(RBX) | reg_bit(RSP) | reg_bit(RBP) | reg_bit(R12) | reg_bit(R13) | reg_bit(R14) | reg_bit(R15);
+}
+
+inline MEffects machine_effects(const MInst& inst) {
+    MEffects effects;
+    const MOperand& dst = inst.dst;
+    const MOperand& src = inst.src;
+    bool same_register = dst.is_reg() && src.is_reg() && dst.reg == src.reg;
+    // dst written (and read as well when `read_dst`), src read.
+    auto binary = [&](bool read_dst, bool flags) {
+        effects.uses |= operand_reads(src);
+        effects.reads_memory = src.is_mem();
+        if (dst.is_reg()) {
+            effects.defs |= reg_bit(dst.reg);
+            if (read_dst) effects.uses |= reg_bit(dst.reg);
+        } else if (dst.is_mem()) {
+            effects.uses |= operand_reads(dst);
+            effects.writes_memory = true;
+            if (read_dst) effects.reads_memory = true;
+        }
+        if (flags) effects.defs |= kFlagsBit;
+    };
+    switch (inst.op) {
+        case MOp::Mov: binary(dst.is_reg() && inst.size == 1, false); break;
+        case MOp::Movsx8: case MOp::Movzx8: case MOp::CvttSS2si: case MOp::CvttSD2si: case MOp::Movaps:
+            binary(false, false);
+            break;
+        case MOp::Lea:
+            effects.uses |= operand_reads(src);
+            effects.defs |= reg_bit(dst.reg);
+            break;
+        case MOp::Xor: case MOp::Sub: binary(!same_register, true); break;   // xor r, r: zeroing idiom
+        case MOp::Add: case MOp::Imul: case MOp::And: case MOp::Or: binary(true, true); break;
+        case MOp::Cmp: case MOp::Test: case MOp::Bt: case MOp::UcomiSS: case MOp::UcomiSD:
+            effects.uses |= operand_reads(dst) | operand_reads(src);
+            effects.reads_memory = dst.is_mem() || src.is_mem();
+            effects.defs |= kFlagsBit;
+            break;
+        case MOp::Idiv:
+            effects.uses |= reg_bit(RAX) | reg_bit(RDX) | operand_reads(dst);
+            effects.reads_memory = dst.is_mem();
+            effects.defs |= reg_bit(RAX) | reg_bit(RDX) | kFlagsBit;
+            effects.may_trap = true;
+            break;
+        case MOp::Cdq:
+            effects.uses |= reg_bit(RAX);
+            effects.defs |= reg_bit(RDX);
+            break;
+        case MOp::Setcc:
+            effects.uses |= kFlagsBit;
+            binary(true, false);
+            break;
+        case MOp::Jcc:
+            effects.uses |= kFlagsBit;
+            effects.control = true;
+            break;
+        case MOp::JmpTable:
+            effects.uses |= reg_bit(dst.reg);
+            effects.defs |= reg_bit(dst.reg) | reg_bit(RDX) | kFlagsBit;
+            effects.reads_memory = true;
+            effects.control = true;
+            break;
+        case MOp::Jmp:
+            // A jump to a symbol is a tail call: the arguments and the
+            // registers our caller expects preserved are in use.
+            if (dst.kind == MOperandKind::Symbol) effects.uses |= argument_registers(inst) | callee_saved_registers();
+            effects.control = true;
+            break;
+        case MOp::Call:
+            effects.uses |= argument_registers(inst) | reg_bit(RSP);
+            for (int r = 0; r < kNumX86Regs; ++r) {
+                if (sysv_x86_64_register_file().caller_saved[r]) effects.defs |= reg_bit(r);
+            }
+            effects.defs |= kFlagsBit;
+            effects.reads_memory = effects.writes_memory = true;
+            effects.control = true;
+            break;
+        case MOp::Ret:
+            effects.uses |= reg_bit(RAX) | reg_bit(XMM0) | callee_saved_registers();
+            effects.reads_memory = true;
+            effects.control = true;
+            break;
+        case MOp::Push:
+            effects.uses |= reg_bit(dst.reg) | reg_bit(RSP);
+            effects.defs |= reg_bit(RSP);
+            effects.writes_memory = true;
+            effects.control = true;   // moves the stack pointer: never reordered
+            break;
+        case MOp::Pop:
+            effects.uses |= reg_bit(RSP);
+            effects.defs |= reg_bit(dst.reg) | reg_bit(RSP);
+            effects.reads_memory = true;
+            effects.control = true;
+            break;
+        case MOp::MovSS: case MOp::MovSD: binary(dst.is_reg() && src.is_reg(), false); break;
+        case MOp::Xorps: binary(!same_register, false); break;
+        case MOp::AddSS: case MOp::SubSS: case MOp::MulSS: case MOp::DivSS:
+        case MOp::AddSD: case MOp::SubSD: case MOp::MulSD: case MOp::DivSD:
+        case MOp::Cvtsi2SS: case MOp::Cvtsi2SD: case MOp::CvtSS2SD: case MOp::CvtSD2SS:
+            binary(true, false);
+            break;
+    }
+    return effects;
+}
+
+// ===================================================================
+// ===         ASSEMBLY PRINTER                                    ===
+// ===================================================================
+// Writes GNU assembler input in either AT&T or Intel syntax.
+
+enum class AsmSyntax { ATT, Intel };
+
+class AsmPrinter {
+public:
+    AsmPrinter(OutputBuffer& out, AsmSyntax syntax) : m_out(out), m_syntax(syntax) {}
+
+    void print(const MModule& module) {
+        if (m_syntax == AsmSyntax::Intel) m_out << "\t.intel_syntax noprefix\n";
+        if (!module.functions.empty()) m_out << "\t.text\n";
+        for (size_t f = 0; f < module.functions.size(); ++f) {
+            print_function(module.functions[f], (int)f);
+        }
+        if (!module.constants.empty()) {
+            m_out << "\t.section\t.rodata\n";
+            for (const MConstant& constant : module.constants) {
+                m_out << "\t.p2align\t" << (constant.size == 8 ? 3 : 2) << "\n"
+                      << constant.label << ":\n";
+                if (constant.size == 8) m_out << "\t.quad\t" << (long long)constant.bits << "\n";
+                else m_out << "\t.long\t" << (long long)constant.bits << "\n";
+            }
+        }
+        if (!module.globals.empty()) {
+            m_out << "\t.data\n";
+            for (const MGlobal& global : module.globals) {
+                m_out << "\t.globl\t" << global.name << "\n"
+                      << "\t.p2align\t" << (global.align == 8 ? 3 : global.align == 4 ? 2 : 0) << "\n"
+                      << "\t.type\t" << global.name << ", @object\n"
+                      << "\t.size\t" << global.name << ", " << global.size << "\n"
+                      << global.name << ":\n";
+                for (uint8_t byte : global.bytes) m_out << "\t.byte\t" << (int)byte << "\n";
+            }
+        }
+        m_out << "\t.section\t.note.GNU-stack,\"\",@progbits\n";
+    }
+
+    static string block_label(int function_index, int block) {
+        return ".LBB" + to_string(function_index) + "_" + to_string(block);
+    }
+
+private:
+    OutputBuffer& m_out;
+    AsmSyntax m_syntax;
+    int m_function_index = 0;
+    int m_table_count = 0;             // jump tables printed in the current function
+
+    void print_function(const MFunction& function, int index) {
+        m_function_index = index;
+        m_table_count = 0;
+        m_out << "\t.globl\t" << function.name << "\n"
+              << "\t.type\t" << function.name << ", @function\n"
+              << function.name << ":\n";
+        for (size_t b = 0; b < function.blocks.size(); ++b) {
+            if (b > 0) m_out << block_label(index, (int)b) << ":\n";
+            for (const MInst& inst : function.blocks[b].insts) print_inst(inst);
+        }
+        m_out << "\t.size\t" << function.name << ", .-" << function.name << "\n";
+    }
+
+    static const char* gp_name(int reg, int size) {
+        static const char* const names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                              "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+        static const char* const names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                              "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+        static const char* const names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                             "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+        if (size == 8) return names64[reg];
+        if (size == 1) return names8[reg];
+        return names32[reg];
+    }
+
+    static const char* cond_name(Cond cond) {
+        static const char* const names[] = {"o", "no", "b", "ae", "e", "ne", "be", "a",
+                                            "s", "ns", "p", "np", "l", "ge", "le", "g"};
+        return names[(int)cond];
+    }
+
+    // Mnemonic without size suffix, and whether it takes one in AT&T syntax.
+    static const char* mnemonic(MOp op, bool& sized) {
+        sized = false;
+        switch (op) {
+            case MOp::MovSS: return "movss";
+            case MOp::MovSD: return "movsd";
+            case MOp::Movaps: return "movaps";
+            case MOp::AddSS: return "addss";
+            case MOp::SubSS: return "subss";
+            case MOp::MulSS: return "mulss";
+            case MOp::DivSS: return "divss";
+            case MOp::AddSD: return "addsd";
+            case MOp::SubSD: return "subsd";
+            case MOp::MulSD: return "mulsd";
+            case MOp::DivSD: return "divsd";
+            case MOp::UcomiSS: return "ucomiss";
+            case MOp::UcomiSD: return "ucomisd";
+            case MOp::CvtSS2SD: return "cvtss2sd";
+            case MOp::CvtSD2SS: return "cvtsd2ss";
+            case MOp::Xorps: return "xorps";
+            case MOp::Ret: return "ret";
+            case MOp::Call: return "call";
+            case MOp::Jmp: return "jmp";
+            default: break;
+        }
+        sized = true;
+        switch (op) {
+            case MOp::Mov: return "mov";
+            case MOp::Lea: return "lea";
+            case MOp::Add: return "add";
+            case MOp::Sub: return "sub";
+            case MOp::Imul: return "imul";
+            case MOp::Idiv: return "idiv";
+            case MOp::And: return "and";
+            case MOp::Or: return "or";
+            case MOp::Xor: return "xor";
+            case MOp::Cmp: return "cmp";
+            case MOp::Test: return "test";
+            case MOp::Bt: return "bt";
+            case MOp::Push: return "push";
+            case MOp::Pop: return "pop";
+            case MOp::Cvtsi2SS: return "cvtsi2ss";
+            case MOp::Cvtsi2SD: return "cvtsi2sd";
+            case MOp::CvttSS2si: return "cvttss2si";
+            case MOp::CvttSD2si: return "cvttsd2si";
+            default: return "?";
+        }
+    }
+
+    static char size_suffix(int size) {
+        return size == 8 ? 'q' : size == 1 ? 'b' : 'l';
+    }
+
+    string operand(const MOperand& op, int size) const {
+        bool att = m_syntax == AsmSyntax::ATT;
+        switch (op.kind) {
+            case MOperandKind::Reg:
+                if (op.reg >= XMM0) return string(att ? "%" : "") + "xmm" + to_string(op.reg - XMM0);
+                return string(att ? "%" : "") + gp_name(op.reg, size);
+            case MOperandKind::Imm:
+                return (att ? "$" : "") + to_string(op.imm);
+            case MOperandKind::Label:
+                return block_label(m_function_index, op.label);
+            case MOperandKind::Symbol:
+                return op.symbol;
+            case MOperandKind::Mem:
+                return att ? att_memory(op) : intel_memory(op, size);
+            case MOperandKind::None:
+                break;
+        }
+        return "";
+    }
+
+    static string att_memory(const MOperand& op) {
+        if (!op.symbol.empty()) {
+            return op.symbol + (op.disp ? (op.disp > 0 ? "+" : "") + to_string(op.disp) : "") + "(%rip)";
+        }
+        string text = op.disp ? to_string(op.disp) : "";
+        text += "(%" + string(gp_name(op.reg, 8));
+        if (op.index >= 0) text += ",%" + string(gp_name(op.index, 8)) + "," + to_string(op.scale);
+        return text + ")";
+    }
+
+    static string intel_memory(const MOperand& op, int size) {
+        string prefix = size == 8 ? "qword ptr " : size == 1 ? "byte ptr " : size == 16 ? "xmmword ptr " : "dword ptr ";
+        if (!op.symbol.empty()) {
+            return prefix + "[rip + " + op.symbol + (op.disp ? " + " + to_string(op.disp) : "") + "]";
+        }
+        string text = prefix + "[" + gp_name(op.reg, 8);
+        if (op.index >= 0) text += " + " + string(gp_name(op.index, 8)) + "*" + to_string(op.scale);
+        if (op.disp > 0) text += " + " + to_string(op.disp);
+        if (op.disp < 0) text += " - " + to_string(-op.disp);
+        return text + "]";
+    }
+
+    // Size in bytes of each operand, as far as the printer needs to know it.
+    void operand_sizes(const MInst& inst, int& dst_size, int& src_size) const {
+        dst_size = src_size = inst.size;
+        switch (inst.op) {
+            case MOp::Movsx8: case MOp::Movzx8: src_size = 1; break;
+            case MOp::Setcc: dst_size = 1; break;
+            case MOp::Cvtsi2SS: case MOp::Cvtsi2SD: dst_size = 16; break;
+            case MOp::CvttSS2si: src_size = 4; break;
+            case MOp::CvttSD2si: src_size = 8; break;
+            case MOp::MovSS: case MOp::AddSS: case MOp::SubSS: case MOp::MulSS: case MOp::DivSS:
+            case MOp::UcomiSS: case MOp::CvtSS2SD:
+                dst_size = inst.op == MOp::CvtSS2SD ? 16 : 4;
+                src_size = 4;
+                break;
+            case MOp::MovSD: case MOp::AddSD: case MOp::SubSD: case MOp::MulSD: case MOp::DivSD:
+            case MOp::UcomiSD: case MOp::CvtSD2SS:
+                dst_size = inst.op == MOp::CvtSD2SS ? 16 : 8;
+                src_size = 8;
+                break;
+            case MOp::Movaps: case MOp::Xorps: dst_size = src_size = 16; break;
+            case MOp::Push: case MOp::Pop: dst_size = 8; break;
+            default: break;
+        }
+    }
+
+    void print_inst(const MInst& inst) {
+        bool att = m_syntax == AsmSyntax::ATT;
+        int dst_size, src_size;
+        operand_sizes(inst, dst_size, src_size);
+        string name;
+        bool sized = false;
+        switch (inst.op) {
+            case MOp::Cdq: m_out << "\t" << (att ? "cltd" : "cdq") << "\n"; return;
+            case MOp::JmpTable: print_jump_table(inst); return;
+            case MOp::Jcc: name = string("j") + cond_name(inst.cond); break;
+            case MOp::Setcc: name = string("set") + cond_name(inst.cond); break;
+            case MOp::Movsx8: name = att ? string("movsb") + size_suffix(inst.size) : "movsx"; break;
+            case MOp::Movzx8: name = att ? string("movzb") + size_suffix(inst.size) : "movzx"; break;
+            default:
+                name = mnemonic(inst.op, sized);
+                // AT&T needs the size suffix when no register operand implies it.
+                if (att && sized) {
+                    bool has_reg = (inst.dst.is_reg() && inst.dst.reg < XMM0) || (inst.src.is_reg() && inst.src.reg < XMM0);
+                    bool converts = inst.op == MOp::Cvtsi2SS || inst.op == MOp::Cvtsi2SD;
+                    if (!has_reg || converts) name += size_suffix(inst.size);
+                }
+                break;
+        }
+        m_out << "\t" << name;
+        bool has_dst = inst.dst.kind != MOperandKind::None;
+        bool has_src = inst.src.kind != MOperandKind::None;
+        if (inst.op == MOp::Call && att && inst.dst.kind == MOperandKind::Symbol) {
+            m_out << "\t" << inst.dst.symbol << "\n";
+            return;
+        }
+        if (has_dst && has_src) {
+            if (att) m_out << "\t" << operand(inst.src, src_size) << ", " << operand(inst.dst, dst_size);
+            else m_out << "\t" << operand(inst.dst, dst_size) << ", " << operand(inst.src, src_size);
+        } else if (has_dst) {
+            m_out << "\t" << operand(inst.dst, dst_size);
+        }
+        m_out << "\n";
+    }
+
+    // Entries are 32-bit offsets from the table, so that the code needs no
+    // relocation wherever it is loaded.
+    void print_jump_table(const MInst& inst) {
+        string table = ".LJT" + to_string(m_function_index) + "_" + to_string(m_table_count++);
+        string index = gp_name(inst.dst.reg, 8);
+        if (m_syntax == AsmSyntax::ATT) {
+            m_out << "\tlea\t" << table << "(%rip), %rdx\n"
+                  << "\tmovslq\t(%rdx,%" << index << ",4), %" << index << "\n"
+                  << "\tadd\t%rdx, %" << index << "\n"
+                  << "\tjmp\t*%" << index << "\n";
+        } else {
+            m_out << "\tlea\trdx, [rip + " << table << "]\n"
+                  << "\tmovsxd\t" << index << ", dword ptr [rdx + " << index << "*4]\n"
+                  << "\tadd\t" << index << ", rdx\n"
+                  << "\tjmp\t" << index << "\n";
+        }
+        m_out << "\t.p2align\t2\n" << table << ":\n";
+        for (int label : inst.table) {
+            m_out << "\t.long\t" << block_label(m_function_index, label) << "-" << table << "\n";
+        }
+    }
+};
+
+#endif
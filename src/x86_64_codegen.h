@@ -0,0 +1,694 @@
+#ifndef X86_64_CODEGEN_H
+#define X86_64_CODEGEN_H
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "ir.h"
+#include "regalloc.h"
+#include "x86_64.h"
+#include "x86_64_select.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         CODE GENERATION: IR -> x86-64                       ===
+// ===================================================================
+// Integer expressions are selected as trees (x86_64_select.h): a value used
+// once, right where it is computed, is folded into its user, and the cheapest
+// cover of the tree by x86-64 instructions is emitted. Everything else (calls,
+// floating point, conversions) is expanded one IR instruction at a time.
+// Operands are wherever the linear-scan allocator put the vregs (a register or
+// a spill slot in the frame). rax/rdx and xmm14/xmm15 are never allocated, so
+// the code uses them freely as temporaries.
+//
+// Calling convention: System V AMD64. Integer arguments in rdi, rsi, rdx, rcx,
+// r8, r9, floating ones in xmm0-xmm7, the rest on the stack; results in
+// eax/xmm0. Frame layout (rbp-relative):
+//
+//     [rbp + 16 + 8j]                  incoming stack argument j
+//     [rbp + 8]                        return address
+//     [rbp]                            caller's rbp
+//     [rbp - 8 .. rbp - 8n]            saved callee-saved registers
+//     [rbp - 8n - 8(i+1)]              spill slot i
+//     [rsp + 8j]                       outgoing stack argument j
+
+class X86CodeGenerator {
+public:
+    X86CodeGenerator(const IrModule& module) : m_module(module), m_registers(sysv_x86_64_register_file()) {}
+
+    MModule generate() {
+        MModule result;
+        for (const IrGlobal& global : m_module.globals) result.globals.push_back(lower_global(global));
+        m_constants = &result.constants;
+        for (const IrFunction& function : m_module.functions) {
+            if (function.defined) result.functions.push_back(lower_function(function));
+        }
+        m_constants = nullptr;
+        return result;
+    }
+
+private:
+    static const int kIntArgRegs = 6;
+    static const int kFloatArgRegs = 8;
+
+    const IrModule& m_module;
+    const RegisterFile& m_registers;
+    vector<MConstant>* m_constants = nullptr;
+
+    // Per-function state.
+    const IrFunction* m_function = nullptr;
+    X86Selector* m_selector = nullptr;
+    const LinearScanAllocator* m_allocator = nullptr;
+    MFunction* m_output = nullptr;
+    int m_current = 0;                 // machine block being filled
+    vector<int> m_saved;               // callee-saved registers pushed by the prologue
+    int m_frame_size = 0;              // bytes below the saved registers
+
+    static int int_arg_reg(int i) {
+        static const int regs[kIntArgRegs] = {RDI, RSI, RDX, RCX, R8, R9};
+        return regs[i];
+    }
+
+    static bool is_float(IrType type) { return type == IrType::Float || type == IrType::Double; }
+
+    // --- DATA ---
+    static MGlobal lower_global(const IrGlobal& global) {
+        MGlobal result;
+        result.name = global.name;
+        uint64_t bits = 0;
+        switch (global.type) {
+            case IrType::Char: result.size = 1; bits = (uint64_t)global.init; break;
+            case IrType::Float: {
+                float value = (float)global.finit;
+                uint32_t raw;
+                memcpy(&raw, &value, 4);
+                result.size = 4;
+                bits = raw;
+                break;
+            }
+            case IrType::Double: result.size = 8; memcpy(&bits, &global.finit, 8); break;
+            default: result.size = 4; bits = (uint64_t)global.init; break;
+        }
+        result.align = result.size;
+        for (int i = 0; i < result.size; ++i) result.bytes.push_back((uint8_t)(bits >> (8 * i)));
+        return result;
+    }
+
+    // Floating constants live in .rodata; identical ones share a label.
+    MOperand constant(IrType type, double value) {
+        MConstant entry;
+        if (type == IrType::Float) {
+            float narrow = (float)value;
+            uint32_t raw;
+            memcpy(&raw, &narrow, 4);
+            entry.size = 4;
+            entry.bits = raw;
+        } else {
+            entry.size = 8;
+            memcpy(&entry.bits, &value, 8);
+        }
+        for (const MConstant& existing : *m_constants) {
+            if (existing.size == entry.size && existing.bits == entry.bits) return MOperand::make_global(existing.label);
+        }
+        entry.label = ".LC" + to_string(m_constants->size());
+        m_constants->push_back(entry);
+        return MOperand::make_global(entry.label);
+    }
+
+    // --- EMISSION HELPERS ---
+    void emit(const MInst& inst) { m_output->blocks[m_current].insts.push_back(inst); }
+
+    void emit(MOp op, int size, const MOperand& dst, const MOperand& src = MOperand()) {
+        MInst inst(op, size);
+        inst.dst = dst;
+        inst.src = src;
+        emit(inst);
+    }
+
+    void emit_cond(MOp op, Cond cond, const MOperand& dst) {
+        MInst inst(op, 1);
+        inst.cond = cond;
+        inst.dst = dst;
+        emit(inst);
+    }
+
+    static MOperand reg(int r) { return MOperand::make_reg(r); }
+
+    int slot_offset(int slot) const { return -8 * (int)m_saved.size() - 8 * (slot + 1); }
+
+    MOperand operand(const Location& where) const {
+        if (where.is_reg()) return reg(where.reg);
+        return MOperand::make_mem(RBP, slot_offset(where.slot));
+    }
+    MOperand use(int vreg, int index) const { return operand(m_allocator->use_location(vreg, index)); }
+    MOperand def(int vreg, int index) const { return operand(m_allocator->def_location(vreg, index)); }
+
+    // 32-bit integer move; memory to memory goes through eax.
+    void move_int(const MOperand& dst, const MOperand& src) {
+        if (dst == src) return;
+        if (dst.is_mem() && src.is_mem()) {
+            emit(MOp::Mov, 4, reg(RAX), src);
+            emit(MOp::Mov, 4, dst, reg(RAX));
+            return;
+        }
+        emit(MOp::Mov, 4, dst, src);
+    }
+
+    // Scalar float/double move; memory to memory goes through xmm15.
+    void move_float(IrType type, const MOperand& dst, const MOperand& src) {
+        if (dst == src) return;
+        MOp op = type == IrType::Float ? MOp::MovSS : MOp::MovSD;
+        if (dst.is_reg() && src.is_reg()) {
+            emit(MOp::Movaps, 16, dst, src);
+        } else if (dst.is_mem() && src.is_mem()) {
+            emit(op, 4, reg(XMM15), src);
+            emit(op, 4, dst, reg(XMM15));
+        } else {
+            emit(op, 4, dst, src);
+        }
+    }
+
+    void move_value(IrType type, const MOperand& dst, const MOperand& src) {
+        if (is_float(type)) move_float(type, dst, src);
+        else move_int(dst, src);
+    }
+
+    // Moves issued by the allocator copy whole 8-byte slots, whatever the type.
+    void emit_moves(const vector<Move>& moves) {
+        for (const Move& move : sequence_parallel_moves(moves, m_registers)) {
+            MOperand dst = operand(move.to), src = operand(move.from);
+            if (move.cls == RegClass::General) {
+                if (dst.is_mem() && src.is_mem()) {
+                    emit(MOp::Mov, 8, reg(RDX), src);
+                    emit(MOp::Mov, 8, dst, reg(RDX));
+                } else {
+                    emit(MOp::Mov, 8, dst, src);
+                }
+            } else if (dst.is_reg() && src.is_reg()) {
+                emit(MOp::Movaps, 16, dst, src);
+            } else if (dst.is_mem() && src.is_mem()) {
+                emit(MOp::MovSD, 8, reg(XMM14), src);
+                emit(MOp::MovSD, 8, dst, reg(XMM14));
+            } else {
+                emit(MOp::MovSD, 8, dst, src);
+            }
+        }
+    }
+
+    // --- FUNCTIONS ---
+    MFunction lower_function(const IrFunction& function) {
+        X86Selector selector(function);
+        AllocInput input = selector.allocation_input();
+        LinearScanAllocator allocator(input, m_registers);
+        allocator.run();
+
+        MFunction result;
+        result.name = function.name;
+        result.blocks.resize(function.blocks.size());
+        m_function = &function;
+        m_selector = &selector;
+        m_allocator = &allocator;
+        m_output = &result;
+        m_saved = allocator.used_callee_saved();
+
+        int outgoing = 0;
+        for (const IrBlock& block : function.blocks) {
+            for (const IrInst& inst : block.insts) {
+                if (inst.op == IrOp::Call) outgoing = max(outgoing, stack_argument_count(inst.args));
+            }
+        }
+        m_frame_size = 8 * (allocator.spill_slot_count() + outgoing);
+        // Keep rsp 16-byte aligned at calls: the return address and rbp make 16.
+        if ((8 * (int)m_saved.size() + m_frame_size) % 16 != 0) m_frame_size += 8;
+
+        m_current = 0;
+        emit_prologue();
+        for (size_t b = 0; b < function.blocks.size(); ++b) {
+            m_current = (int)b;
+            lower_block((int)b);
+        }
+        m_output = nullptr;
+        m_allocator = nullptr;
+        m_selector = nullptr;
+        m_function = nullptr;
+        return result;
+    }
+
+    int stack_argument_count(const vector<int>& args) const {
+        int ints = 0, floats = 0, stack = 0;
+        for (int arg : args) {
+            if (is_float(m_function->vreg_types[arg])) { if (floats++ >= kFloatArgRegs) stack++; }
+            else if (ints++ >= kIntArgRegs) stack++;
+        }
+        return stack;
+    }
+
+    void emit_prologue() {
+        emit(MOp::Push, 8, reg(RBP));
+        emit(MOp::Mov, 8, reg(RBP), reg(RSP));
+        for (int r : m_saved) emit(MOp::Push, 8, reg(r));
+        if (m_frame_size > 0) emit(MOp::Sub, 8, reg(RSP), MOperand::make_imm(m_frame_size));
+
+        // Incoming arguments move to wherever the allocator wants the parameters.
+        vector<Move> moves;
+        vector<pair<int, int>> stack_params; // (vreg, incoming stack index)
+        int ints = 0, floats = 0, stack = 0;
+        for (int param : m_function->params) {
+            IrType type = m_function->vreg_types[param];
+            Location from;
+            if (is_float(type) && floats < kFloatArgRegs) from.reg = XMM0 + floats++;
+            else if (!is_float(type) && ints < kIntArgRegs) from.reg = int_arg_reg(ints++);
+            else {
+                stack_params.push_back(make_pair(param, stack++));
+                continue;
+            }
+            if (!m_allocator->live_at(param, 0)) continue; // never read before it is overwritten
+            moves.push_back(Move{from, m_allocator->location(param, 0), register_class(type)});
+        }
+        emit_moves(moves);
+        for (const pair<int, int>& param : stack_params) {
+            if (!m_allocator->live_at(param.first, 0)) continue;
+            Location to = m_allocator->location(param.first, 0);
+            move_value(m_function->vreg_types[param.first], operand(to),
+                       MOperand::make_mem(RBP, 16 + 8 * param.second));
+        }
+    }
+
+    // Everything after the body of a function; `ret` is left to the caller so
+    // that a tail call can jump instead.
+    void emit_epilogue() {
+        if (m_frame_size > 0) emit(MOp::Add, 8, reg(RSP), MOperand::make_imm(m_frame_size));
+        for (size_t i = m_saved.size(); i-- > 0;) emit(MOp::Pop, 8, reg(m_saved[i]));
+        emit(MOp::Pop, 8, reg(RBP));
+    }
+
+    // --- BLOCKS AND INSTRUCTIONS ---
+    void lower_block(int b) {
+        const IrBlock& block = m_function->blocks[b];
+        int first = m_allocator->block_first_index(b);
+        for (size_t i = 0; i < block.insts.size(); ++i) {
+            int index = first + (int)i;
+            emit_moves(m_allocator->moves_before(index));
+            if (m_selector->folded(b, (int)i)) continue; // evaluated as part of a later tree
+            const IrInst& inst = block.insts[i];
+            if (inst.op == IrOp::Call && inst.tail_call && i + 1 < block.insts.size() &&
+                stack_argument_count(inst.args) == 0) {
+                lower_tail_call(inst, index);
+                return; // the Ret that follows is subsumed by the jump
+            }
+            lower_inst(inst, index, b, (int)i);
+        }
+    }
+
+    // --- TREES ---
+    // Emits tree `node` deriving `goal` with its leaves read at instruction k.
+    // Fails (emitting nothing) when `target` is a register a leaf still needs.
+    bool select(int node, SelNt goal, int k, const MOperand& target, MOperand& result, Cond& cond) {
+        vector<MInst> code;
+        SelLeafOperand leaf = [this, k](int vreg) { return use(vreg, k); };
+        if (!m_selector->select(node, goal, target, leaf, code, result, cond)) return false;
+        for (const MInst& inst : code) emit(inst);
+        return true;
+    }
+
+    // Leaves the value of tree `node` in eax; no leaf ever lives there.
+    void select_into_rax(int node, int k) {
+        MOperand result;
+        Cond cond;
+        select(node, SelNt::Value, k, reg(RAX), result, cond);
+    }
+
+    // dst = tree `node`, computed in dst's register when no leaf is in the way.
+    void select_value(int node, int k, const MOperand& dst) {
+        MOperand result;
+        Cond cond;
+        if (dst.is_reg() && select(node, SelNt::Value, k, dst, result, cond)) return;
+        if (dst.is_mem() && m_selector->op(node) == SelOp::Const) {
+            select(node, SelNt::Imm, k, reg(RAX), result, cond);
+            emit(MOp::Mov, 4, dst, result);
+            return;
+        }
+        select_into_rax(node, k);
+        move_int(dst, reg(RAX));
+    }
+
+    void lower_inst(const IrInst& inst, int k, int b, int i) {
+        int tree = m_selector->value_tree(b, i);
+        if (tree >= 0) {
+            select_value(tree, k, def(inst.dest, k));
+            return;
+        }
+        switch (inst.op) {
+            case IrOp::Const:
+                emit(MOp::Mov, 4, def(inst.dest, k), MOperand::make_imm((int)inst.imm));
+                break;
+            case IrOp::FConst: lower_fconst(inst, k); break;
+            case IrOp::Copy: {
+                int copied = m_selector->operand_tree(b, i, 0);
+                if (copied >= 0 && m_selector->op(copied) != SelOp::Leaf) select_value(copied, k, def(inst.dest, k));
+                else move_value(inst.type, def(inst.dest, k), use(inst.a, k));
+                break;
+            }
+            case IrOp::Add: case IrOp::Sub: case IrOp::Mul:
+                if (is_float(inst.type)) lower_float_arithmetic(inst, k);
+                else lower_int_arithmetic(inst, k);
+                break;
+            case IrOp::Div:
+                if (is_float(inst.type)) lower_float_arithmetic(inst, k);
+                else lower_int_division(inst, k, b, i);
+                break;
+            case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Gt: case IrOp::Le: case IrOp::Ge:
+                lower_comparison(inst, k);
+                break;
+            case IrOp::Convert: lower_convert(inst, k); break;
+            case IrOp::TruncChar: {
+                MOperand dst = def(inst.dest, k);
+                MOperand target = dst.is_reg() ? dst : reg(RAX);
+                emit(MOp::Movsx8, 4, target, use(inst.a, k));
+                move_int(dst, target);
+                break;
+            }
+            case IrOp::TestBit: lower_test_bit(inst, k); break;
+            case IrOp::LoadGlobal: lower_load_global(inst, k); break;
+            case IrOp::StoreGlobal: lower_store_global(inst, k, b, i); break;
+            case IrOp::Call: lower_call(inst, k); break;
+            case IrOp::Jump: lower_jump(b, inst.target); break;
+            case IrOp::Branch: lower_branch(inst, k, b, i); break;
+            case IrOp::Switch: lower_switch(inst, k, b); break;
+            case IrOp::Ret: lower_ret(inst, k, b, i); break;
+        }
+    }
+
+    void lower_fconst(const IrInst& inst, int k) {
+        MOperand dst = def(inst.dest, k);
+        MOperand target = dst.is_reg() ? dst : reg(XMM15);
+        if (inst.fimm == 0.0 && !signbit(inst.fimm)) {
+            emit(MOp::Xorps, 16, target, target);
+        } else {
+            emit(inst.type == IrType::Float ? MOp::MovSS : MOp::MovSD, 4, target, constant(inst.type, inst.fimm));
+        }
+        move_float(inst.type, dst, target);
+    }
+
+    // dst = a op b, computed in dst's register when it has one (eax otherwise).
+    void lower_int_arithmetic(const IrInst& inst, int k) {
+        MOp op = inst.op == IrOp::Add ? MOp::Add : inst.op == IrOp::Sub ? MOp::Sub : MOp::Imul;
+        MOperand dst = def(inst.dest, k), a = use(inst.a, k), b = use(inst.b, k);
+        MOperand target = dst.is_reg() ? dst : reg(RAX);
+        if (target == b && a != b) {
+            if (op != MOp::Sub) {
+                emit(op, 4, target, a); // commutative: dst = b op a
+                return;
+            }
+            target = reg(RAX);
+        }
+        move_int(target, a);
+        emit(op, 4, target, b);
+        move_int(dst, target);
+    }
+
+    // The dividend is computed in eax; the divisor is a vreg or a global.
+    void lower_int_division(const IrInst& inst, int k, int b, int i) {
+        select_into_rax(m_selector->operand_tree(b, i, 0), k);
+        MOperand divisor;
+        Cond cond;
+        select(m_selector->operand_tree(b, i, 1), SelNt::Opnd, k, reg(RAX), divisor, cond);
+        emit(MOp::Cdq, 4, MOperand());
+        emit(MOp::Idiv, 4, divisor);
+        move_int(def(inst.dest, k), reg(RAX));
+    }
+
+    void lower_float_arithmetic(const IrInst& inst, int k) {
+        bool single = inst.type == IrType::Float;
+        MOp op;
+        switch (inst.op) {
+            case IrOp::Add: op = single ? MOp::AddSS : MOp::AddSD; break;
+            case IrOp::Sub: op = single ? MOp::SubSS : MOp::SubSD; break;
+            case IrOp::Mul: op = single ? MOp::MulSS : MOp::MulSD; break;
+            default: op = single ? MOp::DivSS : MOp::DivSD; break;
+        }
+        MOperand dst = def(inst.dest, k), a = use(inst.a, k), b = use(inst.b, k);
+        MOperand target = dst.is_reg() ? dst : reg(XMM15);
+        if (target == b && a != b) {
+            if (inst.op == IrOp::Add || inst.op == IrOp::Mul) {
+                emit(op, 4, target, a);
+                return;
+            }
+            target = reg(XMM15);
+        }
+        move_float(inst.type, target, a);
+        emit(op, 4, target, b);
+        move_float(inst.type, dst, target);
+    }
+
+    void lower_comparison(const IrInst& inst, int k) {
+        MOperand a = use(inst.a, k), b = use(inst.b, k);
+        if (!is_float(inst.operand_type)) {
+            if (a.is_mem() && b.is_mem()) {
+                emit(MOp::Mov, 4, reg(RAX), a);
+                a = reg(RAX);
+            }
+            emit(MOp::Cmp, 4, a, b);
+            static const Cond conds[] = {Cond::E, Cond::NE, Cond::L, Cond::G, Cond::LE, Cond::GE};
+            emit_cond(MOp::Setcc, conds[(int)inst.op - (int)IrOp::Eq], reg(RAX));
+        } else {
+            // ucomis sets the flags like an unsigned compare; `a < b` is
+            // tested as `b > a` so that an unordered result (NaN) is false.
+            MOp op = inst.operand_type == IrType::Float ? MOp::UcomiSS : MOp::UcomiSD;
+            bool swap = inst.op == IrOp::Lt || inst.op == IrOp::Le;
+            MOperand left = swap ? b : a, right = swap ? a : b;
+            if (!left.is_reg()) {
+                move_float(inst.operand_type, reg(XMM15), left);
+                left = reg(XMM15);
+            }
+            emit(op, 4, left, right);
+            switch (inst.op) {
+                case IrOp::Eq:
+                    emit_cond(MOp::Setcc, Cond::E, reg(RAX));
+                    emit_cond(MOp::Setcc, Cond::NP, reg(RDX));
+                    emit(MOp::And, 1, reg(RAX), reg(RDX));
+                    break;
+                case IrOp::Ne:
+                    emit_cond(MOp::Setcc, Cond::NE, reg(RAX));
+                    emit_cond(MOp::Setcc, Cond::P, reg(RDX));
+                    emit(MOp::Or, 1, reg(RAX), reg(RDX));
+                    break;
+                case IrOp::Lt: case IrOp::Gt: emit_cond(MOp::Setcc, Cond::A, reg(RAX)); break;
+                default: emit_cond(MOp::Setcc, Cond::AE, reg(RAX)); break;
+            }
+        }
+        emit(MOp::Movzx8, 4, reg(RAX), reg(RAX));
+        move_int(def(inst.dest, k), reg(RAX));
+    }
+
+    void lower_convert(const IrInst& inst, int k) {
+        MOperand dst = def(inst.dest, k), a = use(inst.a, k);
+        if (!is_float(inst.type)) {
+            MOperand target = dst.is_reg() ? dst : reg(RAX);
+            emit(inst.operand_type == IrType::Float ? MOp::CvttSS2si : MOp::CvttSD2si, 4, target, a);
+            move_int(dst, target);
+            return;
+        }
+        MOperand target = dst.is_reg() ? dst : reg(XMM15);
+        MOp op;
+        if (!is_float(inst.operand_type)) op = inst.type == IrType::Float ? MOp::Cvtsi2SS : MOp::Cvtsi2SD;
+        else op = inst.type == IrType::Float ? MOp::CvtSD2SS : MOp::CvtSS2SD;
+        emit(op, 4, target, a);
+        move_float(inst.type, dst, target);
+    }
+
+    // bt takes the bit number modulo 64 from a register operand, like the IR.
+    void lower_test_bit(const IrInst& inst, int k) {
+        MOperand index = use(inst.a, k);
+        if (!index.is_reg()) {
+            emit(MOp::Mov, 4, reg(RDX), index);
+            index = reg(RDX);
+        }
+        emit(MOp::Mov, 8, reg(RAX), MOperand::make_imm(inst.imm));
+        emit(MOp::Bt, 8, reg(RAX), index);
+        emit_cond(MOp::Setcc, Cond::B, reg(RAX));
+        emit(MOp::Movzx8, 4, reg(RAX), reg(RAX));
+        move_int(def(inst.dest, k), reg(RAX));
+    }
+
+    void lower_load_global(const IrInst& inst, int k) {
+        MOperand dst = def(inst.dest, k), global = MOperand::make_global(inst.symbol);
+        if (is_float(inst.type)) {
+            MOperand target = dst.is_reg() ? dst : reg(XMM15);
+            move_float(inst.type, target, global);
+            move_float(inst.type, dst, target);
+            return;
+        }
+        MOperand target = dst.is_reg() ? dst : reg(RAX);
+        if (inst.operand_type == IrType::Char) emit(MOp::Movsx8, 4, target, global);
+        else emit(MOp::Mov, 4, target, global);
+        move_int(dst, target);
+    }
+
+    void lower_store_global(const IrInst& inst, int k, int b, int i) {
+        MOperand value = use(inst.a, k), global = MOperand::make_global(inst.symbol);
+        int size = inst.operand_type == IrType::Char ? 1 : 4;
+        int tree = m_selector->operand_tree(b, i, 0);
+        if (tree >= 0 && m_selector->op(tree) == SelOp::Const) {
+            Cond cond;
+            select(tree, SelNt::Imm, k, reg(RAX), value, cond);
+            if (size == 1) value.imm = (signed char)value.imm;
+            emit(MOp::Mov, size, global, value);
+            return;
+        }
+        if (tree >= 0 && m_selector->op(tree) != SelOp::Leaf) {
+            select_into_rax(tree, k);
+            emit(MOp::Mov, size, global, reg(RAX));
+            return;
+        }
+        if (is_float(inst.type)) {
+            if (value.is_mem()) {
+                move_float(inst.type, reg(XMM15), value);
+                value = reg(XMM15);
+            }
+            move_float(inst.type, global, value);
+            return;
+        }
+        if (value.is_mem()) {
+            emit(MOp::Mov, 4, reg(RAX), value);
+            value = reg(RAX);
+        }
+        emit(MOp::Mov, size, global, value);
+    }
+
+    // Stores stack arguments, then moves the register arguments into place as
+    // one parallel move (the sources may themselves sit in argument registers).
+    // `call` learns which argument registers are in use.
+    void emit_call_arguments(const IrInst& inst, int k, MInst& call) {
+        vector<Move> moves;
+        int ints = 0, floats = 0, stack = 0;
+        for (int arg : inst.args) {
+            IrType type = m_function->vreg_types[arg];
+            Location to;
+            if (is_float(type) && floats < kFloatArgRegs) to.reg = XMM0 + floats++;
+            else if (!is_float(type) && ints < kIntArgRegs) to.reg = int_arg_reg(ints++);
+            else {
+                MOperand slot = MOperand::make_mem(RSP, 8 * stack++);
+                MOperand value = use(arg, k);
+                if (value.is_mem()) {
+                    MOperand temp = reg(is_float(type) ? XMM15 : RAX);
+                    move_value(type, temp, value);
+                    value = temp;
+                }
+                move_value(type, slot, value);
+                continue;
+            }
+            moves.push_back(Move{m_allocator->use_location(arg, k), to, register_class(type)});
+        }
+        emit_moves(moves);
+        call.int_arguments = min(ints, (int)kIntArgRegs);
+        call.float_arguments = min(floats, (int)kFloatArgRegs);
+    }
+
+    void lower_call(const IrInst& inst, int k) {
+        MInst call(MOp::Call, 8);
+        call.dst = MOperand::make_symbol(inst.symbol);
+        emit_call_arguments(inst, k, call);
+        emit(call);
+        if (inst.dest >= 0) move_value(inst.type, def(inst.dest, k), reg(is_float(inst.type) ? XMM0 : RAX));
+    }
+
+    // A call whose result is returned unchanged: tear down the frame and jump,
+    // so the callee returns straight to our caller.
+    void lower_tail_call(const IrInst& inst, int k) {
+        MInst jump(MOp::Jmp, 8);
+        jump.dst = MOperand::make_symbol(inst.symbol);
+        emit_call_arguments(inst, k, jump);
+        emit_epilogue();
+        emit(jump);
+    }
+
+    void lower_ret(const IrInst& inst, int k, int b, int i) {
+        int tree = inst.a >= 0 ? m_selector->operand_tree(b, i, 0) : -1;
+        if (tree >= 0 && m_selector->op(tree) != SelOp::Leaf) select_into_rax(tree, k);
+        else if (inst.a >= 0) move_value(value_type(m_function->return_type), reg(is_float(inst.type) ? XMM0 : RAX),
+                                         use(inst.a, k));
+        emit_epilogue();
+        emit(MOp::Ret, 8, MOperand());
+    }
+
+    void lower_jump(int b, int target) {
+        emit_moves(m_allocator->edge_moves(b, target));
+        if (target != b + 1) emit(MOp::Jmp, 8, MOperand::make_label(target));
+    }
+
+    // Edges that need resolution moves get a block of their own at the end of
+    // the function: moves, then a jump to the real target.
+    int edge_label(int b, int target) {
+        const vector<Move>& moves = m_allocator->edge_moves(b, target);
+        if (moves.empty()) return target;
+        int saved = m_current;
+        m_output->blocks.push_back(MBlock());
+        m_current = (int)m_output->blocks.size() - 1;
+        emit_moves(moves);
+        emit(MOp::Jmp, 8, MOperand::make_label(target));
+        int label = m_current;
+        m_current = saved;
+        return label;
+    }
+
+    // The index is rebased to 0 and checked with one unsigned compare, which
+    // also sends values below the table to the default.
+    void lower_switch(const IrInst& inst, int k, int b) {
+        move_int(reg(RAX), use(inst.a, k));
+        if (inst.imm != 0) emit(MOp::Sub, 4, reg(RAX), MOperand::make_imm(inst.imm));
+        emit(MOp::Cmp, 4, reg(RAX), MOperand::make_imm((long long)inst.table.size() - 1));
+        MInst out_of_range(MOp::Jcc, 8);
+        out_of_range.cond = Cond::A;
+        out_of_range.dst = MOperand::make_label(edge_label(b, inst.target));
+        emit(out_of_range);
+        MInst dispatch(MOp::JmpTable, 8);
+        dispatch.dst = reg(RAX);
+        map<int, int> labels;   // one edge block per distinct target
+        for (int target : inst.table) {
+            if (!labels.count(target)) labels[target] = edge_label(b, target);
+            dispatch.table.push_back(labels[target]);
+        }
+        emit(dispatch);
+    }
+
+    // A comparison tree sets the flags for the jump directly; any other value
+    // is tested against zero.
+    void lower_branch(const IrInst& inst, int k, int b, int i) {
+        int tree = m_selector->operand_tree(b, i, 0);
+        Cond taken = Cond::NE;
+        MOperand result;
+        if (m_selector->op(tree) == SelOp::Cmp) {
+            select(tree, SelNt::Flags, k, reg(RAX), result, taken);
+        } else if (m_selector->op(tree) != SelOp::Leaf) {
+            select_into_rax(tree, k);
+            emit(MOp::Test, 4, reg(RAX), reg(RAX));
+        } else {
+            MOperand cond = use(inst.a, k);
+            if (cond.is_reg()) emit(MOp::Test, 4, cond, cond);
+            else emit(MOp::Cmp, 4, cond, MOperand::make_imm(0));
+        }
+        int if_true = edge_label(b, inst.target);
+        int if_false = edge_label(b, inst.target_false);
+        MInst jump(MOp::Jcc, 8);
+        if (if_false == b + 1) {
+            jump.cond = taken;
+            jump.dst = MOperand::make_label(if_true);
+            emit(jump);
+        } else if (if_true == b + 1) {
+            jump.cond = (Cond)((int)taken ^ 1);   // conditions come in pairs
+            jump.dst = MOperand::make_label(if_false);
+            emit(jump);
+        } else {
+            jump.cond = taken;
+            jump.dst = MOperand::make_label(if_true);
+            emit(jump);
+            emit(MOp::Jmp, 8, MOperand::make_label(if_false));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef X86_64_ENCODER_H
+#define X86_64_ENCODER_H
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "x86_64.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         x86-64 MACHINE CODE ENCODING                        ===
+// ===================================================================
+// Turns the machine instructions of an MModule into bytes, without going
+// through an assembler. The result keeps the three kinds of contents apart
+// (code, initialised data, read-only constants) and lists every place in the
+// code that refers to something whose address is only known once the pieces
+// are placed: globals, constants and functions defined elsewhere. Calls and
+// jumps between functions of the module are resolved here, since the code
+// stays in one piece.
+//
+// Both the ELF object writer and the JIT consume this representation.
+
+struct CodeRelocation {
+    size_t offset;         // position of the 32-bit field in the code
+    string symbol;         // global, constant label or external function
+    int addend;            // value = symbol + addend - (address of the field)
+    bool is_call;          // call/jmp to an external function (PLT-style)
+};
+
+struct EncodedSymbol {
+    string name;
+    size_t offset;
+    size_t size;
+};
+
+struct EncodedModule {
+    vector<uint8_t> text;
+    vector<uint8_t> data;
+    vector<uint8_t> rodata;
+    vector<EncodedSymbol> functions;   // offsets into text
+    vector<EncodedSymbol> globals;     // offsets into data
+    vector<EncodedSymbol> constants;   // offsets into rodata
+    vector<CodeRelocation> relocations;
+
+    const EncodedSymbol* find(const vector<EncodedSymbol>& symbols, const string& name) const {
+        for (const EncodedSymbol& symbol : symbols) {
+            if (symbol.name == name) return &symbol;
+        }
+        return nullptr;
+    }
+};
+
+class X86Encoder {
+public:
+    EncodedModule encode(const MModule& module) {
+        EncodedModule result;
+        m_result = &result;
+        m_code = &result.text;
+
+        for (const MGlobal& global : module.globals) {
+            align(result.data, global.align, 0);
+            result.globals.push_back(EncodedSymbol{global.name, result.data.size(), (size_t)global.size});
+            result.data.insert(result.data.end(), global.bytes.begin(), global.bytes.end());
+        }
+        for (const MConstant& constant : module.constants) {
+            align(result.rodata, constant.size, 0);
+            result.constants.push_back(EncodedSymbol{constant.label, result.rodata.size(), (size_t)constant.size});
+            for (int i = 0; i < constant.size; ++i) result.rodata.push_back((uint8_t)(constant.bits >> (8 * i)));
+        }
+
+        map<string, bool> defined;
+        for (const MFunction& function : module.functions) defined[function.name] = true;
+        for (const MFunction& function : module.functions) {
+            align(result.text, 16, 0x90);
+            size_t start = result.text.size();
+            encode_function(function, defined);
+            result.functions.push_back(EncodedSymbol{function.name, start, result.text.size() - start});
+        }
+        // Calls between functions of the module.
+        for (const CallFixup& fixup : m_call_fixups) {
+            const EncodedSymbol* target = result.find(result.functions, fixup.symbol);
+            patch32(fixup.offset, (int32_t)((int64_t)target->offset - (int64_t)(fixup.offset + 4)));
+        }
+        m_call_fixups.clear();
+        m_code = nullptr;
+        m_result = nullptr;
+        return result;
+    }
+
+private:
+    struct LabelFixup {
+        size_t offset;
+        int block;
+    };
+    struct CallFixup {
+        size_t offset;
+        string symbol;
+    };
+    // A jump table entry: the offset of `block` from the table.
+    struct TableFixup {
+        size_t offset;
+        int block;
+        size_t table;
+    };
+
+    EncodedModule* m_result = nullptr;
+    vector<uint8_t>* m_code = nullptr;
+    vector<LabelFixup> m_label_fixups;
+    vector<CallFixup> m_call_fixups;
+    vector<TableFixup> m_table_fixups;
+
+    static void align(vector<uint8_t>& bytes, size_t alignment, uint8_t fill) {
+        while (bytes.size() % alignment != 0) bytes.push_back(fill);
+    }
+
+    void byte(int value) { m_code->push_back((uint8_t)value); }
+    void imm32(int64_t value) {
+        for (int i = 0; i < 4; ++i) byte((int)((value >> (8 * i)) & 0xff));
+    }
+    void imm64(int64_t value) {
+        for (int i = 0; i < 8; ++i) byte((int)((value >> (8 * i)) & 0xff));
+    }
+    void patch32(size_t offset, int32_t value) {
+        for (int i = 0; i < 4; ++i) (*m_code)[offset + i] = (uint8_t)(((uint32_t)value >> (8 * i)) & 0xff);
+    }
+    static bool fits_int8(long long value) { return value >= -128 && value <= 127; }
+    static bool fits_int32(long long value) { return value >= INT32_MIN && value <= INT32_MAX; }
+
+    // Hardware number of a register: xmm registers are numbered from 0 again.
+    static int hw(int reg) { return reg >= XMM0 ? reg - XMM0 : reg; }
+
+    void encode_function(const MFunction& function, const map<string, bool>& defined) {
+        vector<size_t> block_offset(function.blocks.size());
+        for (size_t b = 0; b < function.blocks.size(); ++b) {
+            block_offset[b] = m_code->size();
+            for (const MInst& inst : function.blocks[b].insts) encode(inst, defined);
+        }
+        for (const LabelFixup& fixup : m_label_fixups) {
+            patch32(fixup.offset, (int32_t)((int64_t)block_offset[fixup.block] - (int64_t)(fixup.offset + 4)));
+        }
+        m_label_fixups.clear();
+        for (const TableFixup& fixup : m_table_fixups) {
+            patch32(fixup.offset, (int32_t)((int64_t)block_offset[fixup.block] - (int64_t)fixup.table));
+        }
+        m_table_fixups.clear();
+    }
+
+    // --- OPERAND ENCODING ---
+    // Emits [legacy prefix] [REX] opcode ModRM [SIB] [disp]. `reg_field` is the
+    // register (or opcode extension) in ModRM.reg; `trailing` is the number of
+    // immediate bytes that follow, which RIP-relative addressing must skip.
+    void encode_rm(int prefix, bool wide, const vector<int>& opcode, int reg_field, const MOperand& rm,
+                   bool byte_registers = false, int trailing = 0) {
+        if (prefix) byte(prefix);
+        int rex = wide ? 0x48 : 0;
+        if (reg_field >= 8) rex |= 0x44;
+        if (rm.is_reg() && hw(rm.reg) >= 8) rex |= 0x41;
+        if (rm.is_mem() && rm.symbol.empty()) {
+            if (rm.reg >= 8) rex |= 0x41;
+            if (rm.index >= 8) rex |= 0x42;
+        }
+        // spl/bpl/sil/dil only exist with a REX prefix (without one the same
+        // numbers mean ah/ch/dh/bh).
+        if (byte_registers && ((reg_field >= 4 && reg_field < 8) || (rm.is_reg() && rm.reg >= 4 && rm.reg < 8))) {
+            rex |= 0x40;
+        }
+        if (rex) byte(rex);
+        for (int op : opcode) byte(op);
+        encode_modrm(reg_field & 7, rm, trailing);
+    }
+
+    void encode_modrm(int reg_field, const MOperand& rm, int trailing) {
+        if (rm.is_reg()) {
+            byte(0xC0 | (reg_field << 3) | (hw(rm.reg) & 7));
+            return;
+        }
+        if (!rm.symbol.empty()) {
+            byte(0x05 | (reg_field << 3));
+            m_result->relocations.push_back(CodeRelocation{m_code->size(), rm.symbol, rm.disp - 4 - trailing, false});
+            imm32(0);
+            return;
+        }
+        int base = rm.reg & 7;
+        int mod = (rm.disp == 0 && base != 5) ? 0 : fits_int8(rm.disp) ? 1 : 2;
+        bool sib = rm.index >= 0 || base == 4;
+        byte((mod << 6) | (reg_field << 3) | (sib ? 4 : base));
+        if (sib) {
+            int scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            int index = rm.index >= 0 ? (rm.index & 7) : 4;
+            byte((scale_bits << 6) | (index << 3) | base);
+        }
+        if (mod == 1) byte(rm.disp & 0xff);
+        if (mod == 2) imm32(rm.disp);
+    }
+
+    void encode_rel32_label(int block) {
+        m_label_fixups.push_back(LabelFixup{m_code->size(), block});
+        imm32(0);
+    }
+
+    void encode_rel32_symbol(const string& symbol, const map<string, bool>& defined) {
+        if (defined.count(symbol)) m_call_fixups.push_back(CallFixup{m_code->size(), symbol});
+        else m_result->relocations.push_back(CodeRelocation{m_code->size(), symbol, -4, true});
+        imm32(0);
+    }
+
+    // lea rdx, [rip + table]; movsxd idx, [rdx + idx*4]; add idx, rdx; jmp idx;
+    // then the table itself, 4-aligned, padded with int3.
+    void encode_jump_table(const MInst& inst) {
+        int index = inst.dst.reg;
+        byte(0x48);
+        byte(0x8D);
+        byte(0x15);   // ModRM: rdx, [rip + disp32]
+        size_t lea_field = m_code->size();
+        imm32(0);
+        MOperand entry = MOperand::make_mem(RDX, 0);
+        entry.index = index;
+        entry.scale = 4;
+        encode_rm(0, true, {0x63}, index, entry);
+        encode_rm(0, true, {0x01}, RDX, MOperand::make_reg(index));
+        encode_rm(0, false, {0xFF}, 4, MOperand::make_reg(index));
+        align(*m_code, 4, 0xCC);
+        size_t table = m_code->size();
+        patch32(lea_field, (int32_t)((int64_t)table - (int64_t)(lea_field + 4)));
+        for (int label : inst.table) {
+            m_table_fixups.push_back(TableFixup{m_code->size(), label, table});
+            imm32(0);
+        }
+    }
+
+    // --- INSTRUCTIONS ---
+    static int alu_extension(MOp op) {
+        switch (op) {
+            case MOp::Add: return 0;
+            case MOp::Or: return 1;
+            case MOp::And: return 4;
+            case MOp::Sub: return 5;
+            case MOp::Xor: return 6;
+            default: return 7; // Cmp
+        }
+    }
+
+    void encode(const MInst& inst, const map<string, bool>& defined) {
+        bool wide = inst.size == 8;
+        bool is_byte = inst.size == 1;
+        const MOperand& dst = inst.dst;
+        const MOperand& src = inst.src;
+        switch (inst.op) {
+            case MOp::Mov:
+                if (src.is_imm()) {
+                    if (dst.is_reg() && !wide) {
+                        if (dst.reg >= 8) byte(0x41);
+                        else if (is_byte && dst.reg >= 4) byte(0x40);
+                        byte((is_byte ? 0xB0 : 0xB8) + (dst.reg & 7));
+                        if (is_byte) byte((int)(src.imm & 0xff));
+                        else imm32(src.imm);
+                    } else if (dst.is_reg() && !fits_int32(src.imm)) {
+                        byte(0x48 | (dst.reg >= 8 ? 1 : 0));
+                        byte(0xB8 + (dst.reg & 7));
+                        imm64(src.imm);
+                    } else {
+                        encode_rm(0, wide, {is_byte ? 0xC6 : 0xC7}, 0, dst, is_byte, is_byte ? 1 : 4);
+                        if (is_byte) byte((int)(src.imm & 0xff));
+                        else imm32(src.imm);
+                    }
+                } else if (src.is_mem()) {
+                    encode_rm(0, wide, {is_byte ? 0x8A : 0x8B}, dst.reg, src, is_byte);
+                } else {
+                    encode_rm(0, wide, {is_byte ? 0x88 : 0x89}, src.reg, dst, is_byte);
+                }
+                break;
+            case MOp::Movsx8: encode_rm(0, wide, {0x0F, 0xBE}, dst.reg, src, true); break;
+            case MOp::Movzx8: encode_rm(0, wide, {0x0F, 0xB6}, dst.reg, src, true); break;
+            case MOp::Lea: encode_rm(0, wide, {0x8D}, dst.reg, src); break;
+            case MOp::Add: case MOp::Sub: case MOp::And: case MOp::Or: case MOp::Xor: case MOp::Cmp: {
+                int ext = alu_extension(inst.op);
+                if (src.is_imm()) {
+                    if (is_byte) {
+                        encode_rm(0, false, {0x80}, ext, dst, true, 1);
+                        byte((int)(src.imm & 0xff));
+                    } else if (fits_int8(src.imm)) {
+                        encode_rm(0, wide, {0x83}, ext, dst, false, 1);
+                        byte((int)(src.imm & 0xff));
+                    } else {
+                        encode_rm(0, wide, {0x81}, ext, dst, false, 4);
+                        imm32(src.imm);
+                    }
+                } else if (src.is_mem()) {
+                    encode_rm(0, wide, {ext * 8 + (is_byte ? 2 : 3)}, dst.reg, src, is_byte);
+                } else {
+                    encode_rm(0, wide, {ext * 8 + (is_byte ? 0 : 1)}, src.reg, dst, is_byte);
+                }
+                break;
+            }
+            case MOp::Imul:
+                if (!src.is_imm()) {
+                    encode_rm(0, wide, {0x0F, 0xAF}, dst.reg, src);
+                } else if (fits_int8(src.imm)) {   // imul r, r, imm
+                    encode_rm(0, wide, {0x6B}, dst.reg, dst, false, 1);
+                    byte((int)(src.imm & 0xff));
+                } else {
+                    encode_rm(0, wide, {0x69}, dst.reg, dst, false, 4);
+                    imm32(src.imm);
+                }
+                break;
+            case MOp::Idiv: encode_rm(0, wide, {0xF7}, 7, dst); break;
+            case MOp::Cdq:
+                if (wide) byte(0x48);
+                byte(0x99);
+                break;
+            case MOp::Test: encode_rm(0, wide, {is_byte ? 0x84 : 0x85}, src.reg, dst, is_byte); break;
+            case MOp::Bt: encode_rm(0, wide, {0x0F, 0xA3}, src.reg, dst); break;
+            case MOp::Setcc: encode_rm(0, false, {0x0F, 0x90 + (int)inst.cond}, 0, dst, true); break;
+            case MOp::Jmp:
+                byte(0xE9);
+                if (dst.kind == MOperandKind::Label) encode_rel32_label(dst.label);
+                else encode_rel32_symbol(dst.symbol, defined);
+                break;
+            case MOp::Jcc:
+                byte(0x0F);
+                byte(0x80 + (int)inst.cond);
+                encode_rel32_label(dst.label);
+                break;
+            case MOp::JmpTable: encode_jump_table(inst); break;
+            case MOp::Call:
+                byte(0xE8);
+                encode_rel32_symbol(dst.symbol, defined);
+                break;
+            case MOp::Ret: byte(0xC3); break;
+            case MOp::Push: case MOp::Pop:
+                if (dst.reg >= 8) byte(0x41);
+                byte((inst.op == MOp::Push ? 0x50 : 0x58) + (dst.reg & 7));
+                break;
+
+            // SSE: the mandatory prefix goes before REX.
+            case MOp::MovSS: case MOp::MovSD: {
+                int prefix = inst.op == MOp::MovSS ? 0xF3 : 0xF2;
+                if (dst.is_mem()) encode_rm(prefix, false, {0x0F, 0x11}, hw(src.reg), dst);
+                else encode_rm(prefix, false, {0x0F, 0x10}, hw(dst.reg), src);
+                break;
+            }
+            case MOp::Movaps: encode_rm(0, false, {0x0F, 0x28}, hw(dst.reg), src); break;
+            case MOp::Xorps: encode_rm(0, false, {0x0F, 0x57}, hw(dst.reg), src); break;
+            case MOp::AddSS: encode_rm(0xF3, false, {0x0F, 0x58}, hw(dst.reg), src); break;
+            case MOp::MulSS: encode_rm(0xF3, false, {0x0F, 0x59}, hw(dst.reg), src); break;
+            case MOp::SubSS: encode_rm(0xF3, false, {0x0F, 0x5C}, hw(dst.reg), src); break;
+            case MOp::DivSS: encode_rm(0xF3, false, {0x0F, 0x5E}, hw(dst.reg), src); break;
+            case MOp::AddSD: encode_rm(0xF2, false, {0x0F, 0x58}, hw(dst.reg), src); break;
+            case MOp::MulSD: encode_rm(0xF2, false, {0x0F, 0x59}, hw(dst.reg), src); break;
+            case MOp::SubSD: encode_rm(0xF2, false, {0x0F, 0x5C}, hw(dst.reg), src); break;
+            case MOp::DivSD: encode_rm(0xF2, false, {0x0F, 0x5E}, hw(dst.reg), src); break;
+            case MOp::UcomiSS: encode_rm(0, false, {0x0F, 0x2E}, hw(dst.reg), src); break;
+            case MOp::UcomiSD: encode_rm(0x66, false, {0x0F, 0x2E}, hw(dst.reg), src); break;
+            case MOp::Cvtsi2SS: encode_rm(0xF3, wide, {0x0F, 0x2A}, hw(dst.reg), src); break;
+            case MOp::Cvtsi2SD: encode_rm(0xF2, wide, {0x0F, 0x2A}, hw(dst.reg), src); break;
+            case MOp::CvttSS2si: encode_rm(0xF3, wide, {0x0F, 0x2C}, dst.reg, src); break;
+            case MOp::CvttSD2si: encode_rm(0xF2, wide, {0x0F, 0x2C}, dst.reg, src); break;
+            case MOp::CvtSS2SD: encode_rm(0xF3, false, {0x0F, 0x5A}, hw(dst.reg), src); break;
+            case MOp::CvtSD2SS: encode_rm(0xF2, false, {0x0F, 0x5A}, hw(dst.reg), src); break;
+        }
+    }
+};
+
+#endif
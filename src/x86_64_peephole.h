@@ -0,0 +1,355 @@
+#ifndef X86_64_PEEPHOLE_H
+#define X86_64_PEEPHOLE_H
+
+#include <vector>
+#include "x86_64.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         PEEPHOLE OPTIMISATION                               ===
+// ===================================================================
+// The code generator expands every IR instruction on its own, which leaves
+// seams between the expansions: constants loaded into a register just to be
+// added, results moved out of the scratch register, comparisons materialised
+// as 0/1 only to be tested by the branch that follows. The rules below rewrite
+// such short windows. Each rule is an entry of kRules and may only fire when
+// register liveness (computed over the whole function, flags included) shows
+// the values it drops are dead.
+//
+// The rules never make a value live on entry to a block where it was not, so
+// after a rewrite the liveness of the other blocks is still a safe
+// over-approximation; the pass recomputes it and repeats until nothing changes.
+
+// Register liveness over the blocks of one machine function.
+class MachineLiveness {
+public:
+    MachineLiveness(const MFunction& function) : m_function(function) {
+        m_live_in.assign(function.blocks.size(), 0);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t b = function.blocks.size(); b-- > 0;) {
+                vector<RegMask> after = live_after((int)b);
+                RegMask in = live_out((int)b);
+                if (!after.empty()) {
+                    MEffects first = effects_at(function.blocks[b].insts, 0);
+                    in = (after[0] & ~first.defs) | first.uses;
+                }
+                if (in != m_live_in[b]) {
+                    m_live_in[b] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Registers live after each instruction of block `b`.
+    vector<RegMask> live_after(int b) const {
+        const vector<MInst>& insts = m_function.blocks[b].insts;
+        vector<RegMask> result(insts.size());
+        RegMask live = live_out(b);
+        for (size_t i = insts.size(); i-- > 0;) {
+            const MInst& inst = insts[i];
+            if (inst.op == MOp::Jcc) live |= m_live_in[inst.dst.label];
+            if (inst.op == MOp::Jmp && inst.dst.kind == MOperandKind::Label) live = m_live_in[inst.dst.label];
+            if (inst.op == MOp::Ret || (inst.op == MOp::Jmp && inst.dst.kind == MOperandKind::Symbol)) live = 0;
+            if (inst.op == MOp::JmpTable) {
+                live = 0;
+                for (int label : inst.table) live |= m_live_in[label];
+            }
+            result[i] = live | kAlwaysLive;
+            MEffects effects = effects_at(insts, i);
+            live = (live & ~effects.defs) | effects.uses;
+        }
+        return result;
+    }
+
+private:
+    // The frame registers are never touched by the rewrites.
+    static const RegMask kAlwaysLive = ((RegMask)1 << RSP) | ((RegMask)1 << RBP);
+
+    const MFunction& m_function;
+    vector<RegMask> m_live_in;
+
+    // setcc writes only the low byte of its register, but when the movzx the
+    // code generator puts after it follows, the pair defines the whole
+    // register and the old value is dead.
+    static MEffects effects_at(const vector<MInst>& insts, size_t i) {
+        MEffects effects = machine_effects(insts[i]);
+        const MInst& inst = insts[i];
+        if (inst.op == MOp::Setcc && inst.dst.is_reg() && i + 1 < insts.size()) {
+            const MInst& next = insts[i + 1];
+            if (next.op == MOp::Movzx8 && next.dst.is_reg() && next.src.is_reg() && next.dst.reg == inst.dst.reg &&
+                next.src.reg == inst.dst.reg) {
+                effects.uses &= ~reg_bit(inst.dst.reg);
+            }
+        }
+        return effects;
+    }
+
+    // Live on leaving `b` by falling through to the next block.
+    RegMask live_out(int b) const {
+        const vector<MInst>& insts = m_function.blocks[b].insts;
+        if (!insts.empty() && is_block_terminator(insts.back().op)) return 0;
+        return b + 1 < (int)m_function.blocks.size() ? m_live_in[b + 1] : 0;
+    }
+};
+
+class X86Peephole {
+public:
+    X86Peephole(MModule& module) : m_module(module) {}
+
+    // Returns the number of rewrites made.
+    int run() {
+        int rewrites = 0;
+        for (MFunction& function : m_module.functions) rewrites += optimise(function);
+        return rewrites;
+    }
+
+private:
+    typedef bool (X86Peephole::*Rule)(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after);
+
+    struct RuleEntry {
+        const char* name;
+        Rule rule;
+    };
+
+    static const RuleEntry* rules(size_t& count) {
+        static const RuleEntry kRules[] = {
+            {"redundant move", &X86Peephole::redundant_move},
+            {"dead definition", &X86Peephole::dead_definition},
+            {"compare and branch", &X86Peephole::fuse_compare_branch},
+            {"immediate operand", &X86Peephole::fold_immediate},
+            {"move into place", &X86Peephole::retarget_move},
+            {"copy propagation", &X86Peephole::propagate_copy},
+            {"lea arithmetic", &X86Peephole::lea_arithmetic},
+            {"zeroing idiom", &X86Peephole::zeroing_idiom},
+        };
+        count = sizeof(kRules) / sizeof(kRules[0]);
+        return kRules;
+    }
+
+    MModule& m_module;
+
+    int optimise(MFunction& function) {
+        size_t rule_count;
+        const RuleEntry* table = rules(rule_count);
+        int rewrites = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            MachineLiveness liveness(function);
+            for (size_t b = 0; b < function.blocks.size(); ++b) {
+                vector<MInst>& insts = function.blocks[b].insts;
+                bool applied = true;
+                while (applied) {
+                    applied = false;
+                    vector<RegMask> live_after = liveness.live_after((int)b);
+                    for (size_t i = 0; i < insts.size() && !applied; ++i) {
+                        for (size_t r = 0; r < rule_count && !applied; ++r) {
+                            applied = (this->*table[r].rule)(insts, i, live_after);
+                        }
+                    }
+                    if (applied) {
+                        rewrites++;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        return rewrites;
+    }
+
+    static bool is_reg(const MOperand& op, int reg) { return op.is_reg() && op.reg == reg; }
+    static bool dead_after(const vector<RegMask>& live_after, size_t i, RegMask mask) {
+        return (live_after[i] & mask) == 0;
+    }
+    static bool is_general(const MOperand& op) { return op.is_reg() && op.reg < XMM0; }
+
+    // mov r, r / movaps x, x
+    bool redundant_move(vector<MInst>& insts, size_t i, const vector<RegMask>&) {
+        const MInst& inst = insts[i];
+        if ((inst.op != MOp::Mov && inst.op != MOp::Movaps) || !inst.dst.is_reg() || inst.dst != inst.src) return false;
+        insts.erase(insts.begin() + i);
+        return true;
+    }
+
+    // An instruction without side effects whose results nobody reads.
+    bool dead_definition(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        const MInst& inst = insts[i];
+        switch (inst.op) {
+            case MOp::Idiv: case MOp::Jmp: case MOp::Jcc: case MOp::JmpTable: case MOp::Call: case MOp::Ret:
+            case MOp::Push: case MOp::Pop:
+                return false;
+            default: break;
+        }
+        MEffects effects = machine_effects(inst);
+        if (effects.writes_memory || effects.defs == 0 || !dead_after(live_after, i, effects.defs)) return false;
+        insts.erase(insts.begin() + i);
+        return true;
+    }
+
+    // setcc r8; [movzx r, r8;] test r, r; jne/je L  ->  jcc/jncc L
+    // The flags the setcc read are still there when the jump executes.
+    bool fuse_compare_branch(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        if (insts[i].op != MOp::Setcc || !is_general(insts[i].dst)) return false;
+        int value = insts[i].dst.reg;
+        size_t j = i + 1;
+        if (j < insts.size() && insts[j].op == MOp::Movzx8 && is_reg(insts[j].src, value) && is_general(insts[j].dst)) {
+            value = insts[j].dst.reg;
+            j++;
+        }
+        if (j + 1 >= insts.size()) return false;
+        const MInst& test = insts[j];
+        bool tests_value = (test.op == MOp::Test && is_reg(test.dst, value) && is_reg(test.src, value)) ||
+                           (test.op == MOp::Cmp && is_reg(test.dst, value) && test.src.is_imm() && test.src.imm == 0);
+        MInst& jump = insts[j + 1];
+        if (!tests_value || jump.op != MOp::Jcc || (jump.cond != Cond::NE && jump.cond != Cond::E)) return false;
+        RegMask dropped = reg_bit(insts[i].dst.reg) | reg_bit(value);
+        if (!dead_after(live_after, j + 1, dropped)) return false;
+        Cond cond = insts[i].cond;
+        jump.cond = jump.cond == Cond::NE ? cond : (Cond)((int)cond ^ 1);   // conditions come in pairs
+        insts.erase(insts.begin() + i, insts.begin() + j + 1);
+        return true;
+    }
+
+    // The first instruction after `i` in the same straight-line stretch that
+    // reads or writes a register of `mask`, or insts.size().
+    static size_t next_access(const vector<MInst>& insts, size_t i, RegMask mask) {
+        for (size_t k = i + 1; k < insts.size(); ++k) {
+            MEffects effects = machine_effects(insts[k]);
+            if ((effects.uses | effects.defs) & mask) return k;
+            if (effects.control) break;
+        }
+        return insts.size();
+    }
+
+    // Whether any instruction strictly between `i` and `k` reads or writes `mask`.
+    static bool accessed_between(const vector<MInst>& insts, size_t i, size_t k, RegMask mask) {
+        for (size_t m = i + 1; m < k; ++m) {
+            MEffects effects = machine_effects(insts[m]);
+            if ((effects.uses | effects.defs) & mask) return true;
+        }
+        return false;
+    }
+
+    // mov r, imm; ...; op x, r  ->  ...; op x, imm
+    bool fold_immediate(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        const MInst& load = insts[i];
+        if (load.op != MOp::Mov || load.size != 4 || !is_general(load.dst) || !load.src.is_imm()) return false;
+        int r = load.dst.reg;
+        size_t k = next_access(insts, i, reg_bit(r));
+        if (k == insts.size()) return false;
+        MInst& user = insts[k];
+        switch (user.op) {
+            case MOp::Add: case MOp::Sub: case MOp::And: case MOp::Or: case MOp::Xor: case MOp::Cmp: case MOp::Mov:
+                break;
+            default:
+                return false;
+        }
+        if (!is_reg(user.src, r) || (operand_reads(user.dst) & reg_bit(r)) || !dead_after(live_after, k, reg_bit(r))) {
+            return false;
+        }
+        // Values are 32 bits wide; an 8-byte register copy only moves them.
+        if (user.size == 8) {
+            if (user.op != MOp::Mov || !user.dst.is_reg()) return false;
+            user.size = 4;
+        }
+        if (user.size != 4) return false;
+        user.src = load.src;
+        insts.erase(insts.begin() + i);
+        return true;
+    }
+
+    // def r, ...; ...; mov s, r  ->  def s, ...; ...   when r dies there and s
+    // is not touched in between
+    bool retarget_move(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        const MInst& def = insts[i];
+        bool full_write = def.op == MOp::Mov || def.op == MOp::Movzx8 || def.op == MOp::Movsx8 || def.op == MOp::Lea;
+        if (!full_write || !is_general(def.dst) || (def.op == MOp::Mov && def.size != 4)) return false;
+        int r = def.dst.reg;
+        size_t k = next_access(insts, i, reg_bit(r));
+        if (k == insts.size()) return false;
+        const MInst& move = insts[k];
+        if (move.op != MOp::Mov || !is_reg(move.src, r) || !is_general(move.dst) || move.dst.reg == r) return false;
+        if ((move.size != 4 && move.size != 8) || !dead_after(live_after, k, reg_bit(r))) return false;
+        if (accessed_between(insts, i, k, reg_bit(move.dst.reg))) return false;
+        insts[i].dst = move.dst;
+        insts.erase(insts.begin() + k);
+        return true;
+    }
+
+    // mov d, s; ...; op x, d  ->  ...; op x, s   when d dies there and s is not
+    // written in between
+    bool propagate_copy(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        const MInst& copy = insts[i];
+        if (copy.op != MOp::Mov || copy.size != 4 || !is_general(copy.dst) || !is_general(copy.src)) return false;
+        int d = copy.dst.reg, s = copy.src.reg;
+        if (d == s) return false;
+        size_t k = next_access(insts, i, reg_bit(d));
+        if (k == insts.size()) return false;
+        MInst& user = insts[k];
+        switch (user.op) {
+            case MOp::Mov: case MOp::Add: case MOp::Sub: case MOp::Imul: case MOp::And: case MOp::Or: case MOp::Xor:
+            case MOp::Cmp: case MOp::Test: case MOp::Movsx8: case MOp::Movzx8: case MOp::Idiv:
+                break;
+            default:
+                return false;
+        }
+        // d must be read only as the source (idiv: as its only operand).
+        MOperand& operand = user.op == MOp::Idiv ? user.dst : user.src;
+        const MOperand& other = user.op == MOp::Idiv ? user.src : user.dst;
+        if (!is_reg(operand, d) || (operand_reads(other) & reg_bit(d))) return false;
+        if (user.op == MOp::Idiv && (s == RAX || s == RDX)) return false;   // idiv rewrites them before reading
+        if (!dead_after(live_after, k, reg_bit(d))) return false;
+        for (size_t m = i + 1; m < k; ++m) {
+            if (machine_effects(insts[m]).defs & reg_bit(s)) return false;
+        }
+        operand = copy.src;
+        insts.erase(insts.begin() + i);
+        return true;
+    }
+
+    // mov r, a; add r, b  ->  lea r, [a + b]   (also add/sub of a constant)
+    bool lea_arithmetic(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        const MInst& move = insts[i];
+        if (move.op != MOp::Mov || move.size != 4 || !is_general(move.dst) || !is_general(move.src)) return false;
+        if (i + 1 >= insts.size() || move.dst == move.src) return false;
+        const MInst& op = insts[i + 1];
+        if ((op.op != MOp::Add && op.op != MOp::Sub) || op.size != 4 || op.dst != move.dst) return false;
+        if (!dead_after(live_after, i + 1, kFlagsBit)) return false;
+        MOperand address = MOperand::make_mem(move.src.reg, 0);
+        if (op.src.is_imm()) {
+            long long disp = op.op == MOp::Add ? op.src.imm : -op.src.imm;
+            if (disp < INT32_MIN || disp > INT32_MAX) return false;
+            address.disp = (int)disp;
+        } else if (op.op == MOp::Add && is_general(op.src) && op.src.reg != move.dst.reg) {
+            address.index = op.src.reg;
+            // rsp cannot be an index; the frame registers never hold values anyway.
+            if (address.index == RSP) return false;
+        } else {
+            return false;
+        }
+        MInst lea(MOp::Lea, 4);
+        lea.dst = move.dst;
+        lea.src = address;
+        insts[i] = lea;
+        insts.erase(insts.begin() + i + 1);
+        return true;
+    }
+
+    // mov r, 0  ->  xor r, r   (shorter, and breaks the dependency on r)
+    bool zeroing_idiom(vector<MInst>& insts, size_t i, const vector<RegMask>& live_after) {
+        MInst& move = insts[i];
+        if (move.op != MOp::Mov || move.size != 4 || !is_general(move.dst) || !move.src.is_imm() || move.src.imm != 0) {
+            return false;
+        }
+        if (!dead_after(live_after, i, kFlagsBit)) return false;
+        move.op = MOp::Xor;
+        move.src = move.dst;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef X86_64_SCHEDULER_H
+#define X86_64_SCHEDULER_H
+
+#include <algorithm>
+#include <vector>
+#include "x86_64.h"
+#include "x86_64_peephole.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         INSTRUCTION SCHEDULING                              ===
+// ===================================================================
+// List scheduling of straight-line regions (the instructions between two
+// jumps, calls or stack adjustments). A dependence graph is built from the
+// registers (and flags) each instruction reads and writes and from its memory
+// accesses; the instructions are then issued one per cycle, each time picking
+// among those whose operands are ready the one with the longest latency-
+// weighted path to the end of the region. Long operations (loads, multiplies,
+// divisions, floating point) thereby start early and independent work fills
+// their latency. Ties keep the original order.
+//
+// Memory accesses keep their order unless they provably touch different
+// locations: different globals, a global and the stack, or disjoint slots of
+// the same frame register.
+
+class X86Scheduler {
+public:
+    X86Scheduler(MModule& module) : m_module(module) {}
+
+    // Returns the number of regions whose order changed.
+    int run() {
+        int changed = 0;
+        for (MFunction& function : m_module.functions) {
+            for (MBlock& block : function.blocks) changed += schedule_block(block.insts);
+        }
+        return changed;
+    }
+
+    // Cycles until the result of `inst` can be used (a rough model of a
+    // current x86-64 core).
+    static int latency(const MInst& inst) {
+        int cycles;
+        switch (inst.op) {
+            case MOp::Imul: cycles = 3; break;
+            case MOp::Idiv: cycles = 26; break;
+            case MOp::AddSS: case MOp::SubSS: case MOp::MulSS: case MOp::AddSD: case MOp::SubSD: case MOp::MulSD:
+                cycles = 4;
+                break;
+            case MOp::DivSS: cycles = 11; break;
+            case MOp::DivSD: cycles = 14; break;
+            case MOp::Cvtsi2SS: case MOp::Cvtsi2SD: case MOp::CvttSS2si: case MOp::CvttSD2si:
+            case MOp::CvtSS2SD: case MOp::CvtSD2SS:
+                cycles = 5;
+                break;
+            case MOp::UcomiSS: case MOp::UcomiSD: cycles = 3; break;
+            default: cycles = 1; break;
+        }
+        // A memory source adds the load-to-use latency of the L1 cache.
+        if (inst.op != MOp::Lea && (inst.src.is_mem() || (inst.dst.is_mem() && inst.op != MOp::Mov &&
+                                                          inst.op != MOp::MovSS && inst.op != MOp::MovSD))) {
+            cycles += 4;
+        }
+        return cycles;
+    }
+
+private:
+    MModule& m_module;
+
+    struct Node {
+        MEffects effects;
+        int latency = 1;
+        int height = 0;                  // longest path to the end of the region
+        vector<pair<int, int>> succs;    // (node, latency of the edge)
+        int preds_left = 0;
+        int ready_at = 0;
+    };
+
+    // The memory operand of an instruction, if it has one.
+    static const MOperand* memory_operand(const MInst& inst) {
+        if (inst.op == MOp::Lea) return nullptr;
+        if (inst.dst.is_mem()) return &inst.dst;
+        if (inst.src.is_mem()) return &inst.src;
+        return nullptr;
+    }
+
+    static bool may_alias(const MInst& a, const MInst& b) {
+        const MOperand* x = memory_operand(a);
+        const MOperand* y = memory_operand(b);
+        if (!x || !y) return true;
+        if (!x->symbol.empty() || !y->symbol.empty()) return x->symbol == y->symbol;
+        if (x->index >= 0 || y->index >= 0 || x->reg != y->reg) return true;
+        // Frame slots are 8 bytes; no access is wider.
+        return x->disp < y->disp + 8 && y->disp < x->disp + 8;
+    }
+
+    static bool memory_conflict(const MInst& a, const MEffects& ea, const MInst& b, const MEffects& eb) {
+        if (ea.may_trap && (eb.writes_memory || eb.may_trap)) return true;
+        if (eb.may_trap && ea.writes_memory) return true;
+        if (!(ea.writes_memory && (eb.reads_memory || eb.writes_memory)) && !(ea.reads_memory && eb.writes_memory)) {
+            return false;
+        }
+        return may_alias(a, b);
+    }
+
+    int schedule_block(vector<MInst>& insts) {
+        int changed = 0;
+        size_t start = 0;
+        for (size_t i = 0; i <= insts.size(); ++i) {
+            if (i < insts.size() && !machine_effects(insts[i]).control) continue;
+            if (i - start > 2 && schedule_region(insts, start, i)) changed++;
+            start = i + 1;
+        }
+        return changed;
+    }
+
+    bool schedule_region(vector<MInst>& insts, size_t begin, size_t end) {
+        int n = (int)(end - begin);
+        vector<Node> nodes(n);
+        for (int i = 0; i < n; ++i) {
+            nodes[i].effects = machine_effects(insts[begin + i]);
+            nodes[i].latency = latency(insts[begin + i]);
+        }
+        for (int i = 0; i < n; ++i) {
+            for (int j = i + 1; j < n; ++j) {
+                const MEffects& a = nodes[i].effects;
+                const MEffects& b = nodes[j].effects;
+                int edge = -1;
+                if (a.defs & b.uses) edge = nodes[i].latency;                       // true dependence
+                else if ((a.uses & b.defs) || (a.defs & b.defs)) edge = 0;         // anti, output
+                if (memory_conflict(insts[begin + i], a, insts[begin + j], b)) edge = max(edge, nodes[i].latency);
+                if (edge < 0) continue;
+                nodes[i].succs.push_back(make_pair(j, edge));
+                nodes[j].preds_left++;
+            }
+        }
+        for (int i = n; i-- > 0;) {
+            int height = 0;
+            for (const pair<int, int>& succ : nodes[i].succs) height = max(height, nodes[succ.first].height + succ.second);
+            nodes[i].height = max(height, nodes[i].latency);
+        }
+
+        vector<int> order;
+        vector<int> ready;
+        for (int i = 0; i < n; ++i) {
+            if (nodes[i].preds_left == 0) ready.push_back(i);
+        }
+        // Prefer what can issue now; among those the tallest, otherwise what
+        // becomes ready first; then the original order.
+        int cycle = 0;
+        auto better = [&](int x, int y) {
+            bool x_now = nodes[x].ready_at <= cycle, y_now = nodes[y].ready_at <= cycle;
+            if (x_now != y_now) return x_now;
+            if (x_now && nodes[x].height != nodes[y].height) return nodes[x].height > nodes[y].height;
+            if (!x_now && nodes[x].ready_at != nodes[y].ready_at) return nodes[x].ready_at < nodes[y].ready_at;
+            return x < y;
+        };
+        while (!ready.empty()) {
+            int best = ready[0];
+            for (int candidate : ready) {
+                if (better(candidate, best)) best = candidate;
+            }
+            ready.erase(find(ready.begin(), ready.end(), best));
+            int issue = max(cycle, nodes[best].ready_at);
+            cycle = issue + 1;
+            order.push_back(best);
+            for (const pair<int, int>& succ : nodes[best].succs) {
+                Node& next = nodes[succ.first];
+                next.ready_at = max(next.ready_at, issue + succ.second);
+                if (--next.preds_left == 0) ready.push_back(succ.first);
+            }
+        }
+
+        bool reordered = false;
+        for (int i = 0; i < n; ++i) reordered = reordered || order[i] != i;
+        if (!reordered) return false;
+        vector<MInst> scheduled;
+        for (int i : order) scheduled.push_back(insts[begin + i]);
+        copy(scheduled.begin(), scheduled.end(), insts.begin() + begin);
+        return true;
+    }
+};
+
+// The machine-level optimisations run at -O1: peephole rewrites, then scheduling.
+inline void optimise_machine_code(MModule& module) {
+    X86Peephole(module).run();
+    X86Scheduler(module).run();
+}
+
+#endif
@@ -0,0 +1,600 @@
+#ifndef X86_64_SELECT_H
+#define X86_64_SELECT_H
+
+#include <climits>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "ir.h"
+#include "regalloc.h"
+#include "x86_64.h"
+
+using namespace std;
+
+// ===================================================================
+// ===         INSTRUCTION SELECTION BY TREE PATTERN MATCHING      ===
+// ===================================================================
+// One x86-64 instruction often does the work of several IR instructions: `add`
+// takes a constant or a global as its source, `lea` adds two registers and a
+// constant (one register scaled) without touching the flags, `cmp` feeds a
+// conditional jump with no 0/1 value in between. To find such instructions the
+// selector covers expression trees rather than single IR instructions
+// (bottom-up rewriting, as in BURS/iburg):
+//
+//   1. Tree building, before register allocation. A vreg with one definition
+//      and one use in the same block is folded into its use when the vregs the
+//      definition reads are not redefined in between and, for a load, no call
+//      or store in between can change the global. A folded instruction emits no
+//      code of its own; the allocator sees its operands used by the tree's
+//      root instead.
+//   2. Labelling, once the allocator has placed the leaves. For every node and
+//      every nonterminal a bottom-up dynamic program over the rule table finds
+//      the cheapest derivation; chain rules (`Value <- Opnd`) are closed over
+//      afterwards. Costs count instructions plus one per memory access, so the
+//      cover depends on whether a leaf got a register or a stack slot.
+//   3. Reduction: the cheapest cover is emitted top-down. A computed value is
+//      built in a single target register; the shape rules of step 1 (at most
+//      one computed operand per node, never the right operand of `-`) make
+//      sure one register is always enough.
+//
+// Nonterminals:
+//   Reg        a leaf vreg where the allocator put it (register or stack slot)
+//   Imm        a constant
+//   Mem        an int global
+//   Opnd       Reg, Imm or Mem: anything an instruction takes as its source
+//   Value      a result in the target register
+//   Index      a register, optionally scaled by 2, 4 or 8
+//   BaseIndex  a register plus an optional Index
+//   Addr       a BaseIndex plus a displacement (the operand of `lea`)
+//   Flags      a comparison in the flags (its condition is remembered)
+
+enum class SelOp { None, Leaf, Const, Global, Add, Sub, Mul, Cmp };
+
+enum class SelNt { Reg, Imm, Mem, Opnd, Value, Index, BaseIndex, Addr, Flags };
+
+const int kSelNonterminals = 9;
+
+enum class SelAction {
+    Leaf, Constant, Global, GlobalChar, Chain, Move, Lea, SetFlag, IndexReg, BaseReg,
+    ArithLeft, ArithRight, IndexScale, LeaTimes, BaseIndex, BaseIndexSwap, Disp, DispSwap, DispSub,
+    Compare, CompareLeft, CompareRight
+};
+
+// `lhs <- op(kids[0], kids[1])`, or the chain rule `lhs <- kids[0]` when op is
+// None.
+struct SelRule {
+    SelNt lhs;
+    SelOp op;
+    SelNt kids[2];
+    int cost;
+    SelAction action;
+};
+
+struct SelNode {
+    SelOp op = SelOp::Leaf;
+    const IrInst* inst = nullptr;  // the IR instruction of Const, Global and operator nodes
+    int position = -1;             // index of `inst` in its block
+    int vreg = -1;                 // Leaf
+    int kids[2] = {-1, -1};
+    int cost[kSelNonterminals];
+    int rule[kSelNonterminals];    // index into the rule table, -1: not derivable
+};
+
+// Where the allocator put a leaf vreg at the instruction being selected.
+typedef function<MOperand(int vreg)> SelLeafOperand;
+
+class X86Selector {
+public:
+    X86Selector(const IrFunction& function) : m_function(function) { build(); }
+
+    // Whether instruction `i` of block `b` was folded into a later one.
+    bool folded(int b, int i) const { return m_folded[b][i]; }
+    // The tree of the value instruction `i` computes, or -1 for instructions
+    // that are not tree operators (calls, floating point, ...).
+    int value_tree(int b, int i) const { return m_value_tree[b][i]; }
+    // The tree of operand `which` (0: a, 1: b) of an instruction that takes
+    // trees as operands, or -1.
+    int operand_tree(int b, int i, int which) const { return m_operand_tree[b][i][which]; }
+    SelOp op(int node) const { return m_nodes[node].op; }
+
+    // The allocator's view: folded instructions use and define nothing, and a
+    // tree's root uses the leaves of its trees.
+    AllocInput allocation_input() const {
+        AllocInput input;
+        for (IrType type : m_function.vreg_types) input.vreg_classes.push_back(register_class(type));
+        for (size_t b = 0; b < m_function.blocks.size(); ++b) {
+            const IrBlock& block = m_function.blocks[b];
+            AllocBlock alloc_block;
+            alloc_block.loop_depth = block.loop_depth;
+            alloc_block.successors = successors(block);
+            for (size_t i = 0; i < block.insts.size(); ++i) {
+                const IrInst& inst = block.insts[i];
+                AllocInst alloc_inst;
+                if (!m_folded[b][i]) {
+                    for (int which = 0; which < 2; ++which) {
+                        int vreg = which == 0 ? inst.a : inst.b;
+                        int tree = m_operand_tree[b][i][which];
+                        if (tree >= 0) leaves(tree, alloc_inst.uses);
+                        else if (vreg >= 0) alloc_inst.uses.push_back(vreg);
+                    }
+                    for (int arg : inst.args) alloc_inst.uses.push_back(arg);
+                    if (inst.dest >= 0) alloc_inst.defs.push_back(inst.dest);
+                    alloc_inst.is_call = inst.op == IrOp::Call;
+                    int copied = m_operand_tree[b][i][0];
+                    if (inst.op == IrOp::Copy && (copied < 0 || m_nodes[copied].op == SelOp::Leaf)) {
+                        alloc_inst.copy_source = inst.a;
+                    }
+                }
+                alloc_block.insts.push_back(alloc_inst);
+            }
+            input.blocks.push_back(alloc_block);
+        }
+        return input;
+    }
+
+    // Emits the cheapest cover of tree `root` deriving `goal` into `out`:
+    //   Value          the result is left in `target` (a register)
+    //   Flags          `cond` is the condition to test afterwards
+    //   Opnd/Reg/Mem   no code; `result` is the operand
+    // Returns false when a leaf would be read from `target` after the target was
+    // written; the caller then picks a scratch register that no leaf lives in.
+    bool select(int root, SelNt goal, const MOperand& target, const SelLeafOperand& leaf, vector<MInst>& out,
+                MOperand& result, Cond& cond) {
+        m_leaf = &leaf;
+        m_target = target;
+        m_out = &out;
+        m_written = false;
+        m_conflict = false;
+        label(root);
+        if (m_nodes[root].rule[(int)goal] < 0) {
+            m_leaf = nullptr;
+            m_out = nullptr;
+            return false;
+        }
+        result = reduce(root, goal);
+        cond = m_cond;
+        m_leaf = nullptr;
+        m_out = nullptr;
+        return !m_conflict;
+    }
+
+private:
+    static const int kNoCost = INT_MAX / 4;
+
+    const IrFunction& m_function;
+    vector<SelNode> m_nodes;
+    vector<vector<bool>> m_folded;
+    vector<vector<int>> m_value_tree;
+    vector<vector<vector<int>>> m_operand_tree;
+
+    // Selection state.
+    const SelLeafOperand* m_leaf = nullptr;
+    MOperand m_target;
+    vector<MInst>* m_out = nullptr;
+    bool m_written = false;
+    bool m_conflict = false;
+    Cond m_cond = Cond::NE;
+
+    static const SelRule* rules(size_t& count) {
+        static const SelRule kSelRules[] = {
+            {SelNt::Reg, SelOp::Leaf, {SelNt::Reg, SelNt::Reg}, 0, SelAction::Leaf},
+            {SelNt::Imm, SelOp::Const, {SelNt::Reg, SelNt::Reg}, 0, SelAction::Constant},
+            {SelNt::Mem, SelOp::Global, {SelNt::Reg, SelNt::Reg}, 1, SelAction::Global},
+            {SelNt::Value, SelOp::Global, {SelNt::Reg, SelNt::Reg}, 2, SelAction::GlobalChar},
+            {SelNt::Value, SelOp::Add, {SelNt::Value, SelNt::Opnd}, 1, SelAction::ArithLeft},
+            {SelNt::Value, SelOp::Add, {SelNt::Opnd, SelNt::Value}, 1, SelAction::ArithRight},
+            {SelNt::Value, SelOp::Sub, {SelNt::Value, SelNt::Opnd}, 1, SelAction::ArithLeft},
+            {SelNt::Value, SelOp::Mul, {SelNt::Value, SelNt::Opnd}, 3, SelAction::ArithLeft},
+            {SelNt::Value, SelOp::Mul, {SelNt::Opnd, SelNt::Value}, 3, SelAction::ArithRight},
+            {SelNt::Index, SelOp::Mul, {SelNt::Reg, SelNt::Imm}, 0, SelAction::IndexScale},
+            {SelNt::Addr, SelOp::Mul, {SelNt::Reg, SelNt::Imm}, 0, SelAction::LeaTimes},
+            {SelNt::BaseIndex, SelOp::Add, {SelNt::Reg, SelNt::Index}, 0, SelAction::BaseIndex},
+            {SelNt::BaseIndex, SelOp::Add, {SelNt::Index, SelNt::Reg}, 0, SelAction::BaseIndexSwap},
+            {SelNt::Addr, SelOp::Add, {SelNt::BaseIndex, SelNt::Imm}, 0, SelAction::Disp},
+            {SelNt::Addr, SelOp::Add, {SelNt::Imm, SelNt::BaseIndex}, 0, SelAction::DispSwap},
+            {SelNt::Addr, SelOp::Sub, {SelNt::BaseIndex, SelNt::Imm}, 0, SelAction::DispSub},
+            {SelNt::Flags, SelOp::Cmp, {SelNt::Opnd, SelNt::Opnd}, 1, SelAction::Compare},
+            {SelNt::Flags, SelOp::Cmp, {SelNt::Value, SelNt::Opnd}, 1, SelAction::CompareLeft},
+            {SelNt::Flags, SelOp::Cmp, {SelNt::Opnd, SelNt::Value}, 1, SelAction::CompareRight},
+            // Chain rules, tried in this order.
+            {SelNt::Opnd, SelOp::None, {SelNt::Reg, SelNt::Reg}, 0, SelAction::Chain},
+            {SelNt::Opnd, SelOp::None, {SelNt::Imm, SelNt::Reg}, 0, SelAction::Chain},
+            {SelNt::Opnd, SelOp::None, {SelNt::Mem, SelNt::Reg}, 0, SelAction::Chain},
+            {SelNt::Value, SelOp::None, {SelNt::Opnd, SelNt::Reg}, 1, SelAction::Move},
+            {SelNt::Index, SelOp::None, {SelNt::Reg, SelNt::Reg}, 0, SelAction::IndexReg},
+            {SelNt::BaseIndex, SelOp::None, {SelNt::Reg, SelNt::Reg}, 0, SelAction::BaseReg},
+            {SelNt::Addr, SelOp::None, {SelNt::BaseIndex, SelNt::Reg}, 0, SelAction::Chain},
+            {SelNt::Value, SelOp::None, {SelNt::Addr, SelNt::Reg}, 1, SelAction::Lea},
+            {SelNt::Value, SelOp::None, {SelNt::Flags, SelNt::Reg}, 2, SelAction::SetFlag},
+        };
+        count = sizeof(kSelRules) / sizeof(kSelRules[0]);
+        return kSelRules;
+    }
+
+    static bool is_float(IrType type) { return type == IrType::Float || type == IrType::Double; }
+
+    // --- TREE BUILDING ---
+    // IR instructions that become operator nodes.
+    static bool is_tree_operator(const IrInst& inst) {
+        switch (inst.op) {
+            case IrOp::Const: return true;
+            case IrOp::Add: case IrOp::Sub: case IrOp::Mul: return inst.type == IrType::Int;
+            case IrOp::LoadGlobal: return !is_float(inst.type);
+            default: return is_comparison(inst.op) && !is_float(inst.operand_type);
+        }
+    }
+
+    // IR instructions whose operands may be trees.
+    static bool takes_trees(const IrInst& inst) {
+        switch (inst.op) {
+            case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div: case IrOp::Copy:
+                return inst.type == IrType::Int;
+            case IrOp::StoreGlobal: case IrOp::Ret: return inst.a >= 0 && !is_float(inst.type);
+            case IrOp::Branch: return true;
+            default: return is_comparison(inst.op) && !is_float(inst.operand_type);
+        }
+    }
+
+    static SelOp node_op(const IrInst& inst) {
+        switch (inst.op) {
+            case IrOp::Const: return SelOp::Const;
+            case IrOp::LoadGlobal: return SelOp::Global;
+            case IrOp::Add: return SelOp::Add;
+            case IrOp::Sub: return SelOp::Sub;
+            case IrOp::Mul: return SelOp::Mul;
+            default: return SelOp::Cmp;
+        }
+    }
+
+    // Nodes whose value has to be computed into the target register.
+    bool computed(int node) const {
+        const SelNode& n = m_nodes[node];
+        if (n.op == SelOp::Global) return n.inst->operand_type == IrType::Char;
+        return n.op != SelOp::Leaf && n.op != SelOp::Const;
+    }
+
+    bool shape_allows(const IrInst& consumer, int which, int folded_a, int candidate) const {
+        switch (consumer.op) {
+            case IrOp::Sub: return which == 0 || !computed(candidate);
+            case IrOp::Div:
+                return which == 0 || (m_nodes[candidate].op == SelOp::Global && !computed(candidate));
+            case IrOp::Copy: case IrOp::StoreGlobal: case IrOp::Ret: case IrOp::Branch: return true;
+            default: // Add, Mul and comparisons: one computed operand at most
+                return which == 0 || !computed(candidate) || folded_a < 0 || !computed(folded_a);
+        }
+    }
+
+    int new_node(SelOp op) {
+        SelNode node;
+        node.op = op;
+        m_nodes.push_back(node);
+        return (int)m_nodes.size() - 1;
+    }
+
+    void leaves(int node, vector<int>& out) const {
+        const SelNode& n = m_nodes[node];
+        if (n.op == SelOp::Leaf) out.push_back(n.vreg);
+        for (int kid : n.kids) {
+            if (kid >= 0) leaves(kid, out);
+        }
+    }
+
+    // Whether tree `node`, rooted at position `root`, still computes the same
+    // value at the current position.
+    bool unchanged(int node, int root, const map<int, int>& last_def, int last_call,
+                   const map<string, int>& last_store) const {
+        const SelNode& n = m_nodes[node];
+        if (n.op == SelOp::Leaf) {
+            map<int, int>::const_iterator def = last_def.find(n.vreg);
+            return def == last_def.end() || def->second < root;
+        }
+        if (n.op == SelOp::Global) {
+            map<string, int>::const_iterator store = last_store.find(n.inst->symbol);
+            if (last_call > n.position || (store != last_store.end() && store->second > n.position)) return false;
+        }
+        for (int kid : n.kids) {
+            if (kid >= 0 && !unchanged(kid, root, last_def, last_call, last_store)) return false;
+        }
+        return true;
+    }
+
+    void build() {
+        size_t vregs = m_function.vreg_types.size();
+        vector<int> defs(vregs, 0), uses(vregs, 0);
+        for (int param : m_function.params) defs[param]++;
+        for (const IrBlock& block : m_function.blocks) {
+            for (const IrInst& inst : block.insts) {
+                if (inst.dest >= 0) defs[inst.dest]++;
+                if (inst.a >= 0) uses[inst.a]++;
+                if (inst.b >= 0) uses[inst.b]++;
+                for (int arg : inst.args) uses[arg]++;
+            }
+        }
+
+        size_t blocks = m_function.blocks.size();
+        m_folded.assign(blocks, vector<bool>());
+        m_value_tree.assign(blocks, vector<int>());
+        m_operand_tree.assign(blocks, vector<vector<int>>());
+        for (size_t b = 0; b < blocks; ++b) {
+            const vector<IrInst>& insts = m_function.blocks[b].insts;
+            m_folded[b].assign(insts.size(), false);
+            m_value_tree[b].assign(insts.size(), -1);
+            m_operand_tree[b].assign(insts.size(), vector<int>(2, -1));
+
+            map<int, int> pending;          // foldable vreg -> position of its definition
+            map<int, int> last_def;         // vreg -> position of its latest definition
+            map<string, int> last_store;    // global -> position of the latest store
+            int last_call = -1;
+            for (size_t i = 0; i < insts.size(); ++i) {
+                const IrInst& inst = insts[i];
+                if (takes_trees(inst)) {
+                    for (int which = 0; which < 2; ++which) {
+                        int vreg = which == 0 ? inst.a : inst.b;
+                        if (vreg < 0) continue;
+                        int tree = -1;
+                        map<int, int>::iterator candidate = pending.find(vreg);
+                        if (candidate != pending.end()) {
+                            int root = candidate->second;
+                            int node = m_value_tree[b][root];
+                            int folded_a = which == 1 && inst.a >= 0 && m_operand_tree[b][i][0] >= 0 &&
+                                                   m_nodes[m_operand_tree[b][i][0]].op != SelOp::Leaf
+                                               ? m_operand_tree[b][i][0]
+                                               : -1;
+                            if (shape_allows(inst, which, folded_a, node) &&
+                                unchanged(node, root, last_def, last_call, last_store)) {
+                                m_folded[b][root] = true;
+                                pending.erase(candidate);
+                                tree = node;
+                            }
+                        }
+                        if (tree < 0) {
+                            tree = new_node(SelOp::Leaf);
+                            m_nodes[tree].vreg = vreg;
+                        }
+                        m_operand_tree[b][i][which] = tree;
+                    }
+                }
+                if (is_tree_operator(inst)) {
+                    int node = new_node(node_op(inst));
+                    m_nodes[node].inst = &inst;
+                    m_nodes[node].position = (int)i;
+                    m_nodes[node].kids[0] = m_operand_tree[b][i][0];
+                    m_nodes[node].kids[1] = m_operand_tree[b][i][1];
+                    m_value_tree[b][i] = node;
+                    if (defs[inst.dest] == 1 && uses[inst.dest] == 1) pending[inst.dest] = (int)i;
+                }
+                if (inst.dest >= 0) last_def[inst.dest] = (int)i;
+                if (inst.op == IrOp::Call) last_call = (int)i;
+                if (inst.op == IrOp::StoreGlobal) last_store[inst.symbol] = (int)i;
+            }
+        }
+    }
+
+    // --- LABELLING ---
+    MOperand leaf_operand(int node) const { return (*m_leaf)(m_nodes[node].vreg); }
+
+    bool leaf_in_register(int node) const {
+        return m_nodes[node].op == SelOp::Leaf && leaf_operand(node).is_reg();
+    }
+
+    // Operands that are memory accesses when used as a source.
+    bool in_memory(int node) const {
+        const SelNode& n = m_nodes[node];
+        return n.op == SelOp::Global || (n.op == SelOp::Leaf && leaf_operand(node).is_mem());
+    }
+
+    long long constant(int node) const { return m_nodes[node].inst->imm; }
+    bool is_constant(int node, long long value) const {
+        return m_nodes[node].op == SelOp::Const && constant(node) == value;
+    }
+
+    // Cost of applying rule `r` at `node` (without the kids' costs), or -1
+    // when the rule's condition does not hold.
+    int rule_cost(const SelRule& rule, int node) const {
+        const SelNode& n = m_nodes[node];
+        switch (rule.action) {
+            case SelAction::Leaf: return leaf_operand(node).is_mem() ? 1 : 0;
+            case SelAction::Global: return n.inst->operand_type == IrType::Char ? -1 : rule.cost;
+            case SelAction::GlobalChar: return n.inst->operand_type == IrType::Char ? rule.cost : -1;
+            case SelAction::Move:
+                return n.op == SelOp::Leaf && leaf_operand(node) == m_target ? 0 : rule.cost;
+            case SelAction::IndexReg: case SelAction::BaseReg: return leaf_in_register(node) ? rule.cost : -1;
+            case SelAction::IndexScale: {
+                int scale = n.kids[1];
+                bool ok = is_constant(scale, 2) || is_constant(scale, 4) || is_constant(scale, 8);
+                return ok && leaf_in_register(n.kids[0]) ? rule.cost : -1;
+            }
+            case SelAction::LeaTimes: {
+                int times = n.kids[1];
+                bool ok = is_constant(times, 3) || is_constant(times, 5) || is_constant(times, 9);
+                return ok && leaf_in_register(n.kids[0]) ? rule.cost : -1;
+            }
+            case SelAction::BaseIndex: return leaf_in_register(n.kids[0]) ? rule.cost : -1;
+            case SelAction::BaseIndexSwap: return leaf_in_register(n.kids[1]) ? rule.cost : -1;
+            case SelAction::DispSub: return is_constant(n.kids[1], INT_MIN) ? -1 : rule.cost;
+            case SelAction::Compare: {
+                bool both_constant = m_nodes[n.kids[0]].op == SelOp::Const && m_nodes[n.kids[1]].op == SelOp::Const;
+                return both_constant || (in_memory(n.kids[0]) && in_memory(n.kids[1])) ? -1 : rule.cost;
+            }
+            default: return rule.cost;
+        }
+    }
+
+    void label(int node) {
+        SelNode& n = m_nodes[node];
+        for (int kid : n.kids) {
+            if (kid >= 0) label(kid);
+        }
+        for (int nt = 0; nt < kSelNonterminals; ++nt) {
+            n.cost[nt] = kNoCost;
+            n.rule[nt] = -1;
+        }
+        size_t count;
+        const SelRule* table = rules(count);
+        for (size_t r = 0; r < count; ++r) {
+            const SelRule& rule = table[r];
+            if (rule.op != n.op) continue;
+            int cost = rule_cost(rule, node);
+            if (cost < 0) continue;
+            for (int k = 0; k < 2 && n.kids[k] >= 0 && cost < kNoCost; ++k) {
+                cost += m_nodes[n.kids[k]].cost[(int)rule.kids[k]];
+            }
+            if (cost < n.cost[(int)rule.lhs]) {
+                n.cost[(int)rule.lhs] = cost;
+                n.rule[(int)rule.lhs] = (int)r;
+            }
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t r = 0; r < count; ++r) {
+                const SelRule& rule = table[r];
+                if (rule.op != SelOp::None || n.cost[(int)rule.kids[0]] >= kNoCost) continue;
+                int cost = rule_cost(rule, node);
+                if (cost < 0) continue;
+                cost += n.cost[(int)rule.kids[0]];
+                if (cost < n.cost[(int)rule.lhs]) {
+                    n.cost[(int)rule.lhs] = cost;
+                    n.rule[(int)rule.lhs] = (int)r;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // --- REDUCTION ---
+    void emit(MOp op, const MOperand& dst, const MOperand& src) {
+        MInst inst(op, 4);
+        inst.dst = dst;
+        inst.src = src;
+        m_out->push_back(inst);
+    }
+
+    MOperand write_target() {
+        m_written = true;
+        return m_target;
+    }
+
+    static Cond condition(IrOp op, bool swapped) {
+        switch (op) {
+            case IrOp::Eq: return Cond::E;
+            case IrOp::Ne: return Cond::NE;
+            case IrOp::Lt: return swapped ? Cond::G : Cond::L;
+            case IrOp::Gt: return swapped ? Cond::L : Cond::G;
+            case IrOp::Le: return swapped ? Cond::GE : Cond::LE;
+            default: return swapped ? Cond::LE : Cond::GE;
+        }
+    }
+
+    static MOp arithmetic(SelOp op) {
+        return op == SelOp::Add ? MOp::Add : op == SelOp::Sub ? MOp::Sub : MOp::Imul;
+    }
+
+    MOperand reduce(int node, SelNt goal) {
+        size_t count;
+        const SelRule& rule = rules(count)[m_nodes[node].rule[(int)goal]];
+        const SelNode& n = m_nodes[node];
+        switch (rule.action) {
+            case SelAction::Leaf: {
+                MOperand operand = leaf_operand(node);
+                if (m_written && operand == m_target) m_conflict = true;
+                return operand;
+            }
+            case SelAction::Constant: return MOperand::make_imm((int)n.inst->imm);
+            case SelAction::Global: return MOperand::make_global(n.inst->symbol);
+            case SelAction::GlobalChar:
+                emit(MOp::Movsx8, m_target, MOperand::make_global(n.inst->symbol));
+                return write_target();
+            case SelAction::Chain: return reduce(node, rule.kids[0]);
+            case SelAction::Move: {
+                MOperand source = reduce(node, SelNt::Opnd);
+                if (source != m_target) emit(MOp::Mov, m_target, source);
+                return write_target();
+            }
+            case SelAction::Lea: {
+                MOperand address = reduce(node, SelNt::Addr);
+                emit(MOp::Lea, m_target, address);
+                return write_target();
+            }
+            case SelAction::SetFlag: {
+                reduce(node, SelNt::Flags);
+                MInst set(MOp::Setcc, 1);
+                set.cond = m_cond;
+                set.dst = MOperand::make_reg(RAX);
+                m_out->push_back(set);
+                emit(MOp::Movzx8, m_target, MOperand::make_reg(RAX));
+                return write_target();
+            }
+            case SelAction::IndexReg: {
+                MOperand index = MOperand::make_mem(-1, 0);
+                index.index = reduce(node, SelNt::Reg).reg;
+                return index;
+            }
+            case SelAction::BaseReg: return MOperand::make_mem(reduce(node, SelNt::Reg).reg, 0);
+            case SelAction::ArithLeft: case SelAction::ArithRight: {
+                bool left = rule.action == SelAction::ArithLeft;
+                reduce(n.kids[left ? 0 : 1], SelNt::Value);
+                MOperand source = reduce(n.kids[left ? 1 : 0], SelNt::Opnd);
+                emit(arithmetic(n.op), m_target, source);
+                return write_target();
+            }
+            case SelAction::IndexScale: {
+                MOperand index = MOperand::make_mem(-1, 0);
+                index.index = reduce(n.kids[0], SelNt::Reg).reg;
+                index.scale = (int)constant(n.kids[1]);
+                return index;
+            }
+            case SelAction::LeaTimes: {
+                int reg = reduce(n.kids[0], SelNt::Reg).reg;
+                MOperand address = MOperand::make_mem(reg, 0);
+                address.index = reg;
+                address.scale = (int)constant(n.kids[1]) - 1;
+                return address;
+            }
+            case SelAction::BaseIndex: case SelAction::BaseIndexSwap: {
+                bool swap = rule.action == SelAction::BaseIndexSwap;
+                MOperand address = MOperand::make_mem(reduce(n.kids[swap ? 1 : 0], SelNt::Reg).reg, 0);
+                MOperand index = reduce(n.kids[swap ? 0 : 1], SelNt::Index);
+                address.index = index.index;
+                address.scale = index.scale;
+                return address;
+            }
+            case SelAction::Disp: case SelAction::DispSub: {
+                MOperand address = reduce(n.kids[0], SelNt::BaseIndex);
+                long long disp = constant(n.kids[1]);
+                address.disp = (int)(rule.action == SelAction::Disp ? disp : -disp);
+                return address;
+            }
+            case SelAction::DispSwap: {
+                MOperand address = reduce(n.kids[1], SelNt::BaseIndex);
+                address.disp = (int)constant(n.kids[0]);
+                return address;
+            }
+            case SelAction::Compare: {
+                MOperand a = reduce(n.kids[0], SelNt::Opnd), b = reduce(n.kids[1], SelNt::Opnd);
+                bool swap = a.is_imm();
+                emit(MOp::Cmp, swap ? b : a, swap ? a : b);
+                m_cond = condition(n.inst->op, swap);
+                return MOperand();
+            }
+            case SelAction::CompareLeft: {
+                reduce(n.kids[0], SelNt::Value);
+                emit(MOp::Cmp, m_target, reduce(n.kids[1], SelNt::Opnd));
+                m_cond = condition(n.inst->op, false);
+                return MOperand();
+            }
+            case SelAction::CompareRight: {
+                reduce(n.kids[1], SelNt::Value);
+                MOperand a = reduce(n.kids[0], SelNt::Opnd);
+                bool swap = a.is_imm();
+                emit(MOp::Cmp, swap ? m_target : a, swap ? a : m_target);
+                m_cond = condition(n.inst->op, swap);
+                return MOperand();
+            }
+        }
+        return MOperand();
+    }
+};
+
+#endif
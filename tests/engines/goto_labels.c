@@ -0,0 +1,82 @@
+// goto forwards, backwards, out of loops and into loop, if and switch bodies.
+int a(int n) {
+    int s = 0;
+    int i = 0;
+    if (n > 3) goto inside;
+    for (i = 0; i < n; i = i + 1) {
+        s = s + i;
+        if (s > 2) {
+inside:
+            s = s + 10;
+        } else {
+            s = s + 1;
+        }
+    }
+    return s + i;
+}
+int b(int n) {
+    int s = 0;
+    switch (n) {
+        case 1:
+            s = 5;
+        lab:
+            s = s + 3;
+            break;
+        case 2:
+            s = 7;
+            goto lab;
+        default:
+            if (n > 10) goto lab;
+            s = 1;
+    }
+    return s;
+}
+int c(int n) {
+    int s = 0;
+    int k = 0;
+top:
+    k = k + 1;
+    do {
+        s = s + k;
+        if (s > 40) goto end;
+        if (k / 2 * 2 == k) continue;
+        s = s + 1;
+    } while (s < k * 3);
+    if (k < n) goto top;
+end:
+    return s * 3 + k;
+}
+int d(int n) {
+    int s = 0;
+    int i = 0;
+    while (i < n) {
+        i = i + 1;
+        if (i == 3) goto skip;
+        s = s + i;
+    skip:
+        ;
+    }
+    goto x;
+y:
+    return s;
+x:
+    s = s + 1000;
+    goto y;
+}
+int e(int n) {
+    int s = 0;
+    int i = n;
+    goto cond;
+body:
+    s = s + i;
+    i = i - 1;
+cond:
+    if (i > 0) goto body;
+    return s;
+}
+int main() {
+    int s = 0;
+    int k;
+    for (k = 0; k < 15; k = k + 1) s = s + a(k) + b(k) * 3 + c(k) * 5 + d(k) * 7 + e(k) * 11;
+    return s - (s / 251) * 251;
+}
@@ -0,0 +1,12 @@
+// A parameter that is overwritten before it is read is not live on entry;
+// moving it out of its argument register clobbered p1 (native code only).
+int g2;
+int f0(int p1, int p2) {
+    g2 = p1;
+    p2 = p1;
+    return 0;
+}
+int main() {
+    f0(102, 7);
+    return g2;
+}
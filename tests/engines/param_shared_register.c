@@ -0,0 +1,10 @@
+// Two parameters that are dead on entry were both moved into the register of
+// their later definitions, and the parallel move never terminated.
+int f0(char p0, int p1, char p2, int p3) {
+    if (1 < p3 < 6) return 1;
+    p1 = 1 / 5;
+    return p1;
+}
+int main() {
+    return f0(1, 2, 3, 4) + f0(1, 2, 3, 0) * 2;
+}
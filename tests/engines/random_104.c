@@ -0,0 +1,54 @@
+// Generated program (random differential testing, seed 104).
+int g0 = 49;
+int g1 = 14;
+char g2 = 25;
+int f0() {
+  int i0; int i1; int a = 2; char b = 0; int c = 2;
+  g0 = 11;
+  for (i0 = 1; i0 < 4; i0 = i0 + 1) {
+    for (i1 = 3; i1 <= 7; i1 = i1 + 1) {
+      if ((b + (b - 6))) return (i1 - (c + c));
+      g0 = (c - (i0 + g0));
+      g1 = 0;
+    }
+    g2 = ((a + g0) >= b);
+  }
+  return (((0 * 5) - (b) / 2) == ((g0 - g1) + (a <= a)));
+}
+int f1(int p0, char p1, int p2, int p3, int p4, int p5) {
+  int i0; int i1; int a = 6; char b = 3; int c = 6;
+  for (i0 = 3; i0 < 4; i0 = i0 + 1) {
+    for (i1 = 1; i1 < 7; i1 = i1 + 1) {
+      g1 = f0();
+      p2 = p1;
+      g1 = p1;
+      p1 = p1;
+    }
+  }
+  g2 = (f0() - ((6) / 5 <= (g0 * a)));
+  p3 = (((p3 < 10) - 0) + ((p4 * 9) != (p1 >= a)));
+  p3 = (((8 != 15) - (g1 != 12)) * f0());
+  p5 = (((p0 == p4) != (p1 + a)) != (f0() + (p0 < p3)));
+  a = (p2 >= (11 - (p3 - g0)));
+  return (((p2 - p2) + (g2 <= 18)) < p2);
+}
+int f2() {
+  int i0; int i1; int a = 9; char b = 6; int c = 3;
+  a = b;
+  g2 = g1;
+  b = (((g1) / 2 == (c <= g0))) / 2;
+  for (i0 = 2; i0 < 7; i0 = i0 + 1) {
+    g1 = (f1((c < g1), g0, (a - a), (17 < g0), f0(), 20) > ((a - i0) + f0()));
+  }
+  g0 = (((2 + b) - (15 != 13)) == ((g0 - a) + (g1 >= c)));
+  g1 = ((g2 - g0) != (g1) / 1);
+  return f1(6, g1, a, (f1(b, b, g1, g1, b, 18) < (g1 >= c)), ((7 != b) * (g1 + g1)), 6);
+}
+int main() {
+  int r = 0;
+  r = r * 31 + f0();
+  r = r * 31 + f1(1, 0, 10, 8, 12, 10);
+  r = r * 31 + f2();
+  r = r + g0 + g1 + g2;
+  return r - (r / 256) * 256 + 10;
+}
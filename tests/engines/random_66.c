@@ -0,0 +1,66 @@
+// Generated program (random differential testing, seed 66).
+int g0 = 15;
+int g1 = 50;
+int g2 = 28;
+int f0(char p0, int p1, char p2, int p3) {
+  int i0; int i1; int a = 2; char b = 7; int c = 8;
+  if (((g1 > c) < (p3 < 6))) return ((b - 12) == a);
+  p1 = (((19 >= b) + (9 + b))) / 5;
+  for (i0 = 2; i0 < 0; i0 = i0 + 1) {
+    g1 = 3;
+    p0 = i0;
+    for (i1 = 1; i1 < 1; i1 = i1 + 1) {
+      c = (1 == (15 != (13) / 2));
+    }
+  }
+  return (5) / 7;
+}
+int f1(char p0, int p1) {
+  int i0; int i1; int a = 2; char b = 9; int c = 3;
+  for (i0 = 0; i0 <= 9; i0 = i0 + 1) {
+    for (i1 = 3; i1 < 6; i1 = i1 + 1) {
+      c = f0(((p1 >= g1) > (19 - b)), ((7) / 2 - (a >= c)), 20, (f0(g2, 18, p0, i1)) / 7);
+      g0 = (c * (2 > 10));
+      g1 = f0(i1, (p0 == i0), (g0 < b), f0(g1, i1, b, b));
+    }
+    g0 = g0;
+    for (i1 = 1; i1 < 5; i1 = i1 + 1) {
+      g0 = ((b > g0) == (b + 4));
+      g2 = a;
+      g0 = f0((g0 >= 9), (a - p0), f0(g2, 14, g2, a), (18 + p0));
+    }
+  }
+  if (((b < c)) / 2) {
+    g0 = ((p0) / 3 == (f0(5, p1, 11, 17)) / 5);
+    g0 = c;
+  }
+  return ((g2) / 3 + f0(g2, (10 + 20), 1, g1));
+}
+int f2(int p0, int p1, int p2, char p3, char p4, int p5) {
+  int i0; int i1; int a = 8; char b = 3; int c = 1;
+  g0 = ((a != 19)) / 2;
+  for (i0 = 3; i0 > 2; i0 = i0 - 1) {
+    if ((p0) / 1) {
+      p4 = (p2 <= ((2 + p0) * f1(17, i0)));
+      p4 = g0;
+      p4 = (((3 > p3) * (5 < 0)) != (8 - (c <= g2)));
+    } else {
+      g2 = ((i0 * 8) < (c > b));
+      g1 = ((p1) / 7 < (p3 + p4));
+    }
+    for (i1 = 1; i1 <= 8; i1 = i1 + 1) {
+      p5 = (g2 - 7);
+      g1 = ((f0(c, 6, c, 20) != (i0 <= p0)) > ((3 * g1)) / 7);
+    }
+    c = (((g0 - g2) <= (13 - 14)) - ((p1 <= g1) < (p4 > p1)));
+  }
+  return ((g1) / 5 < p5);
+}
+int main() {
+  int r = 0;
+  r = r * 31 + f0(3, 11, 11, 9);
+  r = r * 31 + f1(10, 11);
+  r = r * 31 + f2(8, 4, 12, 12, 8, 0);
+  r = r + g0 + g1 + g2;
+  return r - (r / 256) * 256 + 10;
+}
@@ -0,0 +1,55 @@
+// Generated program (random differential testing, seed 80).
+int g0 = 45;
+int g1 = 26;
+char g2 = 23;
+int f0(int p0, int p1, char p2, int p3, int p4, char p5) {
+  int i0; int i1; int a = 0; char b = 6; int c = 3;
+  if (((p5 * p3) * (g1) / 1)) return ((p0 - 7) * (14 >= b));
+  for (i0 = 11; i0 > 2; i0 = i0 - 1) {
+    p1 = p4;
+    g2 = 10;
+  }
+  for (i0 = 1; i0 <= 7; i0 = i0 + 1) {
+    g1 = 3;
+    p2 = (((b >= 5) - (p4 < p5)) - (2) / 3);
+  }
+  return p5;
+}
+int f1(int p0, char p1, int p2, int p3) {
+  int i0; int i1; int a = 3; char b = 2; int c = 2;
+  for (i0 = 7; i0 > 0; i0 = i0 - 1) {
+    if (6) return ((10 + 5) != c);
+    for (i1 = 0; i1 < 7; i1 = i1 + 1) {
+      b = (((i1 - 18) * (7 >= b)) + a);
+    }
+  }
+  c = (p1 - ((a + p2)) / 2);
+  a = 3;
+  return (((c) / 3) / 3 + (p1 - (g1) / 3));
+}
+int f2(int p0, char p1) {
+  int i0; int i1; int a = 1; char b = 9; int c = 4;
+  g0 = g2;
+  a = 19;
+  g0 = (11 * (p1 != g0));
+  g1 = (((4 - p0)) / 2) / 1;
+  if (4) {
+    for (i0 = 2; i0 < 6; i0 = i0 + 1) {
+      c = (((g0 < a) >= 12)) / 1;
+    }
+    for (i0 = 4; i0 > 0; i0 = i0 - 1) {
+      if (f0((b) / 1, (c < g0), (p1 - i0), (20 <= p0), (g2 > 10), a)) return c;
+      g1 = c;
+    }
+  }
+  g1 = ((f1(7, a, p1, 15) < (b <= 13)) >= ((g0 + g1) <= g1));
+  return (f1(g1, (12) / 1, f1(10, c, 14, b), (p0) / 7) == f0(9, f1(p1, 20, p0, g1), 3, g0, (g2 - c), p0));
+}
+int main() {
+  int r = 0;
+  r = r * 31 + f0(11, 3, 11, 7, 6, 7);
+  r = r * 31 + f1(7, 8, 8, 3);
+  r = r * 31 + f2(4, 11);
+  r = r + g0 + g1 + g2;
+  return r - (r / 256) * 256 + 10;
+}
@@ -0,0 +1,101 @@
+// while, do-while, continue and break in rotated loops (the exit test at the
+// bottom), including the loops the unroller rewrites.
+int gv;
+int sum(int n) {
+    int i = 0;
+    int s = 0;
+    while (i < n) {
+        s = s + i * 3;
+        i = i + 1;
+    }
+    return s;
+}
+int dw(int n) {
+    int i = 0;
+    int s = 0;
+    do {
+        s = s + i;
+        i = i + 1;
+    } while (i < n);
+    return s;
+}
+int cont(int n) {
+    int i;
+    int s = 0;
+    for (i = 0; i < n; i = i + 1) {
+        if (i - (i / 3) * 3 == 0) continue;
+        s = s + i;
+        if (s > 1000) break;
+    }
+    return s;
+}
+int wcont(int n) {
+    int i = 0;
+    int s = 0;
+    while (1) {
+        i = i + 1;
+        if (i > n) break;
+        if (i / 2 * 2 == i) continue;
+        s = s + i;
+    }
+    do {
+        s = s + 1;
+        if (s > 5) continue;
+        s = s + 100;
+    } while (s < 3);
+    return s;
+}
+int gto(int n) {
+    int i = 0;
+    int s = 0;
+again:
+    s = s + i;
+    i = i + 1;
+    if (i < n) goto again;
+    goto done;
+    s = 999;
+done:
+    return s;
+}
+int nested(int n) {
+    int i;
+    int j;
+    int s = 0;
+    for (i = 0; i < n; i = i + 1) {
+        for (j = 0; j <= i; j = j + 1) {
+            s = s + j;
+            if (s > 5000) goto out;
+        }
+    }
+out:
+    return s;
+}
+int into(int n) {
+    int s = 0;
+    int i = 0;
+    goto mid;
+    while (i < n) {
+        s = s + 2;
+mid:
+        s = s + 1;
+        i = i + 1;
+    }
+    return s;
+}
+int inf() {
+    int i = 0;
+    for (;;) {
+        i = i + 7;
+        if (i > 100) return i;
+    }
+    return 0;
+}
+int main() {
+    int s = 0;
+    int k;
+    for (k = 0; k < 12; k = k + 1) {
+        s = s + sum(k) + dw(k) * 3 + cont(k * 7) * 5 + wcont(k) * 7 + gto(k) * 11 + nested(k * 9) * 13 + into(k) * 17;
+    }
+    s = s + dw(0 - 5) + sum(0 - 5) + inf();
+    return s - (s / 251) * 251;
+}
@@ -0,0 +1,138 @@
+// Jump tables, bit tests, binary search, fallthrough and break out of
+// switches nested in loops, including selectors outside every table.
+int dense(int x) {
+    switch (x) {
+        case 0: return 11;
+        case 1: return 22;
+        case 2: return 33;
+        case 3: return 44;
+        case 5: return 55;
+        case 6: return 66;
+        case 7: return 77;
+        case 9: return 88;
+        default: return 3;
+    }
+    return 0;
+}
+
+int sparse(int x) {
+    int r = 0;
+    switch (x) {
+        case 1: r = 5; break;
+        case 100: r = 6; break;
+        case 1000: r = 7; break;
+        case 5000: r = 8; break;
+        case 70000: r = 9; break;
+        case 123456: r = 10; break;
+        case 2000000: r = 11; break;
+        case 0 - 40: r = 12; break;
+    }
+    return r;
+}
+
+int bits(int x) {
+    int r = 1;
+    switch (x) {
+        case 1: case 3: case 5: case 7: case 9: case 11: case 41:
+            r = 2;
+            break;
+        case 2: case 4: case 6: case 50:
+            r = 3;
+            break;
+        default:
+            r = 4;
+    }
+    return r;
+}
+
+int bits2(int x) {
+    switch (x) {
+        case 100: case 109: case 118: case 127: case 136: case 145: case 163:
+            return 5;
+        case 105: case 120: case 160: case 161:
+            return 6;
+        case 1000:
+            return 7;
+    }
+    return 8;
+}
+
+int fall(int x) {
+    int r = 0;
+    switch (x) {
+        default:
+            r = r + 1;
+        case 1:
+            r = r + 10;
+        case 2: {
+            int t = r * 2;
+            r = t + 100;
+            break;
+        }
+        case 3:
+            r = 1000;
+    }
+    return r;
+}
+
+int loops(int n) {
+    int i;
+    int s = 0;
+    for (i = 0; i < n; i = i + 1) {
+        switch (i - (i / 4) * 4) {
+            case 0: s = s + 1; break;
+            case 1: s = s + 3;
+            case 2: s = s + 5; break;
+            default:
+                if (s > 100) break;
+                s = s + 7;
+        }
+        if (s > 200) break;
+    }
+    return s;
+}
+
+int chars(char c) {
+    switch (c) {
+        case 97: return 1;
+        case 98: return 2;
+        case 99: return 3;
+        case 100: return 4;
+        case 122: return 26;
+    }
+    return 0;
+}
+
+int nested(int a, int b) {
+    switch (a) {
+        case 1:
+            switch (b) {
+                case 1: return 11;
+                case 2: break;
+            }
+            return 12;
+        case 2:
+            return 20;
+    }
+    return 0;
+}
+
+int main() {
+    int s = 0;
+    int i;
+    for (i = 0 - 3; i < 13; i = i + 1) {
+        s = s + dense(i) * (i + 5);
+        s = s + bits(i) * (i + 7);
+        s = s + fall(i) * (i + 3);
+    }
+    s = s + sparse(1) + sparse(100) * 3 + sparse(1000) * 5 + sparse(5000) * 7 + sparse(70000) * 11;
+    s = s + sparse(123456) * 13 + sparse(2000000) * 17 + sparse(0 - 40) * 19 + sparse(99) * 23 + sparse(41);
+    s = s + bits(41) * 29 + bits(50) * 31 + bits(64) + bits(0 - 64) * 37 + bits(2147483647) * 39;
+    for (i = 90; i < 170; i = i + 1) s = s + bits2(i) * i;
+    s = s + bits2(1000) + bits2(0 - 2147483647) * 3 + bits2(2147483647);
+    s = s + dense(2147483647) + dense(0 - 2147483647) * 41;
+    s = s + loops(50) * 43 + loops(3);
+    s = s + chars(97) + chars(98) * 2 + chars(99) * 3 + chars(100) * 4 + chars(122) * 5 + chars(113);
+    s = s + nested(1, 1) + nested(1, 2) * 2 + nested(2, 0) * 3 + nested(3, 3);
+    return s - (s / 251) * 251;
+}